@@ -1,575 +1,12845 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <stdarg.h>
 #include <time.h>
+#include <math.h>
+#include <limits.h>
+#if defined(SOCIAL_METRICS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
 #include "social.h"
 
-Node *all_nodes[MAX_NODES];             // Array to store all nodes.
-int num_nodes = 0;                      // Counter to keep track of total no. of nodes.
-int id = 1;                             // I have made the ID self incrementing i.e. it gets incremented and set as an ID of every new node created.
-char all_content[MAX_NODES][MAX_NODES]; // Array to store the content posted all nodes. Has been used to prevent duplication.
-int num_content = 0;                    // Counter to keep track of total no. of contents.
+Node **all_nodes = NULL; // Array to store all nodes. Grows on demand, see array_append().
+int num_nodes = 0;       // Counter to keep track of total no. of nodes.
+int id = 1;              // I have made the ID self incrementing i.e. it gets incremented and set as an ID of every new node created.
+char **all_content = NULL; // Hash table of the content posted by all nodes, see Content timelines. Has been used to prevent duplication.
+int num_content = 0;       // Counter to keep track of total no. of contents.
+int quiet = 0;             // When set, the status messages of the create/update/delete functions are not printed.
+
+#define NODE_TYPES "IBGO"
+static Node **typed_nodes[4] = {NULL, NULL, NULL, NULL}; // Nodes of each type in NODE_TYPES, in id (and creation) order.
+static int num_typed_nodes[4] = {0, 0, 0, 0};
+static long long last_created = 0; // Creation time of the newest node, creation times never go back in id order.
+
+// Prints a status message of a create/update/delete function, unless quiet is set.
+#define report(...)              \
+    do                           \
+    {                            \
+        if (!quiet)              \
+        {                        \
+            printf(__VA_ARGS__); \
+        }                        \
+    } while (0)
+
+// Growable byte buffer used to build responses and output.
+typedef struct Buffer
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+} Buffer;
 
-// Function to create a node
-Node *create_node(char *name, char type)
+// Function to make room for more bytes in a buffer
+static int buffer_reserve(Buffer *buffer, size_t extra)
 {
-    Node *node = (Node *)malloc(sizeof(Node));
-    node->id = id++;
-    node->name = strdup(name);
+    if (buffer->length + extra <= buffer->capacity)
+    {
+        return 0;
+    }
 
-    // Setting date and time to current date and time
-    time_t currentTime;
-    time(&currentTime);
-    char *currentTimeString = ctime(&currentTime);
-    node->date = strdup(currentTimeString);
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->length + extra)
+    {
+        capacity *= 2;
+    }
 
-    node->type = type;
-    node->num_links = 0;
-    node->links = NULL;
-    node->num_contents = 0;
-    node->content = NULL;
+    char *grown = realloc(buffer->data, capacity);
+    if (!grown)
+    {
+        return -1;
+    }
+    buffer->data = grown;
+    buffer->capacity = capacity;
+    return 0;
+}
 
-    return node;
+static int buffer_append(Buffer *buffer, const char *data, size_t length)
+{
+    if (buffer_reserve(buffer, length) != 0)
+    {
+        return -1;
+    }
+    if (length)
+    {
+        memcpy(buffer->data + buffer->length, data, length);
+    }
+    buffer->length += length;
+    return 0;
 }
 
-// Function to create an individual
-Individual *create_individual(char *name, Birthday birthday)
+static int buffer_printf(Buffer *buffer, const char *format, ...)
 {
-    Individual *individual = (Individual *)malloc(sizeof(Individual));
-    individual->node = *create_node(name, 'I');
-    individual->birthday = birthday;
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
 
-    all_nodes[num_nodes++] = &individual->node;
+    if (length < 0 || buffer_reserve(buffer, length + 1) != 0)
+    {
+        return -1;
+    }
 
-    return individual;
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->length, length + 1, format, args);
+    va_end(args);
+    buffer->length += length;
+    return 0;
 }
 
-// Function to create a business
-Business *create_business(char *name, Location location)
+// Function to drop the first bytes of a buffer
+static void buffer_consume(Buffer *buffer, size_t length)
 {
-    Business *business = (Business *)malloc(sizeof(Business));
-    business->node = *create_node(name, 'B');
-    business->location = location;
-    business->num_owners = 0;
-    business->num_customers = 0;
-
-    all_nodes[num_nodes++] = &business->node;
+    if (length == 0)
+    {
+        return;
+    }
+    memmove(buffer->data, buffer->data + length, buffer->length - length);
+    buffer->length -= length;
+}
 
-    return business;
+// Returns the current time in nanoseconds, for latency measurements.
+static long long now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
 }
 
-// Function to create a group
-Group *create_group(char *name)
+/*
+    Metrics:
+
+    Built with -DSOCIAL_METRICS, every operation of social.h records its call count and latency, and the engine counts
+    lookups, allocations and reclamation. Each thread writes only to its own ThreadMetrics block, print_stats() sums the
+    blocks of all threads. Latencies go into log-linear histograms (8 sub-buckets per power of two, so percentiles are
+    within 12.5%) measured with the time stamp counter where there is one.
+    Stats are printed by the "stats" entry of the text interface, the T server command, and written to the file named by
+    the SOCIAL_STATS_FILE environment variable (default social_stats.txt) when the process receives SIGUSR1.
+    Without -DSOCIAL_METRICS the METRIC_* macros expand to nothing, and the stats are the node, edge and content totals.
+*/
+
+// Operations with a call count and latency histogram, add new public functions here.
+#define METRIC_OPERATIONS(X)          \
+    X(create_node)                    \
+    X(create_individual)              \
+    X(create_business)                \
+    X(create_group)                   \
+    X(create_organisation)            \
+    X(add_member)                     \
+    X(add_owner_or_customer)          \
+    X(delete_node)                    \
+    X(delete_nodes)                   \
+    X(remove_node_from_links)         \
+    X(same_component)                 \
+    X(component_size)                 \
+    X(search_node_by_name)            \
+    X(search_node_by_type)            \
+    X(search_individual_by_birthday)  \
+    X(search_nodes_by_creation)       \
+    X(search_node_by_prefix)          \
+    X(search_node_fuzzy)              \
+    X(newest_nodes)                   \
+    X(is_node_in_links)               \
+    X(print_linked_nodes)             \
+    X(search_edges)                   \
+    X(post_content)                   \
+    X(search_and_print_content)       \
+    X(search_posts)                   \
+    X(trending_content)               \
+    X(display_linked_content)         \
+    X(print_node_details)             \
+    X(print_all_nodes)                \
+    X(page_nodes)                     \
+    X(recommend_people)               \
+    X(recommend_all_people)           \
+    X(export_network)                 \
+    X(start_checkpoint)               \
+    X(ingest_post)                    \
+    X(ingest_member)                  \
+    X(ingest_owner_or_customer)       \
+    X(shortest_paths)                 \
+    X(nodes_within_hops)              \
+    X(run_query)                      \
+    X(pagerank)                       \
+    X(detect_communities)             \
+    X(node_community)                 \
+    X(group_community)
+
+// Event counters.
+#define METRIC_COUNTERS(X)  \
+    X(name_lookup_hits)     \
+    X(name_lookup_misses)   \
+    X(content_intern_hits)  \
+    X(content_intern_misses) \
+    X(content_reclaimed)    \
+    X(archived_blocks)      \
+    X(archive_reads)        \
+    X(array_allocations)    \
+    X(array_grows)          \
+    X(array_copies)         \
+    X(retired)              \
+    X(reclaimed)            \
+    X(component_rebuilds)
+
+#define METRIC_ENUM(name) METRIC_##name,
+enum
 {
-    Group *group = (Group *)malloc(sizeof(Group));
-    group->node = *create_node(name, 'G');
+    METRIC_OPERATIONS(METRIC_ENUM) NUM_METRIC_OPERATIONS
+};
+enum
+{
+    METRIC_COUNTERS(METRIC_ENUM) NUM_METRIC_COUNTERS
+};
 
-    all_nodes[num_nodes++] = &group->node;
+#ifdef SOCIAL_METRICS
 
-    return group;
-}
+#if defined(__x86_64__) || defined(__i386__)
+#define metrics_clock() __rdtsc()
+#else
+#define metrics_clock() ((unsigned long long)now_ns())
+#endif
 
-// Function to create an organisation
-Organisation *create_organisation(char *name, Location location)
+#define HISTOGRAM_BUCKETS 512
+
+// Metrics of one thread, only ever written by that thread.
+typedef struct ThreadMetrics
 {
-    Organisation *organisation = (Organisation *)malloc(sizeof(Organisation));
-    organisation->node = *create_node(name, 'O');
-    organisation->location = location;
+    unsigned long long calls[NUM_METRIC_OPERATIONS];
+    unsigned long long histogram[NUM_METRIC_OPERATIONS][HISTOGRAM_BUCKETS];
+    unsigned long long counters[NUM_METRIC_COUNTERS];
+} ThreadMetrics;
 
-    all_nodes[num_nodes++] = &organisation->node;
+typedef struct MetricScope
+{
+    int operation;
+    unsigned long long started;
+} MetricScope;
 
-    return organisation;
+static ThreadMetrics *thread_metrics[MAX_THREADS];
+static int num_thread_metrics = 0;
+static __thread ThreadMetrics *my_metrics = NULL;
+
+// Function to find (or register) the metrics block of the calling thread
+static ThreadMetrics *get_thread_metrics()
+{
+    if (!my_metrics)
+    {
+        int index = __atomic_fetch_add(&num_thread_metrics, 1, __ATOMIC_ACQ_REL);
+        if (index >= MAX_THREADS)
+        {
+            return NULL; // Out of slots, this thread is not measured.
+        }
+        my_metrics = calloc(1, sizeof(ThreadMetrics));
+        __atomic_store_n(&thread_metrics[index], my_metrics, __ATOMIC_RELEASE);
+    }
+    return my_metrics;
 }
 
-// Function to delete a node
-void delete_node(char *name)
+// Returns the histogram bucket of a value: exact below 16, then 8 buckets per power of two
+static int histogram_bucket(unsigned long long value)
 {
-    SearchResult result = search_node_by_name(name);
+    if (value < 16)
+    {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    return 16 + (exponent - 4) * 8 + (int)((value >> (exponent - 3)) & 7);
+}
 
-    if (result.size == 0)
+// Returns the smallest value of a histogram bucket
+static unsigned long long histogram_value(int bucket)
+{
+    if (bucket < 16)
     {
-        printf("Node not found\n");
+        return bucket;
     }
-    else
+    int exponent = (bucket - 16) / 8 + 4;
+    return (8ULL + (bucket - 16) % 8) << (exponent - 3);
+}
+
+// Single-writer increment, readers of other threads may see a slightly old value
+#define METRIC_INCREMENT(location) __atomic_store_n(&(location), (location) + 1, __ATOMIC_RELAXED)
+
+static void metric_scope_end(MetricScope *scope)
+{
+    ThreadMetrics *metrics = get_thread_metrics();
+    if (metrics)
     {
-        printf("Node(s) found:\n");
+        unsigned long long elapsed = metrics_clock() - scope->started;
+        METRIC_INCREMENT(metrics->calls[scope->operation]);
+        METRIC_INCREMENT(metrics->histogram[scope->operation][histogram_bucket(elapsed)]);
+    }
+}
 
-        for (int i = 0; i < result.size; i++)
+static void metric_count(int counter)
+{
+    ThreadMetrics *metrics = get_thread_metrics();
+    if (metrics)
+    {
+        METRIC_INCREMENT(metrics->counters[counter]);
+    }
+}
+
+// Measures the enclosing function as the given operation, whichever way it returns.
+#define METRIC_SCOPE(operation) MetricScope metric_scope __attribute__((cleanup(metric_scope_end))) = {METRIC_##operation, metrics_clock()}
+#define METRIC_COUNT(counter) metric_count(METRIC_##counter)
+
+#else
+
+#define METRIC_SCOPE(operation)
+#define METRIC_COUNT(counter)
+
+#endif
+
+#define METRIC_NAME(name) #name,
+
+static int count_posts(Node *node);
+
+// Function to write node, edge and content totals and, when built with metrics, counters and latency percentiles
+static void format_stats(Buffer *out)
+{
+    long long edges = 0, posts = 0;
+    begin_read();
+    Node **nodes;
+    int count = read_all_nodes(&nodes);
+    int live = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (nodes[i])
         {
-            Node *current_node = result.nodes[i];
+            live++;
+            edges += __atomic_load_n(&nodes[i]->num_links, __ATOMIC_RELAXED);
+            posts += count_posts(nodes[i]);
+        }
+    }
+    int contents = __atomic_load_n(&num_content, __ATOMIC_RELAXED);
+    end_read();
 
-            for (int j = 0; j < num_nodes; j++)
-            {
-                if (j != current_node->id - 1)
-                {
-                    remove_node_from_links(all_nodes[j], current_node);
-                }
-            }
+    buffer_printf(out, "nodes %d\nedges %lld\ncontents %d\nposts %lld\n", live, edges, contents, posts);
 
-            int node_index = -1;
-            for (int j = 0; j < num_nodes; j++)
-            {
-                if (all_nodes[j]->id == current_node->id)
-                {
-                    node_index = j;
-                    break;
-                }
-            }
+#ifdef SOCIAL_METRICS
+    static const char *operation_names[] = {METRIC_OPERATIONS(METRIC_NAME)};
+    static const char *counter_names[] = {METRIC_COUNTERS(METRIC_NAME)};
+    static double ticks_per_ns = 0;
+
+    if (ticks_per_ns == 0)
+    {
+        long long started = now_ns();
+        unsigned long long started_ticks = metrics_clock();
+        while (now_ns() - started < 10000000)
+            ;
+        ticks_per_ns = (metrics_clock() - started_ticks) / (double)(now_ns() - started);
+    }
 
-            for (int j = node_index; j < num_nodes - 1; j++)
+    ThreadMetrics *total = calloc(1, sizeof(ThreadMetrics));
+    int threads = __atomic_load_n(&num_thread_metrics, __ATOMIC_ACQUIRE);
+    for (int t = 0; t < threads && t < MAX_THREADS; t++)
+    {
+        ThreadMetrics *metrics = __atomic_load_n(&thread_metrics[t], __ATOMIC_ACQUIRE);
+        if (!metrics)
+        {
+            continue;
+        }
+        for (int i = 0; i < NUM_METRIC_COUNTERS; i++)
+        {
+            total->counters[i] += __atomic_load_n(&metrics->counters[i], __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < NUM_METRIC_OPERATIONS; i++)
+        {
+            total->calls[i] += __atomic_load_n(&metrics->calls[i], __ATOMIC_RELAXED);
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
             {
-                all_nodes[j] = all_nodes[j + 1];
+                total->histogram[i][b] += __atomic_load_n(&metrics->histogram[i][b], __ATOMIC_RELAXED);
             }
+        }
+    }
 
-            num_nodes--;
+    for (int i = 0; i < NUM_METRIC_COUNTERS; i++)
+    {
+        buffer_printf(out, "%s %llu\n", counter_names[i], total->counters[i]);
+    }
 
-            if (current_node->type == 'B')
-            {
-                Business *business = (Business *)current_node;
-                free(business->owners);
-                free(business->customers);
-            }
-            else if (current_node->type == 'G')
+    static const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+    for (int i = 0; i < NUM_METRIC_OPERATIONS; i++)
+    {
+        if (total->calls[i] == 0)
+        {
+            continue;
+        }
+
+        // The histogram can be a little behind calls while other threads are running, so percentiles use its own total.
+        unsigned long long samples = 0;
+        int highest = 0;
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+        {
+            samples += total->histogram[i][b];
+            if (total->histogram[i][b])
             {
-                Group *group = (Group *)current_node;
-                free(group->members);
+                highest = b;
             }
-            else if (current_node->type == 'O')
+        }
+
+        buffer_printf(out, "%s calls %llu", operation_names[i], total->calls[i]);
+        static const char *labels[] = {"p50_ns", "p90_ns", "p99_ns", "p999_ns"};
+        for (int p = 0; p < 4; p++)
+        {
+            unsigned long long rank = (unsigned long long)(percentiles[p] * samples), seen = 0;
+            int b = 0;
+            while (b < HISTOGRAM_BUCKETS - 1 && seen + total->histogram[i][b] <= rank)
             {
-                Organisation *organisation = (Organisation *)current_node;
-                free(organisation->members);
+                seen += total->histogram[i][b++];
             }
-
-            free(current_node->date);
-            free(current_node->name);
-            free(current_node->links);
-            free(current_node->content);
-            free(current_node);
+            buffer_printf(out, " %s %.0f", labels[p], histogram_value(b) / ticks_per_ns);
         }
-
-        printf("Node(s) deleted\n");
+        buffer_printf(out, " max_ns %.0f\n", histogram_value(highest + 1) / ticks_per_ns);
     }
+    free(total);
+#else
+    buffer_printf(out, "metrics disabled, build with -DSOCIAL_METRICS\n");
+#endif
+}
 
-    free(result.nodes);
+// Function to print the stats
+void print_stats()
+{
+    Buffer out = {NULL, 0, 0};
+    format_stats(&out);
+    fwrite(out.data, 1, out.length, stdout);
+    free(out.data);
 }
 
-// Function to remove a node from the links of another node
-void remove_node_from_links(Node *node, Node *target)
+// Function to write the stats to a file, returns 0 on success
+int write_stats(const char *path)
 {
-    for (int i = 0; i < node->num_links; i++)
+    FILE *file = fopen(path, "w");
+    if (!file)
     {
-        if (node->links[i] == target)
-        {
-            for (int j = i; j < node->num_links - 1; j++)
-            {
-                node->links[j] = node->links[j + 1];
-            }
-            node->num_links--;
-            break;
-        }
+        return -1;
     }
+
+    Buffer out = {NULL, 0, 0};
+    format_stats(&out);
+    fwrite(out.data, 1, out.length, file);
+    free(out.data);
+    return fclose(file);
 }
 
-// Function to search node by name
-SearchResult search_node_by_name(char *name)
-{
-    SearchResult result;
-    result.nodes = (Node **)malloc(num_nodes * sizeof(Node *));
-    result.size = 0;
+#ifdef __linux__
 
-    for (int i = 0; i < num_nodes; i++)
+// Thread waiting for SIGUSR1, formatting in a signal handler would not be safe
+static void *stats_signal_thread(void *argument)
+{
+    sigset_t *signals = argument;
+    int signal_number;
+    while (sigwait(signals, &signal_number) == 0)
     {
-        if (strcmp(all_nodes[i]->name, name) == 0)
-        {
-            result.nodes[result.size++] = all_nodes[i];
-        }
+        const char *path = getenv("SOCIAL_STATS_FILE");
+        write_stats(path ? path : "social_stats.txt");
     }
-
-    result.nodes = realloc(result.nodes, result.size * sizeof(Node *));
-    return result;
+    return NULL;
 }
 
-// Function to search node by type
-SearchResult search_node_by_type(char type)
+// Function to dump the stats on SIGUSR1, must be called before any other thread is started so that they all block it
+static void start_stats_signal_thread()
 {
-    SearchResult result;
-    result.nodes = (Node **)malloc(num_nodes * sizeof(Node *));
-    result.size = 0;
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
 
-    for (int i = 0; i < num_nodes; i++)
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, stats_signal_thread, &signals) == 0)
     {
-        if (all_nodes[i]->type == type)
-        {
-            result.nodes[result.size++] = all_nodes[i];
-        }
+        pthread_detach(thread);
     }
+}
 
-    result.nodes = realloc(result.nodes, result.size * sizeof(Node *));
-    return result;
+#else
+
+static void start_stats_signal_thread()
+{
 }
 
-// Function to search individual by birthday
-SearchResult search_individual_by_birthday(Birthday birthday)
+#endif
+
+/*
+    Concurrency:
+
+    Any number of reader threads may run searches and traversals while one writer at a time applies mutations.
+    - Writers serialise on write_mutex through begin_write()/end_write().
+    - Readers never lock. They announce the epoch they started in through begin_read()/end_read(), and load
+      the shared arrays (all_nodes, all_content, links, edges, content) with read_array().
+    - Shared arrays are never changed in a way a reader could trip over: appends go into free capacity and are
+      published by a release store of the count, growth and removal build a new array and publish its pointer.
+    - Anything unlinked by a writer (old arrays, deleted nodes) is handed to retire() instead of free(), and is
+      freed once every reader that could still see it has left its read section (epoch based reclamation).
+
+    Snapshots (multi-version reads):
+
+    Every write section is one version, committed by end_write(). A read section pins the last committed version and
+    sees the shared arrays exactly as they were then, however long it runs: a half done add_member() or a delete_node()
+    committed after it started stays invisible.
+    - Each array allocation records the version that published it and the allocation (with its final count) it replaced,
+      so a reader walks back from the current allocation to the newest one not newer than its snapshot.
+    - Appends into free capacity record the count the allocation had before the first append of the version. An
+      allocation holds that for one version only, so a version appends in place only if no pinned snapshot falls between
+      the allocation's own version and its last version of appends, otherwise it appends into a copy.
+    - Allocations of the version being written are invisible to every reader, so the writer changes them in place.
+    - Old allocations are retired as before: a reader that can walk back to one started before it was retired, so
+      epoch based reclamation keeps it until that reader is done.
+    Write sections read the latest state. The indexes are built from shared arrays as well and are read the same way: the
+    name index levels, the fuzzy, birthday and location lists, the full-text term table, posts, postings and skip entries,
+    and the pages of the component union-find. Their writers run inside write sections, so no index has a lock of its
+    own. Trending only holds counters, which queries load atomically (see Trending content). The PageRank and community
+    caches are computed on demand under their own mutex; nothing else a reader calls takes a lock.
+*/
+
+// Header stored in front of every shared array, so that a reader knows the capacity of the exact allocation it loaded.
+typedef struct ArrayHeader
 {
-    SearchResult result;
-    result.nodes = (Node **)malloc(num_nodes * sizeof(Node *));
-    result.size = 0;
+    long capacity;
+    unsigned long version;          // Version that published this allocation
+    void **previous;                // Allocation it replaced, NULL for the first one
+    int previous_count;             // Count of the previous allocation when it was replaced
+    int count_before;               // Count before the appends in place of version appended
+    unsigned long appended;         // Last version that appended in place
+    long padding;                   // Keeps the elements 16-byte aligned.
+} ArrayHeader;
+
+// State of a reader thread, padded to its own cache line so that readers never write to a shared line.
+typedef struct ReaderSlot
+{
+    unsigned long state;   // (epoch << 1) | 1 while inside a read section, 0 otherwise.
+    unsigned long version; // Snapshot pinned by the read section
+    int in_use;
+    char padding[64 - 2 * sizeof(unsigned long) - sizeof(int)];
+} __attribute__((aligned(64))) ReaderSlot;
+
+// A pointer unlinked by a writer, waiting for the readers of its epoch to finish.
+typedef struct Retired
+{
+    void *pointer;
+    unsigned long epoch;
+} Retired;
+
+static ReaderSlot reader_slots[MAX_THREADS];
+static int num_reader_slots = 0; // Highest slot index ever claimed + 1, bounds the scan in reclaim_retired().
+static unsigned long global_epoch = 1;
+static unsigned long committed_version = 0; // Last version committed by end_write()
+static unsigned long write_version = 0;     // Version of the write section in progress, only used by the writer
+static unsigned long pinned_versions[MAX_THREADS]; // Snapshots pinned by readers when the write section began, sorted
+static int num_pinned_versions = 0;
+
+static pthread_mutex_t write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Retired *retired = NULL; // Only touched while holding write_mutex.
+static int num_retired = 0;
+static int retired_capacity = 0;
+
+static pthread_key_t reader_key;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+static __thread ReaderSlot *reader_slot = NULL;
+static __thread int read_depth = 0;
+static __thread int write_depth = 0;
+static __thread unsigned long snapshot_version = 0;
+
+// Function to release the reader slot of an exiting thread
+static void release_reader_slot(void *slot)
+{
+    __atomic_store_n(&((ReaderSlot *)slot)->state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&((ReaderSlot *)slot)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_reader_key()
+{
+    pthread_key_create(&reader_key, release_reader_slot);
+}
 
-    for (int i = 0; i < num_nodes; i++)
+// Function to claim a free reader slot, which the thread that uses it registers for release with reader_key
+static ReaderSlot *claim_reader_slot()
+{
+    pthread_once(&reader_key_once, create_reader_key);
+
+    for (int i = 0; i < MAX_THREADS; i++)
     {
-        if (all_nodes[i]->type == 'I' && ((Individual *)all_nodes[i])->birthday.day == birthday.day && ((Individual *)all_nodes[i])->birthday.month == birthday.month && ((Individual *)all_nodes[i])->birthday.year == birthday.year)
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&reader_slots[i].in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
         {
-            result.nodes[result.size++] = all_nodes[i];
+            int highest = __atomic_load_n(&num_reader_slots, __ATOMIC_RELAXED);
+            while (highest < i + 1 && !__atomic_compare_exchange_n(&num_reader_slots, &highest, i + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                ;
+            return &reader_slots[i];
         }
     }
 
-    result.nodes = realloc(result.nodes, result.size * sizeof(Node *));
-    return result;
+    printf("Too many threads, increase the MAX_THREADS macro.\n");
+    exit(1);
 }
 
-// Function to check if a link between two nodes already exists
-int is_node_in_links(Node *node, Node *target)
+// Function to start a read section in a reader slot, returns the version it pins
+static unsigned long pin_snapshot(ReaderSlot *slot)
 {
-    for (int i = 0; i < node->num_links; i++)
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&slot->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+
+    // Pin the last committed version. Checking it did not move after publishing the pin means that any writer that
+    // began after a newer commit sees the pin.
+    unsigned long version = __atomic_load_n(&committed_version, __ATOMIC_SEQ_CST), pinned;
+    do
     {
-        if (node->links[i] == target)
-        {
-            return 1;
-        }
-    }
-    return 0;
+        pinned = version;
+        __atomic_store_n(&slot->version, version, __ATOMIC_SEQ_CST);
+        version = __atomic_load_n(&committed_version, __ATOMIC_SEQ_CST);
+    } while (version != pinned);
+    return pinned;
 }
 
-// Function to add members in groups and organisations
-void add_member(Node *group_or_org, Node *new_member)
+// Function to enter a read section
+void begin_read()
 {
-    if (group_or_org->type == 'O' && new_member->type != 'I')
+    if (read_depth++ > 0)
     {
-        printf("Only individuals can be added to organisations.\n");
         return;
     }
 
-    if (is_node_in_links(group_or_org, new_member))
+    if (!reader_slot)
     {
-        printf("Node is already a member.\n");
-        return;
+        reader_slot = claim_reader_slot();
+        pthread_setspecific(reader_key, reader_slot);
     }
+    snapshot_version = pin_snapshot(reader_slot);
+}
 
-    group_or_org->links = realloc(group_or_org->links, (group_or_org->num_links + 1) * sizeof(Node *));
-    if (!group_or_org->links)
+// Returns the version pinned by the read section of the calling thread, or the last committed one outside of read sections
+unsigned long read_version()
+{
+    return read_depth > 0 ? snapshot_version : __atomic_load_n(&committed_version, __ATOMIC_ACQUIRE);
+}
+
+// Function to leave a read section
+void end_read()
+{
+    if (--read_depth > 0)
     {
-        printf("Failed to allocate memory for new link.\n");
         return;
     }
 
-    group_or_org->links[group_or_org->num_links] = new_member;
-    group_or_org->num_links++;
+    __atomic_store_n(&reader_slot->state, 0, __ATOMIC_RELEASE);
+}
 
-    new_member->links = realloc(new_member->links, (new_member->num_links + 1) * sizeof(Node *));
-    if (!new_member->links)
+// Function to hand a pointer over to the reclaimer instead of freeing it
+static void retire(void *pointer)
+{
+    if (!pointer)
     {
-        printf("Failed to allocate memory for new link.\n");
         return;
     }
 
-    new_member->links[new_member->num_links] = group_or_org;
-    new_member->num_links++;
-
-    if (group_or_org->type == 'G' || group_or_org->type == 'O')
+    if (num_retired == retired_capacity)
     {
-        for (int i = 0; i < group_or_org->num_links; i++)
+        int capacity = retired_capacity ? retired_capacity * 2 : 64;
+        Retired *grown = realloc(retired, capacity * sizeof(Retired));
+        if (!grown)
         {
-            Node *member_of_group_or_org = group_or_org->links[i];
-
-            if (member_of_group_or_org->type == 'I' && member_of_group_or_org != new_member)
-            {
-                if (!is_node_in_links(member_of_group_or_org, new_member))
-                {
-                    member_of_group_or_org->links = realloc(member_of_group_or_org->links, (member_of_group_or_org->num_links + 1) * sizeof(Node *));
-                    if (!member_of_group_or_org->links)
-                    {
-                        printf("Failed to allocate memory for new link.\n");
-                        return;
-                    }
-
-                    member_of_group_or_org->links[member_of_group_or_org->num_links] = new_member;
-                    member_of_group_or_org->num_links++;
-
-                    new_member->links = realloc(new_member->links, (new_member->num_links + 1) * sizeof(Node *));
-                    if (!new_member->links)
-                    {
-                        printf("Failed to allocate memory for new link.\n");
-                        return;
-                    }
-
-                    new_member->links[new_member->num_links] = member_of_group_or_org;
-                    new_member->num_links++;
-                }
-            }
+            report("Failed to allocate memory for retired pointer.\n");
+            return; // Leaking is the only safe option while readers may still hold the pointer.
         }
+        retired = grown;
+        retired_capacity = capacity;
     }
 
-    printf("Node(s) added successfully.\n");
+    METRIC_COUNT(retired);
+    retired[num_retired].pointer = pointer;
+    retired[num_retired].epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    num_retired++;
 }
 
-// Function to add an owner or customer to a business
-void add_owner_or_customer(Business *business, Individual *new_owner_or_customer, char role)
+// Function to advance the epoch when every active reader has caught up, and free what no reader can see anymore
+static void reclaim_retired()
 {
-    if (role == 'O' || role == 'C')
+    if (num_retired == 0)
     {
-        for (int i = 0; i < business->node.num_links; i++)
-        {
-            if (business->node.links[i] == &new_owner_or_customer->node)
-            {
-                printf("Node is already a link.\n");
-                return;
-            }
-        }
+        return;
+    }
 
-        business->node.links = realloc(business->node.links, (business->node.num_links + 1) * sizeof(Node *));
-        if (!business->node.links)
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    int can_advance = 1;
+    int slots = __atomic_load_n(&num_reader_slots, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < slots; i++)
+    {
+        unsigned long state = __atomic_load_n(&reader_slots[i].state, __ATOMIC_SEQ_CST);
+        if ((state & 1) && (state >> 1) != epoch)
         {
-            printf("Failed to allocate memory for new link.\n");
-            return;
+            can_advance = 0;
+            break;
         }
+    }
 
-        business->node.links[business->node.num_links] = &new_owner_or_customer->node;
-        business->node.num_links++;
+    if (can_advance)
+    {
+        epoch = __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+    }
 
-        if (role == 'O')
+    int kept = 0;
+    for (int i = 0; i < num_retired; i++)
+    {
+        if (retired[i].epoch + 2 <= epoch)
         {
-            business->owners = realloc(business->owners, (business->num_owners + 1) * sizeof(Individual *));
-            if (!business->owners)
-            {
-                printf("Failed to allocate memory for new owner.\n");
-                return;
-            }
-
-            business->owners[business->num_owners] = new_owner_or_customer;
-            business->num_owners++;
-            printf("Node(s) added as owner(s) successfully.\n");
+            free(retired[i].pointer);
+            METRIC_COUNT(reclaimed);
         }
         else
         {
-            business->customers = realloc(business->customers, (business->num_customers + 1) * sizeof(Individual *));
-            if (!business->customers)
-            {
-                printf("Failed to allocate memory for new customer.\n");
-                return;
-            }
-
-            business->customers[business->num_customers] = new_owner_or_customer;
-            business->num_customers++;
-            printf("Node(s) added as customer(s) successfully.\n");
+            retired[kept++] = retired[i];
         }
     }
-    else
-    {
-        printf("Invalid role. Role must be 'O' for owner or 'C' for customer.\n");
-    }
+    num_retired = kept;
 }
 
-// Function to print the linked nodes of a node
-void print_linked_nodes(char *name)
+// Function to enter a write section, writers are serialised
+void begin_write()
 {
-    int flag = 0;
-    for (int i = 0; i < num_nodes; i++)
+    if (write_depth++ == 0)
     {
-        if (strcmp(all_nodes[i]->name, name) == 0)
+        pthread_mutex_lock(&write_mutex);
+        write_version = committed_version + 1;
+
+        // Snapshots pinned from now on are the last committed version, which needs no older counts.
+        num_pinned_versions = 0;
+        int slots = __atomic_load_n(&num_reader_slots, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < slots; i++)
         {
-            flag = 1;
-            if (all_nodes[i]->num_links == 0)
-            {
-                printf("No linked nodes found.\n");
-                return;
-            }
-            for (int j = 0; j < all_nodes[i]->num_links; j++)
+            unsigned long state = __atomic_load_n(&reader_slots[i].state, __ATOMIC_SEQ_CST);
+            unsigned long version = __atomic_load_n(&reader_slots[i].version, __ATOMIC_SEQ_CST);
+            if ((state & 1) && version < committed_version)
             {
-                printf("Linked node: %s\n", all_nodes[i]->links[j]->name);
+                int position = num_pinned_versions++;
+                while (position > 0 && pinned_versions[position - 1] > version)
+                {
+                    pinned_versions[position] = pinned_versions[position - 1];
+                    position--;
+                }
+                pinned_versions[position] = version;
             }
-            return;
         }
     }
-    if (flag == 0)
+}
+
+// Function to leave a write section
+void end_write()
+{
+    if (--write_depth == 0)
     {
-        printf("Node not found\n");
+        __atomic_store_n(&committed_version, write_version, __ATOMIC_SEQ_CST);
+        reclaim_retired();
+        pthread_mutex_unlock(&write_mutex);
     }
 }
 
-// Function to post content on a node
-void post_content(char *name, char *content)
+// Returns 1 if a reader pinned a snapshot in [from, to) when the write section began
+static int snapshot_pinned_between(unsigned long from, unsigned long to)
 {
-
-    int content_index = -1;
-    for (int i = 0; i < num_content; i++)
+    int low = 0, high = num_pinned_versions;
+    while (low < high)
     {
-        if (strcmp(all_content[i], content) == 0)
+        int middle = (low + high) / 2;
+        if (pinned_versions[middle] < from)
         {
-            content_index = i;
-            break;
+            low = middle + 1;
         }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low < num_pinned_versions && pinned_versions[low] < to;
+}
+
+// Function to allocate a zeroed shared array
+static void **array_alloc(int capacity)
+{
+    ArrayHeader *header = calloc(1, sizeof(ArrayHeader) + capacity * sizeof(void *));
+    if (!header)
+    {
+        return NULL;
+    }
+
+    METRIC_COUNT(array_allocations);
+    header->capacity = capacity;
+    header->version = write_version;
+    header->appended = write_version;
+    return (void **)(header + 1);
+}
+
+static int array_capacity(void **array)
+{
+    return array ? ((ArrayHeader *)array - 1)->capacity : 0;
+}
+
+// Function to retire a shared array
+static void retire_array(void *array)
+{
+    if (array)
+    {
+        retire((ArrayHeader *)array - 1);
+    }
+}
+
+// Function to publish a new allocation of a shared array in place of the current one, which readers of older snapshots still reach
+static void array_publish(void ***array_slot, int *count_slot, void **replacement, int count)
+{
+    void **array = *array_slot;
+    ArrayHeader *header = (ArrayHeader *)replacement - 1;
+    header->previous = array;
+    header->previous_count = *count_slot;
+    header->count_before = count;
+
+    // No snapshot stops at an allocation of this version, so the chain can skip it.
+    if (array && ((ArrayHeader *)array - 1)->version == write_version)
+    {
+        header->previous = ((ArrayHeader *)array - 1)->previous;
+        header->previous_count = ((ArrayHeader *)array - 1)->previous_count;
+    }
+    retire_array(array);
+    __atomic_store_n(array_slot, replacement, __ATOMIC_RELEASE);
+    __atomic_store_n(count_slot, count, __ATOMIC_RELEASE);
+}
+
+// Function to get an allocation with free capacity ready for appends in place, recording the count older snapshots see.
+// Returns 0 if a snapshot still needs the count before its last version of appends, the appends then go into a copy.
+static int array_prepare_append(void **array, int count)
+{
+    ArrayHeader *header = (ArrayHeader *)array - 1;
+    if (header->appended == write_version)
+    {
+        return 1;
+    }
+    if (snapshot_pinned_between(header->version, header->appended))
+    {
+        return 0;
+    }
+    header->count_before = count;
+    __atomic_store_n(&header->appended, write_version, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Function to append to a shared array, growing it into a new allocation when it is full
+static int array_append(void ***array_slot, int *count_slot, void *item, int initial_capacity)
+{
+    void **array = *array_slot;
+    int count = *count_slot;
+
+    // A full array grows, and so does one whose count before its last version of appends is still needed by a snapshot.
+    int full = count >= array_capacity(array);
+    if (full || !array_prepare_append(array, count))
+    {
+        int capacity = !array ? initial_capacity : full ? array_capacity(array) * 2 : array_capacity(array);
+        void **grown = array_alloc(capacity);
+        if (!grown)
+        {
+            return -1;
+        }
+
+        if (count > 0)
+        {
+            METRIC_COUNT(array_grows);
+            memcpy(grown, array, count * sizeof(void *));
+        }
+        array_publish(array_slot, count_slot, grown, count);
+        array = grown;
+    }
+
+    __atomic_store_n(&array[count], item, __ATOMIC_RELAXED);
+    __atomic_store_n(count_slot, count + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Function to make room in a shared array for extra appends in one allocation, so a batch of appends grows it at most once
+// and, once this succeeded, cannot fail. Must be called inside a write section.
+static int array_reserve(void ***array_slot, int *count_slot, int extra)
+{
+    void **array = *array_slot;
+    int count = *count_slot;
+    int capacity = array_capacity(array);
+    if (extra <= 0 || (count + extra <= capacity && array && array_prepare_append(array, count)))
+    {
+        return 0;
+    }
+    while (capacity < count + extra)
+    {
+        capacity = capacity ? capacity * 2 : 4;
+    }
+
+    void **grown = array_alloc(capacity);
+    if (!grown)
+    {
+        return -1;
+    }
+    if (count > 0)
+    {
+        METRIC_COUNT(array_grows);
+        memcpy(grown, array, count * sizeof(void *));
+    }
+    array_publish(array_slot, count_slot, grown, count);
+    return 0;
+}
+
+// Function to remove an item from a shared array by publishing a copy without it
+static int array_remove(void ***array_slot, int *count_slot, void *item)
+{
+    void **array = *array_slot;
+    int count = *count_slot;
+
+    int index = -1;
+    for (int i = 0; i < count; i++)
+    {
+        if (array[i] == item)
+        {
+            index = i;
+            break;
+        }
+    }
+
+    if (index == -1)
+    {
+        return 0;
+    }
+
+    // No reader sees an allocation of the version being written.
+    if (((ArrayHeader *)array - 1)->version == write_version)
+    {
+        memmove(array + index, array + index + 1, (count - index - 1) * sizeof(void *));
+        array[count - 1] = NULL;
+        __atomic_store_n(count_slot, count - 1, __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    // The copy keeps the old capacity, so a reader still holding the old count finds NULL in the last slot.
+    void **copy = array_alloc(array_capacity(array));
+    if (!copy)
+    {
+        return -1;
+    }
+
+    METRIC_COUNT(array_copies);
+    memcpy(copy, array, index * sizeof(void *));
+    memcpy(copy + index, array + index + 1, (count - index - 1) * sizeof(void *));
+    array_publish(array_slot, count_slot, copy, count - 1);
+    return 1;
+}
+
+// Function to load a shared array and its count as of the snapshot of the read section, or the latest in a write section
+int read_array(void ***array_slot, int *count_slot, void ***array)
+{
+    if (write_depth > 0 || read_depth == 0)
+    {
+        int count = __atomic_load_n(count_slot, __ATOMIC_ACQUIRE);
+        *array = __atomic_load_n(array_slot, __ATOMIC_ACQUIRE);
+        int capacity = array_capacity(*array);
+        return count < capacity ? count : capacity;
+    }
+
+    // The count belongs to the allocation if the pointer did not change around loading it (a writer stores the pointer first).
+    void **current;
+    int count;
+    do
+    {
+        current = __atomic_load_n(array_slot, __ATOMIC_ACQUIRE);
+        count = __atomic_load_n(count_slot, __ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(array_slot, __ATOMIC_ACQUIRE) != current);
+
+    while (current && ((ArrayHeader *)current - 1)->version > snapshot_version)
+    {
+        count = ((ArrayHeader *)current - 1)->previous_count;
+        current = ((ArrayHeader *)current - 1)->previous;
+    }
+    if (current && __atomic_load_n(&((ArrayHeader *)current - 1)->appended, __ATOMIC_ACQUIRE) > snapshot_version)
+    {
+        count = ((ArrayHeader *)current - 1)->count_before;
+    }
+
+    *array = current;
+    int capacity = array_capacity(current);
+    return count < capacity ? count : capacity;
+}
+
+int read_all_nodes(Node ***nodes)
+{
+    return read_array((void ***)&all_nodes, &num_nodes, (void ***)nodes);
+}
+
+int read_links(Node *node, Node ***links)
+{
+    return read_array((void ***)&node->links, &node->num_links, (void ***)links);
+}
+
+// Returns the position of a node type in NODE_TYPES, -1 for an unknown type
+static int type_slot(char type)
+{
+    const char *slot = type ? strchr(NODE_TYPES, type) : NULL;
+    return slot ? (int)(slot - NODE_TYPES) : -1;
+}
+
+// Loads the nodes of one type in id order, or all nodes if type is '\0'. Entries can be NULL at the end, as in read_array().
+int read_typed_nodes(char type, Node ***nodes)
+{
+    int slot = type_slot(type);
+    if (slot < 0)
+    {
+        if (type)
+        {
+            *nodes = NULL;
+            return 0;
+        }
+        return read_all_nodes(nodes);
+    }
+    return read_array((void ***)&typed_nodes[slot], &num_typed_nodes[slot], (void ***)nodes);
+}
+
+int read_edges(Node *node, int label, Node ***edges)
+{
+    return read_array((void ***)&node->edges[label], &node->num_edges[label], (void ***)edges);
+}
+
+int read_contents(Node *node, char ***content)
+{
+    return read_array((void ***)&node->content, &node->num_contents, (void ***)content);
+}
+
+// Returns the number of posts of a node, archived ones included, as of the snapshot of the read section
+static int count_posts(Node *node)
+{
+    void **blocks;
+    char **content;
+    return read_array(&node->archived, &node->num_archived, &blocks) * TIMELINE_WINDOW + read_contents(node, &content);
+}
+
+// Growable list of nodes, used for BFS frontiers and lists of links.
+typedef struct NodeList
+{
+    Node **nodes;
+    int size;
+    int capacity;
+} NodeList;
+
+static void node_list_push(NodeList *list, Node *node)
+{
+    if (list->size == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->nodes = realloc(list->nodes, list->capacity * sizeof(Node *));
+    }
+    list->nodes[list->size++] = node;
+}
+
+/*
+    Compressed links:
+
+    With compressed_links set (social reads SOCIAL_COMPRESSED_LINKS=1 at start), a node keeps its links in one shared
+    array, its adjacency block, instead of the links and edges arrays:
+    - word 0 holds the tail capacity (low 32 bits) and the length in bytes of the packed links (high 32 bits),
+    - then the tail: links added since the block was packed, as Node pointers with the role in their low 3 bits,
+    - then the packed links, sorted by id, each one the varint of (id - previous id) << 3 | role.
+    An append goes into the tail, and a full tail is merged into a new block with a tail an eighth the size of the links,
+    so merging costs a few steps per link however big a node gets. A removal writes a new block without the link. Blocks
+    are published like any other shared array, so read sections see them as of their snapshot. num_links and num_edges
+    keep counting the links, the links and edges arrays stay empty. Traversals walk both forms in batches with
+    start_links()/next_links(), packed ids are turned back into nodes by a forward search of all_nodes.
+*/
+
+int compressed_links = 0; // Set before the first link is added, see Compressed links above.
+
+#define ADJACENCY_MIN_TAIL 4
+
+static int adjacency_tail_capacity(void **block)
+{
+    return (int)((unsigned long)block[0] & 0xffffffffUL);
+}
+
+static int adjacency_packed_length(void **block)
+{
+    return (int)((unsigned long)block[0] >> 32);
+}
+
+static const unsigned char *adjacency_packed(void **block)
+{
+    return (const unsigned char *)(block + 1 + adjacency_tail_capacity(block));
+}
+
+// Function to append a varint of up to 64 bits
+static void append_varint64(Buffer *buffer, unsigned long long value)
+{
+    unsigned char bytes[10];
+    int length = 0;
+    while (value >= 0x80)
+    {
+        bytes[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[length++] = (unsigned char)value;
+    buffer_append(buffer, (char *)bytes, length);
+}
+
+static unsigned long long read_varint64(const unsigned char **bytes)
+{
+    unsigned long long value = 0;
+    int shift = 0;
+    while (**bytes & 0x80)
+    {
+        value |= (unsigned long long)(*(*bytes)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return value | (unsigned long long)(*(*bytes)++) << shift;
+}
+
+static int compare_link_keys(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to find the position of the node with an id in nodes (sorted by id, NULLs last), or where it would be,
+// searching forward from a position whose node has at least from_id as id
+static int find_node_from(Node **nodes, int count, int from, int from_id, int node_id)
+{
+    if (from >= count || node_id <= from_id)
+    {
+        return from;
+    }
+
+    // Ids grow by at least one per position, so the node is at most this far ahead, and right there unless nodes in
+    // between were deleted. Only that node is loaded then, and nothing waits on the previous search.
+    long bound = (long)from + (node_id - from_id);
+    int high = bound < count ? (int)bound : count - 1;
+    if (nodes[high] && nodes[high]->id == node_id)
+    {
+        return high;
+    }
+
+    // Otherwise the search gallops back from the bound.
+    int step = 1;
+    while (high - step >= from && (!nodes[high - step] || nodes[high - step]->id >= node_id))
+    {
+        step *= 2;
+    }
+
+    int low = high - step >= from ? high - step + 1 : from, top = high + 1;
+    while (low < top)
+    {
+        int middle = low + (top - low) / 2;
+        if (!nodes[middle] || nodes[middle]->id >= node_id)
+        {
+            top = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+// Function to change the number of links of a node with a role, which readers load without a lock
+static void adjacency_count(Node *node, int label, int change)
+{
+    __atomic_store_n(&node->num_links, node->num_links + change, __ATOMIC_RELEASE);
+    __atomic_store_n(&node->num_edges[label], node->num_edges[label] + change, __ATOMIC_RELEASE);
+}
+
+// Returns 1 for the links a rebuild drops, given the id and role of their target.
+typedef int (*LinkDrop)(void *context, int target_id, int label);
+
+// Drops the links to the node given as context
+static int drop_target(void *context, int target_id, int label)
+{
+    (void)label;
+    return target_id == ((Node *)context)->id;
+}
+
+// Function to pack a node's links into a new adjacency block: its packed and tail links without the ones drop returns 1 for
+// (if not NULL), plus a new link to add (if not NULL), with room for at least reserve more in the tail. Counts the dropped
+// links in removed and returns the block, not published yet, or NULL when out of memory (the counts are then unchanged).
+// Must be called inside a write section.
+static void **adjacency_pack(Node *node, Node *add, int add_label, LinkDrop drop, void *context, int reserve, int *removed)
+{
+    void **block = node->adjacency;
+    int tail_count = block ? node->num_adjacency : 0;
+
+    // The tail is sorted and merged with the packed links, which are sorted already.
+    unsigned long long *tail = malloc((tail_count + 1) * sizeof(unsigned long long));
+    if (!tail)
+    {
+        return NULL;
+    }
+    int num_tail = 0, changes[NUM_EDGE_LABELS] = {0};
+    *removed = 0;
+    for (int i = 0; i < tail_count; i++)
+    {
+        Node *target = (Node *)((unsigned long)block[1 + i] & ~7UL);
+        if (drop && drop(context, target->id, (unsigned long)block[1 + i] & 7))
+        {
+            changes[(unsigned long)block[1 + i] & 7]--;
+            (*removed)++;
+            continue;
+        }
+        tail[num_tail++] = (unsigned long long)target->id << 3 | ((unsigned long)block[1 + i] & 7);
+    }
+    if (add)
+    {
+        tail[num_tail++] = (unsigned long long)add->id << 3 | add_label;
+        changes[add_label]++;
+    }
+    qsort(tail, num_tail, sizeof(unsigned long long), compare_link_keys);
+
+    Buffer packed = {NULL, 0, 0};
+    const unsigned char *bytes = block ? adjacency_packed(block) : NULL;
+    const unsigned char *end = block ? bytes + adjacency_packed_length(block) : NULL;
+    unsigned long long packed_key = 0, packed_id = 0, previous_id = 0;
+    int have_packed = 0, next_tail = 0, num_packed = 0;
+    while (1)
+    {
+        if (!have_packed && bytes < end)
+        {
+            unsigned long long value = read_varint64(&bytes);
+            packed_id += value >> 3;
+            packed_key = packed_id << 3 | (value & 7);
+            have_packed = 1;
+        }
+
+        unsigned long long key;
+        if (have_packed && (next_tail == num_tail || packed_key <= tail[next_tail]))
+        {
+            key = packed_key;
+            have_packed = 0;
+            if (drop && drop(context, (int)(key >> 3), key & 7))
+            {
+                changes[key & 7]--;
+                (*removed)++;
+                continue;
+            }
+        }
+        else if (next_tail < num_tail)
+        {
+            key = tail[next_tail++];
+        }
+        else
+        {
+            break;
+        }
+
+        append_varint64(&packed, ((key >> 3) - previous_id) << 3 | (key & 7));
+        previous_id = key >> 3;
+        num_packed++;
+    }
+    free(tail);
+
+    int tail_capacity = num_packed / 8 > ADJACENCY_MIN_TAIL ? num_packed / 8 : ADJACENCY_MIN_TAIL;
+    if (tail_capacity < reserve)
+    {
+        tail_capacity = reserve;
+    }
+    int words = 1 + tail_capacity + (int)((packed.length + sizeof(void *) - 1) / sizeof(void *));
+    void **replacement = array_alloc(words);
+    if (!replacement)
+    {
+        free(packed.data);
+        report("Failed to allocate memory for links.\n");
+        return NULL;
+    }
+    replacement[0] = (void *)((unsigned long)packed.length << 32 | (unsigned long)tail_capacity);
+    if (packed.length)
+    {
+        memcpy(replacement + 1 + tail_capacity, packed.data, packed.length);
+    }
+    free(packed.data);
+
+    // The counts change only once the block exists, so a failed pack leaves the node as it was.
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        if (changes[label])
+        {
+            adjacency_count(node, label, changes[label]);
+        }
+    }
+    return replacement;
+}
+
+// Function to write a new adjacency block for a node: its links without the ones to remove (if not NULL), plus a new
+// link to add (if not NULL), all packed. Returns the number of links removed or -1. Must be called inside a write section.
+static int adjacency_rebuild(Node *node, Node *add, int add_label, Node *remove)
+{
+    int removed;
+    void **replacement = adjacency_pack(node, add, add_label, remove ? drop_target : NULL, remove, 0, &removed);
+    if (!replacement)
+    {
+        return -1;
+    }
+    array_publish(&node->adjacency, &node->num_adjacency, replacement, 0);
+    return removed;
+}
+
+// Function to add a link to the tail of a node's adjacency block, packing the block again when the tail is full.
+// Must be called inside a write section.
+static int adjacency_append(Node *node, Node *target, int label)
+{
+    void **block = node->adjacency;
+    int count = node->num_adjacency;
+    if (!block || count >= adjacency_tail_capacity(block) || !array_prepare_append(block, count))
+    {
+        return adjacency_rebuild(node, target, label, NULL) < 0 ? -1 : 0;
+    }
+
+    __atomic_store_n(&block[1 + count], (void *)((unsigned long)target | label), __ATOMIC_RELAXED);
+    __atomic_store_n(&node->num_adjacency, count + 1, __ATOMIC_RELEASE);
+    adjacency_count(node, label, 1);
+    return 0;
+}
+
+// Function to make room in the tail of a node's adjacency block for extra more links, packing the block again if the
+// tail is short, so that appending them cannot fail. Must be called inside a write section.
+static int adjacency_reserve(Node *node, int extra)
+{
+    void **block = node->adjacency;
+    int count = node->num_adjacency;
+    if (extra <= 0 || (block && count + extra <= adjacency_tail_capacity(block) && array_prepare_append(block, count)))
+    {
+        return 0;
+    }
+
+    int removed;
+    void **replacement = adjacency_pack(node, NULL, 0, NULL, NULL, extra, &removed);
+    if (!replacement)
+    {
+        return -1;
+    }
+    array_publish(&node->adjacency, &node->num_adjacency, replacement, 0);
+    return 0;
+}
+
+// Function to start walking the links of a node with a role, or with any role if label is -1. Must be called inside a
+// read or write section.
+void start_links(LinkCursor *cursor, Node *node, int label)
+{
+    cursor->label = label;
+    cursor->tail = NULL;
+    cursor->num_tail = 0;
+    cursor->bytes = NULL;
+    cursor->end = NULL;
+    cursor->node_id = 0;
+    cursor->node_position = 0;
+    cursor->position_id = 0;
+
+    void **block;
+    int tail_count = read_array(&node->adjacency, &node->num_adjacency, &block);
+    if (!block)
+    {
+        // Uncompressed links are handed out in one batch, straight from the array.
+        cursor->num_tail = label < 0 ? read_links(node, &cursor->tail) : read_edges(node, label, &cursor->tail);
+        cursor->tagged = 0;
+        return;
+    }
+
+    cursor->tail = (Node **)block + 1;
+    cursor->num_tail = tail_count;
+    cursor->tagged = 1;
+    cursor->bytes = adjacency_packed(block);
+    cursor->end = cursor->bytes + adjacency_packed_length(block);
+    cursor->num_nodes = read_all_nodes(&cursor->nodes);
+}
+
+// Function to get the next batch of links, returns how many there are (0 at the end). Entries can be NULL, skip those.
+int next_links(LinkCursor *cursor, Node ***links)
+{
+    if (!cursor->tagged)
+    {
+        int count = cursor->num_tail;
+        *links = cursor->tail;
+        cursor->num_tail = 0;
+        return count;
+    }
+
+    int count = 0;
+    while (cursor->bytes < cursor->end && count < LINK_BATCH)
+    {
+        unsigned long long value = read_varint64(&cursor->bytes);
+        cursor->node_id += (int)(value >> 3);
+        if (cursor->label >= 0 && (int)(value & 7) != cursor->label)
+        {
+            continue;
+        }
+
+        cursor->node_position = find_node_from(cursor->nodes, cursor->num_nodes, cursor->node_position, cursor->position_id, cursor->node_id);
+        cursor->position_id = cursor->node_id;
+        Node *node = cursor->node_position < cursor->num_nodes ? cursor->nodes[cursor->node_position] : NULL;
+        if (node && node->id == cursor->node_id)
+        {
+            cursor->batch[count++] = node;
+        }
+    }
+
+    while (cursor->bytes >= cursor->end && cursor->num_tail > 0 && count < LINK_BATCH)
+    {
+        unsigned long entry = (unsigned long)__atomic_load_n(cursor->tail, __ATOMIC_RELAXED);
+        cursor->tail++;
+        cursor->num_tail--;
+        if (cursor->label < 0 || (int)(entry & 7) == cursor->label)
+        {
+            cursor->batch[count++] = (Node *)(entry & ~7UL);
+        }
+    }
+
+    *links = cursor->batch;
+    return count;
+}
+
+// Function to check if a node's adjacency block holds a link to target, without turning packed ids back into nodes.
+// Returns -1 when the node has no block. Must be called inside a read or write section.
+static int adjacency_contains(Node *node, Node *target)
+{
+    void **block;
+    int tail_count = read_array(&node->adjacency, &node->num_adjacency, &block);
+    if (!block)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < tail_count; i++)
+    {
+        if ((Node *)((unsigned long)__atomic_load_n(&block[1 + i], __ATOMIC_RELAXED) & ~7UL) == target)
+        {
+            return 1;
+        }
+    }
+
+    // Packed ids are sorted, so the scan stops at the first id past the target.
+    const unsigned char *bytes = adjacency_packed(block);
+    const unsigned char *end = bytes + adjacency_packed_length(block);
+    unsigned long long node_id = 0;
+    while (bytes < end && node_id <= (unsigned long long)target->id)
+    {
+        node_id += read_varint64(&bytes) >> 3;
+        if (node_id == (unsigned long long)target->id)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void release_content(char *content);
+
+// Function to retire a node and everything it owns
+static void retire_node(Node *node)
+{
+    for (int i = 0; i < node->num_contents; i++)
+    {
+        release_content(node->content[i]);
+    }
+
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        retire_array(node->edges[label]);
+    }
+
+    retire(node->date);
+    retire(node->name);
+    retire_array(node->links);
+    retire_array(node->adjacency);
+    retire_array(node->content);
+    retire_array(node->archived);
+    retire(node);
+}
+
+// Function to fill in the common fields of a node
+static void init_node(Node *node, char *name, char type)
+{
+    node->id = 0;
+    node->name = strdup(name);
+
+    // Setting date and time to current date and time
+    time_t currentTime;
+    time(&currentTime);
+    char currentTimeString[32];
+    ctime_r(&currentTime, currentTimeString);
+    node->date = strdup(currentTimeString);
+    node->created = currentTime;
+
+    node->type = type;
+    node->num_links = 0;
+    node->links = NULL;
+    node->adjacency = NULL;
+    node->num_adjacency = 0;
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        node->edges[label] = NULL;
+        node->num_edges[label] = 0;
+    }
+    node->num_contents = 0;
+    node->content = NULL;
+    node->num_archived = 0;
+    node->archived = NULL;
+}
+
+/*
+    Name index:
+
+    Node names, case-folded, in sorted runs for prefix queries. An entry is the first 8 folded bytes of the name packed
+    into an integer (so most comparisons never touch the name) and the node; equal names are ordered by id. The runs form
+    levels like a binary counter: level 0 holds up to NAME_INDEX_BASE entries kept sorted on insert, level i holds none or
+    up to NAME_INDEX_BASE << i, and a full level 0 is merged with the occupied levels above it into the first empty one.
+    An insert costs a copy of level 0 plus O(log n) amortized merging. A delete turns its entry into a tombstone by
+    recording its version in it, tombstones are dropped by merges and all levels are merged into one when they pass a
+    quarter of the entries. A query binary searches every level and merges the matches of all levels in name order. There
+    is one index per node type, so a query for one type never walks past names of other types.
+    The index is updated by add_to_network() and delete_node() inside the write section. Levels are shared arrays that are
+    only ever replaced, never changed in place, except for the version of a tombstone, which readers compare with their
+    snapshot: a query sees the index of its snapshot without a lock.
+*/
+
+#define NAME_INDEX_BASE 256
+#define NAME_INDEX_LEVELS 24
+
+typedef struct NameEntry
+{
+    uint64_t key;          // First 8 bytes of the folded name, big-endian and zero padded
+    Node *node;
+    unsigned long removed; // Version that deleted the node, 0 while it is in the network
+} NameEntry;
+
+#define NAME_ENTRY_WORDS ((int)(sizeof(NameEntry) / sizeof(void *)))
+
+typedef struct NameIndex
+{
+    NameEntry *levels[NAME_INDEX_LEVELS]; // Shared arrays of NAME_ENTRY_WORDS words per entry
+    int sizes[NAME_INDEX_LEVELS];         // In entries
+    long entries;                         // Live entries
+    long tombstones;
+} NameIndex;
+
+// One index per type in NODE_TYPES, a query for any type merges them.
+static NameIndex name_indexes[4];
+
+// Returns the first 8 bytes of a case-folded name as an integer that sorts like the bytes
+static uint64_t name_key(const char *name)
+{
+    uint64_t key = 0;
+    for (int i = 0; i < 8 && name[i]; i++)
+    {
+        key |= (uint64_t)(unsigned char)tolower((unsigned char)name[i]) << (56 - 8 * i);
+    }
+    return key;
+}
+
+// Compares two names ignoring case, like strcmp
+static int fold_compare(const char *a, const char *b)
+{
+    for (;; a++, b++)
+    {
+        int difference = tolower((unsigned char)*a) - tolower((unsigned char)*b);
+        if (difference != 0 || *a == '\0')
+        {
+            return difference;
+        }
+    }
+}
+
+// Returns 1 if the node of an entry is in the network as of the snapshot of the read section, or in the latest state in a
+// write section
+static int name_entry_live(const NameEntry *entry)
+{
+    unsigned long removed = __atomic_load_n(&entry->removed, __ATOMIC_ACQUIRE);
+    return removed == 0 || (write_depth == 0 && removed > read_version());
+}
+
+// Function to allocate a run of entries as a shared array, NULL when out of memory
+static NameEntry *name_run_alloc(long entries)
+{
+    return (NameEntry *)array_alloc((int)entries * NAME_ENTRY_WORDS);
+}
+
+// Function to load a level of an index as of the snapshot of the read section, returns its size
+static int read_name_level(NameIndex *index, int level, NameEntry **entries)
+{
+    return read_array((void ***)&index->levels[level], &index->sizes[level], (void ***)entries);
+}
+
+// Compares a live entry with a (key, name, id), in index order
+static int name_entry_compare(const NameEntry *entry, uint64_t key, const char *name, int node_id)
+{
+    if (entry->key != key)
+    {
+        return entry->key < key ? -1 : 1;
+    }
+    // The keys hold whole names unless their last byte is set.
+    if (key & 0xff)
+    {
+        int difference = fold_compare(entry->node->name + 8, name + 8);
+        if (difference != 0)
+        {
+            return difference;
+        }
+    }
+    return (entry->node->id > node_id) - (entry->node->id < node_id);
+}
+
+// Returns the first position in a level not below (key, name, id). Tombstones are passed over by looking at the next live entry.
+static int name_level_lower_bound(const NameEntry *level, int size, uint64_t key, const char *name, int node_id)
+{
+    int low = 0, high = size;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        int live = middle;
+        while (live < high && !name_entry_live(&level[live]))
+        {
+            live++;
+        }
+        if (live < high && name_entry_compare(&level[live], key, name, node_id) < 0)
+        {
+            low = live + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Function to merge two levels into out, leaving out tombstones. Returns the number of entries written.
+static int name_level_merge(const NameEntry *a, int size_a, const NameEntry *b, int size_b, NameEntry *out)
+{
+    int i = 0, j = 0, count = 0;
+    while (i < size_a || j < size_b)
+    {
+        if (i < size_a && a[i].removed)
+        {
+            i++;
+        }
+        else if (j < size_b && b[j].removed)
+        {
+            j++;
+        }
+        else if (j == size_b || (i < size_a && name_entry_compare(&a[i], b[j].key, b[j].node->name, b[j].node->id) < 0))
+        {
+            out[count++] = a[i++];
+        }
+        else
+        {
+            out[count++] = b[j++];
+        }
+    }
+    return count;
+}
+
+// Function to merge levels [0, last) into one run, returns it (NULL when out of memory) and its size in *size. Must be
+// called inside a write section.
+static NameEntry *name_index_gather(NameIndex *index, int last, int *size)
+{
+    long total = 0;
+    for (int level = 0; level < last; level++)
+    {
+        total += index->sizes[level];
+    }
+    NameEntry *run = name_run_alloc(total);
+    NameEntry *spare = name_run_alloc(total);
+    if (!run || !spare)
+    {
+        free(run ? (ArrayHeader *)run - 1 : NULL);
+        free(spare ? (ArrayHeader *)spare - 1 : NULL);
+        return NULL;
+    }
+
+    int count = 0;
+    for (int level = 0; level < last; level++)
+    {
+        count = name_level_merge(run, count, index->levels[level], index->sizes[level], spare);
+        NameEntry *swap = run;
+        run = spare;
+        spare = swap;
+    }
+    free((ArrayHeader *)spare - 1);
+    *size = count;
+    return run;
+}
+
+// Function to publish a run in level 0 or the smallest level it fits in, emptying levels [0, last) that it was gathered
+// from. Returns -1 when out of memory, the run is then left to the caller. Must be called inside a write section.
+static int name_index_place(NameIndex *index, NameEntry *run, int size, int last)
+{
+    NameEntry *empty[NAME_INDEX_LEVELS] = {NULL};
+    for (int level = 0; level < last; level++)
+    {
+        if (index->sizes[level] > 0 && !(empty[level] = name_run_alloc(0)))
+        {
+            for (int i = 0; i < level; i++)
+            {
+                free(empty[i] ? (ArrayHeader *)empty[i] - 1 : NULL);
+            }
+            return -1;
+        }
+    }
+    for (int level = 0; level < last; level++)
+    {
+        if (empty[level])
+        {
+            array_publish((void ***)&index->levels[level], &index->sizes[level], (void **)empty[level], 0);
+        }
+    }
+
+    // Level 0 keeps room for the next insert.
+    int level = 0;
+    while ((level == 0 ? NAME_INDEX_BASE - 1 : (long)NAME_INDEX_BASE << level) < size && level < NAME_INDEX_LEVELS - 1)
+    {
+        level++;
+    }
+    array_publish((void ***)&index->levels[level], &index->sizes[level], (void **)run, size);
+    return 0;
+}
+
+// Function to merge all levels into one, dropping every tombstone. Must be called inside a write section.
+static void name_index_compact(NameIndex *index)
+{
+    int size;
+    NameEntry *run = name_index_gather(index, NAME_INDEX_LEVELS, &size);
+    if (run && name_index_place(index, run, size, NAME_INDEX_LEVELS) == 0)
+    {
+        index->entries = size;
+        index->tombstones = 0;
+    }
+    else if (run)
+    {
+        free((ArrayHeader *)run - 1);
+    }
+}
+
+// Function to add a node to the name index. Called inside the write section.
+static void name_index_add(Node *node)
+{
+    int slot = type_slot(node->type);
+    if (slot < 0)
+    {
+        return;
+    }
+    NameIndex *index = &name_indexes[slot];
+    uint64_t key = name_key(node->name);
+    if (index->sizes[0] == NAME_INDEX_BASE)
+    {
+        // Carry level 0 up to the first level that is empty, merging the full ones on the way.
+        int last = 1;
+        while (last < NAME_INDEX_LEVELS - 1 && index->sizes[last] > 0)
+        {
+            last++;
+        }
+        long gathered = 0;
+        for (int level = 0; level <= last; level++)
+        {
+            gathered += index->sizes[level];
+        }
+        int size;
+        NameEntry *run = name_index_gather(index, last + 1, &size);
+        if (run && name_index_place(index, run, size, last + 1) == 0)
+        {
+            index->tombstones -= gathered - size;
+        }
+        else if (run)
+        {
+            free((ArrayHeader *)run - 1);
+        }
+    }
+
+    // Level 0 is inserted into in place only if this write section allocated it with room, otherwise into a copy.
+    NameEntry *level = index->levels[0];
+    int size = index->sizes[0];
+    NameEntry *target = level;
+    if (!level || ((ArrayHeader *)level - 1)->version != write_version || array_capacity((void **)level) < (size + 1) * NAME_ENTRY_WORDS)
+    {
+        target = name_run_alloc(NAME_INDEX_BASE);
+    }
+    if (!target || size == NAME_INDEX_BASE)
+    {
+        report("Failed to allocate memory for the name index.\n");
+        return;
+    }
+
+    int position = name_level_lower_bound(level, size, key, node->name, node->id);
+    if (target != level && position > 0)
+    {
+        memcpy(target, level, position * sizeof(NameEntry));
+    }
+    if (size > position)
+    {
+        memmove(target + position + 1, level + position, (size - position) * sizeof(NameEntry));
+    }
+    target[position].key = key;
+    target[position].node = node;
+    target[position].removed = 0;
+    if (target != level)
+    {
+        array_publish((void ***)&index->levels[0], &index->sizes[0], (void **)target, size + 1);
+    }
+    else
+    {
+        __atomic_store_n(&index->sizes[0], size + 1, __ATOMIC_RELEASE);
+    }
+    index->entries++;
+}
+
+// Function to remove the entry at a position of level 0, in place if this write section allocated the level, otherwise
+// from a copy. Must be called inside a write section.
+static void name_level0_remove(NameIndex *index, int position)
+{
+    NameEntry *level = index->levels[0];
+    int size = index->sizes[0];
+    NameEntry *target = ((ArrayHeader *)level - 1)->version == write_version ? level : name_run_alloc(NAME_INDEX_BASE);
+    if (!target)
+    {
+        // The entry stays as a tombstone instead, until the next merge.
+        __atomic_store_n(&level[position].removed, write_version, __ATOMIC_RELEASE);
+        index->tombstones++;
+        return;
+    }
+
+    if (target != level && position > 0)
+    {
+        memcpy(target, level, position * sizeof(NameEntry));
+    }
+    memmove(target + position, level + position + 1, (size - position - 1) * sizeof(NameEntry));
+    if (target != level)
+    {
+        array_publish((void ***)&index->levels[0], &index->sizes[0], (void **)target, size - 1);
+    }
+    else
+    {
+        __atomic_store_n(&index->sizes[0], size - 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Function to remove a node from the name index. Called inside the write section, before the node is retired.
+static void name_index_remove(Node *node)
+{
+    int slot = type_slot(node->type);
+    if (slot < 0)
+    {
+        return;
+    }
+    NameIndex *index = &name_indexes[slot];
+    uint64_t key = name_key(node->name);
+    for (int level = 0; level < NAME_INDEX_LEVELS; level++)
+    {
+        NameEntry *entries = index->levels[level];
+        int size = index->sizes[level];
+        int position = name_level_lower_bound(entries, size, key, node->name, node->id);
+        while (position < size && entries[position].removed)
+        {
+            position++;
+        }
+        if (position < size && entries[position].node == node)
+        {
+            if (level == 0)
+            {
+                name_level0_remove(index, position);
+            }
+            else
+            {
+                __atomic_store_n(&entries[position].removed, write_version, __ATOMIC_RELEASE);
+                index->tombstones++;
+            }
+            index->entries--;
+            break;
+        }
+    }
+
+    if (index->tombstones > NAME_INDEX_BASE && 4 * index->tombstones > index->entries)
+    {
+        name_index_compact(index);
+    }
+}
+
+// Function to remove the nodes marked in a bitmap by id from the name index, in one pass over the entries. Called inside the
+// write section, before the nodes are retired.
+static void name_index_remove_marked(const unsigned long long *marked, int max_id)
+{
+    for (int slot = 0; slot < 4; slot++)
+    {
+        NameIndex *index = &name_indexes[slot];
+        for (int level = 0; level < NAME_INDEX_LEVELS; level++)
+        {
+            // As in name_index_remove(), level 0 drops its entries (from the last, so that the positions left to visit stay
+            // put) and the levels above keep tombstones.
+            for (int i = index->sizes[level] - 1; i >= 0; i--)
+            {
+                NameEntry *entry = &index->levels[level][i];
+                if (entry->removed || entry->node->id >= max_id || !(marked[entry->node->id / 64] >> entry->node->id % 64 & 1))
+                {
+                    continue;
+                }
+                index->entries--;
+                if (level == 0)
+                {
+                    name_level0_remove(index, i);
+                }
+                else
+                {
+                    __atomic_store_n(&entry->removed, write_version, __ATOMIC_RELEASE);
+                    index->tombstones++;
+                }
+            }
+        }
+
+        if (index->tombstones > NAME_INDEX_BASE && 4 * index->tombstones > index->entries)
+        {
+            name_index_compact(index);
+        }
+    }
+}
+
+// Returns 1 if a name starts with a folded prefix, ignoring case
+static int name_has_prefix(const char *name, const char *prefix)
+{
+    for (; *prefix; name++, prefix++)
+    {
+        if (tolower((unsigned char)*name) != *prefix)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+    Fuzzy name index:
+
+    Lists of node ids by the bigrams of their case-folded names, padded with '\0' at both ends ("bob" has "\0b", "bo",
+    "ob", "b\0"). A name within edit distance d of a query lacks at most 2d of the query's distinct bigrams, since an edit
+    changes at most two bigrams, so it is in at least one of any 2d + 1 of their lists: a query reads the 2d + 1 shortest
+    ones and checks each candidate with a bit-parallel edit distance. Queries with 2d or fewer bigrams read lists of short
+    names by length instead. Ids are appended in order, so lists stay sorted; deleted ids are left in place, skipped as
+    find_node_by_id() no longer finds them, and purged once they are half of the index.
+    The index is updated by add_to_network() and delete_node() inside the write section. Lists are shared arrays of one id
+    per word, a purge publishes a copy, so queries read the lists of their snapshot without a lock.
+*/
+
+#define FUZZY_SHORT_LENGTH (3 * FUZZY_MAX_DISTANCE - 1) // Longest name a query with too few bigrams can match
+#define FUZZY_GRAMS 65536
+
+typedef struct IdList
+{
+    int *ids;
+    int size;
+    int capacity;
+} IdList;
+
+// A list of node ids in an index, as a shared array of one id per word
+typedef struct IdArray
+{
+    void **ids;
+    int size;
+} IdArray;
+
+typedef struct FuzzyIndex
+{
+    IdArray grams[FUZZY_GRAMS];
+    IdArray lengths[FUZZY_SHORT_LENGTH + 1]; // Names of each length up to FUZZY_SHORT_LENGTH
+    long indexed;                            // Nodes added, deleted ones included
+    long deleted;
+} FuzzyIndex;
+
+static FuzzyIndex fuzzy_index;
+
+static int id_list_append(IdList *list, int node_id)
+{
+    if (list->size == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 4;
+        int *ids = realloc(list->ids, capacity * sizeof(int));
+        if (!ids)
+        {
+            return -1;
+        }
+        list->ids = ids;
+        list->capacity = capacity;
+    }
+    list->ids[list->size++] = node_id;
+    return 0;
+}
+
+// Function to append an id to an index list. Must be called inside a write section.
+static int id_array_append(IdArray *list, int node_id)
+{
+    return array_append(&list->ids, &list->size, (void *)(long)node_id, 4);
+}
+
+// Function to load an index list as of the snapshot of the read section, returns its size
+static int read_id_array(IdArray *list, void ***ids)
+{
+    return read_array(&list->ids, &list->size, ids);
+}
+
+// Function to drop the ids of deleted nodes from an index list by publishing a copy without them. Must be called inside a
+// write section, after the nodes have left all_nodes.
+static void id_array_purge(IdArray *list)
+{
+    int kept = 0;
+    for (int i = 0; i < list->size; i++)
+    {
+        kept += find_node_by_id((int)(long)list->ids[i]) != NULL;
+    }
+    if (kept == list->size)
+    {
+        return;
+    }
+
+    void **copy = array_alloc(kept > 4 ? kept : 4);
+    if (!copy)
+    {
+        return; // The deleted ids stay, queries skip them.
+    }
+    int count = 0;
+    for (int i = 0; i < list->size; i++)
+    {
+        if (find_node_by_id((int)(long)list->ids[i]))
+        {
+            copy[count++] = list->ids[i];
+        }
+    }
+    array_publish(&list->ids, &list->size, copy, count);
+}
+
+static int compare_ints(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to collect the distinct padded bigrams of a folded name into grams (room for length + 1), returns their count
+static int name_grams(const char *folded, int length, int *grams)
+{
+    int previous = 0;
+    for (int i = 0; i <= length; i++)
+    {
+        int current = i < length ? (unsigned char)folded[i] : 0;
+        grams[i] = previous << 8 | current;
+        previous = current;
+    }
+    qsort(grams, length + 1, sizeof(int), compare_ints);
+    int count = 0;
+    for (int i = 0; i <= length; i++)
+    {
+        if (count == 0 || grams[count - 1] != grams[i])
+        {
+            grams[count++] = grams[i];
+        }
+    }
+    return count;
+}
+
+// Function to copy a name folded to lower case, returns NULL when out of memory
+static char *fold_name(const char *name)
+{
+    char *folded = strdup(name);
+    for (char *c = folded; c && *c; c++)
+    {
+        *c = (char)tolower((unsigned char)*c);
+    }
+    return folded;
+}
+
+// Function to add a node to the fuzzy index. Called inside the write section, after the node got its id.
+static void fuzzy_index_add(Node *node)
+{
+    char *folded = fold_name(node->name);
+    int length = folded ? (int)strlen(folded) : 0;
+    int *grams = malloc((length + 1) * sizeof(int));
+    if (!folded || !grams)
+    {
+        free(folded);
+        free(grams);
+        report("Failed to allocate memory for the fuzzy index.\n");
+        return;
+    }
+    int count = name_grams(folded, length, grams);
+
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        failed |= id_array_append(&fuzzy_index.grams[grams[i]], node->id);
+    }
+    if (length <= FUZZY_SHORT_LENGTH)
+    {
+        failed |= id_array_append(&fuzzy_index.lengths[length], node->id);
+    }
+    fuzzy_index.indexed++;
+
+    if (failed)
+    {
+        report("Failed to allocate memory for the fuzzy index.\n");
+    }
+    free(folded);
+    free(grams);
+}
+
+// Function to count deleted nodes, purging deleted ids when they are half of the index. Called inside the write section,
+// after the nodes have left all_nodes.
+static void fuzzy_index_remove(int count)
+{
+    fuzzy_index.deleted += count;
+    if (fuzzy_index.deleted > 1024 && 2 * fuzzy_index.deleted > fuzzy_index.indexed)
+    {
+        for (int gram = 0; gram < FUZZY_GRAMS; gram++)
+        {
+            id_array_purge(&fuzzy_index.grams[gram]);
+        }
+        for (int length = 0; length <= FUZZY_SHORT_LENGTH; length++)
+        {
+            id_array_purge(&fuzzy_index.lengths[length]);
+        }
+        fuzzy_index.indexed -= fuzzy_index.deleted;
+        fuzzy_index.deleted = 0;
+    }
+}
+
+// Edit distance of a text to a folded pattern, or max_distance + 1 if it is larger. Patterns up to 64 bytes use the
+// bit-parallel algorithm of Myers (as formulated by Hyyrö): one machine word holds a whole column of the distance table.
+static int edit_distance_within(const char *pattern, int m, const uint64_t *peq, const char *text, int n, int max_distance)
+{
+    if (m > 64)
+    {
+        // Long patterns: the plain table, one row at a time.
+        int *row = malloc((m + 1) * sizeof(int));
+        for (int i = 0; i <= m; i++)
+        {
+            row[i] = i;
+        }
+        for (int j = 1; j <= n; j++)
+        {
+            int diagonal = row[0], lowest = ++row[0];
+            char c = (char)tolower((unsigned char)text[j - 1]);
+            for (int i = 1; i <= m; i++)
+            {
+                int above = row[i];
+                int best = diagonal + (pattern[i - 1] != c);
+                best = above + 1 < best ? above + 1 : best;
+                best = row[i - 1] + 1 < best ? row[i - 1] + 1 : best;
+                row[i] = best;
+                diagonal = above;
+                lowest = best < lowest ? best : lowest;
+            }
+            if (lowest > max_distance)
+            {
+                free(row);
+                return max_distance + 1;
+            }
+        }
+        int distance = row[m];
+        free(row);
+        return distance <= max_distance ? distance : max_distance + 1;
+    }
+    if (m == 0)
+    {
+        return n <= max_distance ? n : max_distance + 1;
+    }
+
+    uint64_t positive = m == 64 ? ~0ULL : (1ULL << m) - 1, negative = 0;
+    uint64_t last = 1ULL << (m - 1);
+    int score = m;
+    for (int j = 0; j < n; j++)
+    {
+        uint64_t equal = peq[(unsigned char)tolower((unsigned char)text[j])];
+        uint64_t vertical = equal | negative;
+        uint64_t horizontal = (((equal & positive) + positive) ^ positive) | equal;
+        uint64_t horizontal_positive = negative | ~(horizontal | positive);
+        uint64_t horizontal_negative = positive & horizontal;
+        if (horizontal_positive & last)
+        {
+            score++;
+        }
+        else if (horizontal_negative & last)
+        {
+            score--;
+        }
+        // The top row grows by one per text character, hence the 1 shifted in.
+        horizontal_positive = horizontal_positive << 1 | 1;
+        horizontal_negative <<= 1;
+        positive = horizontal_negative | ~(vertical | horizontal_positive);
+        negative = horizontal_positive & vertical;
+
+        // The score drops by at most one per remaining character.
+        if (score - (n - j - 1) > max_distance)
+        {
+            return max_distance + 1;
+        }
+    }
+    return score <= max_distance ? score : max_distance + 1;
+}
+
+/*
+    Birthday and location indexes:
+
+    Individuals by birthday, in one id list per (month, day) plus one for dates out of range, and businesses and
+    organisations by location, in one id list per square of a grid of side LOCATION_CELL, found through an open addressing
+    table of the squares in use. As in the fuzzy index, ids are appended in order so lists stay sorted, and deleted ids are
+    left in place, skipped as find_node_by_id() no longer finds them and purged once they are half of the index. The size
+    of a list is then a cheap upper bound of its nodes, which the query planner uses as an estimate.
+    Both are updated by add_to_network() and delete_node() inside the write section. Their lists are shared arrays as in
+    the fuzzy index, and the table of squares is a shared array of pointers to them, so queries read them without a lock.
+*/
+
+#define BIRTHDAY_LISTS (12 * 31 + 1) // One per (month, day), the last one for dates out of range
+#define LOCATION_MAX_CELL 1e15       // Grid coordinates are clamped to this, so that they fit a long long
+
+typedef struct BirthdayIndex
+{
+    IdArray lists[BIRTHDAY_LISTS];
+    long indexed; // Nodes added, deleted ones included
+    long deleted;
+} BirthdayIndex;
+
+static BirthdayIndex birthday_index;
+
+typedef struct LocationCell
+{
+    long long x; // Grid coordinates, the location divided by LOCATION_CELL and rounded down
+    long long y;
+    IdArray ids;
+} LocationCell;
+
+typedef struct LocationIndex
+{
+    void **cells; // Shared array of LocationCell pointers, NULL for a free slot
+    int capacity; // Slots, a power of two
+    int used;
+    long indexed;
+    long deleted;
+} LocationIndex;
+
+static LocationIndex location_index;
+
+// Returns the list of a birthday in the birthday index
+static int birthday_list(int day, int month)
+{
+    if (day < 1 || day > 31 || month < 1 || month > 12)
+    {
+        return BIRTHDAY_LISTS - 1;
+    }
+    return (month - 1) * 31 + day - 1;
+}
+
+// Function to add an individual to the birthday index. Called inside the write section, after the node got its id.
+static void birthday_index_add(Node *node)
+{
+    if (node->type != 'I')
+    {
+        return;
+    }
+    Birthday *birthday = &((Individual *)node)->birthday;
+    int failed = id_array_append(&birthday_index.lists[birthday_list(birthday->day, birthday->month)], node->id);
+    birthday_index.indexed += !failed;
+
+    if (failed)
+    {
+        report("Failed to allocate memory for the birthday index.\n");
+    }
+}
+
+// Function to count a deleted individual, purging deleted ids when they are half of the index. Called inside the write
+// section, after the node has left all_nodes.
+static void birthday_index_remove(Node *node)
+{
+    if (node->type != 'I')
+    {
+        return;
+    }
+    birthday_index.deleted++;
+    if (birthday_index.deleted > 1024 && 2 * birthday_index.deleted > birthday_index.indexed)
+    {
+        for (int list = 0; list < BIRTHDAY_LISTS; list++)
+        {
+            id_array_purge(&birthday_index.lists[list]);
+        }
+        birthday_index.indexed -= birthday_index.deleted;
+        birthday_index.deleted = 0;
+    }
+}
+
+// Returns the grid coordinate of a location coordinate
+static long long location_cell(double coordinate)
+{
+    double cell = floor(coordinate / LOCATION_CELL);
+    if (!(cell > -LOCATION_MAX_CELL))
+    {
+        return cell != cell ? 0 : (long long)-LOCATION_MAX_CELL;
+    }
+    return cell < LOCATION_MAX_CELL ? (long long)cell : (long long)LOCATION_MAX_CELL;
+}
+
+// Returns the slot of a grid square in a table, or the free slot where it goes
+static void **location_slot(void **cells, int capacity, long long x, long long y)
+{
+    unsigned long long hash = (unsigned long long)x * 0x9e3779b97f4a7c15ULL ^ (unsigned long long)y * 0xc2b2ae3d27d4eb4fULL;
+    for (int slot = (int)((hash ^ hash >> 29) & (capacity - 1));; slot = (slot + 1) & (capacity - 1))
+    {
+        LocationCell *cell = __atomic_load_n(&cells[slot], __ATOMIC_ACQUIRE);
+        if (!cell || (cell->x == x && cell->y == y))
+        {
+            return &cells[slot];
+        }
+    }
+}
+
+// Function to add a business or organisation to the location index. Called inside the write section, after the node got its id.
+static void location_index_add(Node *node)
+{
+    if (node->type != 'B' && node->type != 'O')
+    {
+        return;
+    }
+    Location *location = node->type == 'B' ? &((Business *)node)->location : &((Organisation *)node)->location;
+    long long x = location_cell(location->x), y = location_cell(location->y);
+
+    int failed = 0;
+    if (2 * (location_index.used + 1) > location_index.capacity)
+    {
+        // Doubles the table, keeping it at most half full. The squares move over, their lists stay where they are.
+        int capacity = location_index.capacity ? 2 * location_index.capacity : 64;
+        void **cells = array_alloc(capacity);
+        if (cells)
+        {
+            for (int slot = 0; slot < location_index.capacity; slot++)
+            {
+                LocationCell *cell = location_index.cells[slot];
+                if (cell)
+                {
+                    *location_slot(cells, capacity, cell->x, cell->y) = cell;
+                }
+            }
+            array_publish(&location_index.cells, &location_index.capacity, cells, capacity);
+        }
+        failed = !cells && location_index.used + 1 >= location_index.capacity;
+    }
+
+    void **slot = failed ? NULL : location_slot(location_index.cells, location_index.capacity, x, y);
+    LocationCell *cell = slot ? *slot : NULL;
+    if (slot && !cell && (cell = calloc(1, sizeof(LocationCell))))
+    {
+        // A new square is published with its list empty, a reader of an older snapshot sees no ids in it.
+        cell->x = x;
+        cell->y = y;
+        __atomic_store_n(slot, cell, __ATOMIC_RELEASE);
+        __atomic_store_n(&location_index.used, location_index.used + 1, __ATOMIC_RELEASE);
+    }
+    failed = !cell || id_array_append(&cell->ids, node->id) != 0;
+    location_index.indexed += !failed;
+
+    if (failed)
+    {
+        report("Failed to allocate memory for the location index.\n");
+    }
+}
+
+// Function to count a deleted business or organisation, purging deleted ids when they are half of the index. Called inside
+// the write section, after the node has left all_nodes.
+static void location_index_remove(Node *node)
+{
+    if (node->type != 'B' && node->type != 'O')
+    {
+        return;
+    }
+    location_index.deleted++;
+    if (location_index.deleted > 1024 && 2 * location_index.deleted > location_index.indexed)
+    {
+        for (int slot = 0; slot < location_index.capacity; slot++)
+        {
+            if (location_index.cells[slot])
+            {
+                id_array_purge(&((LocationCell *)location_index.cells[slot])->ids);
+            }
+        }
+        location_index.indexed -= location_index.deleted;
+        location_index.deleted = 0;
+    }
+}
+
+// Function to publish a new node in all_nodes. The id is given out under the same lock, so all_nodes stays sorted by id.
+// Function to add a new node to the node lists and indexes, returns 0 or -1 if it could not be added, the node is then freed
+static int add_to_network(Node *node)
+{
+    begin_write();
+    // Both lists get their room first, so the node is in both or in neither.
+    int slot = type_slot(node->type);
+    if (array_reserve((void ***)&all_nodes, &num_nodes, all_nodes ? 1 : MAX_NODES) != 0 ||
+        (slot >= 0 && array_reserve((void ***)&typed_nodes[slot], &num_typed_nodes[slot], typed_nodes[slot] ? 1 : MAX_NODES) != 0))
+    {
+        report("Failed to allocate memory for new node.\n");
+        retire_node(node);
+        end_write();
+        return -1;
+    }
+
+    node->id = id++;
+    // The clock can step back, creation times are kept in id order so that they can be binary searched.
+    if (node->created < last_created)
+    {
+        node->created = last_created;
+    }
+    last_created = node->created;
+
+    array_append((void ***)&all_nodes, &num_nodes, node, MAX_NODES);
+    if (slot >= 0)
+    {
+        array_append((void ***)&typed_nodes[slot], &num_typed_nodes[slot], node, MAX_NODES);
+    }
+    name_index_add(node);
+    fuzzy_index_add(node);
+    birthday_index_add(node);
+    location_index_add(node);
+    end_write();
+    return 0;
+}
+
+// Function to create a node
+Node *create_node(char *name, char type)
+{
+    METRIC_SCOPE(create_node);
+    Node *node = (Node *)malloc(sizeof(Node));
+    init_node(node, name, type);
+    begin_write();
+    node->id = id++;
+    end_write();
+
+    return node;
+}
+
+// Function to create an individual
+Individual *create_individual(char *name, Birthday birthday)
+{
+    METRIC_SCOPE(create_individual);
+    Individual *individual = (Individual *)malloc(sizeof(Individual));
+    if (!individual)
+    {
+        report("Failed to allocate memory for new node.\n");
+        return NULL;
+    }
+    init_node(&individual->node, name, 'I');
+    individual->birthday = birthday;
+
+    if (add_to_network(&individual->node) != 0)
+    {
+        return NULL;
+    }
+    return individual;
+}
+
+// Function to create a business
+Business *create_business(char *name, Location location)
+{
+    METRIC_SCOPE(create_business);
+    Business *business = (Business *)malloc(sizeof(Business));
+    if (!business)
+    {
+        report("Failed to allocate memory for new node.\n");
+        return NULL;
+    }
+    init_node(&business->node, name, 'B');
+    business->location = location;
+
+    if (add_to_network(&business->node) != 0)
+    {
+        return NULL;
+    }
+    return business;
+}
+
+// Function to create a group
+Group *create_group(char *name)
+{
+    METRIC_SCOPE(create_group);
+    Group *group = (Group *)malloc(sizeof(Group));
+    if (!group)
+    {
+        report("Failed to allocate memory for new node.\n");
+        return NULL;
+    }
+    init_node(&group->node, name, 'G');
+
+    if (add_to_network(&group->node) != 0)
+    {
+        return NULL;
+    }
+    return group;
+}
+
+// Function to create an organisation
+Organisation *create_organisation(char *name, Location location)
+{
+    METRIC_SCOPE(create_organisation);
+    Organisation *organisation = (Organisation *)malloc(sizeof(Organisation));
+    if (!organisation)
+    {
+        report("Failed to allocate memory for new node.\n");
+        return NULL;
+    }
+    init_node(&organisation->node, name, 'O');
+    organisation->location = location;
+
+    if (add_to_network(&organisation->node) != 0)
+    {
+        return NULL;
+    }
+    return organisation;
+}
+
+// Returns the range of the entries of a level whose names are a folded name (exact) or start with it, from first,
+// tombstones included. Those entries follow each other in index order.
+static int name_level_range(const NameEntry *level, int size, const char *folded, int exact, int *first)
+{
+    *first = name_level_lower_bound(level, size, name_key(folded), folded, 0);
+    int low = *first, high = size;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        int live = middle;
+        while (live < high && !name_entry_live(&level[live]))
+        {
+            live++;
+        }
+        const char *name = live < high ? level[live].node->name : NULL;
+        if (name && (exact ? fold_compare(name, folded) == 0 : name_has_prefix(name, folded)))
+        {
+            low = live + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low - *first;
+}
+
+// Function to count the name index entries of a name (exact) or prefix over all types, or with ids not NULL, to also copy
+// the ids of the live ones with that exact name (case included) or prefix. Returns the count.
+static int name_index_match(const char *text, int exact, IdList *ids)
+{
+    char *folded = exact ? fold_name(text) : strdup(text);
+    if (!folded)
+    {
+        return 0;
+    }
+
+    int count = 0;
+    begin_read();
+    for (int slot = 0; slot < 4; slot++)
+    {
+        for (int level = 0; level < NAME_INDEX_LEVELS; level++)
+        {
+            NameEntry *entries;
+            int first, level_size = read_name_level(&name_indexes[slot], level, &entries);
+            int size = name_level_range(entries, level_size, folded, exact, &first);
+            count += size;
+            for (int i = first; ids && i < first + size; i++)
+            {
+                if (name_entry_live(&entries[i]) && (!exact || strcmp(entries[i].node->name, text) == 0))
+                {
+                    id_list_append(ids, entries[i].node->id);
+                }
+            }
+        }
+    }
+    end_read();
+    free(folded);
+    return count;
+}
+
+// Returns the first node with a name and one of the given types (any type if types is NULL), from the name index. Must be
+// called inside a read or write section.
+static Node *find_first_node(const char *name, const char *types)
+{
+    IdList ids = {NULL, 0, 0};
+    name_index_match(name, 1, &ids);
+    Node *first = NULL;
+    for (int i = 0; i < ids.size; i++)
+    {
+        Node *node = find_node_by_id(ids.ids[i]);
+        if (node && (!types || strchr(types, node->type)) && (!first || node->id < first->id))
+        {
+            first = node;
+        }
+    }
+    free(ids.ids);
+    return first;
+}
+
+/*
+    Connected components:
+
+    A union-find over node ids (union by rank) is kept up to date by every new link, so connectivity questions never
+    traverse the graph. Links are never split by a union-find, so a write section that removes links marks the components
+    of their nodes dirty and calls components_rebuild() before it ends: a parallel pass finds the ids of the dirty
+    components, which are reset and unioned again over their current links.
+    The union-find is kept in pages of COMPONENTS_PAGE ids, each page a shared array listed in the shared array pages. A
+    write section copies a page the first time it changes it, so queries read the components of their snapshot without a
+    lock, like the links they come from. Paths are not compressed, as that would write on reads; union by rank keeps them
+    O(log n) long.
+*/
+
+#define COMPONENTS_PAGE 1024
+
+// The place of a node id in the union-find
+typedef struct ComponentEntry
+{
+    int parent;
+    int size; // Number of nodes in the component, valid at roots
+    int rank;
+} ComponentEntry;
+
+#define COMPONENTS_PAGE_WORDS ((int)((COMPONENTS_PAGE * sizeof(ComponentEntry) + sizeof(void *) - 1) / sizeof(void *)))
+
+typedef struct Components
+{
+    void **pages;         // Pages by id / COMPONENTS_PAGE, ids past the last page are components of their own
+    int num_pages;
+    int page_words;       // Count of every page, COMPONENTS_PAGE_WORDS
+    unsigned char *dirty; // Set at roots of components that lost a node or link, only used by the writer
+    int dirty_capacity;
+    int num_dirty;
+} Components;
+
+static Components components = {NULL, 0, COMPONENTS_PAGE_WORDS, NULL, 0, 0};
+
+// Function to find the root of an id's component, and its size if size is not NULL. Reads the snapshot of the read
+// section, the latest state in a write section.
+static int components_find(int node_id, int *size)
+{
+    void **pages;
+    int num_pages = read_array(&components.pages, &components.num_pages, &pages);
+    while (1)
+    {
+        ComponentEntry *entry = NULL;
+        if (node_id / COMPONENTS_PAGE < num_pages)
+        {
+            void **page;
+            read_array((void ***)&pages[node_id / COMPONENTS_PAGE], &components.page_words, &page);
+            entry = (ComponentEntry *)page + node_id % COMPONENTS_PAGE;
+        }
+        if (!entry || entry->parent == node_id)
+        {
+            if (size)
+            {
+                *size = entry ? entry->size : 1;
+            }
+            return node_id;
+        }
+        node_id = entry->parent;
+    }
+}
+
+// Function to get the entry of an id to change it, adding the pages up to it and copying its page the first time the write
+// section changes it. Returns NULL when out of memory. Must be called inside a write section.
+static ComponentEntry *components_entry(int node_id)
+{
+    int page = node_id / COMPONENTS_PAGE;
+    while (components.num_pages <= page)
+    {
+        void **fresh = array_alloc(COMPONENTS_PAGE_WORDS);
+        if (!fresh)
+        {
+            return NULL;
+        }
+        for (int i = 0; i < COMPONENTS_PAGE; i++)
+        {
+            ((ComponentEntry *)fresh)[i].parent = components.num_pages * COMPONENTS_PAGE + i;
+            ((ComponentEntry *)fresh)[i].size = 1;
+        }
+        if (array_append(&components.pages, &components.num_pages, fresh, 64) != 0)
+        {
+            free((ArrayHeader *)fresh - 1);
+            return NULL;
+        }
+    }
+
+    void **entries = components.pages[page];
+    if (((ArrayHeader *)entries - 1)->version != write_version)
+    {
+        void **copy = array_alloc(COMPONENTS_PAGE_WORDS);
+        if (!copy)
+        {
+            return NULL;
+        }
+        memcpy(copy, entries, COMPONENTS_PAGE_WORDS * sizeof(void *));
+        array_publish((void ***)&components.pages[page], &components.page_words, copy, COMPONENTS_PAGE_WORDS);
+        entries = copy;
+    }
+    return (ComponentEntry *)entries + node_id % COMPONENTS_PAGE;
+}
+
+static int components_dirty(int root)
+{
+    return root < components.dirty_capacity && components.dirty[root];
+}
+
+// Function to set or clear the dirty mark of a root, returns -1 when out of memory
+static int components_mark(int root, int dirty)
+{
+    if (root >= components.dirty_capacity)
+    {
+        if (!dirty)
+        {
+            return 0;
+        }
+        int capacity = components.dirty_capacity ? components.dirty_capacity : MAX_NODES;
+        while (capacity <= root)
+        {
+            capacity *= 2;
+        }
+        unsigned char *grown = realloc(components.dirty, capacity);
+        if (!grown)
+        {
+            return -1;
+        }
+        memset(grown + components.dirty_capacity, 0, capacity - components.dirty_capacity);
+        components.dirty = grown;
+        components.dirty_capacity = capacity;
+    }
+    components.num_dirty += dirty - components.dirty[root];
+    components.dirty[root] = (unsigned char)dirty;
+    return 0;
+}
+
+// Function to merge the components of two ids. Must be called inside a write section.
+static void components_union(int a, int b)
+{
+    a = components_find(a, NULL);
+    b = components_find(b, NULL);
+    if (a == b)
+    {
+        return;
+    }
+
+    ComponentEntry *root_a = components_entry(a), *root_b = components_entry(b);
+    if (!root_a || !root_b)
+    {
+        report("Failed to allocate memory for components.\n");
+        return;
+    }
+    if (root_a->rank < root_b->rank)
+    {
+        ComponentEntry *swap = root_a;
+        root_a = root_b;
+        root_b = swap;
+        int swap_id = a;
+        a = b;
+        b = swap_id;
+    }
+    root_b->parent = a;
+    root_a->size += root_b->size;
+    if (root_a->rank == root_b->rank)
+    {
+        root_a->rank++;
+    }
+    if (components_dirty(b))
+    {
+        components_mark(b, 0);
+        components_mark(a, 1);
+    }
+}
+
+// Function to record a new link between two nodes. Must be called inside a write section.
+static void components_link(Node *a, Node *b)
+{
+    components_union(a->id, b->id);
+}
+
+// Function to mark the component of a node that is being deleted or unlinked dirty. Must be called inside a write section,
+// which calls components_rebuild() before it ends.
+static void components_unlink(Node *node)
+{
+    int size;
+    int root = components_find(node->id, &size);
+    if (size > 1 && !components_dirty(root) && components_mark(root, 1) != 0)
+    {
+        report("Failed to allocate memory for components.\n");
+    }
+}
+
+// Marks the ids of dirty components, the union-find is only read so that threads can share it.
+typedef struct ComponentsScan
+{
+    unsigned char *in_dirty;
+} ComponentsScan;
+
+static void components_scan_range(void *context, long begin, long end, int thread)
+{
+    (void)thread;
+    ComponentsScan *scan = context;
+    for (long i = begin; i < end; i++)
+    {
+        scan->in_dirty[i] = (unsigned char)components_dirty(components_find((int)i, NULL));
+    }
+}
+
+// Function to rebuild every dirty component from the latest links. Must be called inside the write section that removed
+// the links, after the nodes deleted in it have left all_nodes.
+static void components_rebuild()
+{
+    if (components.num_dirty == 0)
+    {
+        return;
+    }
+    METRIC_COUNT(component_rebuilds);
+    long count = (long)components.num_pages * COMPONENTS_PAGE;
+    ComponentsScan scan;
+    scan.in_dirty = malloc(count);
+    if (!scan.in_dirty)
+    {
+        report("Failed to allocate memory for components.\n");
+        return;
+    }
+    parallel_for(0, count, 65536, components_scan_range, &scan);
+
+    for (long i = 0; i < count; i++)
+    {
+        ComponentEntry *entry = scan.in_dirty[i] ? components_entry((int)i) : NULL;
+        if (entry)
+        {
+            entry->parent = (int)i;
+            entry->size = 1;
+            entry->rank = 0;
+        }
+    }
+    memset(components.dirty, 0, components.dirty_capacity);
+    components.num_dirty = 0;
+
+    // Every link of these nodes stays inside their old component, so their own links are enough to join them up again.
+    Node **nodes;
+    int num_nodes_read = read_all_nodes(&nodes);
+    for (int i = 0; i < num_nodes_read; i++)
+    {
+        if (nodes[i] && nodes[i]->id < count && scan.in_dirty[nodes[i]->id])
+        {
+            LinkCursor cursor;
+            Node **links;
+            int num_links;
+            start_links(&cursor, nodes[i], -1);
+            while ((num_links = next_links(&cursor, &links)) > 0)
+            {
+                for (int j = 0; j < num_links; j++)
+                {
+                    if (links[j])
+                    {
+                        components_union(nodes[i]->id, links[j]->id);
+                    }
+                }
+            }
+        }
+    }
+    free(scan.in_dirty);
+}
+
+// Function to check if the first nodes named a and b are connected, returns 1 if they are, 0 if not and -1 if one is missing
+int same_component(char *a, char *b)
+{
+    METRIC_SCOPE(same_component);
+    begin_read();
+    Node *ends[2] = {find_first_node(a, NULL), find_first_node(b, NULL)};
+
+    int connected = -1;
+    if (ends[0] && ends[1])
+    {
+        connected = components_find(ends[0]->id, NULL) == components_find(ends[1]->id, NULL);
+    }
+    end_read();
+    return connected;
+}
+
+// Function to get the number of nodes in the component of the first node with the given name, -1 if there is none
+int component_size(char *name)
+{
+    METRIC_SCOPE(component_size);
+    begin_read();
+    int size = -1;
+    Node *node = find_first_node(name, NULL);
+    if (node)
+    {
+        components_find(node->id, &size);
+    }
+    end_read();
+    return size;
+}
+
+// Function to remove target from the links and edges of node, the other direction is left alone. Must be called inside a write section.
+static void unlink_node(Node *node, Node *target)
+{
+    if (node->adjacency)
+    {
+        if (adjacency_rebuild(node, NULL, 0, target) < 0)
+        {
+            report("Failed to allocate memory for removing link.\n");
+        }
+        return;
+    }
+
+    if (array_remove((void ***)&node->links, &node->num_links, target) < 0)
+    {
+        report("Failed to allocate memory for removing link.\n");
+    }
+
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        if (array_remove((void ***)&node->edges[label], &node->num_edges[label], target) != 0)
+        {
+            break; // A pair of nodes is linked with one role only.
+        }
+    }
+}
+
+/*
+    Bulk delete:
+
+    delete_nodes() removes every node picked by id, by name or by a filter in one write section. The victims are marked in
+    a bitmap by id. The nodes linked to them, found from the victims' own links, then build their links, edges or adjacency
+    block without the victims in one parallel pass, and publish them afterwards. all_nodes and typed_nodes are copied once
+    without the victims and the name index drops them in one pass, so a delete costs O(N + E) for the nodes and links it
+    touches instead of a scan of all_nodes and a copy of every array per node. Individuals that were members of a deleted
+    group or organisation also lose the co-member links add_member() made through it, unless they still share another one.
+    delete_node() is delete_nodes() with one name.
+*/
+
+// A node linked to a victim, with the arrays it gets in the parallel pass of delete_nodes().
+typedef struct DeleteSurvivor
+{
+    Node *node;
+    void **links;
+    int num_links;
+    void **edges[NUM_EDGE_LABELS]; // NULL for the roles that lose no link
+    int num_edges[NUM_EDGE_LABELS];
+    void **adjacency;
+    int removed;    // Links removed
+    int co_members; // Of those, co-member links to nodes left
+} DeleteSurvivor;
+
+typedef struct DeleteBatch
+{
+    DeleteSurvivor *survivors;
+    const unsigned long long *victims;    // Bitmap by id
+    const unsigned long long *left_group; // Individuals that were members of a deleted group or organisation
+    int max_id;
+} DeleteBatch;
+
+// Links a survivor drops: to victims, and the co-member links in co_members.
+typedef struct DeleteDrop
+{
+    const DeleteBatch *batch;
+    int *co_members; // Sorted ids
+    int num_co_members;
+} DeleteDrop;
+
+static int bitmap_has(const unsigned long long *bitmap, int max_id, int node_id)
+{
+    return node_id >= 0 && node_id < max_id && (bitmap[node_id / 64] >> node_id % 64 & 1);
+}
+
+static void bitmap_set(unsigned long long *bitmap, int max_id, int node_id)
+{
+    if (node_id >= 0 && node_id < max_id)
+    {
+        bitmap[node_id / 64] |= 1ULL << node_id % 64;
+    }
+}
+
+// Returns 1 for a link a survivor drops, label is -1 for the links array (a pair of nodes is linked with one role only)
+static int delete_drops(void *context, int target_id, int label)
+{
+    DeleteDrop *drop = context;
+    if (bitmap_has(drop->batch->victims, drop->batch->max_id, target_id))
+    {
+        return 1;
+    }
+    return (label < 0 || label == EDGE_CO_MEMBER) && drop->num_co_members > 0 &&
+           bsearch(&target_id, drop->co_members, drop->num_co_members, sizeof(int), compare_ints) != NULL;
+}
+
+// Function to find the co-member links an individual that left a group drops: to individuals that left one too and share
+// no group or organisation left with it. Fills in the sorted ids of drop.
+static void delete_co_members(DeleteDrop *drop, Node *node)
+{
+    const DeleteBatch *batch = drop->batch;
+    if (node->type != 'I' || !bitmap_has(batch->left_group, batch->max_id, node->id))
+    {
+        return;
+    }
+
+    IdList groups = {NULL, 0, 0}, dropped = {NULL, 0, 0};
+    LinkCursor cursor;
+    Node **links;
+    int num_links;
+    start_links(&cursor, node, EDGE_MEMBER_OF);
+    while ((num_links = next_links(&cursor, &links)) > 0)
+    {
+        for (int i = 0; i < num_links; i++)
+        {
+            if (links[i] && !bitmap_has(batch->victims, batch->max_id, links[i]->id))
+            {
+                id_list_append(&groups, links[i]->id);
+            }
+        }
+    }
+    if (groups.size > 1)
+    {
+        qsort(groups.ids, groups.size, sizeof(int), compare_ints);
+    }
+
+    start_links(&cursor, node, EDGE_CO_MEMBER);
+    while ((num_links = next_links(&cursor, &links)) > 0)
+    {
+        for (int i = 0; i < num_links; i++)
+        {
+            Node *other = links[i];
+            if (!other || bitmap_has(batch->victims, batch->max_id, other->id) || !bitmap_has(batch->left_group, batch->max_id, other->id))
+            {
+                continue;
+            }
+
+            int shared = 0;
+            LinkCursor other_cursor;
+            Node **other_groups;
+            int num_other_groups;
+            start_links(&other_cursor, other, EDGE_MEMBER_OF);
+            while (!shared && (num_other_groups = next_links(&other_cursor, &other_groups)) > 0)
+            {
+                for (int j = 0; j < num_other_groups && !shared; j++)
+                {
+                    shared = other_groups[j] && groups.size > 0 &&
+                             bsearch(&other_groups[j]->id, groups.ids, groups.size, sizeof(int), compare_ints) != NULL;
+                }
+            }
+            if (!shared)
+            {
+                id_list_append(&dropped, other->id);
+            }
+        }
+    }
+    free(groups.ids);
+
+    if (dropped.size > 1)
+    {
+        qsort(dropped.ids, dropped.size, sizeof(int), compare_ints);
+    }
+    drop->co_members = dropped.ids;
+    drop->num_co_members = dropped.size;
+}
+
+// Function to copy a shared array of links without the ones dropped, keeping its capacity like array_remove() does.
+// Returns NULL if none is dropped or when out of memory, counts the dropped links in removed.
+static void **delete_filter(void **array, int count, DeleteDrop *drop, int label, int *kept, int *removed)
+{
+    *removed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        *removed += !array[i] || delete_drops(drop, ((Node *)array[i])->id, label);
+    }
+    if (*removed == 0)
+    {
+        return NULL;
+    }
+
+    void **copy = array_alloc(array_capacity(array));
+    if (!copy)
+    {
+        report("Failed to allocate memory for removing link.\n");
+        return NULL;
+    }
+    *kept = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (array[i] && !delete_drops(drop, ((Node *)array[i])->id, label))
+        {
+            copy[(*kept)++] = array[i];
+        }
+    }
+    return copy;
+}
+
+// Function to build the arrays of a range of survivors without the links they drop. Runs on worker threads inside the
+// write section and publishes nothing, so every survivor reads the links of the others as they were.
+static void delete_survivors_range(void *context, long begin, long end, int thread)
+{
+    (void)thread;
+    DeleteBatch *batch = context;
+    for (long i = begin; i < end; i++)
+    {
+        DeleteSurvivor *survivor = &batch->survivors[i];
+        Node *node = survivor->node;
+        DeleteDrop drop = {batch, NULL, 0};
+        delete_co_members(&drop, node);
+
+        if (node->adjacency)
+        {
+            survivor->adjacency = adjacency_pack(node, NULL, 0, delete_drops, &drop, 0, &survivor->removed);
+        }
+        else
+        {
+            survivor->links = delete_filter((void **)node->links, node->num_links, &drop, -1, &survivor->num_links, &survivor->removed);
+            for (int label = 0; label < NUM_EDGE_LABELS; label++)
+            {
+                int removed;
+                survivor->edges[label] = delete_filter((void **)node->edges[label], node->num_edges[label], &drop, label, &survivor->num_edges[label], &removed);
+            }
+        }
+        survivor->co_members = drop.num_co_members;
+        free(drop.co_members);
+    }
+}
+
+// Function to copy a shared array of nodes without the victims, keeping its capacity
+static int delete_compact(void ***array_slot, int *count_slot, const unsigned long long *victims, int max_id)
+{
+    void **array = *array_slot;
+    int count = *count_slot;
+    void **copy = array_alloc(array_capacity(array));
+    if (!copy)
+    {
+        report("Failed to allocate memory for deleting nodes.\n");
+        return -1;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (array[i] && !bitmap_has(victims, max_id, ((Node *)array[i])->id))
+        {
+            copy[kept++] = array[i];
+        }
+    }
+    array_publish(array_slot, count_slot, copy, kept);
+    return 0;
+}
+
+// Set on the shards of a sharded server: their coordinator drops the co-member links, as it sees the groups of every shard.
+static int delete_keeps_co_members = 0;
+
+// Function to delete the nodes with one of the given ids, one of the given names, or for which filter returns non-zero
+// (each may be left out), see Bulk delete above. Returns the number of nodes deleted or -1.
+int delete_nodes(const int *ids, int num_ids, char **names, int num_names, NodeFilter filter, void *context, DeleteStats *stats)
+{
+    METRIC_SCOPE(delete_nodes);
+    long long started = now_ns();
+    DeleteStats totals = {0, 0, 0, 0, 0};
+
+    begin_write();
+    int max_id = id;
+    int words = max_id / 64 + 1;
+    unsigned long long *victims = calloc(words, sizeof(unsigned long long));
+    unsigned long long *left_group = calloc(words, sizeof(unsigned long long));
+    unsigned long long *affected = calloc(words, sizeof(unsigned long long));
+    if (!victims || !left_group || !affected)
+    {
+        free(victims);
+        free(left_group);
+        free(affected);
+        end_write();
+        report("Failed to allocate memory for deleting nodes.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < num_ids; i++)
+    {
+        bitmap_set(victims, max_id, ids[i]);
+    }
+    for (int i = 0; i < num_names; i++)
+    {
+        IdList named = {NULL, 0, 0};
+        name_index_match(names[i], 1, &named);
+        for (int j = 0; j < named.size; j++)
+        {
+            bitmap_set(victims, max_id, named.ids[j]);
+        }
+        free(named.ids);
+    }
+
+    // One pass over the nodes settles the victims, so ids of nodes deleted before are left out.
+    NodeList victim_list = {NULL, 0, 0};
+    Node **nodes;
+    int count = read_all_nodes(&nodes);
+    for (int i = 0; i < count; i++)
+    {
+        Node *node = nodes[i];
+        if (node && (bitmap_has(victims, max_id, node->id) || (filter && filter(node, context))))
+        {
+            bitmap_set(victims, max_id, node->id);
+            node_list_push(&victim_list, node);
+        }
+    }
+
+    // The nodes left that are linked to a victim, from the victims' links.
+    NodeList survivor_list = {NULL, 0, 0};
+    for (int i = 0; i < victim_list.size; i++)
+    {
+        Node *victim = victim_list.nodes[i];
+        totals.posts += count_posts(victim);
+        components_unlink(victim);
+        for (int label = 0; label < NUM_EDGE_LABELS; label++)
+        {
+            LinkCursor cursor;
+            Node **links;
+            int num_links;
+            start_links(&cursor, victim, label);
+            while ((num_links = next_links(&cursor, &links)) > 0)
+            {
+                for (int j = 0; j < num_links; j++)
+                {
+                    Node *target = links[j];
+                    if (!target || bitmap_has(victims, max_id, target->id))
+                    {
+                        continue;
+                    }
+                    if (label == EDGE_MEMBER && (victim->type == 'G' || victim->type == 'O') && target->type == 'I' && !delete_keeps_co_members)
+                    {
+                        bitmap_set(left_group, max_id, target->id);
+                    }
+                    if (!bitmap_has(affected, max_id, target->id))
+                    {
+                        bitmap_set(affected, max_id, target->id);
+                        node_list_push(&survivor_list, target);
+                    }
+                }
+            }
+        }
+    }
+
+    DeleteSurvivor *survivors = calloc(survivor_list.size > 0 ? survivor_list.size : 1, sizeof(DeleteSurvivor));
+    if (survivors)
+    {
+        for (int i = 0; i < survivor_list.size; i++)
+        {
+            survivors[i].node = survivor_list.nodes[i];
+        }
+        DeleteBatch batch = {survivors, victims, left_group, max_id};
+        parallel_for(0, survivor_list.size, 256, delete_survivors_range, &batch);
+
+        for (int i = 0; i < survivor_list.size; i++)
+        {
+            DeleteSurvivor *survivor = &survivors[i];
+            Node *node = survivor->node;
+            if (survivor->adjacency)
+            {
+                array_publish(&node->adjacency, &node->num_adjacency, survivor->adjacency, 0);
+            }
+            if (survivor->links)
+            {
+                array_publish((void ***)&node->links, &node->num_links, survivor->links, survivor->num_links);
+            }
+            for (int label = 0; label < NUM_EDGE_LABELS; label++)
+            {
+                if (survivor->edges[label])
+                {
+                    array_publish((void ***)&node->edges[label], &node->num_edges[label], survivor->edges[label], survivor->num_edges[label]);
+                }
+            }
+            totals.links += survivor->removed - survivor->co_members;
+            totals.co_member_links += survivor->co_members;
+        }
+        totals.co_member_links /= 2;
+    }
+    else
+    {
+        report("Failed to allocate memory for deleting nodes.\n");
+    }
+
+    if (victim_list.size > 0)
+    {
+        delete_compact((void ***)&all_nodes, &num_nodes, victims, max_id);
+        for (int slot = 0; slot < 4; slot++)
+        {
+            if (typed_nodes[slot])
+            {
+                delete_compact((void ***)&typed_nodes[slot], &num_typed_nodes[slot], victims, max_id);
+            }
+        }
+
+        if (victim_list.size < 64)
+        {
+            for (int i = 0; i < victim_list.size; i++)
+            {
+                name_index_remove(victim_list.nodes[i]);
+            }
+        }
+        else
+        {
+            name_index_remove_marked(victims, max_id);
+        }
+        fuzzy_index_remove(victim_list.size);
+        for (int i = 0; i < victim_list.size; i++)
+        {
+            birthday_index_remove(victim_list.nodes[i]);
+            location_index_remove(victim_list.nodes[i]);
+            // Readers may still be looking at the node, it is freed once they are done.
+            retire_node(victim_list.nodes[i]);
+        }
+    }
+    components_rebuild();
+    end_write();
+
+    totals.nodes = victim_list.size;
+    totals.duration_ns = now_ns() - started;
+    if (stats)
+    {
+        *stats = totals;
+    }
+    free(survivors);
+    free(survivor_list.nodes);
+    free(victim_list.nodes);
+    free(victims);
+    free(left_group);
+    free(affected);
+    return totals.nodes;
+}
+
+// Function to delete every node with a name, returns the number of nodes deleted
+int delete_node(char *name)
+{
+    METRIC_SCOPE(delete_node);
+    int deleted = delete_nodes(NULL, 0, &name, 1, NULL, NULL, NULL);
+    if (deleted <= 0)
+    {
+        report("Node not found\n");
+        return 0;
+    }
+    report("Node(s) found:\n");
+    report("Node(s) deleted\n");
+    return deleted;
+}
+
+// Function to remove the link between two nodes, in both directions
+void remove_node_from_links(Node *node, Node *target)
+{
+    METRIC_SCOPE(remove_node_from_links);
+    begin_write();
+    unlink_node(node, target);
+    unlink_node(target, node);
+    components_unlink(node);
+    components_rebuild();
+    end_write();
+}
+
+// Function to search node by name
+SearchResult search_node_by_name(char *name)
+{
+    METRIC_SCOPE(search_node_by_name);
+    begin_read();
+    IdList ids = {NULL, 0, 0};
+    name_index_match(name, 1, &ids);
+    qsort(ids.ids, ids.size, sizeof(int), compare_ints);
+
+    SearchResult result;
+    result.nodes = (Node **)malloc((ids.size + 1) * sizeof(Node *));
+    result.size = 0;
+
+    for (int i = 0; i < ids.size; i++)
+    {
+        Node *node = i > 0 && ids.ids[i] == ids.ids[i - 1] ? NULL : find_node_by_id(ids.ids[i]);
+        if (node)
+        {
+            result.nodes[result.size++] = node;
+        }
+    }
+    free(ids.ids);
+    end_read();
+
+    if (result.size > 0)
+    {
+        METRIC_COUNT(name_lookup_hits);
+    }
+    else
+    {
+        METRIC_COUNT(name_lookup_misses);
+    }
+
+    result.nodes = realloc(result.nodes, result.size * sizeof(Node *));
+    return result;
+}
+
+// Function to search the first k nodes, in name order ignoring case, whose names start with prefix, of one type or any if type is '\0'
+SearchResult search_node_by_prefix(char *prefix, int k, char type)
+{
+    METRIC_SCOPE(search_node_by_prefix);
+    SearchResult result = {NULL, 0};
+    int slot = type_slot(type);
+    if (k <= 0 || (type && slot < 0))
+    {
+        return result;
+    }
+
+    char *folded = fold_name(prefix);
+    if (!folded)
+    {
+        return result;
+    }
+    uint64_t key = name_key(folded);
+    int first = type ? slot : 0, last = type ? slot + 1 : 4;
+
+    begin_read();
+    result.nodes = (Node **)malloc(k * sizeof(Node *));
+
+    // One cursor per level at the first name not below the prefix, the matches are merged in name order.
+    NameEntry *levels[4][NAME_INDEX_LEVELS];
+    int sizes[4][NAME_INDEX_LEVELS], positions[4][NAME_INDEX_LEVELS];
+    for (int i = first; i < last; i++)
+    {
+        for (int level = 0; level < NAME_INDEX_LEVELS; level++)
+        {
+            sizes[i][level] = read_name_level(&name_indexes[i], level, &levels[i][level]);
+            positions[i][level] = name_level_lower_bound(levels[i][level], sizes[i][level], key, folded, 0);
+        }
+    }
+
+    while (result.size < k)
+    {
+        NameEntry *best = NULL;
+        int *best_position = NULL;
+        for (int i = first; i < last; i++)
+        {
+            for (int level = 0; level < NAME_INDEX_LEVELS; level++)
+            {
+                NameEntry *entries = levels[i][level];
+                int size = sizes[i][level];
+                int *position = &positions[i][level];
+                while (*position < size && !name_entry_live(&entries[*position]))
+                {
+                    (*position)++;
+                }
+                if (*position >= size)
+                {
+                    continue;
+                }
+
+                NameEntry *entry = &entries[*position];
+                if (!name_has_prefix(entry->node->name, folded))
+                {
+                    *position = size;
+                    continue;
+                }
+                if (!best || name_entry_compare(entry, best->key, best->node->name, best->node->id) < 0)
+                {
+                    best = entry;
+                    best_position = position;
+                }
+            }
+        }
+        if (!best)
+        {
+            break;
+        }
+
+        (*best_position)++;
+        result.nodes[result.size++] = best->node;
+    }
+    end_read();
+    free(folded);
+
+    result.nodes = realloc(result.nodes, (result.size > 0 ? result.size : 1) * sizeof(Node *));
+    return result;
+}
+
+// Orders (distance, id) pairs, closest first
+static int compare_matches(const void *a, const void *b)
+{
+    const int *x = a, *y = b;
+    return x[0] != y[0] ? (x[0] > y[0]) - (x[0] < y[0]) : (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+static int compare_id_array_sizes(const void *a, const void *b)
+{
+    int x = __atomic_load_n(&(*(IdArray *const *)a)->size, __ATOMIC_RELAXED);
+    int y = __atomic_load_n(&(*(IdArray *const *)b)->size, __ATOMIC_RELAXED);
+    return (x > y) - (x < y);
+}
+
+// Function to find the k nodes closest to a name ignoring case, within max_distance edits. Scores are the distances.
+RankedResult search_node_fuzzy(char *name, int max_distance, int k)
+{
+    METRIC_SCOPE(search_node_fuzzy);
+    RankedResult result = {NULL, NULL, 0};
+    max_distance = max_distance < 0 ? 0 : max_distance > FUZZY_MAX_DISTANCE ? FUZZY_MAX_DISTANCE : max_distance;
+    char *folded = fold_name(name);
+    int m = folded ? (int)strlen(folded) : 0;
+    int *grams = malloc((m + 1) * sizeof(int));
+    if (k <= 0 || !folded || !grams)
+    {
+        free(folded);
+        free(grams);
+        return result;
+    }
+    int num_grams = name_grams(folded, m, grams);
+
+    uint64_t peq[256] = {0};
+    for (int i = 0; i < m && i < 64; i++)
+    {
+        peq[(unsigned char)folded[i]] |= 1ULL << i;
+    }
+
+    begin_read();
+
+    // Candidates: the ids in the 2d + 1 shortest bigram lists, the short names of close lengths, or else every node.
+    IdArray **sources = malloc((num_grams + FUZZY_SHORT_LENGTH + 1) * sizeof(IdArray *));
+    int num_sources = 0;
+    if (num_grams > 2 * max_distance)
+    {
+        for (int i = 0; i < num_grams; i++)
+        {
+            sources[i] = &fuzzy_index.grams[grams[i]];
+        }
+        qsort(sources, num_grams, sizeof(IdArray *), compare_id_array_sizes);
+        num_sources = 2 * max_distance + 1;
+    }
+    else if (m + max_distance <= FUZZY_SHORT_LENGTH)
+    {
+        for (int length = m > max_distance ? m - max_distance : 0; length <= m + max_distance; length++)
+        {
+            sources[num_sources++] = &fuzzy_index.lengths[length];
+        }
+    }
+
+    long total = 0;
+    void **ids;
+    for (int i = 0; i < num_sources; i++)
+    {
+        total += read_id_array(sources[i], &ids);
+    }
+    Node **nodes = NULL;
+    int count = 0;
+    if (num_sources == 0)
+    {
+        count = read_all_nodes(&nodes);
+        total = count;
+    }
+
+    int *candidates = malloc((total > 0 ? total : 1) * sizeof(int));
+    int num_candidates = 0;
+    for (int i = 0; i < num_sources; i++)
+    {
+        int size = read_id_array(sources[i], &ids);
+        for (int j = 0; j < size; j++)
+        {
+            candidates[num_candidates++] = (int)(long)ids[j];
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (nodes[i])
+        {
+            candidates[num_candidates++] = nodes[i]->id;
+        }
+    }
+    if (num_sources > 1)
+    {
+        qsort(candidates, num_candidates, sizeof(int), compare_ints);
+    }
+
+    // Matches as (distance, id) pairs.
+    int *matches = malloc((num_candidates > 0 ? num_candidates : 1) * 2 * sizeof(int));
+    int num_matches = 0;
+    for (int i = 0; i < num_candidates; i++)
+    {
+        if (i > 0 && candidates[i] == candidates[i - 1])
+        {
+            continue;
+        }
+        Node *node = find_node_by_id(candidates[i]);
+        if (!node)
+        {
+            continue;
+        }
+        int n = (int)strlen(node->name);
+        if (n - m > max_distance || m - n > max_distance)
+        {
+            continue;
+        }
+        int distance = edit_distance_within(folded, m, peq, node->name, n, max_distance);
+        if (distance <= max_distance)
+        {
+            matches[2 * num_matches] = distance;
+            matches[2 * num_matches + 1] = node->id;
+            num_matches++;
+        }
+    }
+
+    qsort(matches, num_matches, 2 * sizeof(int), compare_matches);
+    int size = num_matches < k ? num_matches : k;
+    result.nodes = malloc((size + 1) * sizeof(Node *));
+    result.scores = malloc((size + 1) * sizeof(double));
+    for (int i = 0; i < size; i++)
+    {
+        Node *node = find_node_by_id(matches[2 * i + 1]);
+        if (node)
+        {
+            result.nodes[result.size] = node;
+            result.scores[result.size++] = matches[2 * i];
+        }
+    }
+    end_read();
+
+    free(folded);
+    free(grams);
+    free(sources);
+    free(candidates);
+    free(matches);
+    return result;
+}
+
+// Function to print the names closest to a name that was not found, if any are within two edits
+static void print_name_suggestions(char *name)
+{
+    begin_read();
+    RankedResult result = search_node_fuzzy(name, 2, 5);
+    if (result.size > 0)
+    {
+        printf("Did you mean:");
+        for (int i = 0; i < result.size; i++)
+        {
+            printf(" %s", result.nodes[i]->name);
+        }
+        printf("?\n");
+    }
+    free_ranked_result(&result);
+    end_read();
+}
+
+// Function to search node by type
+SearchResult search_node_by_type(char type)
+{
+    METRIC_SCOPE(search_node_by_type);
+    begin_read();
+    Node **nodes;
+    int count = type ? read_typed_nodes(type, &nodes) : 0;
+
+    SearchResult result;
+    result.nodes = (Node **)malloc(count * sizeof(Node *));
+    result.size = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (nodes[i])
+        {
+            result.nodes[result.size++] = nodes[i];
+        }
+    }
+    end_read();
+
+    result.nodes = realloc(result.nodes, result.size * sizeof(Node *));
+    return result;
+}
+
+// Function to search individual by birthday, reading the birthday index list of its day and month
+SearchResult search_individual_by_birthday(Birthday birthday)
+{
+    METRIC_SCOPE(search_individual_by_birthday);
+    begin_read();
+    void **ids;
+    int count = read_id_array(&birthday_index.lists[birthday_list(birthday.day, birthday.month)], &ids);
+
+    SearchResult result;
+    result.nodes = (Node **)malloc((count > 0 ? count : 1) * sizeof(Node *));
+    result.size = 0;
+
+    for (int i = 0; result.nodes && i < count; i++)
+    {
+        Node *node = find_node_by_id((int)(long)ids[i]);
+        if (node && ((Individual *)node)->birthday.day == birthday.day && ((Individual *)node)->birthday.month == birthday.month && ((Individual *)node)->birthday.year == birthday.year)
+        {
+            result.nodes[result.size++] = node;
+        }
+    }
+    end_read();
+
+    result.nodes = realloc(result.nodes, (result.size > 0 ? result.size : 1) * sizeof(Node *));
+    return result;
+}
+
+// Returns the position of the first node created at or after time in an array in id order (NULLs at the end sort last)
+static int first_created_at(Node **nodes, int count, long long time)
+{
+    int low = 0, high = count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (nodes[middle] && nodes[middle]->created < time)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Function to search nodes created between two times, of one type or of any type if type is '\0'
+SearchResult search_nodes_by_creation(long long from, long long to, char type)
+{
+    METRIC_SCOPE(search_nodes_by_creation);
+    begin_read();
+    Node **nodes;
+    int count = read_typed_nodes(type, &nodes);
+    int first = first_created_at(nodes, count, from);
+    int last = to < LLONG_MAX ? first_created_at(nodes, count, to + 1) : count;
+
+    SearchResult result;
+    result.nodes = (Node **)malloc((last > first ? last - first : 0) * sizeof(Node *));
+    result.size = 0;
+    for (int i = first; i < last; i++)
+    {
+        if (nodes[i])
+        {
+            result.nodes[result.size++] = nodes[i];
+        }
+    }
+    end_read();
+
+    return result;
+}
+
+// Function to get the newest nodes of one type, or of any type if type is '\0'
+SearchResult newest_nodes(int count, char type)
+{
+    METRIC_SCOPE(newest_nodes);
+    begin_read();
+    Node **nodes;
+    int total = read_typed_nodes(type, &nodes);
+
+    SearchResult result;
+    result.nodes = (Node **)malloc((count > 0 ? count : 0) * sizeof(Node *));
+    result.size = 0;
+    for (int i = total - 1; i >= 0 && result.size < count; i--)
+    {
+        if (nodes[i])
+        {
+            result.nodes[result.size++] = nodes[i];
+        }
+    }
+    end_read();
+
+    return result;
+}
+
+// Function to check if a link between two nodes already exists
+int is_node_in_links(Node *node, Node *target)
+{
+    METRIC_SCOPE(is_node_in_links);
+    begin_read();
+    int found = adjacency_contains(node, target);
+    if (found >= 0)
+    {
+        end_read();
+        return found;
+    }
+
+    LinkCursor cursor;
+    Node **links;
+    int count;
+    start_links(&cursor, node, -1);
+
+    found = 0;
+    while (!found && (count = next_links(&cursor, &links)) > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (links[i] == target)
+            {
+                found = 1;
+                break;
+            }
+        }
+    }
+    end_read();
+
+    return found;
+}
+
+// Function to append a link to a node
+static int append_link(Node *node, Node *target)
+{
+    if (array_append((void ***)&node->links, &node->num_links, target, 4) != 0)
+    {
+        report("Failed to allocate memory for new link.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Function to make room for the links a node is about to get, extra[label] of them with each role, so that appending them
+// cannot fail. Must be called inside a write section.
+static int link_reserve(Node *node, const int *extra)
+{
+    int total = 0;
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        total += extra[label];
+    }
+    if (compressed_links)
+    {
+        return adjacency_reserve(node, total);
+    }
+
+    if (array_reserve((void ***)&node->links, &node->num_links, total) != 0)
+    {
+        return -1;
+    }
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        if (array_reserve((void ***)&node->edges[label], &node->num_edges[label], extra[label]) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Function to link two nodes in both directions, label being the role of target as seen from node. Both ends are reserved
+// first, so the link is added in both directions or not at all. Must be called inside a write section.
+static int append_edge(Node *node, Node *target, int label)
+{
+    int extra[NUM_EDGE_LABELS] = {0}, target_extra[NUM_EDGE_LABELS] = {0};
+    extra[label] = 1;
+    target_extra[edge_reverse(label)] = 1;
+    if (link_reserve(node, extra) != 0 || link_reserve(target, target_extra) != 0)
+    {
+        report("Failed to allocate memory for new link.\n");
+        return -1;
+    }
+
+    if (compressed_links)
+    {
+        if (adjacency_append(node, target, label) != 0 || adjacency_append(target, node, edge_reverse(label)) != 0)
+        {
+            return -1;
+        }
+        components_link(node, target);
+        return 0;
+    }
+
+    if (append_link(node, target) != 0 || append_link(target, node) != 0)
+    {
+        return -1;
+    }
+
+    if (array_append((void ***)&node->edges[label], &node->num_edges[label], target, 4) != 0 ||
+        array_append((void ***)&target->edges[edge_reverse(label)], &target->num_edges[edge_reverse(label)], node, 4) != 0)
+    {
+        report("Failed to allocate memory for new edge.\n");
+        return -1;
+    }
+    components_link(node, target);
+    return 0;
+}
+
+// Function to add members in groups and organisations, returns 0 on success and -1 otherwise
+int add_member(Node *group_or_org, Node *new_member)
+{
+    METRIC_SCOPE(add_member);
+    if (group_or_org->type == 'O' && new_member->type != 'I')
+    {
+        report("Only individuals can be added to organisations.\n");
+        return -1;
+    }
+
+    begin_write();
+    if (is_node_in_links(group_or_org, new_member))
+    {
+        report("Node is already a member.\n");
+        end_write();
+        return -1;
+    }
+
+    // The members to link the new member with are collected first, and every node reserves room for its new links, so
+    // that either all the links are added or, when memory runs out, none of them.
+    NodeList co_members = {NULL, 0, 0};
+    if (group_or_org->type == 'G' || group_or_org->type == 'O')
+    {
+        LinkCursor cursor;
+        Node **members;
+        int num_members;
+        start_links(&cursor, group_or_org, EDGE_MEMBER);
+        while ((num_members = next_links(&cursor, &members)) > 0)
+        {
+            for (int i = 0; i < num_members; i++)
+            {
+                Node *member_of_group_or_org = members[i];
+
+                if (member_of_group_or_org && member_of_group_or_org->type == 'I' && member_of_group_or_org != new_member &&
+                    !is_node_in_links(member_of_group_or_org, new_member))
+                {
+                    node_list_push(&co_members, member_of_group_or_org);
+                }
+            }
+        }
+    }
+
+    int group_extra[NUM_EDGE_LABELS] = {0}, member_extra[NUM_EDGE_LABELS] = {0}, co_member_extra[NUM_EDGE_LABELS] = {0};
+    group_extra[EDGE_MEMBER] = 1;
+    member_extra[EDGE_MEMBER_OF] = 1;
+    member_extra[EDGE_CO_MEMBER] = co_members.size;
+    co_member_extra[EDGE_CO_MEMBER] = 1;
+    int status = link_reserve(group_or_org, group_extra) == 0 && link_reserve(new_member, member_extra) == 0 ? 0 : -1;
+    for (int i = 0; status == 0 && i < co_members.size; i++)
+    {
+        status = link_reserve(co_members.nodes[i], co_member_extra);
+    }
+
+    if (status == 0)
+    {
+        status = append_edge(group_or_org, new_member, EDGE_MEMBER);
+    }
+    for (int i = 0; status == 0 && i < co_members.size; i++)
+    {
+        status = append_edge(co_members.nodes[i], new_member, EDGE_CO_MEMBER);
+    }
+    free(co_members.nodes);
+    end_write();
+
+    if (status != 0)
+    {
+        report("Failed to allocate memory for new member.\n");
+        return -1;
+    }
+
+    report("Node(s) added successfully.\n");
+    return 0;
+}
+
+// Function to add an owner or customer to a business, returns 0 on success and -1 otherwise
+int add_owner_or_customer(Business *business, Individual *new_owner_or_customer, char role)
+{
+    METRIC_SCOPE(add_owner_or_customer);
+    if (role == 'O' || role == 'C')
+    {
+        begin_write();
+        if (is_node_in_links(&business->node, &new_owner_or_customer->node))
+        {
+            report("Node is already a link.\n");
+            end_write();
+            return -1;
+        }
+
+        if (append_edge(&business->node, &new_owner_or_customer->node, role == 'O' ? EDGE_OWNER : EDGE_CUSTOMER) != 0)
+        {
+            end_write();
+            return -1;
+        }
+        end_write();
+
+        if (role == 'O')
+        {
+            report("Node(s) added as owner(s) successfully.\n");
+        }
+        else
+        {
+            report("Node(s) added as customer(s) successfully.\n");
+        }
+        return 0;
+    }
+    else
+    {
+        report("Invalid role. Role must be 'O' for owner or 'C' for customer.\n");
+        return -1;
+    }
+}
+
+// Function to print the linked nodes of a node
+void print_linked_nodes(char *name)
+{
+    METRIC_SCOPE(print_linked_nodes);
+    begin_read();
+    Node *node = find_first_node(name, NULL);
+    if (node)
+    {
+        LinkCursor cursor;
+        Node **links;
+        int num_links, printed = 0;
+        start_links(&cursor, node, -1);
+        while ((num_links = next_links(&cursor, &links)) > 0)
+        {
+            for (int j = 0; j < num_links; j++)
+            {
+                if (links[j])
+                {
+                    printf("Linked node: %s\n", links[j]->name);
+                    printed++;
+                }
+            }
+        }
+        if (printed == 0)
+        {
+            printf("No linked nodes found.\n");
+        }
+    }
+    end_read();
+
+    if (!node)
+    {
+        printf("Node not found\n");
+        print_name_suggestions(name);
+    }
+}
+
+static const char *edge_label_names[NUM_EDGE_LABELS] = {"member", "member_of", "owner", "owns", "customer", "customer_of", "co_member"};
+
+// Returns the label of the same edge seen from the other end
+int edge_reverse(int label)
+{
+    return label == EDGE_CO_MEMBER ? label : label ^ 1;
+}
+
+const char *edge_label_name(int label)
+{
+    return label >= 0 && label < NUM_EDGE_LABELS ? edge_label_names[label] : "unknown";
+}
+
+int edge_label_by_name(const char *name)
+{
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        if (strcmp(edge_label_names[label], name) == 0)
+        {
+            return label;
+        }
+    }
+    return -1;
+}
+
+// Function to list the nodes linked with a role to the first node with the given name
+SearchResult search_edges(char *name, int label)
+{
+    METRIC_SCOPE(search_edges);
+    SearchResult result = {NULL, 0};
+    if (label < 0 || label >= NUM_EDGE_LABELS)
+    {
+        return result;
+    }
+
+    begin_read();
+    Node *node = find_first_node(name, NULL);
+    if (node)
+    {
+        NodeList found = {NULL, 0, 0};
+        LinkCursor cursor;
+        Node **edges;
+        int num_edges;
+        start_links(&cursor, node, label);
+        while ((num_edges = next_links(&cursor, &edges)) > 0)
+        {
+            for (int j = 0; j < num_edges; j++)
+            {
+                if (edges[j])
+                {
+                    node_list_push(&found, edges[j]);
+                }
+            }
+        }
+        result.nodes = found.nodes;
+        result.size = found.size;
+    }
+    end_read();
+
+    return result;
+}
+
+/*
+    Full-text index:
+
+    Every post (one piece of content on one node) is a document, numbered in the order posts arrive. Content is split into
+    terms (runs of letters and digits, lower-cased, cut at MAX_TERM_LENGTH). Each term has a posting list of (document,
+    term frequency) pairs in document order, compressed as varint deltas in blocks of POSTING_BLOCK_SIZE postings. A skip
+    entry per block holds its last document and the highest term frequency in it, so queries can jump over blocks.
+    Posts arrive with growing numbers, so indexing one only ever appends to the last block of each of its terms.
+    The index is updated by append_content() inside the write section and read without locks: the term table, the posts,
+    each term's postings and its skip entries are shared arrays, appended in place and republished when they grow. A query
+    stops at the number of posts of its snapshot, postings and skip counts that grew after it are cut there.
+    A document refers to its post by node and number on the node, not to the content, so the index keeps no content in
+    memory and results are read through the node's timeline, from the content archive for older posts.
+*/
+
+#define MAX_TERM_LENGTH 32
+#define POSTING_BLOCK_SIZE 128
+
+// Skip entry of a block of postings. The counters only grow and are updated atomically.
+typedef struct PostingBlock
+{
+    int last_post;
+    int max_frequency;
+    size_t offset; // Where the block starts in the term's postings
+    int count;
+} PostingBlock;
+
+typedef struct Term
+{
+    char *text;
+    void **postings; // Shared array, the first word holds the length in bytes and the varints follow
+    int postings_words;
+    void **blocks;   // Shared array of PostingBlock pointers
+    int num_blocks;
+    int max_frequency; // Highest frequency in any post, bounds the score of the term
+} Term;
+
+// A post: a node and the number of the post on it, see Content timelines. Padded to whole words for the posts array.
+typedef struct Post
+{
+    int node_id;
+    int length; // Number of terms
+    int sequence;
+    long long total_length; // Number of terms of the posts up to this one, for the average length of a snapshot
+} __attribute__((aligned(8))) Post;
+
+#define POST_WORDS ((int)(sizeof(Post) / sizeof(void *)))
+
+typedef struct TextIndex
+{
+    void **table; // Shared array, open addressing hash table of Term pointers, NULL for empty slots
+    int table_capacity;
+    int num_terms;
+    void **posts; // Shared array of POST_WORDS words per post
+    int post_words;
+} TextIndex;
+
+static TextIndex text_index;
+
+// Function to split text into lower-cased terms, calls back for each one. Returns the number of terms.
+static int tokenize(const char *text, void (*term)(void *context, const char *text, int length), void *context)
+{
+    int count = 0;
+    char buffer[MAX_TERM_LENGTH + 1];
+    while (*text)
+    {
+        while (*text && !isalnum((unsigned char)*text))
+        {
+            text++;
+        }
+        int length = 0;
+        while (*text && isalnum((unsigned char)*text))
+        {
+            if (length < MAX_TERM_LENGTH)
+            {
+                buffer[length++] = (char)tolower((unsigned char)*text);
+            }
+            text++;
+        }
+        if (length > 0)
+        {
+            buffer[length] = '\0';
+            term(context, buffer, length);
+            count++;
+        }
+    }
+    return count;
+}
+
+static unsigned long hash_term(const char *text, int length)
+{
+    unsigned long hash = 1469598103934665603UL;
+    for (int i = 0; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char)text[i]) * 1099511628211UL;
+    }
+    return hash;
+}
+
+// Function to find a term in the index, returns it or NULL. Inside a read section it searches the table of the snapshot.
+static Term *find_term(const char *text, int length)
+{
+    void **table;
+    int capacity = read_array(&text_index.table, &text_index.table_capacity, &table);
+    if (capacity == 0)
+    {
+        return NULL;
+    }
+    unsigned long mask = capacity - 1;
+    for (unsigned long slot = hash_term(text, length) & mask;; slot = (slot + 1) & mask)
+    {
+        Term *term = __atomic_load_n(&table[slot], __ATOMIC_ACQUIRE);
+        if (!term)
+        {
+            return NULL;
+        }
+        if (strncmp(term->text, text, length) == 0 && term->text[length] == '\0')
+        {
+            return term;
+        }
+    }
+}
+
+// Function to find a term, adding it if it is new. Returns it or NULL when out of memory. Must be called inside a write section.
+static Term *add_term(const char *text, int length)
+{
+    Term *existing = find_term(text, length);
+    if (existing)
+    {
+        return existing;
+    }
+
+    if (2 * (text_index.num_terms + 1) > text_index.table_capacity)
+    {
+        int capacity = text_index.table_capacity ? text_index.table_capacity * 2 : 1024;
+        void **table = array_alloc(capacity);
+        if (!table)
+        {
+            return NULL;
+        }
+        for (int i = 0; i < text_index.table_capacity; i++)
+        {
+            Term *term = text_index.table[i];
+            if (term)
+            {
+                unsigned long slot = hash_term(term->text, strlen(term->text)) & (capacity - 1);
+                while (table[slot])
+                {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                table[slot] = term;
+            }
+        }
+        array_publish(&text_index.table, &text_index.table_capacity, table, capacity);
+    }
+
+    Term *term = calloc(1, sizeof(Term));
+    if (!term || !(term->text = strndup(text, length)))
+    {
+        free(term);
+        return NULL;
+    }
+    // Most terms are rare, their postings start at 16 bytes.
+    term->postings = array_alloc(3);
+    term->postings_words = term->postings ? 3 : 0;
+    unsigned long slot = hash_term(text, length) & (text_index.table_capacity - 1);
+    while (text_index.table[slot])
+    {
+        slot = (slot + 1) & (text_index.table_capacity - 1);
+    }
+    // Readers probing the slot find the term complete or not at all.
+    __atomic_store_n(&text_index.table[slot], term, __ATOMIC_RELEASE);
+    text_index.num_terms++;
+    return term;
+}
+
+static int encode_varint(unsigned char *bytes, unsigned int value)
+{
+    int length = 0;
+    while (value >= 0x80)
+    {
+        bytes[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[length++] = (unsigned char)value;
+    return length;
+}
+
+// Function to append bytes to the postings of a term, growing them into a new allocation when they are full. Bytes past
+// the length in the first word are never read, so they are written in place and the length is published after them.
+static int postings_append(Term *term, const unsigned char *bytes, int length)
+{
+    void **postings = term->postings;
+    long used = postings ? (long)postings[0] : 0;
+    long room = postings ? (long)(array_capacity(postings) - 1) * (long)sizeof(void *) : 0;
+    if (used + length > room)
+    {
+        long words = array_capacity(postings) ? array_capacity(postings) : 3;
+        while ((words - 1) * (long)sizeof(void *) < used + length)
+        {
+            words *= 2;
+        }
+        void **grown = array_alloc(words);
+        if (!grown)
+        {
+            return -1;
+        }
+        if (postings)
+        {
+            memcpy(grown, postings, sizeof(void *) + used);
+        }
+        array_publish(&term->postings, &term->postings_words, grown, words);
+        postings = grown;
+    }
+
+    memcpy((char *)(postings + 1) + used, bytes, length);
+    __atomic_store_n(&postings[0], (void *)(used + length), __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Function to append a posting to a term, starting a new block when the last one is full
+static int append_posting(Term *term, int post, int frequency)
+{
+    PostingBlock *block = term->num_blocks ? term->blocks[term->num_blocks - 1] : NULL;
+    int previous = block ? block->last_post : -1;
+
+    if (!block || block->count == POSTING_BLOCK_SIZE)
+    {
+        PostingBlock *fresh = calloc(1, sizeof(PostingBlock));
+        if (!fresh)
+        {
+            return -1;
+        }
+        fresh->offset = term->postings ? (size_t)term->postings[0] : 0;
+        if (array_append(&term->blocks, &term->num_blocks, fresh, 4) != 0)
+        {
+            free(fresh);
+            return -1;
+        }
+        block = fresh;
+    }
+
+    unsigned char bytes[10];
+    int length = encode_varint(bytes, (unsigned int)(post - previous));
+    length += encode_varint(bytes + length, (unsigned int)frequency);
+    if (postings_append(term, bytes, length) != 0)
+    {
+        return -1;
+    }
+    __atomic_store_n(&block->last_post, post, __ATOMIC_RELAXED);
+    if (frequency > block->max_frequency)
+    {
+        __atomic_store_n(&block->max_frequency, frequency, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&block->count, block->count + 1, __ATOMIC_RELEASE);
+    if (frequency > term->max_frequency)
+    {
+        __atomic_store_n(&term->max_frequency, frequency, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+// Terms of one post while it is being indexed.
+typedef struct PostTerms
+{
+    char (*terms)[MAX_TERM_LENGTH + 1];
+    int count;
+    int capacity;
+} PostTerms;
+
+static void collect_term(void *context, const char *text, int length)
+{
+    PostTerms *post = context;
+    if (post->count == post->capacity)
+    {
+        int capacity = post->capacity ? post->capacity * 2 : 16;
+        void *terms = realloc(post->terms, capacity * sizeof(*post->terms));
+        if (!terms)
+        {
+            return; // The term is left out of the index.
+        }
+        post->terms = terms;
+        post->capacity = capacity;
+    }
+    memcpy(post->terms[post->count++], text, length + 1);
+}
+
+static int compare_terms(const void *a, const void *b)
+{
+    return strcmp(a, b);
+}
+
+// Function to add post number sequence of a node to the full-text index. Must be called inside a write section.
+static int index_post(Node *node, int sequence, char *content)
+{
+    PostTerms post = {NULL, 0, 0};
+    int length = tokenize(content, collect_term, &post);
+    qsort(post.terms, post.count, sizeof(*post.terms), compare_terms);
+
+    int status = array_reserve(&text_index.posts, &text_index.post_words, POST_WORDS);
+    if (status == 0)
+    {
+        int number = text_index.post_words / POST_WORDS;
+        Post entry = {node->id, length, sequence, length};
+        if (number > 0)
+        {
+            entry.total_length += ((Post *)text_index.posts)[number - 1].total_length;
+        }
+        memcpy(text_index.posts + text_index.post_words, &entry, sizeof(Post));
+        __atomic_store_n(&text_index.post_words, text_index.post_words + POST_WORDS, __ATOMIC_RELEASE);
+
+        for (int i = 0; i < post.count && status == 0;)
+        {
+            int run_end = i;
+            while (run_end < post.count && strcmp(post.terms[run_end], post.terms[i]) == 0)
+            {
+                run_end++;
+            }
+            Term *term = add_term(post.terms[i], strlen(post.terms[i]));
+            if (!term || append_posting(term, number, run_end - i) != 0)
+            {
+                status = -1;
+            }
+            i = run_end;
+        }
+    }
+
+    free(post.terms);
+    if (status != 0)
+    {
+        report("Failed to allocate memory for the full-text index.\n");
+    }
+    return status;
+}
+
+/*
+    Trending content:
+
+    Every post of a piece of content counts once for it (so reposts add up). Counts go into a ring of TRENDING_BUCKETS
+    count-min sketches, one per TRENDING_BUCKET_SECONDS of time, so a count over any recent window is the minimum over the
+    sketch rows of the row's sum over the window's buckets. Which contents to ask about comes from two space-saving
+    summaries of TRENDING_CAPACITY entries: one of all time, and one whose counts halve every bucket, which keeps the
+    contents posted a lot lately. Recording a post costs TRENDING_DEPTH counter increments and a heap update in each
+    summary, whatever the number of posts, and memory is fixed. A summary entry holds a reference to its content, and the
+    sketches count by the hash of the text, so content freed and posted again later keeps its counts.
+    Posts are recorded inside the write section. Queries take no lock: they load the counters and summary entries
+    atomically, so a query running alongside a post may see it in part, which is within the error of the estimates anyway.
+    The ring only moves when a post arrives, queries shift their windows by the buckets that passed since then.
+*/
+
+#define TRENDING_DEPTH 4
+#define TRENDING_WIDTH 4096
+
+// Space-saving summary: the contents with the highest counts, a content that is not in it takes the place of the lowest one.
+typedef struct SpaceSaving
+{
+    char *keys[TRENDING_CAPACITY];
+    double counts[TRENDING_CAPACITY];
+    int heap[TRENDING_CAPACITY];          // Entries ordered as a min-heap on counts
+    int position[TRENDING_CAPACITY];      // Position of each entry in the heap
+    int table[2 * TRENDING_CAPACITY];     // Entries by key hash, linear probing, -1 for empty slots
+    int size;
+} SpaceSaving;
+
+typedef struct Trending
+{
+    unsigned int sketches[TRENDING_BUCKETS][TRENDING_DEPTH][TRENDING_WIDTH];
+    long long bucket;  // Number of the newest bucket (time / TRENDING_BUCKET_SECONDS)
+    SpaceSaving all_time;
+    SpaceSaving recent;
+} Trending;
+
+static Trending *trending = NULL;
+
+static unsigned long content_hash(char *content);
+static void retain_content(char *content);
+static void release_content(char *content);
+
+static unsigned long long mix_hash(unsigned long long value)
+{
+    value += 0x9E3779B97F4A7C15ULL;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+static int space_saving_slot(char *key)
+{
+    return (int)(mix_hash((unsigned long long)(uintptr_t)key) & (2 * TRENDING_CAPACITY - 1));
+}
+
+static void space_saving_set_count(SpaceSaving *summary, int entry, double count)
+{
+    __atomic_store(&summary->counts[entry], &count, __ATOMIC_RELAXED);
+}
+
+static double space_saving_count(SpaceSaving *summary, int entry)
+{
+    double count;
+    __atomic_load(&summary->counts[entry], &count, __ATOMIC_RELAXED);
+    return count;
+}
+
+static void space_saving_swap(SpaceSaving *summary, int a, int b)
+{
+    int entry = summary->heap[a];
+    summary->heap[a] = summary->heap[b];
+    summary->heap[b] = entry;
+    summary->position[summary->heap[a]] = a;
+    summary->position[summary->heap[b]] = b;
+}
+
+static void space_saving_sift_down(SpaceSaving *summary, int position)
+{
+    while (1)
+    {
+        int smallest = position, left = 2 * position + 1, right = left + 1;
+        if (left < summary->size && summary->counts[summary->heap[left]] < summary->counts[summary->heap[smallest]])
+        {
+            smallest = left;
+        }
+        if (right < summary->size && summary->counts[summary->heap[right]] < summary->counts[summary->heap[smallest]])
+        {
+            smallest = right;
+        }
+        if (smallest == position)
+        {
+            return;
+        }
+        space_saving_swap(summary, position, smallest);
+        position = smallest;
+    }
+}
+
+// Function to remove a key from the table, moving back the keys after it so that probing still finds them
+static void space_saving_forget(SpaceSaving *summary, char *key)
+{
+    int mask = 2 * TRENDING_CAPACITY - 1;
+    int slot = space_saving_slot(key);
+    while (summary->keys[summary->table[slot]] != key)
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    int hole = slot;
+    for (slot = (hole + 1) & mask; summary->table[slot] >= 0; slot = (slot + 1) & mask)
+    {
+        int home = space_saving_slot(summary->keys[summary->table[slot]]);
+        // The key can fill the hole if the hole lies between its home slot and where it is now.
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
+        {
+            summary->table[hole] = summary->table[slot];
+            hole = slot;
+        }
+    }
+    summary->table[hole] = -1;
+}
+
+static void space_saving_remember(SpaceSaving *summary, int entry)
+{
+    int mask = 2 * TRENDING_CAPACITY - 1;
+    int slot = space_saving_slot(summary->keys[entry]);
+    while (summary->table[slot] >= 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+    summary->table[slot] = entry;
+}
+
+static void space_saving_add(SpaceSaving *summary, char *key)
+{
+    int mask = 2 * TRENDING_CAPACITY - 1;
+    for (int slot = space_saving_slot(key); summary->table[slot] >= 0; slot = (slot + 1) & mask)
+    {
+        int entry = summary->table[slot];
+        if (summary->keys[entry] == key)
+        {
+            space_saving_set_count(summary, entry, summary->counts[entry] + 1);
+            space_saving_sift_down(summary, summary->position[entry]);
+            return;
+        }
+    }
+
+    retain_content(key);
+    if (summary->size < TRENDING_CAPACITY)
+    {
+        int entry = summary->size;
+        __atomic_store_n(&summary->keys[entry], key, __ATOMIC_RELEASE);
+        space_saving_set_count(summary, entry, 1);
+        __atomic_store_n(&summary->size, entry + 1, __ATOMIC_RELEASE);
+        summary->heap[entry] = entry;
+        summary->position[entry] = entry;
+        space_saving_remember(summary, entry);
+        for (int position = entry; position > 0 && summary->counts[summary->heap[(position - 1) / 2]] > summary->counts[summary->heap[position]];)
+        {
+            space_saving_swap(summary, position, (position - 1) / 2);
+            position = (position - 1) / 2;
+        }
+        return;
+    }
+
+    // The new content takes the place of the lowest one and inherits its count, the most it could have had while it was not counted.
+    int entry = summary->heap[0];
+    space_saving_forget(summary, summary->keys[entry]);
+    release_content(summary->keys[entry]);
+    __atomic_store_n(&summary->keys[entry], key, __ATOMIC_RELEASE);
+    space_saving_set_count(summary, entry, summary->counts[entry] + 1);
+    space_saving_remember(summary, entry);
+    space_saving_sift_down(summary, 0);
+}
+
+static void space_saving_init(SpaceSaving *summary)
+{
+    summary->size = 0;
+    for (int slot = 0; slot < 2 * TRENDING_CAPACITY; slot++)
+    {
+        summary->table[slot] = -1;
+    }
+}
+
+// Function to move the ring to the bucket of the given time, clearing buckets that fell out of it. Must be called inside a write section.
+static void trending_advance(long long seconds)
+{
+    long long bucket = seconds / TRENDING_BUCKET_SECONDS;
+    long long steps = bucket - trending->bucket;
+    for (long long step = 1; step <= steps && step <= TRENDING_BUCKETS; step++)
+    {
+        unsigned int (*sketch)[TRENDING_WIDTH] = trending->sketches[(trending->bucket + step) % TRENDING_BUCKETS];
+        for (int row = 0; row < TRENDING_DEPTH; row++)
+        {
+            for (int column = 0; column < TRENDING_WIDTH; column++)
+            {
+                __atomic_store_n(&sketch[row][column], 0, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    for (long long step = 0; step < steps && step < 64; step++)
+    {
+        for (int i = 0; i < trending->recent.size; i++)
+        {
+            // The same factor for every entry keeps the heap ordered.
+            space_saving_set_count(&trending->recent, i, trending->recent.counts[i] / 2);
+        }
+    }
+    if (steps > 0)
+    {
+        __atomic_store_n(&trending->bucket, bucket, __ATOMIC_RELEASE);
+    }
+}
+
+// Function to count a post of interned content at the given time (seconds). Must be called inside a write section.
+static void trending_record(char *content, long long seconds)
+{
+    if (!trending)
+    {
+        Trending *created = calloc(1, sizeof(Trending));
+        if (!created)
+        {
+            return;
+        }
+        space_saving_init(&created->all_time);
+        space_saving_init(&created->recent);
+        created->bucket = seconds / TRENDING_BUCKET_SECONDS;
+        __atomic_store_n(&trending, created, __ATOMIC_RELEASE);
+    }
+
+    trending_advance(seconds);
+    unsigned long long hash = mix_hash(content_hash(content));
+    unsigned int (*sketch)[TRENDING_WIDTH] = trending->sketches[trending->bucket % TRENDING_BUCKETS];
+    for (int row = 0; row < TRENDING_DEPTH; row++)
+    {
+        // Rows use different 16-bit slices of one 64-bit hash.
+        unsigned int *counter = &sketch[row][(hash >> (16 * row)) & (TRENDING_WIDTH - 1)];
+        __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+    }
+    space_saving_add(&trending->all_time, content);
+    space_saving_add(&trending->recent, content);
+}
+
+// Returns the estimated number of posts of content in the buckets [now - first - count + 1, now - first]. The ring ends
+// at the bucket of the last post, passed buckets before now: the ones after it are empty.
+static unsigned long long trending_estimate(Trending *state, long long passed, char *content, int first, int count)
+{
+    long long newest = __atomic_load_n(&state->bucket, __ATOMIC_ACQUIRE);
+    unsigned long long hash = mix_hash(content_hash(content));
+    unsigned long long estimate = ~0ULL;
+    for (int row = 0; row < TRENDING_DEPTH; row++)
+    {
+        unsigned long long sum = 0;
+        for (int i = first; i < first + count && i < TRENDING_BUCKETS; i++)
+        {
+            if (i < passed)
+            {
+                continue;
+            }
+            long long bucket = ((newest - (i - passed)) % TRENDING_BUCKETS + TRENDING_BUCKETS) % TRENDING_BUCKETS;
+            sum += __atomic_load_n(&state->sketches[bucket][row][(hash >> (16 * row)) & (TRENDING_WIDTH - 1)], __ATOMIC_RELAXED);
+        }
+        if (sum < estimate)
+        {
+            estimate = sum;
+        }
+    }
+    return estimate;
+}
+
+static int compare_trending(const void *a, const void *b)
+{
+    double x = ((const double *)a)[0], y = ((const double *)b)[0];
+    return (x < y) - (x > y);
+}
+
+// Function to report the most reposted contents, or the ones whose posts grew the most over the last windows
+TrendingResult trending_content(int k, int rising)
+{
+    METRIC_SCOPE(trending_content);
+    TrendingResult result = {NULL, NULL, 0};
+    Trending *state = __atomic_load_n(&trending, __ATOMIC_ACQUIRE);
+    if (!state || k < 1)
+    {
+        return result;
+    }
+
+    // The windows follow the clock, so that a quiet spell shows as a fall.
+    long long passed = time(NULL) / TRENDING_BUCKET_SECONDS - __atomic_load_n(&state->bucket, __ATOMIC_ACQUIRE);
+    if (passed < 0)
+    {
+        passed = 0;
+    }
+
+    SpaceSaving *summary = rising ? &state->recent : &state->all_time;
+    int size = __atomic_load_n(&summary->size, __ATOMIC_ACQUIRE);
+    double (*ranked)[2] = malloc((size + 1) * sizeof(*ranked));
+    char **keys = malloc((size + 1) * sizeof(char *));
+    int count = 0;
+    for (int i = 0; i < size; i++)
+    {
+        keys[i] = __atomic_load_n(&summary->keys[i], __ATOMIC_ACQUIRE);
+        double score;
+        if (rising)
+        {
+            double now = (double)trending_estimate(state, passed, keys[i], 0, TRENDING_RISING_BUCKETS);
+            double before = (double)trending_estimate(state, passed, keys[i], TRENDING_RISING_BUCKETS, TRENDING_RISING_BUCKETS);
+            score = now - before;
+        }
+        else
+        {
+            score = space_saving_count(summary, i);
+        }
+        if (score > 0)
+        {
+            ranked[count][0] = score;
+            ranked[count][1] = i;
+            count++;
+        }
+    }
+    qsort(ranked, count, sizeof(*ranked), compare_trending);
+
+    result.size = count < k ? count : k;
+    result.contents = malloc((result.size + 1) * sizeof(char *));
+    result.scores = malloc((result.size + 1) * sizeof(double));
+    for (int i = 0; i < result.size; i++)
+    {
+        result.contents[i] = keys[(int)ranked[i][1]];
+        result.scores[i] = ranked[i][0];
+    }
+
+    free(keys);
+    free(ranked);
+    return result;
+}
+
+void free_trending_result(TrendingResult *result)
+{
+    free(result->contents);
+    free(result->scores);
+    memset(result, 0, sizeof(*result));
+}
+
+/*
+    Content timelines:
+
+    A piece of content is interned once, in the all_content hash table, and counted by reference: each post of it that a
+    node keeps in memory holds one, and so does each trending summary entry. The last release takes it out of the table
+    and retires it, so content no one holds anymore is freed once the readers that may still print it are done.
+    A node keeps its newest posts in memory, in its content array. When the array reaches 2 * TIMELINE_WINDOW posts, the
+    oldest TIMELINE_WINDOW are written as one block to the content archive and the array is copied with the rest, so a
+    node holds one to two windows of posts in memory however much it posts. The archive is a series of append-only
+    segment files of up to ARCHIVE_SEGMENT_BYTES in archive_directory (social reads SOCIAL_ARCHIVE_DIR at start). A block
+    is an ArchiveBlock header followed by the posts as NUL terminated strings. Its position, segment << ARCHIVE_OFFSET_BITS
+    | offset, is appended to the node's archived array, one word per block. The archived array and the content array are
+    published in the same write section, so a read section sees archived posts and posts in memory of one snapshot, with
+    no post in both or in neither. Post number k of a node, counted from 0 in posting order, is in block k /
+    TIMELINE_WINDOW while k is below the archived posts; the full-text index refers to posts that way.
+    Segment files are unlinked as soon as they are created: the archive extends memory and goes away with the process,
+    checkpoints carry the posts. If the archive cannot be written, posts stay in memory.
+*/
+
+#define ARCHIVE_OFFSET_BITS 40
+
+const char *archive_directory = NULL; // See Content timelines above, $TMPDIR or /tmp when NULL.
+
+// Interned content: its references and the hash of its text, in front of the text the rest of the code points to.
+typedef struct Content
+{
+    int references;
+    unsigned long hash;
+    char text[];
+} Content;
+
+// Header of a block of posts in the content archive.
+typedef struct ArchiveBlock
+{
+    int node_id;
+    int count; // Posts in the block
+    int bytes; // Length of the posts after the header
+} ArchiveBlock;
+
+typedef struct ContentArchive
+{
+    void **segments; // File descriptors of the segments, oldest first, as a shared array
+    int num_segments;
+    long long size;  // Bytes written to the last segment
+    int failed;      // Set once a write failed, posts stay in memory from then on
+} ContentArchive;
+
+static ContentArchive archive = {NULL, 0, 0, 0};
+
+static char content_tombstone[1]; // Marks a removed entry of all_content, probes go on past it.
+static int content_capacity = 0;  // Slots of all_content, a power of two
+static int content_tombstones = 0;
+
+static Content *content_of(char *content)
+{
+    return (Content *)(content - offsetof(Content, text));
+}
+
+static unsigned long content_hash(char *content)
+{
+    return content_of(content)->hash;
+}
+
+// Function to rebuild all_content with room for twice the contents it holds, dropping tombstones
+static int content_table_rebuild()
+{
+    int capacity = 128;
+    while (capacity < 4 * (num_content + 1))
+    {
+        capacity *= 2;
+    }
+    char **table = calloc(capacity, sizeof(char *));
+    if (!table)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < content_capacity; i++)
+    {
+        if (all_content[i] && all_content[i] != content_tombstone)
+        {
+            unsigned long slot = content_hash(all_content[i]) & (capacity - 1);
+            while (table[slot])
+            {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            table[slot] = all_content[i];
+        }
+    }
+    free(all_content);
+    all_content = table;
+    content_capacity = capacity;
+    content_tombstones = 0;
+    return 0;
+}
+
+// Function to find content in all_content, adding it if it was never posted before, and take a reference to it. Must be
+// called inside a write section, release_content() drops the reference.
+static char *intern_content(char *content)
+{
+    if (2 * (num_content + content_tombstones + 1) > content_capacity && content_table_rebuild() != 0)
+    {
+        report("Failed to allocate memory for new content.\n");
+        return NULL;
+    }
+
+    size_t length = strlen(content);
+    unsigned long hash = hash_term(content, length);
+    unsigned long mask = content_capacity - 1, slot = hash & mask;
+    long free_slot = -1;
+    for (; all_content[slot]; slot = (slot + 1) & mask)
+    {
+        char *entry = all_content[slot];
+        if (entry == content_tombstone)
+        {
+            free_slot = free_slot < 0 ? (long)slot : free_slot;
+        }
+        else if (content_hash(entry) == hash && strcmp(entry, content) == 0)
+        {
+            METRIC_COUNT(content_intern_hits);
+            content_of(entry)->references++;
+            return entry;
+        }
+    }
+    METRIC_COUNT(content_intern_misses);
+
+    Content *interned = malloc(sizeof(Content) + length + 1);
+    if (!interned)
+    {
+        report("Failed to allocate memory for new content.\n");
+        return NULL;
+    }
+    interned->references = 1;
+    interned->hash = hash;
+    memcpy(interned->text, content, length + 1);
+
+    if (free_slot >= 0)
+    {
+        slot = free_slot;
+        content_tombstones--;
+    }
+    all_content[slot] = interned->text;
+    __atomic_store_n(&num_content, num_content + 1, __ATOMIC_RELAXED);
+    return interned->text;
+}
+
+// Function to take another reference to interned content. Must be called inside a write section.
+static void retain_content(char *content)
+{
+    content_of(content)->references++;
+}
+
+// Function to drop a reference to interned content, freeing it with the last one. Must be called inside a write section.
+static void release_content(char *content)
+{
+    Content *interned = content_of(content);
+    if (--interned->references > 0)
+    {
+        return;
+    }
+
+    unsigned long mask = content_capacity - 1, slot = interned->hash & mask;
+    while (all_content[slot] != content)
+    {
+        slot = (slot + 1) & mask;
+    }
+    all_content[slot] = content_tombstone;
+    content_tombstones++;
+    __atomic_store_n(&num_content, num_content - 1, __ATOMIC_RELAXED);
+
+    METRIC_COUNT(content_reclaimed);
+    // Readers may still be printing it.
+    retire(interned);
+}
+
+// Function to start a new segment of the content archive, returns 0 on success. Must be called inside a write section.
+static int archive_open_segment()
+{
+    const char *directory = archive_directory;
+    if (!directory)
+    {
+        directory = getenv("TMPDIR");
+    }
+    if (!directory || !*directory)
+    {
+        directory = "/tmp";
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/social-archive-%d-%d", directory, (int)getpid(), archive.num_segments);
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    // The open descriptor keeps the segment, nothing is left behind when the process ends.
+    unlink(path);
+
+    if (array_append(&archive.segments, &archive.num_segments, (void *)(intptr_t)fd, 16) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    archive.size = 0;
+    return 0;
+}
+
+// Function to write posts of a node to the content archive as one block, returns its position or -1 on failure. Must be
+// called inside a write section.
+static long long archive_write(Node *node, char **posts, int count)
+{
+    Buffer block = {NULL, 0, 0};
+    ArchiveBlock header = {node->id, count, 0};
+    int status = buffer_append(&block, (char *)&header, sizeof(header));
+    for (int i = 0; i < count && status == 0; i++)
+    {
+        status = buffer_append(&block, posts[i], strlen(posts[i]) + 1);
+    }
+    if (status != 0)
+    {
+        free(block.data);
+        return -1;
+    }
+    ((ArchiveBlock *)block.data)->bytes = (int)(block.length - sizeof(header));
+
+    if ((archive.num_segments == 0 || (archive.size > 0 && archive.size + (long long)block.length > ARCHIVE_SEGMENT_BYTES)) &&
+        archive_open_segment() != 0)
+    {
+        free(block.data);
+        return -1;
+    }
+
+    int fd = (int)(intptr_t)archive.segments[archive.num_segments - 1];
+    long long position = ((long long)(archive.num_segments - 1) << ARCHIVE_OFFSET_BITS) | archive.size;
+    for (size_t written = 0; written < block.length;)
+    {
+        ssize_t length = pwrite(fd, block.data + written, block.length - written, archive.size + written);
+        if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (length <= 0)
+        {
+            free(block.data);
+            return -1;
+        }
+        written += length;
+    }
+    archive.size += block.length;
+    free(block.data);
+    METRIC_COUNT(archived_blocks);
+    return position;
+}
+
+// Function to read bytes at an offset of a file, returns 0 once they are all read
+static int read_at(int fd, void *data, size_t length, off_t offset)
+{
+    for (size_t done = 0; done < length;)
+    {
+        ssize_t count = pread(fd, (char *)data + done, length - done, offset + done);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return -1;
+        }
+        done += count;
+    }
+    return 0;
+}
+
+// Function to read a block of posts back from the content archive into buffer, pointing posts at them. Returns the number
+// of posts, or -1 if the block cannot be read. Must be called inside a read or write section.
+static int archive_read(long long position, Buffer *buffer, char **posts)
+{
+    void **segments;
+    int num_segments = read_array(&archive.segments, &archive.num_segments, &segments);
+    int segment = (int)(position >> ARCHIVE_OFFSET_BITS);
+    off_t offset = position & ((1LL << ARCHIVE_OFFSET_BITS) - 1);
+    if (segment >= num_segments)
+    {
+        return -1;
+    }
+
+    int fd = (int)(intptr_t)segments[segment];
+    ArchiveBlock header;
+    if (read_at(fd, &header, sizeof(header), offset) != 0 || header.count < 0 || header.count > TIMELINE_WINDOW || header.bytes < 0)
+    {
+        return -1;
+    }
+    buffer->length = 0;
+    if (buffer_reserve(buffer, header.bytes) != 0 || read_at(fd, buffer->data, header.bytes, offset + sizeof(header)) != 0)
+    {
+        return -1;
+    }
+    buffer->length = header.bytes;
+    METRIC_COUNT(archive_reads);
+
+    char *text = buffer->data, *end = buffer->data + header.bytes;
+    for (int i = 0; i < header.count; i++)
+    {
+        char *terminator = text < end ? memchr(text, '\0', end - text) : NULL;
+        if (!terminator)
+        {
+            return -1;
+        }
+        posts[i] = text;
+        text = terminator + 1;
+    }
+    return header.count;
+}
+
+// Function to move the oldest window of posts of a node to the content archive once it holds two windows in memory. Must
+// be called inside a write section.
+static void timeline_spill(Node *node)
+{
+    int count = node->num_contents;
+    if (count < 2 * TIMELINE_WINDOW || archive.failed)
+    {
+        return;
+    }
+
+    char **posts = node->content;
+    void **kept = array_alloc(count);
+    long long position = kept ? archive_write(node, posts, TIMELINE_WINDOW) : -1;
+    if (position < 0 || array_append(&node->archived, &node->num_archived, (void *)(intptr_t)position, 4) != 0)
+    {
+        // Never published, no reader has seen it.
+        free(kept ? (ArrayHeader *)kept - 1 : NULL);
+        archive.failed = 1;
+        report("Failed to write the content archive, posts stay in memory.\n");
+        return;
+    }
+
+    memcpy(kept, posts + TIMELINE_WINDOW, (count - TIMELINE_WINDOW) * sizeof(char *));
+    array_publish((void ***)&node->content, &node->num_contents, kept, count - TIMELINE_WINDOW);
+    // The old array is retired, not freed, so the posts can still be read until the write section ends.
+    for (int i = 0; i < TIMELINE_WINDOW; i++)
+    {
+        release_content(posts[i]);
+    }
+}
+
+// Function to start walking the posts of a node, oldest first. Must be called inside a read or write section.
+void start_posts(PostCursor *cursor, Node *node)
+{
+    cursor->num_blocks = read_array(&node->archived, &node->num_archived, &cursor->blocks);
+    cursor->block = 0;
+    cursor->num_recent = read_contents(node, &cursor->recent);
+    cursor->buffer = NULL;
+    cursor->capacity = 0;
+}
+
+// Function to get the next batch of posts of a node, returns how many there are (0 at the end). Archived posts are valid
+// until the next call, blocks that cannot be read back are skipped.
+int next_posts(PostCursor *cursor, char ***posts)
+{
+    while (cursor->block < cursor->num_blocks)
+    {
+        long long position = (long long)(intptr_t)cursor->blocks[cursor->block++];
+        Buffer buffer = {cursor->buffer, 0, cursor->capacity};
+        int count = archive_read(position, &buffer, cursor->batch);
+        cursor->buffer = buffer.data;
+        cursor->capacity = buffer.capacity;
+        if (count > 0)
+        {
+            *posts = cursor->batch;
+            return count;
+        }
+    }
+
+    int count = cursor->num_recent;
+    cursor->num_recent = 0;
+    *posts = cursor->recent;
+    return count;
+}
+
+// Function to free what a post cursor read, it can stop before the end
+void end_posts(PostCursor *cursor)
+{
+    free(cursor->buffer);
+    cursor->buffer = NULL;
+    cursor->capacity = 0;
+}
+
+// Function to get post number sequence of a node as of the snapshot of the read section: the interned content while it
+// is in memory, or its text read back from the archive into block. Returns NULL if the snapshot does not have the post.
+static char *timeline_post(Node *node, int sequence, Buffer *block)
+{
+    void **blocks;
+    char **recent;
+    int archived = read_array(&node->archived, &node->num_archived, &blocks) * TIMELINE_WINDOW;
+    int num_recent = read_contents(node, &recent);
+    if (sequence < 0 || sequence >= archived + num_recent)
+    {
+        return NULL;
+    }
+    if (sequence >= archived)
+    {
+        return recent[sequence - archived];
+    }
+
+    char *posts[TIMELINE_WINDOW];
+    int count = archive_read((long long)(intptr_t)blocks[sequence / TIMELINE_WINDOW], block, posts);
+    return sequence % TIMELINE_WINDOW < count ? posts[sequence % TIMELINE_WINDOW] : NULL;
+}
+
+// Function to add a post of interned content to a node, taking a reference to it. Must be called inside a write section.
+static int append_content(Node *node, char *interned)
+{
+    timeline_spill(node);
+    int sequence = count_posts(node);
+    if (array_append((void ***)&node->content, &node->num_contents, interned, 4) != 0)
+    {
+        report("Failed to allocate memory for new content reference.\n");
+        return -1;
+    }
+    retain_content(interned);
+    trending_record(interned, time(NULL));
+    return index_post(node, sequence, interned);
+}
+
+// Function to post content on a node, returns the number of nodes posted to or -1 on failure
+int post_content(char *name, char *content)
+{
+    METRIC_SCOPE(post_content);
+    begin_write();
+
+    char *interned = intern_content(content);
+    if (!interned)
+    {
+        end_write();
+        return -1;
+    }
+
+    SearchResult result = search_node_by_name(name);
+
+    if (result.size == 0)
+    {
+        report("Node not found\n");
+    }
+    else
+    {
+        report("Node(s) found:\n");
+
+        for (int i = 0; i < result.size; i++)
+        {
+            if (append_content(result.nodes[i], interned) != 0)
+            {
+                release_content(interned);
+                free(result.nodes);
+                end_write();
+                return -1;
+            }
+        }
+
+        report("Content posted to node(s)\n");
+    }
+
+    // The nodes hold the content now, or nothing does if no node has the name.
+    release_content(interned);
+    int posted = result.size;
+    free(result.nodes);
+    end_write();
+    return posted;
+}
+
+// Function to search and print the content posted by a node
+void search_and_print_content(char *content)
+{
+    METRIC_SCOPE(search_and_print_content);
+    begin_read();
+    Node **nodes;
+    int count = read_all_nodes(&nodes);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!nodes[i])
+        {
+            continue;
+        }
+
+        PostCursor posts;
+        char **contents;
+        int num_contents, found = 0;
+        start_posts(&posts, nodes[i]);
+        while (!found && (num_contents = next_posts(&posts, &contents)) > 0)
+        {
+            for (int j = 0; j < num_contents; j++)
+            {
+                if (strstr(contents[j], content))
+                {
+                    printf("Content posted by: %s\n", nodes[i]->name);
+                    printf("The full content is: %s\n", contents[j]);
+                    found = 1;
+                    break;
+                }
+            }
+        }
+        end_posts(&posts);
+    }
+    end_read();
+}
+
+// Function to print the content posted by linked nodes of a node
+void display_linked_content(char *name)
+{
+    METRIC_SCOPE(display_linked_content);
+    begin_read();
+    SearchResult result = search_node_by_name(name);
+
+    if (result.size == 0)
+    {
+        printf("Node not found\n");
+        print_name_suggestions(name);
+    }
+    else
+    {
+        printf("Node(s) found:\n");
+
+        for (int i = 0; i < result.size; i++)
+        {
+            Node *current_node = result.nodes[i];
+
+            if (current_node->type == 'I')
+            {
+                printf("Content linked to individuals linked to %s:\n", current_node->name);
+                LinkCursor cursor;
+                Node **links;
+                int num_links;
+                start_links(&cursor, current_node, -1);
+                while ((num_links = next_links(&cursor, &links)) > 0)
+                {
+                    for (int j = 0; j < num_links; j++)
+                    {
+                        if (links[j] && links[j]->type == 'I')
+                        {
+                            printf("Content posted by %s:\n", links[j]->name);
+                            PostCursor posts;
+                            char **contents;
+                            int num_contents;
+                            start_posts(&posts, links[j]);
+                            while ((num_contents = next_posts(&posts, &contents)) > 0)
+                            {
+                                for (int k = 0; k < num_contents; k++)
+                                {
+                                    printf("%s\n", contents[k]);
+                                }
+                            }
+                            end_posts(&posts);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    free(result.nodes);
+    end_read();
+}
+
+// Function to print the details of a node
+void print_node_details(Node *node)
+{
+    METRIC_SCOPE(print_node_details);
+    begin_read();
+    printf("Node details:\n");
+    printf("ID: %d\n", node->id);
+    printf("Name: %s\n", node->name);
+
+    printf("Type: ");
+    if (node->type == 'I')
+    {
+        printf("Individual\n");
+        if (((Individual *)node)->birthday.day == -1)
+        {
+            printf("Birthday: Not added\n");
+        }
+        else
+        {
+            printf("Birthday: %d-%d-%d\n", ((Individual *)node)->birthday.day, ((Individual *)node)->birthday.month, ((Individual *)node)->birthday.year);
+        }
+    }
+    else if (node->type == 'G')
+        printf("Group\n");
+
+    else if (node->type == 'B')
+    {
+        printf("Business\n");
+        printf("Location: (%lf, %lf)\n", ((Business *)node)->location.x, ((Business *)node)->location.y);
+    }
+    else if (node->type == 'O')
+    {
+        printf("Organisation\n");
+        printf("Location: (%lf, %lf)\n", ((Organisation *)node)->location.x, ((Organisation *)node)->location.y);
+    }
+
+    printf("Date of creation: %s\n", node->date);
+    PostCursor posts;
+    char **contents;
+    int num_contents, printed = 0;
+    start_posts(&posts, node);
+    while ((num_contents = next_posts(&posts, &contents)) > 0)
+    {
+        for (int i = 0; i < num_contents; i++)
+        {
+            printf(printed++ == 0 ? "Content: %s" : ", %s", contents[i]);
+        }
+    }
+    end_posts(&posts);
+    if (printed > 0)
+    {
+        printf("\n");
+    }
+    end_read();
+}
+
+// Function to print all nodes
+void print_all_nodes()
+{
+    METRIC_SCOPE(print_all_nodes);
+    begin_read();
+    Node **nodes;
+    int count = read_all_nodes(&nodes);
+
+    for (int i = 0, printed = 0; i < count; i++)
+    {
+        if (nodes[i])
+        {
+            printf("Node %d:\n", ++printed);
+            print_node_details(nodes[i]);
+            printf("\n");
+        }
+    }
+    end_read();
+}
+
+// Function to find a node by id. all_nodes is sorted by id, so this is a binary search. Must be called inside a read or write section.
+Node *find_node_by_id(int node_id)
+{
+    Node **nodes;
+    int count = read_all_nodes(&nodes);
+
+    // A removal in flight can leave NULLs at the end of the array, they sort after every id.
+    int low = 0, high = count - 1;
+    while (low <= high)
+    {
+        int middle = low + (high - low) / 2;
+        if (nodes[middle] == NULL || nodes[middle]->id > node_id)
+        {
+            high = middle - 1;
+        }
+        else if (nodes[middle]->id < node_id)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            return nodes[middle];
+        }
+    }
+    return NULL;
+}
+
+// Filter for page_nodes() keeping the nodes with the name given as context
+static int has_name(Node *node, void *name)
+{
+    return strcmp(node->name, name) == 0;
+}
+
+// Function to get a page of nodes after a cursor, in id order. The cursor is the last id a page looked at, so a page
+// starts with a binary search wherever it is and inserts or deletes between calls never shift later pages.
+NodePage page_nodes(char type, NodeFilter filter, void *context, long long cursor, int limit)
+{
+    METRIC_SCOPE(page_nodes);
+    NodePage page = {NULL, 0, 0};
+    if (limit <= 0)
+    {
+        return page;
+    }
+
+    begin_read();
+    Node **nodes;
+    int count = read_typed_nodes(type, &nodes);
+    int low = 0, high = count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (nodes[middle] && nodes[middle]->id <= cursor)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    page.nodes = (Node **)malloc(limit * sizeof(Node *));
+    long scanned = 0;
+    int i = low;
+    for (; i < count && page.size < limit && scanned < PAGE_MAX_SCAN; i++, scanned++)
+    {
+        Node *node = nodes[i];
+        if (!node)
+        {
+            continue;
+        }
+        page.next = node->id;
+        if (!filter || filter(node, context))
+        {
+            page.nodes[page.size++] = node;
+        }
+    }
+    // Nothing left after this page: no cursor. A scan cut short keeps its place even with a partial page.
+    int more = 0;
+    for (; i < count && !more; i++)
+    {
+        more = nodes[i] != NULL;
+    }
+    if (!more)
+    {
+        page.next = 0;
+    }
+    end_read();
+
+    return page;
+}
+
+// Returns the number of threads used by parallel work, SOCIAL_THREADS overrides the number of cores
+int num_worker_threads()
+{
+    const char *setting = getenv("SOCIAL_THREADS");
+    int threads = setting ? atoi(setting) : 0;
+#ifdef _SC_NPROCESSORS_ONLN
+    if (threads < 1)
+    {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#endif
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    return threads < MAX_THREADS / 2 ? threads : MAX_THREADS / 2;
+}
+
+// Work shared by the threads of a parallel_for().
+typedef struct ParallelFor
+{
+    long end;
+    long chunk;
+    long next;
+    RangeTask task;
+    void *context;
+    int snapshot;          // Set when the caller is in a read section, the tasks then read its snapshot
+    unsigned long version;
+} ParallelFor;
+
+typedef struct ParallelWorker
+{
+    ParallelFor *work;
+    int thread;
+} ParallelWorker;
+
+static void *parallel_for_worker(void *argument)
+{
+    ParallelWorker *worker = argument;
+    ParallelFor *work = worker->work;
+
+    // Worker threads read the shared arrays as of the caller's snapshot, whose read section keeps them alive.
+    int borrowed = work->snapshot && read_depth == 0;
+    if (borrowed)
+    {
+        read_depth = 1;
+        snapshot_version = work->version;
+    }
+
+    while (1)
+    {
+        long begin = __atomic_fetch_add(&work->next, work->chunk, __ATOMIC_RELAXED);
+        if (begin >= work->end)
+        {
+            break;
+        }
+        long end = begin + work->chunk < work->end ? begin + work->chunk : work->end;
+        work->task(work->context, begin, end, worker->thread);
+    }
+
+    if (borrowed)
+    {
+        read_depth = 0;
+    }
+    return NULL;
+}
+
+// Function to run task over [begin, end) in chunks on all worker threads. The caller's read section covers the tasks.
+void parallel_for(long begin, long end, long chunk, RangeTask task, void *context)
+{
+    int threads = num_worker_threads();
+    ParallelFor work = {end, chunk > 0 ? chunk : 1, begin, task, context, read_depth > 0 && write_depth == 0, snapshot_version};
+
+    if (threads == 1 || end - begin <= work.chunk)
+    {
+        if (end > begin)
+        {
+            ParallelWorker worker = {&work, 0};
+            parallel_for_worker(&worker);
+        }
+        return;
+    }
+
+    pthread_t *handles = malloc(threads * sizeof(pthread_t));
+    ParallelWorker *workers = malloc(threads * sizeof(ParallelWorker));
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].work = &work;
+        workers[i].thread = i;
+        if (i > 0 && pthread_create(&handles[i], NULL, parallel_for_worker, &workers[i]) != 0)
+        {
+            workers[i].thread = -1;
+        }
+    }
+
+    parallel_for_worker(&workers[0]);
+    for (int i = 1; i < threads; i++)
+    {
+        if (workers[i].thread != -1)
+        {
+            pthread_join(handles[i], NULL);
+        }
+    }
+    free(workers);
+    free(handles);
+}
+
+// Function to sort ints and drop duplicates, returns the new count
+static int sort_unique(int *values, int count)
+{
+    qsort(values, count, sizeof(int), compare_ints);
+    int kept = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (kept == 0 || values[kept - 1] != values[i])
+        {
+            values[kept++] = values[i];
+        }
+    }
+    return kept;
+}
+
+typedef struct GraphViewBuild
+{
+    GraphView *view;
+    Node **nodes;
+    int *index_of_id;
+    long long *degrees;
+} GraphViewBuild;
+
+static void graph_view_fill(void *context, long begin, long end, int thread)
+{
+    (void)thread;
+    GraphViewBuild *build = context;
+    GraphView *view = build->view;
+
+    for (long i = begin; i < end; i++)
+    {
+        LinkCursor cursor;
+        Node **links;
+        int num_links;
+        int *neighbours = view->neighbours + view->offsets[i];
+        int count = 0;
+        start_links(&cursor, build->nodes[i], -1);
+        while (count < build->degrees[i] && (num_links = next_links(&cursor, &links)) > 0)
+        {
+            for (int j = 0; j < num_links && count < build->degrees[i]; j++)
+            {
+                if (links[j] && links[j]->id < view->max_id && build->index_of_id[links[j]->id] >= 0)
+                {
+                    neighbours[count++] = build->index_of_id[links[j]->id];
+                }
+            }
+        }
+        build->degrees[i] = sort_unique(neighbours, count);
+    }
+}
+
+// Function to build a compact CSR copy of the links, must be called inside a read section
+GraphView build_graph_view()
+{
+    GraphView view;
+    memset(&view, 0, sizeof(view));
+
+    Node **nodes;
+    int count = read_all_nodes(&nodes);
+    view.nodes = malloc((count + 1) * sizeof(Node *));
+    for (int i = 0; i < count; i++)
+    {
+        if (nodes[i])
+        {
+            view.nodes[view.num_nodes++] = nodes[i];
+        }
+    }
+
+    view.max_id = view.num_nodes ? view.nodes[view.num_nodes - 1]->id + 1 : 1;
+    int *index_of_id = malloc(view.max_id * sizeof(int));
+    memset(index_of_id, -1, view.max_id * sizeof(int));
+    view.ids = malloc((view.num_nodes + 1) * sizeof(int));
+    view.types = malloc(view.num_nodes + 1);
+    long long *degrees = malloc((view.num_nodes + 1) * sizeof(long long));
+    view.offsets = malloc((view.num_nodes + 1) * sizeof(long long));
+
+    long long total = 0;
+    for (int i = 0; i < view.num_nodes; i++)
+    {
+        index_of_id[view.nodes[i]->id] = i;
+        view.ids[i] = view.nodes[i]->id;
+        view.types[i] = view.nodes[i]->type;
+        view.offsets[i] = total;
+        // Links keep growing under a concurrent writer, the count read here bounds what graph_view_fill() copies.
+        degrees[i] = __atomic_load_n(&view.nodes[i]->num_links, __ATOMIC_ACQUIRE);
+        total += degrees[i];
+    }
+    view.offsets[view.num_nodes] = total;
+    view.neighbours = malloc((total + 1) * sizeof(int));
+
+    GraphViewBuild build = {&view, view.nodes, index_of_id, degrees};
+    parallel_for(0, view.num_nodes, 1024, graph_view_fill, &build);
+
+    // Close the gaps left by duplicates and links that vanished while copying.
+    long long packed = 0;
+    for (int i = 0; i < view.num_nodes; i++)
+    {
+        long long start = view.offsets[i];
+        view.offsets[i] = packed;
+        memmove(view.neighbours + packed, view.neighbours + start, degrees[i] * sizeof(int));
+        packed += degrees[i];
+    }
+    view.offsets[view.num_nodes] = packed;
+    view.num_edges = packed;
+
+    view.index_of_id = index_of_id;
+    free(degrees);
+    return view;
+}
+
+void free_graph_view(GraphView *view)
+{
+    free(view->nodes);
+    free(view->ids);
+    free(view->types);
+    free(view->offsets);
+    free(view->neighbours);
+    free(view->index_of_id);
+    memset(view, 0, sizeof(*view));
+}
+
+// Function to write the elements common to two sorted, duplicate free int arrays to out (which may be NULL), returns how many there are
+int intersect_sorted(const int *a, int na, const int *b, int nb, int *out)
+{
+    int i = 0, j = 0, count = 0;
+
+#ifdef __SSE2__
+    // Compare 4 elements of a with all 4 rotations of a block of b, then advance the block with the smaller maximum.
+    while (i + 4 <= na && j + 4 <= nb)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+                                       _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(matches));
+
+        if (mask)
+        {
+            if (out)
+            {
+                for (int k = 0; k < 4; k++)
+                {
+                    if (mask & (1 << k))
+                    {
+                        out[count++] = a[i + k];
+                    }
+                }
+            }
+            else
+            {
+                count += __builtin_popcount(mask);
+            }
+        }
+
+        int a_max = a[i + 3], b_max = b[j + 3];
+        if (a_max <= b_max)
+        {
+            i += 4;
+        }
+        if (b_max <= a_max)
+        {
+            j += 4;
+        }
+    }
+#endif
+
+    while (i < na && j < nb)
+    {
+        if (a[i] < b[j])
+        {
+            i++;
+        }
+        else if (a[i] > b[j])
+        {
+            j++;
+        }
+        else
+        {
+            if (out)
+            {
+                out[count] = a[i];
+            }
+            count++;
+            i++;
+            j++;
+        }
+    }
+    return count;
+}
+
+// Keeps the k best (score, value) pairs seen, as a min-heap on score; ties prefer the smaller value.
+typedef struct TopK
+{
+    double *scores;
+    long *values;
+    int size;
+    int capacity;
+} TopK;
+
+static void topk_init(TopK *top, int k)
+{
+    top->capacity = k > 0 ? k : 0;
+    top->size = 0;
+    top->scores = malloc((top->capacity + 1) * sizeof(double));
+    top->values = malloc((top->capacity + 1) * sizeof(long));
+}
+
+static void topk_free(TopK *top)
+{
+    free(top->scores);
+    free(top->values);
+}
+
+// Returns 1 if (score a, value a) ranks below (score b, value b)
+static int topk_worse(double score_a, long value_a, double score_b, long value_b)
+{
+    return score_a < score_b || (score_a == score_b && value_a > value_b);
+}
+
+static void topk_sift_down(TopK *top, int position)
+{
+    while (1)
+    {
+        int smallest = position, left = 2 * position + 1, right = left + 1;
+        if (left < top->size && topk_worse(top->scores[left], top->values[left], top->scores[smallest], top->values[smallest]))
+        {
+            smallest = left;
+        }
+        if (right < top->size && topk_worse(top->scores[right], top->values[right], top->scores[smallest], top->values[smallest]))
+        {
+            smallest = right;
+        }
+        if (smallest == position)
+        {
+            return;
+        }
+        double score = top->scores[position];
+        long value = top->values[position];
+        top->scores[position] = top->scores[smallest];
+        top->values[position] = top->values[smallest];
+        top->scores[smallest] = score;
+        top->values[smallest] = value;
+        position = smallest;
+    }
+}
+
+// Returns the lowest score in a full TopK, what a new score has to beat
+static double topk_threshold(TopK *top)
+{
+    return top->scores[0];
+}
+
+static void topk_push(TopK *top, double score, long value)
+{
+    if (top->capacity == 0)
+    {
+        return;
+    }
+    if (top->size < top->capacity)
+    {
+        int position = top->size++;
+        top->scores[position] = score;
+        top->values[position] = value;
+        while (position > 0)
+        {
+            int parent = (position - 1) / 2;
+            if (!topk_worse(top->scores[position], top->values[position], top->scores[parent], top->values[parent]))
+            {
+                break;
+            }
+            double swap_score = top->scores[parent];
+            long swap_value = top->values[parent];
+            top->scores[parent] = top->scores[position];
+            top->values[parent] = top->values[position];
+            top->scores[position] = swap_score;
+            top->values[position] = swap_value;
+            position = parent;
+        }
+    }
+    else if (topk_worse(top->scores[0], top->values[0], score, value))
+    {
+        top->scores[0] = score;
+        top->values[0] = value;
+        topk_sift_down(top, 0);
+    }
+}
+
+// Function to empty a top k into arrays ordered best first, returns how many there were
+static int topk_drain(TopK *top, double *scores, long *values)
+{
+    int count = top->size;
+    for (int i = count - 1; i >= 0; i--)
+    {
+        scores[i] = top->scores[0];
+        values[i] = top->values[0];
+        top->size--;
+        top->scores[0] = top->scores[top->size];
+        top->values[0] = top->values[top->size];
+        topk_sift_down(top, 0);
+    }
+    return count;
+}
+
+// Function to turn a top k of node ids into a RankedResult, must be called inside a read section
+static RankedResult ranked_result_from_ids(TopK *top)
+{
+    RankedResult result;
+    long *ids = malloc((top->size + 1) * sizeof(long));
+    result.scores = malloc((top->size + 1) * sizeof(double));
+    result.nodes = malloc((top->size + 1) * sizeof(Node *));
+    int count = topk_drain(top, result.scores, ids);
+
+    result.size = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Node *node = find_node_by_id((int)ids[i]);
+        if (node)
+        {
+            result.scores[result.size] = result.scores[i];
+            result.nodes[result.size++] = node;
+        }
+    }
+    free(ids);
+    return result;
+}
+
+void free_ranked_result(RankedResult *result)
+{
+    free(result->nodes);
+    free(result->scores);
+    result->nodes = NULL;
+    result->scores = NULL;
+    result->size = 0;
+}
+
+// Function to collect the sorted, duplicate free ids of a node's links
+static int sorted_link_ids(Node *node, int **ids)
+{
+    LinkCursor cursor;
+    Node **links;
+    int num_links;
+    int count = 0, capacity = __atomic_load_n(&node->num_links, __ATOMIC_ACQUIRE) + 1;
+    *ids = malloc(capacity * sizeof(int));
+    start_links(&cursor, node, -1);
+    while ((num_links = next_links(&cursor, &links)) > 0)
+    {
+        for (int i = 0; i < num_links; i++)
+        {
+            if (!links[i])
+            {
+                continue;
+            }
+            // A snapshot can see more links than the node has now.
+            if (count == capacity)
+            {
+                capacity *= 2;
+                *ids = realloc(*ids, capacity * sizeof(int));
+            }
+            (*ids)[count++] = links[i]->id;
+        }
+    }
+    return sort_unique(*ids, count);
+}
+
+// Returns the number of distinct nodes linked to a node, its degree in a GraphView
+static int distinct_link_count(Node *node)
+{
+    int *ids;
+    int count = sorted_link_ids(node, &ids);
+    free(ids);
+    return count;
+}
+
+// Function to recommend individuals to the named individual by their mutual links
+RankedResult recommend_people(char *name, int k, int adamic_adar)
+{
+    METRIC_SCOPE(recommend_people);
+    RankedResult result = {NULL, NULL, 0};
+
+    begin_read();
+    Node *user = find_first_node(name, "I");
+    if (!user)
+    {
+        end_read();
+        return result;
+    }
+
+    int *user_links;
+    int num_user_links = sorted_link_ids(user, &user_links);
+
+    // Candidates are the individuals two hops away, hubs are not expanded.
+    int *candidates = NULL;
+    int num_candidates = 0, candidates_capacity = 0;
+    LinkCursor cursor;
+    Node **links;
+    int num_links;
+    start_links(&cursor, user, -1);
+    while ((num_links = next_links(&cursor, &links)) > 0)
+    {
+        for (int i = 0; i < num_links; i++)
+        {
+            // Degrees count distinct nodes as in recommend_all_people(), links can repeat a node with another role.
+            if (!links[i] || (__atomic_load_n(&links[i]->num_links, __ATOMIC_ACQUIRE) > RECOMMEND_HUB_CAP &&
+                              distinct_link_count(links[i]) > RECOMMEND_HUB_CAP))
+            {
+                continue;
+            }
+
+            LinkCursor second_cursor;
+            Node **second;
+            int num_second;
+            start_links(&second_cursor, links[i], -1);
+            while ((num_second = next_links(&second_cursor, &second)) > 0)
+            {
+                for (int j = 0; j < num_second; j++)
+                {
+                    Node *candidate = second[j];
+                    if (!candidate || candidate == user || candidate->type != 'I')
+                    {
+                        continue;
+                    }
+                    if (num_candidates == candidates_capacity)
+                    {
+                        candidates_capacity = candidates_capacity ? candidates_capacity * 2 : 64;
+                        candidates = realloc(candidates, candidates_capacity * sizeof(int));
+                    }
+                    candidates[num_candidates++] = candidate->id;
+                }
+            }
+        }
+    }
+    num_candidates = sort_unique(candidates, num_candidates);
+
+    TopK top;
+    topk_init(&top, k);
+    int *common = malloc((num_user_links + 1) * sizeof(int));
+    for (int i = 0; i < num_candidates; i++)
+    {
+        if (bsearch(&candidates[i], user_links, num_user_links, sizeof(int), compare_ints))
+        {
+            continue; // Already linked.
+        }
+
+        Node *candidate = find_node_by_id(candidates[i]);
+        if (!candidate)
+        {
+            continue;
+        }
+        int *candidate_links;
+        int num_candidate_links = sorted_link_ids(candidate, &candidate_links);
+
+        double score;
+        if (adamic_adar)
+        {
+            int num_common = intersect_sorted(user_links, num_user_links, candidate_links, num_candidate_links, common);
+            score = 0;
+            for (int j = 0; j < num_common; j++)
+            {
+                Node *mutual = find_node_by_id(common[j]);
+                int degree = mutual ? distinct_link_count(mutual) : 0;
+                score += degree > 1 ? 1.0 / log(degree) : 1.0 / log(2);
+            }
+        }
+        else
+        {
+            score = intersect_sorted(user_links, num_user_links, candidate_links, num_candidate_links, NULL);
+        }
+        free(candidate_links);
+
+        if (score > 0)
+        {
+            topk_push(&top, score, candidates[i]);
+        }
+    }
+
+    result = ranked_result_from_ids(&top);
+    end_read();
+
+    topk_free(&top);
+    free(common);
+    free(candidates);
+    free(user_links);
+    return result;
+}
+
+// State of a batch recommendation run.
+typedef struct RecommendBatch
+{
+    GraphView *view;
+    int k;
+    int adamic_adar;
+    double *inverse_log_degree;
+    long first_user;
+    Buffer *chunks;      // One output buffer per chunk of users
+    int **stamps;        // Per thread: stamps[v] == u + 1 marks v as a candidate of u
+    int **candidates;    // Per thread candidate lists
+} RecommendBatch;
+
+#define RECOMMEND_BATCH_CHUNK 256
+
+static void recommend_batch_range(void *context, long begin, long end, int thread)
+{
+    RecommendBatch *batch = context;
+    GraphView *view = batch->view;
+    int *stamps = batch->stamps[thread];
+    int *candidates = batch->candidates[thread];
+    Buffer *out = &batch->chunks[(begin - batch->first_user) / RECOMMEND_BATCH_CHUNK];
+    TopK top;
+    topk_init(&top, batch->k);
+    double *scores = malloc((batch->k + 1) * sizeof(double));
+    long *values = malloc((batch->k + 1) * sizeof(long));
+    int *common = NULL;
+    int common_capacity = 0;
+
+    for (long u = begin; u < end; u++)
+    {
+        if (view->types[u] != 'I')
+        {
+            continue;
+        }
+
+        const int *user_links = view->neighbours + view->offsets[u];
+        int num_user_links = (int)(view->offsets[u + 1] - view->offsets[u]);
+        int num_candidates = 0;
+
+        // Mark the user and their links so they are not candidates.
+        stamps[u] = (int)u + 1;
+        for (int i = 0; i < num_user_links; i++)
+        {
+            stamps[user_links[i]] = (int)u + 1;
+        }
+        for (int i = 0; i < num_user_links; i++)
+        {
+            int v = user_links[i];
+            long long degree = view->offsets[v + 1] - view->offsets[v];
+            if (degree > RECOMMEND_HUB_CAP)
+            {
+                continue;
+            }
+            for (long long j = view->offsets[v]; j < view->offsets[v + 1]; j++)
+            {
+                int w = view->neighbours[j];
+                if (stamps[w] != (int)u + 1 && view->types[w] == 'I')
+                {
+                    stamps[w] = (int)u + 1;
+                    candidates[num_candidates++] = w;
+                }
+            }
+        }
+
+        if (batch->adamic_adar && common_capacity < num_user_links)
+        {
+            common_capacity = num_user_links;
+            common = realloc(common, common_capacity * sizeof(int));
+        }
+
+        for (int i = 0; i < num_candidates; i++)
+        {
+            int w = candidates[i];
+            const int *candidate_links = view->neighbours + view->offsets[w];
+            int num_candidate_links = (int)(view->offsets[w + 1] - view->offsets[w]);
+            double score;
+            if (batch->adamic_adar)
+            {
+                int num_common = intersect_sorted(user_links, num_user_links, candidate_links, num_candidate_links, common);
+                score = 0;
+                for (int j = 0; j < num_common; j++)
+                {
+                    score += batch->inverse_log_degree[common[j]];
+                }
+            }
+            else
+            {
+                score = intersect_sorted(user_links, num_user_links, candidate_links, num_candidate_links, NULL);
+            }
+            if (score > 0)
+            {
+                topk_push(&top, score, view->ids[w]);
+            }
+        }
+
+        int count = topk_drain(&top, scores, values);
+        buffer_printf(out, "%s", view->nodes[u]->name);
+        for (int i = 0; i < count; i++)
+        {
+            Node *candidate = view->nodes[view->index_of_id[values[i]]];
+            buffer_printf(out, batch->adamic_adar ? "\t%s:%.4f" : "\t%s:%.0f", candidate->name, scores[i]);
+        }
+        buffer_append(out, "\n", 1);
+    }
+
+    free(common);
+    free(scores);
+    free(values);
+    topk_free(&top);
+}
+
+// Function to precompute recommendations for every individual in parallel, writing one line per individual to path
+int recommend_all_people(const char *path, int k, int adamic_adar)
+{
+    METRIC_SCOPE(recommend_all_people);
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    begin_read();
+    GraphView view = build_graph_view();
+    int threads = num_worker_threads();
+
+    RecommendBatch batch;
+    batch.view = &view;
+    batch.k = k;
+    batch.adamic_adar = adamic_adar;
+    batch.inverse_log_degree = malloc((view.num_nodes + 1) * sizeof(double));
+    for (int i = 0; i < view.num_nodes; i++)
+    {
+        long long degree = view.offsets[i + 1] - view.offsets[i];
+        batch.inverse_log_degree[i] = degree > 1 ? 1.0 / log((double)degree) : 1.0 / log(2);
+    }
+    batch.stamps = malloc(threads * sizeof(int *));
+    batch.candidates = malloc(threads * sizeof(int *));
+    for (int t = 0; t < threads; t++)
+    {
+        batch.stamps[t] = calloc(view.num_nodes + 1, sizeof(int));
+        batch.candidates[t] = malloc((view.num_nodes + 1) * sizeof(int));
+    }
+
+    // Users are processed in windows of chunks, each window's buffers are written in order before the next one starts.
+    long window = (long)RECOMMEND_BATCH_CHUNK * threads * 4;
+    int chunks_per_window = (int)(window / RECOMMEND_BATCH_CHUNK);
+    batch.chunks = calloc(chunks_per_window, sizeof(Buffer));
+    for (long first = 0; first < view.num_nodes; first += window)
+    {
+        long last = first + window < view.num_nodes ? first + window : view.num_nodes;
+        batch.first_user = first;
+        parallel_for(first, last, RECOMMEND_BATCH_CHUNK, recommend_batch_range, &batch);
+
+        for (int c = 0; c < chunks_per_window; c++)
+        {
+            if (batch.chunks[c].length)
+            {
+                fwrite(batch.chunks[c].data, 1, batch.chunks[c].length, file);
+            }
+            batch.chunks[c].length = 0;
+        }
+    }
+    int written = 0;
+    for (long u = 0; u < view.num_nodes; u++)
+    {
+        written += view.types[u] == 'I';
+    }
+    end_read();
+
+    for (int t = 0; t < threads; t++)
+    {
+        free(batch.stamps[t]);
+        free(batch.candidates[t]);
+    }
+    for (int c = 0; c < chunks_per_window; c++)
+    {
+        free(batch.chunks[c].data);
+    }
+    free(batch.chunks);
+    free(batch.stamps);
+    free(batch.candidates);
+    free(batch.inverse_log_degree);
+    free_graph_view(&view);
+
+    if (fclose(file) != 0)
+    {
+        printf("Failed to write %s\n", path);
+        return -1;
+    }
+    return written;
+}
+
+/*
+    Export:
+
+    export_network() streams every node to a file as an edge list, JSON Lines or GraphML. Nodes are formatted in chunks of
+    EXPORT_CHUNK on all worker threads, each chunk into its own buffer, with hand-written integer and number formatting.
+    Chunks are formatted a window at a time; a writer thread writes one window's buffers in order while the workers
+    format the next window into a second set of buffers. Everything is read inside one read section, so the file is a
+    consistent snapshot as far as each node goes (nodes and links added during the export may or may not be in it).
+*/
+
+#define EXPORT_CHUNK 1024
+
+typedef struct ExportBatch
+{
+    Node **nodes;
+    int format;
+    long first;     // First node of the window being formatted
+    Buffer *chunks; // Buffers of the window being formatted
+} ExportBatch;
+
+typedef struct ExportWriter
+{
+    FILE *file;
+    Buffer *chunks;
+    int num_chunks;
+    int failed;
+    long long bytes;
+} ExportWriter;
+
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Function to append an integer in decimal, two digits at a time
+static void buffer_int(Buffer *out, long long value)
+{
+    char digits[24];
+    char *end = digits + sizeof(digits), *start = end;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    while (magnitude >= 100)
+    {
+        int pair = (int)(magnitude % 100) * 2;
+        magnitude /= 100;
+        *--start = digit_pairs[pair + 1];
+        *--start = digit_pairs[pair];
+    }
+    if (magnitude >= 10)
+    {
+        *--start = digit_pairs[magnitude * 2 + 1];
+        *--start = digit_pairs[magnitude * 2];
+    }
+    else
+    {
+        *--start = (char)('0' + magnitude);
+    }
+    if (value < 0)
+    {
+        *--start = '-';
+    }
+    buffer_append(out, start, end - start);
+}
+
+// Function to append a number with 6 decimals, like printf("%f") does for the numbers locations hold
+static void buffer_number(Buffer *out, double value)
+{
+    if (!(fabs(value) < 9e12))
+    {
+        buffer_printf(out, "%f", value); // Too big to scale, or not a number
+        return;
+    }
+    long long scaled = llround(value * 1e6);
+    if (scaled < 0)
+    {
+        buffer_append(out, "-", 1);
+        scaled = -scaled;
+    }
+    buffer_int(out, scaled / 1000000);
+    char decimals[7];
+    long long fraction = scaled % 1000000;
+    decimals[0] = '.';
+    for (int i = 6; i >= 1; i--)
+    {
+        decimals[i] = (char)('0' + fraction % 10);
+        fraction /= 10;
+    }
+    buffer_append(out, decimals, 7);
+}
+
+static void buffer_string(Buffer *out, const char *text)
+{
+    buffer_append(out, text, strlen(text));
+}
+
+// Function to append text as a quoted JSON string
+static void buffer_json_string(Buffer *out, const char *text)
+{
+    buffer_append(out, "\"", 1);
+    const char *run = text;
+    for (; *text; text++)
+    {
+        unsigned char c = (unsigned char)*text;
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+        buffer_append(out, run, text - run);
+        run = text + 1;
+        if (c == '"' || c == '\\')
+        {
+            char escaped[2] = {'\\', (char)c};
+            buffer_append(out, escaped, 2);
+        }
+        else
+        {
+            buffer_printf(out, "\\u%04x", c);
+        }
+    }
+    buffer_append(out, run, text - run);
+    buffer_append(out, "\"", 1);
+}
+
+// Function to append text with the XML special characters escaped. Control characters other than tab, newline and
+// carriage return cannot appear in XML 1.0 at all, not even as character references, so they become U+FFFD.
+static void buffer_xml_text(Buffer *out, const char *text)
+{
+    const char *run = text;
+    for (; *text; text++)
+    {
+        const char *entity;
+        switch (*text)
+        {
+        case '\t':
+        case '\n':
+        case '\r':
+            continue;
+        case '&':
+            entity = "&amp;";
+            break;
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        case '"':
+            entity = "&quot;";
+            break;
+        default:
+            if ((unsigned char)*text >= 0x20)
+            {
+                continue;
+            }
+            entity = "\xEF\xBF\xBD";
+            break;
+        }
+        buffer_append(out, run, text - run);
+        buffer_string(out, entity);
+        run = text + 1;
+    }
+    buffer_append(out, run, text - run);
+}
+
+// Returns 1 for the one direction of an edge that is exported: the first label of each pair, the lower id for co-members
+static int export_edge_direction(Node *node, Node *target, int label)
+{
+    int reverse = edge_reverse(label);
+    return label < reverse || (label == reverse && node->id < target->id);
+}
+
+static Location *node_location(Node *node)
+{
+    if (node->type == 'B')
+    {
+        return &((Business *)node)->location;
+    }
+    if (node->type == 'O')
+    {
+        return &((Organisation *)node)->location;
+    }
+    return NULL;
+}
+
+// Function to write one node's "id<TAB>id<TAB>label" edge lines
+static void export_edge_list(Buffer *out, Node *node)
+{
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        LinkCursor cursor;
+        Node **edges;
+        int num_edges;
+        start_links(&cursor, node, label);
+        while ((num_edges = next_links(&cursor, &edges)) > 0)
+        {
+            for (int i = 0; i < num_edges; i++)
+            {
+                if (edges[i] && export_edge_direction(node, edges[i], label))
+                {
+                    buffer_int(out, node->id);
+                    buffer_append(out, "\t", 1);
+                    buffer_int(out, edges[i]->id);
+                    buffer_append(out, "\t", 1);
+                    buffer_string(out, edge_label_name(label));
+                    buffer_append(out, "\n", 1);
+                }
+            }
+        }
+    }
+}
+
+// Function to write a node as one JSON object on one line, with the ids it links to by label and its content
+static void export_json_line(Buffer *out, Node *node)
+{
+    char type[2] = {node->type, '\0'};
+    buffer_string(out, "{\"id\":");
+    buffer_int(out, node->id);
+    buffer_string(out, ",\"type\":");
+    buffer_json_string(out, type);
+    buffer_string(out, ",\"name\":");
+    buffer_json_string(out, node->name);
+    buffer_string(out, ",\"created\":");
+    buffer_int(out, node->created);
+
+    if (node->type == 'I' && ((Individual *)node)->birthday.day != -1)
+    {
+        Birthday *birthday = &((Individual *)node)->birthday;
+        buffer_string(out, ",\"birthday\":{\"day\":");
+        buffer_int(out, birthday->day);
+        buffer_string(out, ",\"month\":");
+        buffer_int(out, birthday->month);
+        buffer_string(out, ",\"year\":");
+        buffer_int(out, birthday->year);
+        buffer_append(out, "}", 1);
+    }
+    Location *location = node_location(node);
+    if (location)
+    {
+        buffer_string(out, ",\"location\":{\"x\":");
+        buffer_number(out, location->x);
+        buffer_string(out, ",\"y\":");
+        buffer_number(out, location->y);
+        buffer_append(out, "}", 1);
+    }
+
+    buffer_string(out, ",\"edges\":{");
+    int first_label = 1;
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        int first_edge = 1;
+        LinkCursor cursor;
+        Node **edges;
+        int num_edges;
+        start_links(&cursor, node, label);
+        while ((num_edges = next_links(&cursor, &edges)) > 0)
+        {
+            for (int i = 0; i < num_edges; i++)
+            {
+                if (!edges[i])
+                {
+                    continue;
+                }
+                if (first_edge)
+                {
+                    buffer_string(out, first_label ? "\"" : ",\"");
+                    buffer_string(out, edge_label_name(label));
+                    buffer_string(out, "\":[");
+                    first_label = first_edge = 0;
+                }
+                else
+                {
+                    buffer_append(out, ",", 1);
+                }
+                buffer_int(out, edges[i]->id);
+            }
+        }
+        if (!first_edge)
+        {
+            buffer_append(out, "]", 1);
+        }
+    }
+
+    buffer_string(out, "},\"content\":[");
+    PostCursor posts;
+    char **contents;
+    int num_contents, written = 0;
+    start_posts(&posts, node);
+    while ((num_contents = next_posts(&posts, &contents)) > 0)
+    {
+        for (int i = 0; i < num_contents; i++)
+        {
+            if (written++ > 0)
+            {
+                buffer_append(out, ",", 1);
+            }
+            buffer_json_string(out, contents[i]);
+        }
+    }
+    end_posts(&posts);
+    buffer_string(out, "]}\n");
+}
+
+// Function to write a node as a GraphML node element followed by its edges
+static void export_graphml(Buffer *out, Node *node)
+{
+    char type[2] = {node->type, '\0'};
+    buffer_string(out, "<node id=\"n");
+    buffer_int(out, node->id);
+    buffer_string(out, "\"><data key=\"type\">");
+    buffer_string(out, type);
+    buffer_string(out, "</data><data key=\"name\">");
+    buffer_xml_text(out, node->name);
+    buffer_string(out, "</data><data key=\"created\">");
+    buffer_int(out, node->created);
+    buffer_string(out, "</data>");
+
+    if (node->type == 'I' && ((Individual *)node)->birthday.day != -1)
+    {
+        Birthday *birthday = &((Individual *)node)->birthday;
+        buffer_string(out, "<data key=\"birthday\">");
+        buffer_int(out, birthday->day);
+        buffer_append(out, "-", 1);
+        buffer_int(out, birthday->month);
+        buffer_append(out, "-", 1);
+        buffer_int(out, birthday->year);
+        buffer_string(out, "</data>");
+    }
+    Location *location = node_location(node);
+    if (location)
+    {
+        buffer_string(out, "<data key=\"x\">");
+        buffer_number(out, location->x);
+        buffer_string(out, "</data><data key=\"y\">");
+        buffer_number(out, location->y);
+        buffer_string(out, "</data>");
+    }
+
+    // GraphML has one value per key, contents are joined one per line.
+    PostCursor posts;
+    char **contents;
+    int num_contents, written = 0;
+    start_posts(&posts, node);
+    while ((num_contents = next_posts(&posts, &contents)) > 0)
+    {
+        for (int i = 0; i < num_contents; i++)
+        {
+            buffer_string(out, written++ == 0 ? "<data key=\"content\">" : "\n");
+            buffer_xml_text(out, contents[i]);
+        }
+    }
+    end_posts(&posts);
+    if (written > 0)
+    {
+        buffer_string(out, "</data>");
+    }
+    buffer_string(out, "</node>\n");
+
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        LinkCursor cursor;
+        Node **edges;
+        int num_edges;
+        start_links(&cursor, node, label);
+        while ((num_edges = next_links(&cursor, &edges)) > 0)
+        {
+            for (int i = 0; i < num_edges; i++)
+            {
+                if (edges[i] && export_edge_direction(node, edges[i], label))
+                {
+                    buffer_string(out, "<edge source=\"n");
+                    buffer_int(out, node->id);
+                    buffer_string(out, "\" target=\"n");
+                    buffer_int(out, edges[i]->id);
+                    buffer_string(out, "\"><data key=\"label\">");
+                    buffer_string(out, edge_label_name(label));
+                    buffer_string(out, "</data></edge>\n");
+                }
+            }
+        }
+    }
+}
+
+static void export_range(void *context, long begin, long end, int thread)
+{
+    (void)thread;
+    ExportBatch *batch = context;
+    Buffer *out = &batch->chunks[(begin - batch->first) / EXPORT_CHUNK];
+    for (long i = begin; i < end; i++)
+    {
+        Node *node = batch->nodes[i];
+        if (!node)
+        {
+            continue;
+        }
+        if (batch->format == EXPORT_EDGE_LIST)
+        {
+            export_edge_list(out, node);
+        }
+        else if (batch->format == EXPORT_JSON_LINES)
+        {
+            export_json_line(out, node);
+        }
+        else
+        {
+            export_graphml(out, node);
+        }
+    }
+}
+
+// Thread writing the buffers of one window in order
+static void *export_writer(void *argument)
+{
+    ExportWriter *writer = argument;
+    for (int c = 0; c < writer->num_chunks; c++)
+    {
+        if (writer->chunks[c].length && fwrite(writer->chunks[c].data, 1, writer->chunks[c].length, writer->file) != writer->chunks[c].length)
+        {
+            writer->failed = 1;
+        }
+        writer->bytes += writer->chunks[c].length;
+        writer->chunks[c].length = 0;
+    }
+    return NULL;
+}
+
+static const char *export_format_names[] = {"edges", "jsonl", "graphml"};
+
+// Returns the EXPORT_* format with the given name, or -1
+int export_format_by_name(const char *name)
+{
+    for (int format = EXPORT_EDGE_LIST; format <= EXPORT_GRAPHML; format++)
+    {
+        if (strcmp(name, export_format_names[format]) == 0)
+        {
+            return format;
+        }
+    }
+    return -1;
+}
+
+// Function to write every node to an unbuffered file in one of the EXPORT_* formats, as of the snapshot of the caller's
+// read section if there is one. Returns the number of nodes written or -1, and adds the bytes written to bytes.
+static int export_nodes(FILE *file, int format, long long *bytes)
+{
+    int failed = 0;
+    if (format == EXPORT_GRAPHML)
+    {
+        static const char header[] =
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n"
+            "<key id=\"type\" for=\"node\" attr.name=\"type\" attr.type=\"string\"/>\n"
+            "<key id=\"name\" for=\"node\" attr.name=\"name\" attr.type=\"string\"/>\n"
+            "<key id=\"created\" for=\"node\" attr.name=\"created\" attr.type=\"long\"/>\n"
+            "<key id=\"birthday\" for=\"node\" attr.name=\"birthday\" attr.type=\"string\"/>\n"
+            "<key id=\"x\" for=\"node\" attr.name=\"x\" attr.type=\"double\"/>\n"
+            "<key id=\"y\" for=\"node\" attr.name=\"y\" attr.type=\"double\"/>\n"
+            "<key id=\"content\" for=\"node\" attr.name=\"content\" attr.type=\"string\"/>\n"
+            "<key id=\"label\" for=\"edge\" attr.name=\"label\" attr.type=\"string\"/>\n"
+            "<graph id=\"social\" edgedefault=\"directed\">\n";
+        failed |= fwrite(header, 1, sizeof(header) - 1, file) != sizeof(header) - 1;
+        *bytes += sizeof(header) - 1;
+    }
+
+    begin_read();
+    ExportBatch batch;
+    int count = read_all_nodes(&batch.nodes);
+    batch.format = format;
+
+    // Two sets of buffers: the workers fill one while the writer thread empties the other.
+    long window = (long)EXPORT_CHUNK * num_worker_threads() * 4;
+    int chunks_per_window = (int)(window / EXPORT_CHUNK);
+    Buffer *sets[2] = {calloc(chunks_per_window, sizeof(Buffer)), calloc(chunks_per_window, sizeof(Buffer))};
+    ExportWriter writers[2];
+    pthread_t threads[2];
+    int writing[2] = {0, 0};
+    int set = 0;
+    for (long first = 0; first < count; first += window, set ^= 1)
+    {
+        long last = first + window < count ? first + window : count;
+        batch.first = first;
+        batch.chunks = sets[set];
+        parallel_for(first, last, EXPORT_CHUNK, export_range, &batch);
+
+        // The previous window has to be in the file before this one goes.
+        if (writing[set ^ 1])
+        {
+            pthread_join(threads[set ^ 1], NULL);
+            failed |= writers[set ^ 1].failed;
+            *bytes += writers[set ^ 1].bytes;
+            writing[set ^ 1] = 0;
+        }
+        writers[set] = (ExportWriter){file, sets[set], chunks_per_window, 0, 0};
+        if (pthread_create(&threads[set], NULL, export_writer, &writers[set]) == 0)
+        {
+            writing[set] = 1;
+        }
+        else
+        {
+            export_writer(&writers[set]);
+            failed |= writers[set].failed;
+            *bytes += writers[set].bytes;
+        }
+    }
+    for (int s = 0; s < 2; s++)
+    {
+        if (writing[s])
+        {
+            pthread_join(threads[s], NULL);
+            failed |= writers[s].failed;
+            *bytes += writers[s].bytes;
+        }
+    }
+
+    int written = 0;
+    for (int i = 0; i < count; i++)
+    {
+        written += batch.nodes[i] != NULL;
+    }
+    end_read();
+
+    for (int s = 0; s < 2; s++)
+    {
+        for (int c = 0; c < chunks_per_window; c++)
+        {
+            free(sets[s][c].data);
+        }
+        free(sets[s]);
+    }
+
+    if (format == EXPORT_GRAPHML)
+    {
+        static const char footer[] = "</graph>\n</graphml>\n";
+        failed |= fwrite(footer, 1, sizeof(footer) - 1, file) != sizeof(footer) - 1;
+        *bytes += sizeof(footer) - 1;
+    }
+    return failed ? -1 : written;
+}
+
+// Function to write the whole network to path in one of the EXPORT_* formats, returns the number of nodes written or -1
+int export_network(const char *path, int format)
+{
+    METRIC_SCOPE(export_network);
+    if (format < EXPORT_EDGE_LIST || format > EXPORT_GRAPHML)
+    {
+        printf("Unknown export format\n");
+        return -1;
+    }
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+    setvbuf(file, NULL, _IONBF, 0); // Writes are already large.
+
+    long long bytes = 0;
+    int written = export_nodes(file, format, &bytes);
+    if (fclose(file) != 0 || written < 0)
+    {
+        printf("Failed to write %s\n", path);
+        return -1;
+    }
+    return written;
+}
+
+/*
+    Ingestion:
+
+    ingest_post(), ingest_member() and ingest_owner_or_customer() queue a mutation instead of applying it, from any number
+    of threads, and an applier thread (started by the first of them) applies the queue in batches of up to INGEST_BATCH.
+    The queue is a ring of INGEST_QUEUE_SIZE cells, each with a sequence number: a producer claims the cell at the tail
+    with a compare and swap and publishes its record by moving the cell's sequence on, the applier takes cells from the
+    head as their sequence shows them published. Nothing is locked on the way in; when the ring is full the push fails
+    and the producer sees it (backpressure), there is no unbounded backlog.
+    A batch is sorted by target node (in queue order for each node), room is made in the arrays of each target once
+    for all of its records, and the whole batch is applied in one write section: readers see all of it or none of it,
+    and mutations of different nodes within a batch can be applied in another order than they were queued. Records
+    hold node ids, a node deleted before its records are applied makes them fail. The applier sleeps on a condition
+    variable when the ring is empty, producers only signal it when it does.
+*/
+
+enum
+{
+    INGEST_POST,
+    INGEST_MEMBER,
+    INGEST_OWNER,
+    INGEST_CUSTOMER
+};
+
+typedef struct IngestRecord
+{
+    int kind;
+    int target;        // Id of the node whose arrays change: the poster, the group or organisation, the business
+    int other;         // Id of the member, owner or customer
+    char *content;     // Copy of the content of a post
+    long long queued;  // When the record was queued, for the latency stats
+    unsigned long order;
+} IngestRecord;
+
+typedef struct IngestCell
+{
+    unsigned long sequence; // Position it can be written at, or position + 1 once its record is published
+    IngestRecord record;
+} IngestCell;
+
+#define INGEST_LATENCY_BUCKETS 48
+
+typedef struct Ingest
+{
+    IngestCell *cells;
+    char padding_before[64];
+    unsigned long tail; // Next position producers claim
+    char padding_after[64];
+    unsigned long head; // Next position the applier takes, only used by the applier
+    int sleeping;       // Set while the applier waits for records
+    IngestStats stats;
+    unsigned long long latencies[INGEST_LATENCY_BUCKETS]; // Queue to applied, by power of two of nanoseconds
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;   // Signalled when records are queued while the applier sleeps
+    pthread_cond_t applied; // Broadcast after each batch
+} Ingest;
+
+static Ingest ingest = {.mutex = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER, .applied = PTHREAD_COND_INITIALIZER};
+static pthread_once_t ingest_once = PTHREAD_ONCE_INIT;
+
+static int compare_ingest_records(const void *a, const void *b)
+{
+    const IngestRecord *x = a, *y = b;
+    if (x->target != y->target)
+    {
+        return x->target < y->target ? -1 : 1;
+    }
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+// Function to apply one record to its target, returns 0 on success. Must be called inside a write section.
+static int ingest_apply(IngestRecord *record, Node *target)
+{
+    if (record->kind == INGEST_POST)
+    {
+        char *interned = intern_content(record->content);
+        if (!interned)
+        {
+            return -1;
+        }
+        int status = append_content(target, interned);
+        release_content(interned);
+        return status;
+    }
+
+    Node *other = find_node_by_id(record->other);
+    if (!other)
+    {
+        return -1;
+    }
+    if (record->kind == INGEST_MEMBER)
+    {
+        return add_member(target, other);
+    }
+    if (target->type != 'B' || other->type != 'I')
+    {
+        return -1;
+    }
+    return add_owner_or_customer((Business *)target, (Individual *)other, record->kind == INGEST_OWNER ? 'O' : 'C');
+}
+
+// Function to apply a batch of records sorted by target in one write section, returns the number that failed
+static int ingest_apply_batch(IngestRecord *batch, int count)
+{
+    int failed = 0;
+    begin_write();
+    for (int first = 0; first < count;)
+    {
+        int last = first;
+        int kinds[INGEST_CUSTOMER + 1] = {0};
+        while (last < count && batch[last].target == batch[first].target)
+        {
+            kinds[batch[last].kind]++;
+            last++;
+        }
+
+        Node *target = find_node_by_id(batch[first].target);
+        if (!target)
+        {
+            failed += last - first;
+            first = last;
+            continue;
+        }
+
+        // The arrays of the node grow once for its whole run of records, the content array up to the two windows it keeps.
+        int room = 2 * TIMELINE_WINDOW - target->num_contents;
+        if (kinds[INGEST_POST] > 1 && room > 1)
+        {
+            array_reserve((void ***)&target->content, &target->num_contents, kinds[INGEST_POST] < room ? kinds[INGEST_POST] : room);
+        }
+        if (!compressed_links && last - first - kinds[INGEST_POST] > 1)
+        {
+            static const int labels[] = {-1, EDGE_MEMBER, EDGE_OWNER, EDGE_CUSTOMER};
+            array_reserve((void ***)&target->links, &target->num_links, last - first - kinds[INGEST_POST]);
+            for (int kind = INGEST_MEMBER; kind <= INGEST_CUSTOMER; kind++)
+            {
+                if (kinds[kind] > 1)
+                {
+                    array_reserve((void ***)&target->edges[labels[kind]], &target->num_edges[labels[kind]], kinds[kind]);
+                }
+            }
+        }
+
+        for (int i = first; i < last; i++)
+        {
+            failed += ingest_apply(&batch[i], target) != 0;
+        }
+        first = last;
+    }
+    end_write();
+    return failed;
+}
+
+// Returns the latency bucket of a duration: the number of bits of its nanoseconds
+static int ingest_latency_bucket(long long ns)
+{
+    int bucket = ns > 0 ? 64 - __builtin_clzll((unsigned long long)ns) : 0;
+    return bucket < INGEST_LATENCY_BUCKETS ? bucket : INGEST_LATENCY_BUCKETS - 1;
+}
+
+// Thread applying the queued records
+static void *ingest_thread(void *argument)
+{
+    (void)argument;
+    IngestRecord *batch = malloc(INGEST_BATCH * sizeof(IngestRecord));
+    while (1)
+    {
+        int count = 0;
+        while (count < INGEST_BATCH)
+        {
+            IngestCell *cell = &ingest.cells[ingest.head & (INGEST_QUEUE_SIZE - 1)];
+            if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != ingest.head + 1)
+            {
+                break;
+            }
+            batch[count] = cell->record;
+            batch[count].order = ingest.head;
+            count++;
+            __atomic_store_n(&cell->sequence, ingest.head + INGEST_QUEUE_SIZE, __ATOMIC_RELEASE);
+            ingest.head++;
+        }
+
+        if (count == 0)
+        {
+            // Producers check sleeping after publishing, and the queue is checked again after setting it, so no
+            // record is left waiting. The timeout only bounds the cost of a missed signal.
+            pthread_mutex_lock(&ingest.mutex);
+            __atomic_store_n(&ingest.sleeping, 1, __ATOMIC_SEQ_CST);
+            IngestCell *cell = &ingest.cells[ingest.head & (INGEST_QUEUE_SIZE - 1)];
+            if (__atomic_load_n(&cell->sequence, __ATOMIC_SEQ_CST) != ingest.head + 1)
+            {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_nsec += 10000000;
+                if (deadline.tv_nsec >= 1000000000)
+                {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000;
+                }
+                pthread_cond_timedwait(&ingest.ready, &ingest.mutex, &deadline);
+            }
+            __atomic_store_n(&ingest.sleeping, 0, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&ingest.mutex);
+            continue;
+        }
+
+        qsort(batch, count, sizeof(IngestRecord), compare_ingest_records);
+        int failed = ingest_apply_batch(batch, count);
+        long long applied = now_ns();
+
+        pthread_mutex_lock(&ingest.mutex);
+        for (int i = 0; i < count; i++)
+        {
+            long long latency = applied - batch[i].queued;
+            ingest.latencies[ingest_latency_bucket(latency)]++;
+            if (latency > ingest.stats.max_latency_ns)
+            {
+                ingest.stats.max_latency_ns = latency;
+            }
+            free(batch[i].content);
+        }
+        ingest.stats.applied += count - failed;
+        ingest.stats.failed += failed;
+        ingest.stats.batches++;
+        if (count > ingest.stats.max_batch)
+        {
+            ingest.stats.max_batch = count;
+        }
+        pthread_cond_broadcast(&ingest.applied);
+        pthread_mutex_unlock(&ingest.mutex);
+    }
+    return NULL;
+}
+
+static void start_ingest()
+{
+    ingest.cells = malloc(INGEST_QUEUE_SIZE * sizeof(IngestCell));
+    if (!ingest.cells)
+    {
+        return;
+    }
+    for (unsigned long i = 0; i < INGEST_QUEUE_SIZE; i++)
+    {
+        ingest.cells[i].sequence = i;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ingest_thread, NULL) != 0)
+    {
+        free(ingest.cells);
+        ingest.cells = NULL;
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// Function to queue a record, returns 0 or -1 if the queue is full
+static int ingest_push(int kind, int target, int other, char *content)
+{
+    pthread_once(&ingest_once, start_ingest);
+    if (!ingest.cells)
+    {
+        return -1;
+    }
+
+    IngestRecord record = {kind, target, other, content ? strdup(content) : NULL, now_ns(), 0};
+    if (content && !record.content)
+    {
+        report("Failed to allocate memory for queued content.\n");
+        return -1;
+    }
+
+    unsigned long position = __atomic_load_n(&ingest.tail, __ATOMIC_RELAXED);
+    IngestCell *cell;
+    while (1)
+    {
+        cell = &ingest.cells[position & (INGEST_QUEUE_SIZE - 1)];
+        long difference = (long)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - position);
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&ingest.tail, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // The cell still holds the record of a lap ago, the applier is a whole queue behind.
+            __atomic_fetch_add(&ingest.stats.rejected, 1, __ATOMIC_RELAXED);
+            free(record.content);
+            return -1;
+        }
+        else
+        {
+            position = __atomic_load_n(&ingest.tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->record = record;
+    __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&ingest.stats.queued, 1, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&ingest.sleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&ingest.mutex);
+        pthread_cond_signal(&ingest.ready);
+        pthread_mutex_unlock(&ingest.mutex);
+    }
+    return 0;
+}
+
+// Function to queue a post of content by a node, returns 0 or -1 if the queue is full
+int ingest_post(Node *node, char *content)
+{
+    METRIC_SCOPE(ingest_post);
+    return ingest_push(INGEST_POST, node->id, 0, content);
+}
+
+// Function to queue adding a member to a group or organisation, returns 0 or -1 if the queue is full
+int ingest_member(Node *group_or_org, Node *new_member)
+{
+    METRIC_SCOPE(ingest_member);
+    return ingest_push(INGEST_MEMBER, group_or_org->id, new_member->id, NULL);
+}
+
+// Function to queue adding an owner (role 'O') or customer ('C') to a business, returns 0 or -1 if the queue is full
+int ingest_owner_or_customer(Business *business, Individual *new_owner_or_customer, char role)
+{
+    METRIC_SCOPE(ingest_owner_or_customer);
+    if (role != 'O' && role != 'C')
+    {
+        report("Invalid role. Role must be 'O' for owner or 'C' for customer.\n");
+        return -1;
+    }
+    return ingest_push(role == 'O' ? INGEST_OWNER : INGEST_CUSTOMER, business->node.id, new_owner_or_customer->node.id, NULL);
+}
+
+// Function to wait until every record queued before the call is applied
+void ingest_flush()
+{
+    long long queued = __atomic_load_n(&ingest.stats.queued, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&ingest.mutex);
+    while (ingest.cells && ingest.stats.applied + ingest.stats.failed < queued)
+    {
+        pthread_cond_wait(&ingest.applied, &ingest.mutex);
+    }
+    pthread_mutex_unlock(&ingest.mutex);
+}
+
+// Function to get the ingestion counters, batch sizes and queue to applied latencies
+void ingest_stats(IngestStats *stats)
+{
+    pthread_mutex_lock(&ingest.mutex);
+    *stats = ingest.stats;
+    stats->queued = __atomic_load_n(&ingest.stats.queued, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&ingest.stats.rejected, __ATOMIC_RELAXED);
+    stats->waiting = stats->queued - stats->applied - stats->failed;
+    stats->mean_batch = stats->batches ? (double)(stats->applied + stats->failed) / stats->batches : 0;
+
+    // Percentiles are given as the top of their power of two bucket.
+    unsigned long long total = 0, seen = 0;
+    for (int b = 0; b < INGEST_LATENCY_BUCKETS; b++)
+    {
+        total += ingest.latencies[b];
+    }
+    stats->p50_latency_ns = stats->p99_latency_ns = 0;
+    for (int b = 0; b < INGEST_LATENCY_BUCKETS && total; b++)
+    {
+        seen += ingest.latencies[b];
+        if (!stats->p50_latency_ns && seen * 2 >= total)
+        {
+            stats->p50_latency_ns = 1LL << b;
+        }
+        if (!stats->p99_latency_ns && seen * 100 >= total * 99)
+        {
+            stats->p99_latency_ns = 1LL << b;
+        }
+    }
+    pthread_mutex_unlock(&ingest.mutex);
+}
+
+/*
+    Checkpoints:
+
+    start_checkpoint() writes the whole network to a file in the background, in the JSON Lines export format. The
+    caller pins a snapshot in a reader slot and hands it to the checkpoint thread, which takes the slot over as its read
+    section, so the pause is pinning plus a thread start whatever the size of the network. Writers never wait for the
+    checkpoint: an array they change while the snapshot is pinned is copied once instead of changed in place (see
+    Snapshots), the copy on write fork() would do for pages, and the nodes they delete stay allocated until it ends.
+    The file is written as <path>.tmp with large unbuffered writes, synced and renamed over path, so path always holds a
+    whole checkpoint.
+    One checkpoint runs at a time; checkpoint_stats() reports the pause, bytes written and duration of the last one.
+*/
+
+typedef struct Checkpoint
+{
+    char *path;
+    ReaderSlot *slot; // Read section of the snapshot, begun by start_checkpoint() and ended by the checkpoint thread
+    long long started;
+    CheckpointStats stats;
+    pthread_mutex_t mutex;
+    pthread_cond_t finished;
+} Checkpoint;
+
+static Checkpoint checkpoint = {.mutex = PTHREAD_MUTEX_INITIALIZER, .finished = PTHREAD_COND_INITIALIZER};
+
+// Thread writing a checkpoint
+static void *checkpoint_thread(void *argument)
+{
+    (void)argument;
+    // The read section is taken over as if this thread had begun it.
+    reader_slot = checkpoint.slot;
+    pthread_setspecific(reader_key, reader_slot);
+    read_depth = 1;
+    snapshot_version = checkpoint.stats.version;
+
+    size_t length = strlen(checkpoint.path);
+    char *temporary = malloc(length + 5);
+    memcpy(temporary, checkpoint.path, length);
+    memcpy(temporary + length, ".tmp", 5);
+
+    long long bytes = 0;
+    int written = -1;
+    FILE *file = fopen(temporary, "w");
+    if (file)
+    {
+        setvbuf(file, NULL, _IONBF, 0);
+        written = export_nodes(file, EXPORT_JSON_LINES, &bytes);
+    }
+    end_read();
+
+    if (file && (fsync(fileno(file)) != 0 || fclose(file) != 0 || written < 0 || rename(temporary, checkpoint.path) != 0))
+    {
+        written = -1;
+    }
+    if (written < 0)
+    {
+        remove(temporary);
+    }
+    free(temporary);
+
+    pthread_mutex_lock(&checkpoint.mutex);
+    checkpoint.stats.nodes = written;
+    checkpoint.stats.bytes = bytes;
+    checkpoint.stats.duration_ns = now_ns() - checkpoint.started;
+    checkpoint.stats.running = 0;
+    free(checkpoint.path);
+    checkpoint.path = NULL;
+    pthread_cond_broadcast(&checkpoint.finished);
+    pthread_mutex_unlock(&checkpoint.mutex);
+    return NULL;
+}
+
+// Function to start writing a checkpoint of the network to path in the background, returns 0 once its snapshot is pinned
+// and -1 if a checkpoint is running already or the thread cannot be started
+int start_checkpoint(const char *path)
+{
+    METRIC_SCOPE(start_checkpoint);
+    pthread_mutex_lock(&checkpoint.mutex);
+    if (checkpoint.stats.running)
+    {
+        pthread_mutex_unlock(&checkpoint.mutex);
+        report("A checkpoint is running already.\n");
+        return -1;
+    }
+
+    checkpoint.started = now_ns();
+    checkpoint.path = strdup(path);
+    checkpoint.slot = claim_reader_slot();
+    checkpoint.stats = (CheckpointStats){1, 0, pin_snapshot(checkpoint.slot), 0, 0, 0};
+
+    pthread_t thread;
+    if (!checkpoint.path || pthread_create(&thread, NULL, checkpoint_thread, NULL) != 0)
+    {
+        release_reader_slot(checkpoint.slot);
+        free(checkpoint.path);
+        checkpoint.path = NULL;
+        checkpoint.stats.running = 0;
+        checkpoint.stats.nodes = -1;
+        pthread_mutex_unlock(&checkpoint.mutex);
+        report("Failed to start the checkpoint.\n");
+        return -1;
+    }
+    pthread_detach(thread);
+    checkpoint.stats.pause_ns = now_ns() - checkpoint.started;
+    pthread_mutex_unlock(&checkpoint.mutex);
+
+    report("Checkpoint started.\n");
+    return 0;
+}
+
+// Function to get the stats of the running or last checkpoint, waiting for a running one to finish if wait is set
+void checkpoint_stats(CheckpointStats *stats, int wait)
+{
+    pthread_mutex_lock(&checkpoint.mutex);
+    while (wait && checkpoint.stats.running)
+    {
+        pthread_cond_wait(&checkpoint.finished, &checkpoint.mutex);
+    }
+    *stats = checkpoint.stats;
+    pthread_mutex_unlock(&checkpoint.mutex);
+}
+
+// Per-thread marks for path searches, indexed by node id. A node is marked on a side when its stamp equals the current generation.
+typedef struct PathScratch
+{
+    unsigned generation;
+    int capacity;
+    unsigned *stamps[2];
+    int *distances[2];
+} PathScratch;
+
+static __thread PathScratch path_scratch;
+static pthread_key_t path_scratch_key;
+static pthread_once_t path_scratch_once = PTHREAD_ONCE_INIT;
+
+// Function to free the path marks of an exiting thread
+static void path_scratch_free(void *argument)
+{
+    PathScratch *scratch = argument;
+    for (int side = 0; side < 2; side++)
+    {
+        free(scratch->stamps[side]);
+        free(scratch->distances[side]);
+        scratch->stamps[side] = NULL;
+        scratch->distances[side] = NULL;
+    }
+    scratch->capacity = 0;
+}
+
+static void create_path_scratch_key()
+{
+    pthread_key_create(&path_scratch_key, path_scratch_free);
+}
+
+// Function to make the path marks big enough for every id given out so far and start a new generation. The marks of a
+// thread are registered with path_scratch_key the first time, so they are freed when it exits.
+static int path_scratch_begin(int max_id)
+{
+    PathScratch *scratch = &path_scratch;
+    if (scratch->capacity < max_id)
+    {
+        pthread_once(&path_scratch_once, create_path_scratch_key);
+        pthread_setspecific(path_scratch_key, scratch);
+        int capacity = max_id + max_id / 4 + 1024;
+        for (int side = 0; side < 2; side++)
+        {
+            free(scratch->stamps[side]);
+            free(scratch->distances[side]);
+            scratch->stamps[side] = calloc(capacity, sizeof(unsigned));
+            scratch->distances[side] = malloc(capacity * sizeof(int));
+            if (!scratch->stamps[side] || !scratch->distances[side])
+            {
+                scratch->capacity = 0;
+                return -1;
+            }
+        }
+        scratch->capacity = capacity;
+        scratch->generation = 0;
+    }
+
+    if (++scratch->generation == 0)
+    {
+        for (int side = 0; side < 2; side++)
+        {
+            memset(scratch->stamps[side], 0, scratch->capacity * sizeof(unsigned));
+        }
+        scratch->generation = 1;
+    }
+    return 0;
+}
+
+static int path_seen(int side, Node *node)
+{
+    return node->id < path_scratch.capacity && path_scratch.stamps[side][node->id] == path_scratch.generation;
+}
+
+// Returns 1 if a path may pass through a node of this type
+static int path_allowed(Node *node, const char *through_types)
+{
+    return !through_types || !*through_types || strchr(through_types, node->type) != NULL;
+}
+
+// Collects paths while walking back from a meeting node to one end, one distance step at a time.
+typedef struct PathWalk
+{
+    Node **prefix;      // Path from the source up to the meeting node, filled back to front
+    Node **suffix;      // Path from the meeting node to the target
+    int distance;       // Total length of the path
+    int meeting;        // Position of the meeting node in the path
+    PathResult *result;
+    int k;
+} PathWalk;
+
+static void path_walk_suffix(PathWalk *walk, Node *node, int position);
+
+// Function to walk from a node towards the source over nodes one forward step closer
+static void path_walk_prefix(PathWalk *walk, Node *node, int position)
+{
+    if (walk->result->num_paths >= walk->k)
+    {
+        return;
+    }
+
+    walk->prefix[position] = node;
+    if (position == 0)
+    {
+        path_walk_suffix(walk, walk->prefix[walk->meeting], walk->meeting);
+        return;
+    }
+
+    LinkCursor cursor;
+    Node **links;
+    int num_links;
+    start_links(&cursor, node, -1);
+    while (walk->result->num_paths < walk->k && (num_links = next_links(&cursor, &links)) > 0)
+    {
+        for (int i = 0; i < num_links && walk->result->num_paths < walk->k; i++)
+        {
+            Node *previous = links[i];
+            if (previous && path_seen(0, previous) && path_scratch.distances[0][previous->id] == position - 1)
+            {
+                path_walk_prefix(walk, previous, position - 1);
+            }
+        }
+    }
+}
+
+// Function to walk from a node towards the target over nodes one backward step closer, storing each complete path
+static void path_walk_suffix(PathWalk *walk, Node *node, int position)
+{
+    if (walk->result->num_paths >= walk->k)
+    {
+        return;
+    }
+
+    walk->suffix[position] = node;
+    if (position == walk->distance)
+    {
+        Node **path = walk->result->nodes + (long)walk->result->num_paths * (walk->distance + 1);
+        memcpy(path, walk->prefix, walk->meeting * sizeof(Node *));
+        memcpy(path + walk->meeting, walk->suffix + walk->meeting, (walk->distance + 1 - walk->meeting) * sizeof(Node *));
+        walk->result->num_paths++;
+        return;
+    }
+
+    int remaining = walk->distance - position - 1;
+    LinkCursor cursor;
+    Node **links;
+    int num_links;
+    start_links(&cursor, node, -1);
+    while (walk->result->num_paths < walk->k && (num_links = next_links(&cursor, &links)) > 0)
+    {
+        for (int i = 0; i < num_links && walk->result->num_paths < walk->k; i++)
+        {
+            Node *next = links[i];
+            if (next && path_seen(1, next) && path_scratch.distances[1][next->id] == remaining)
+            {
+                path_walk_suffix(walk, next, position + 1);
+            }
+        }
+    }
+}
+
+// Function to find the shortest paths between the first nodes named from and to, using a bidirectional BFS
+PathResult shortest_paths(char *from, char *to, int k, int max_depth, const char *through_types)
+{
+    METRIC_SCOPE(shortest_paths);
+    PathResult result = {-1, 0, NULL};
+    if (k < 1)
+    {
+        k = 1;
+    }
+    if (max_depth < 1)
+    {
+        max_depth = INT_MAX;
+    }
+
+    begin_read();
+    Node *ends[2] = {find_first_node(from, NULL), find_first_node(to, NULL)};
+
+    if (!ends[0] || !ends[1] || path_scratch_begin(__atomic_load_n(&id, __ATOMIC_ACQUIRE)) != 0)
+    {
+        end_read();
+        return result;
+    }
+
+    if (ends[0] == ends[1])
+    {
+        result.distance = 0;
+        result.num_paths = 1;
+        result.nodes = malloc(sizeof(Node *));
+        result.nodes[0] = ends[0];
+        end_read();
+        return result;
+    }
+
+    NodeList frontiers[2] = {{NULL, 0, 0}, {NULL, 0, 0}};
+    NodeList next = {NULL, 0, 0};
+    NodeList meetings = {NULL, 0, 0};
+    long long work[2]; // Links to scan to expand each frontier, the cheaper side goes first.
+    int depths[2] = {0, 0};
+
+    for (int side = 0; side < 2; side++)
+    {
+        path_scratch.stamps[side][ends[side]->id] = path_scratch.generation;
+        path_scratch.distances[side][ends[side]->id] = 0;
+        node_list_push(&frontiers[side], ends[side]);
+        work[side] = __atomic_load_n(&ends[side]->num_links, __ATOMIC_RELAXED);
+    }
+
+    int best = -1;
+    while (best < 0 && depths[0] + depths[1] < max_depth && frontiers[0].size > 0 && frontiers[1].size > 0)
+    {
+        int side = work[0] <= work[1] ? 0 : 1;
+        int other = 1 - side;
+        int depth = depths[side] + 1;
+        next.size = 0;
+        work[side] = 0;
+
+        for (int i = 0; i < frontiers[side].size; i++)
+        {
+            Node *node = frontiers[side].nodes[i];
+            // Only the ends and allowed types are expanded; the ends themselves can be of any type.
+            if (node != ends[side] && !path_allowed(node, through_types))
+            {
+                continue;
+            }
+
+            LinkCursor cursor;
+            Node **links;
+            int num_links;
+            start_links(&cursor, node, -1);
+            while ((num_links = next_links(&cursor, &links)) > 0)
+            {
+                for (int j = 0; j < num_links; j++)
+                {
+                    Node *neighbour = links[j];
+                    if (!neighbour || neighbour->id >= path_scratch.capacity || path_seen(side, neighbour))
+                    {
+                        continue;
+                    }
+                    if (neighbour != ends[other] && !path_allowed(neighbour, through_types))
+                    {
+                        continue;
+                    }
+
+                    path_scratch.stamps[side][neighbour->id] = path_scratch.generation;
+                    path_scratch.distances[side][neighbour->id] = depth;
+
+                    if (path_seen(other, neighbour))
+                    {
+                        int total = depth + path_scratch.distances[other][neighbour->id];
+                        if (best < 0 || total < best)
+                        {
+                            best = total;
+                            meetings.size = 0;
+                        }
+                        if (total == best)
+                        {
+                            node_list_push(&meetings, neighbour);
+                        }
+                    }
+                    node_list_push(&next, neighbour);
+                    work[side] += __atomic_load_n(&neighbour->num_links, __ATOMIC_RELAXED);
+                }
+            }
+        }
+
+        NodeList swap = frontiers[side];
+        frontiers[side] = next;
+        next = swap;
+        depths[side] = depth;
+    }
+
+    if (best >= 0 && best <= max_depth)
+    {
+        result.distance = best;
+        result.nodes = malloc((long)k * (best + 1) * sizeof(Node *));
+
+        PathWalk walk;
+        walk.prefix = malloc((best + 1) * sizeof(Node *));
+        walk.suffix = malloc((best + 1) * sizeof(Node *));
+        walk.distance = best;
+        walk.result = &result;
+        walk.k = k;
+
+        // Every meeting node sits at the same forward distance, and each one gives different paths.
+        for (int i = 0; i < meetings.size && result.num_paths < k; i++)
+        {
+            walk.meeting = path_scratch.distances[0][meetings.nodes[i]->id];
+            path_walk_prefix(&walk, meetings.nodes[i], walk.meeting);
+        }
+        free(walk.prefix);
+        free(walk.suffix);
+
+        // Links removed since the search can leave no path to report.
+        if (result.num_paths == 0)
+        {
+            free_path_result(&result);
+            result.distance = -1;
+        }
+    }
+    end_read();
+
+    free(frontiers[0].nodes);
+    free(frontiers[1].nodes);
+    free(next.nodes);
+    free(meetings.nodes);
+    return result;
+}
+
+// Function to free the paths of a PathResult
+void free_path_result(PathResult *result)
+{
+    free(result->nodes);
+    result->nodes = NULL;
+    result->num_paths = 0;
+}
+
+// Function to list the nodes at most hops links away from the first node with the given name, nearest first
+SearchResult nodes_within_hops(char *name, int hops)
+{
+    METRIC_SCOPE(nodes_within_hops);
+    SearchResult result = {NULL, 0};
+
+    begin_read();
+    Node *start = find_first_node(name, NULL);
+
+    if (!start || hops < 1 || path_scratch_begin(__atomic_load_n(&id, __ATOMIC_ACQUIRE)) != 0)
+    {
+        end_read();
+        return result;
+    }
+
+    // The list holds every node found so far, one level after the other, so it is also the BFS queue.
+    NodeList found = {NULL, 0, 0};
+    path_scratch.stamps[0][start->id] = path_scratch.generation;
+    node_list_push(&found, start);
+
+    int level = 0;
+    for (int depth = 1; depth <= hops && level < found.size; depth++)
+    {
+        int level_end = found.size;
+        for (int i = level; i < level_end; i++)
+        {
+            LinkCursor cursor;
+            Node **links;
+            int num_links;
+            start_links(&cursor, found.nodes[i], -1);
+            while ((num_links = next_links(&cursor, &links)) > 0)
+            {
+                for (int j = 0; j < num_links; j++)
+                {
+                    Node *neighbour = links[j];
+                    if (neighbour && neighbour->id < path_scratch.capacity && !path_seen(0, neighbour))
+                    {
+                        path_scratch.stamps[0][neighbour->id] = path_scratch.generation;
+                        node_list_push(&found, neighbour);
+                    }
+                }
+            }
+        }
+        level = level_end;
+    }
+    end_read();
+
+    result.size = found.size - 1;
+    result.nodes = malloc((result.size ? result.size : 1) * sizeof(Node *));
+    memcpy(result.nodes, found.nodes + 1, result.size * sizeof(Node *));
+    free(found.nodes);
+    return result;
+}
+
+/*
+    Queries:
+
+    run_query() finds the nodes matching every predicate of a query, written as words separated by spaces:
+
+    type <I|B|G|O>               nodes of a type
+    name <name>                  nodes with this name
+    prefix <prefix>              nodes whose names start with prefix, ignoring case
+    born <day> <month> <year>    individuals born on a date, * for any day, month or year
+    near <x> <y> <radius>        businesses and organisations at most radius away from (x, y)
+    hops <name> <k>              nodes at most k links away from the first node named name
+    role <label> ( <query> )     nodes with a link of a role (member_of, owns, customer_of...) to a node matching a query
+
+    e.g. "type I born * 12 * hops alice 2 role customer_of ( near 0 0 5 )".
+
+    Every predicate can produce its nodes as a sorted id list: from typed_nodes, the name index, the birthday or location
+    index, a BFS, or the reverse edges of the nodes of its inner query. Before that, it gives an upper bound of their number
+    that costs little: list sizes, degrees for hops, the inner bound times the mean degree of the role. The planner produces
+    the cheapest predicate, then takes the others from the smallest bound up. Fields are checked on each candidate; hops
+    checks against a bitmap filled by its BFS; role checks the links of each candidate against the inner query, or produces
+    its ids and intersects them with the candidates when that costs less. Ids the snapshot of the read section does not
+    have are dropped, so no step reads every node unless the query asks for most of them.
+*/
+
+#define QUERY_MAX_PREDICATES 16
+#define QUERY_MAX_DEPTH 8 // Nested role queries
+
+enum
+{
+    QUERY_TYPE,
+    QUERY_NAME,
+    QUERY_PREFIX,
+    QUERY_BORN,
+    QUERY_NEAR,
+    QUERY_HOPS,
+    QUERY_ROLE
+};
+
+static const char *query_kind_names[] = {"type", "name", "prefix", "born", "near", "hops", "role"};
+
+typedef struct Query Query;
+
+typedef struct QueryPredicate
+{
+    int kind;
+    char type;
+    char *text;           // The name, the folded prefix, or the name hops starts from
+    int day, month, year; // -1 for any
+    double x, y, radius;
+    int hops;
+    int label;
+    Query *inner;
+    double estimate;            // Upper bound of the nodes the predicate produces
+    Node *start;                // First node named text, for hops
+    unsigned long long *bitmap; // Ids found by the BFS of hops, once it ran
+} QueryPredicate;
+
+struct Query
+{
+    QueryPredicate predicates[QUERY_MAX_PREDICATES];
+    int size;
+};
+
+// State of one run_query() call.
+typedef struct QueryRun
+{
+    double fanout[NUM_EDGE_LABELS]; // Mean number of links of each role of the nodes that have any
+    int max_id;
+    Buffer plan;
+} QueryRun;
+
+static void free_query(Query *query)
+{
+    if (!query)
+    {
+        return;
+    }
+    for (int i = 0; i < query->size; i++)
+    {
+        free(query->predicates[i].text);
+        free(query->predicates[i].bitmap);
+        free_query(query->predicates[i].inner);
+    }
+    free(query);
+}
+
+// Returns 1 if a word is a whole number, stored in value
+static int query_int(const char *word, int *value)
+{
+    char *end;
+    long number = word ? strtol(word, &end, 10) : 0;
+    if (!word || end == word || *end || number < INT_MIN || number > INT_MAX)
+    {
+        return 0;
+    }
+    *value = (int)number;
+    return 1;
+}
+
+// Returns 1 if a word is a number, stored in value
+static int query_double(const char *word, double *value)
+{
+    char *end;
+    *value = word ? strtod(word, &end) : 0;
+    return word && end != word && !*end && *value == *value;
+}
+
+// Returns 1 if a word is a day, month or year of born, or * (stored as -1)
+static int query_date_part(const char *word, int *value)
+{
+    if (word && strcmp(word, "*") == 0)
+    {
+        *value = -1;
+        return 1;
+    }
+    return query_int(word, value) && *value >= 0;
+}
+
+// Function to parse the predicates of words[*position] up to the end or a ')', which is left for the caller.
+// Returns NULL and sets error when the words are not a query.
+static Query *parse_query(char **words, int size, int *position, int depth, const char **error)
+{
+    Query *query = calloc(1, sizeof(Query));
+    if (!query)
+    {
+        *error = "out of memory";
+        return NULL;
+    }
+
+    while (*position < size && strcmp(words[*position], ")") != 0)
+    {
+        if (query->size == QUERY_MAX_PREDICATES)
+        {
+            *error = "too many predicates";
+            break;
+        }
+        char *word = words[(*position)++];
+        char *arguments[3] = {NULL, NULL, NULL};
+        for (int i = 0; i < 3 && *position + i < size; i++)
+        {
+            arguments[i] = words[*position + i];
+        }
+
+        QueryPredicate *predicate = &query->predicates[query->size];
+        if (strcmp(word, "type") == 0)
+        {
+            predicate->kind = QUERY_TYPE;
+            if (!arguments[0] || strlen(arguments[0]) != 1 || type_slot(arguments[0][0]) < 0)
+            {
+                *error = "type takes I, B, G or O";
+                break;
+            }
+            predicate->type = arguments[0][0];
+            *position += 1;
+        }
+        else if (strcmp(word, "name") == 0 || strcmp(word, "prefix") == 0)
+        {
+            predicate->kind = word[0] == 'n' ? QUERY_NAME : QUERY_PREFIX;
+            if (!arguments[0] || strcmp(arguments[0], "(") == 0 || strcmp(arguments[0], ")") == 0)
+            {
+                *error = "name and prefix take a name";
+                break;
+            }
+            predicate->text = predicate->kind == QUERY_NAME ? strdup(arguments[0]) : fold_name(arguments[0]);
+            *position += 1;
+        }
+        else if (strcmp(word, "born") == 0)
+        {
+            predicate->kind = QUERY_BORN;
+            if (!query_date_part(arguments[0], &predicate->day) || !query_date_part(arguments[1], &predicate->month) ||
+                !query_date_part(arguments[2], &predicate->year))
+            {
+                *error = "born takes a day, a month and a year, or *";
+                break;
+            }
+            *position += 3;
+        }
+        else if (strcmp(word, "near") == 0)
+        {
+            predicate->kind = QUERY_NEAR;
+            if (!query_double(arguments[0], &predicate->x) || !query_double(arguments[1], &predicate->y) ||
+                !query_double(arguments[2], &predicate->radius) || predicate->radius < 0)
+            {
+                *error = "near takes x, y and a radius";
+                break;
+            }
+            *position += 3;
+        }
+        else if (strcmp(word, "hops") == 0)
+        {
+            predicate->kind = QUERY_HOPS;
+            if (!arguments[0] || !query_int(arguments[1], &predicate->hops) || predicate->hops < 1)
+            {
+                *error = "hops takes a name and a number of hops";
+                break;
+            }
+            predicate->text = strdup(arguments[0]);
+            *position += 2;
+        }
+        else if (strcmp(word, "role") == 0)
+        {
+            predicate->kind = QUERY_ROLE;
+            predicate->label = arguments[0] ? edge_label_by_name(arguments[0]) : -1;
+            if (predicate->label < 0 || !arguments[1] || strcmp(arguments[1], "(") != 0)
+            {
+                *error = "role takes a role and a query in parentheses";
+                break;
+            }
+            if (depth + 1 >= QUERY_MAX_DEPTH)
+            {
+                *error = "queries nested too deep";
+                break;
+            }
+            *position += 2;
+            predicate->inner = parse_query(words, size, position, depth + 1, error);
+            if (!predicate->inner)
+            {
+                break;
+            }
+            if (*position >= size)
+            {
+                query->size++;
+                *error = "missing )";
+                break;
+            }
+            (*position)++;
+        }
+        else
+        {
+            *error = "unknown predicate";
+            break;
+        }
+
+        query->size++;
+        if ((predicate->kind == QUERY_NAME || predicate->kind == QUERY_PREFIX || predicate->kind == QUERY_HOPS) && !predicate->text)
+        {
+            *error = "out of memory";
+            break;
+        }
+    }
+
+    if (!*error && query->size == 0)
+    {
+        *error = "empty query";
+    }
+    if (*error)
+    {
+        free_query(query);
+        return NULL;
+    }
+    return query;
+}
+
+// Function to visit the birthday index lists a born predicate can match
+static void birthday_lists_matching(QueryPredicate *predicate, void (*visit)(IdArray *list, void *context), void *context)
+{
+    for (int month = 1; month <= 12; month++)
+    {
+        for (int day = 1; day <= 31; day++)
+        {
+            if ((predicate->month < 0 || predicate->month == month) && (predicate->day < 0 || predicate->day == day))
+            {
+                visit(&birthday_index.lists[birthday_list(day, month)], context);
+            }
+        }
+    }
+    // Dates out of range can still be matched exactly, or by a wildcard.
+    if (predicate->day < 0 || predicate->month < 0 || birthday_list(predicate->day, predicate->month) == BIRTHDAY_LISTS - 1)
+    {
+        visit(&birthday_index.lists[BIRTHDAY_LISTS - 1], context);
+    }
+}
+
+// Function to visit the location index squares a near predicate can match: the squares of its bounding box, or every
+// square in use when there are fewer of them. Must be called inside a read section.
+static void location_cells_matching(QueryPredicate *predicate, void (*visit)(IdArray *list, void *context), void *context)
+{
+    long long x0 = location_cell(predicate->x - predicate->radius), x1 = location_cell(predicate->x + predicate->radius);
+    long long y0 = location_cell(predicate->y - predicate->radius), y1 = location_cell(predicate->y + predicate->radius);
+    double box = ((double)x1 - x0 + 1) * ((double)y1 - y0 + 1);
+    void **cells;
+    int capacity = read_array(&location_index.cells, &location_index.capacity, &cells);
+    if (capacity == 0)
+    {
+        return;
+    }
+
+    if (box > __atomic_load_n(&location_index.used, __ATOMIC_ACQUIRE))
+    {
+        for (int slot = 0; slot < capacity; slot++)
+        {
+            LocationCell *cell = __atomic_load_n(&cells[slot], __ATOMIC_ACQUIRE);
+            if (cell && cell->x >= x0 && cell->x <= x1 && cell->y >= y0 && cell->y <= y1)
+            {
+                visit(&cell->ids, context);
+            }
+        }
+        return;
+    }
+    for (long long x = x0; x <= x1; x++)
+    {
+        for (long long y = y0; y <= y1; y++)
+        {
+            LocationCell *cell = *location_slot(cells, capacity, x, y);
+            if (cell)
+            {
+                visit(&cell->ids, context);
+            }
+        }
+    }
+}
+
+static void count_id_list(IdArray *list, void *context)
+{
+    void **ids;
+    *(double *)context += read_id_array(list, &ids);
+}
+
+static void copy_id_list(IdArray *list, void *context)
+{
+    void **ids;
+    int size = read_id_array(list, &ids);
+    for (int i = 0; i < size; i++)
+    {
+        id_list_append(context, (int)(long)ids[i]);
+    }
+}
+
+static double query_estimate(QueryRun *run, Query *query);
+
+// Function to set the estimate of a predicate: an upper bound of the nodes it produces
+static void estimate_predicate(QueryRun *run, QueryPredicate *predicate)
+{
+    double estimate = 0;
+    Node **nodes;
+    switch (predicate->kind)
+    {
+    case QUERY_TYPE:
+        estimate = read_typed_nodes(predicate->type, &nodes);
+        break;
+    case QUERY_NAME:
+    case QUERY_PREFIX:
+        estimate = name_index_match(predicate->text, predicate->kind == QUERY_NAME, NULL);
+        break;
+    case QUERY_BORN:
+        birthday_lists_matching(predicate, count_id_list, &estimate);
+        break;
+    case QUERY_NEAR:
+        location_cells_matching(predicate, count_id_list, &estimate);
+        break;
+    case QUERY_HOPS:
+        // Nodes one hop away, then the links of those for two hops, growing by the same ratio after that.
+        if (!predicate->start)
+        {
+            predicate->start = find_first_node(predicate->text, NULL);
+        }
+        if (predicate->start)
+        {
+            // The cursor reads compressed links as well, which read_links() does not see.
+            LinkCursor cursor;
+            Node **links;
+            int num_links, degree = 0;
+            double second = 0;
+            start_links(&cursor, predicate->start, -1);
+            while ((num_links = next_links(&cursor, &links)) > 0)
+            {
+                for (int i = 0; i < num_links; i++)
+                {
+                    if (links[i])
+                    {
+                        degree++;
+                        second += __atomic_load_n(&links[i]->num_links, __ATOMIC_RELAXED);
+                    }
+                }
+            }
+            estimate = degree;
+            if (predicate->hops > 1 && degree > 0)
+            {
+                estimate += second * pow(second / degree, predicate->hops - 2);
+            }
+        }
+        break;
+    case QUERY_ROLE:
+        estimate = query_estimate(run, predicate->inner) * run->fanout[edge_reverse(predicate->label)];
+        break;
+    }
+    predicate->estimate = fmin(estimate, read_all_nodes(&nodes));
+}
+
+// Function to estimate every predicate of a query, returns the smallest estimate
+static double query_estimate(QueryRun *run, Query *query)
+{
+    double smallest = INFINITY;
+    for (int i = 0; i < query->size; i++)
+    {
+        estimate_predicate(run, &query->predicates[i]);
+        smallest = fmin(smallest, query->predicates[i].estimate);
+    }
+    return smallest;
+}
+
+// Returns the cost of checking a query on one node, in links looked at
+static double query_check_cost(QueryRun *run, Query *query)
+{
+    double cost = 0;
+    for (int i = 0; i < query->size; i++)
+    {
+        QueryPredicate *predicate = &query->predicates[i];
+        cost += predicate->kind == QUERY_ROLE ? 1 + run->fanout[predicate->label] * query_check_cost(run, predicate->inner) : 1;
+    }
+    return cost;
+}
+
+static double query_produce_cost(Query *query);
+
+// Returns the cost of producing the nodes of a predicate, its inner query included
+static double produce_cost(QueryPredicate *predicate)
+{
+    return predicate->kind == QUERY_ROLE ? predicate->estimate + query_produce_cost(predicate->inner) : predicate->estimate;
+}
+
+// Returns the cost of producing the nodes of a query from its cheapest predicate
+static double query_produce_cost(Query *query)
+{
+    double cost = INFINITY;
+    for (int i = 0; i < query->size; i++)
+    {
+        cost = fmin(cost, produce_cost(&query->predicates[i]));
+    }
+    return cost;
+}
+
+// Function to run the BFS of a hops predicate once, setting the bits of the ids it reaches (not the start) in its bitmap,
+// then to copy those ids in order to ids if it is not NULL. Returns -1 when out of memory.
+static int hops_search(QueryRun *run, QueryPredicate *predicate, IdList *ids)
+{
+    int words = run->max_id / 64 + 1;
+    if (!predicate->bitmap)
+    {
+        predicate->bitmap = calloc(words, sizeof(unsigned long long));
+        if (!predicate->bitmap)
+        {
+            return -1;
+        }
+        if (!predicate->start)
+        {
+            predicate->start = find_first_node(predicate->text, NULL);
+        }
+
+        // As in nodes_within_hops(), the list holds every node found so far, one level after the other.
+        NodeList found = {NULL, 0, 0};
+        if (predicate->start && predicate->start->id < run->max_id)
+        {
+            predicate->bitmap[predicate->start->id / 64] |= 1ULL << predicate->start->id % 64;
+            node_list_push(&found, predicate->start);
+        }
+        int level = 0;
+        for (int depth = 1; depth <= predicate->hops && level < found.size; depth++)
+        {
+            int level_end = found.size;
+            for (int i = level; i < level_end; i++)
+            {
+                LinkCursor cursor;
+                Node **links;
+                int num_links;
+                start_links(&cursor, found.nodes[i], -1);
+                while ((num_links = next_links(&cursor, &links)) > 0)
+                {
+                    for (int j = 0; j < num_links; j++)
+                    {
+                        Node *neighbour = links[j];
+                        if (neighbour && neighbour->id < run->max_id && !(predicate->bitmap[neighbour->id / 64] & 1ULL << neighbour->id % 64))
+                        {
+                            predicate->bitmap[neighbour->id / 64] |= 1ULL << neighbour->id % 64;
+                            node_list_push(&found, neighbour);
+                        }
+                    }
+                }
+            }
+            level = level_end;
+        }
+        if (found.size > 0)
+        {
+            predicate->bitmap[predicate->start->id / 64] &= ~(1ULL << predicate->start->id % 64);
+        }
+        free(found.nodes);
+    }
+
+    for (int word = 0; ids && word < words; word++)
+    {
+        for (unsigned long long bits = predicate->bitmap[word]; bits; bits &= bits - 1)
+        {
+            id_list_append(ids, word * 64 + __builtin_ctzll(bits));
+        }
+    }
+    return 0;
+}
+
+static int query_check(QueryRun *run, Query *query, Node *node);
+
+// Returns 1 if a node satisfies a predicate
+static int predicate_check(QueryRun *run, QueryPredicate *predicate, Node *node)
+{
+    Birthday *birthday = node->type == 'I' ? &((Individual *)node)->birthday : NULL;
+    Location *location = node_location(node);
+    switch (predicate->kind)
+    {
+    case QUERY_TYPE:
+        return node->type == predicate->type;
+    case QUERY_NAME:
+        return strcmp(node->name, predicate->text) == 0;
+    case QUERY_PREFIX:
+        return name_has_prefix(node->name, predicate->text);
+    case QUERY_BORN:
+        return birthday && (predicate->day < 0 || birthday->day == predicate->day) &&
+               (predicate->month < 0 || birthday->month == predicate->month) && (predicate->year < 0 || birthday->year == predicate->year);
+    case QUERY_NEAR:
+        return location && (location->x - predicate->x) * (location->x - predicate->x) + (location->y - predicate->y) * (location->y - predicate->y) <=
+                               predicate->radius * predicate->radius;
+    case QUERY_HOPS:
+        if (!predicate->bitmap && hops_search(run, predicate, NULL) != 0)
+        {
+            return 0;
+        }
+        return node->id < run->max_id && (predicate->bitmap[node->id / 64] >> node->id % 64 & 1);
+    case QUERY_ROLE:
+    {
+        LinkCursor cursor;
+        Node **links;
+        int num_links;
+        start_links(&cursor, node, predicate->label);
+        while ((num_links = next_links(&cursor, &links)) > 0)
+        {
+            for (int i = 0; i < num_links; i++)
+            {
+                if (links[i] && query_check(run, predicate->inner, links[i]))
+                {
+                    return 1;
+                }
+            }
+        }
+        return 0;
+    }
+    }
+    return 0;
+}
+
+// Returns 1 if a node satisfies every predicate of a query
+static int query_check(QueryRun *run, Query *query, Node *node)
+{
+    for (int i = 0; i < query->size; i++)
+    {
+        if (!predicate_check(run, &query->predicates[i], node))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to describe a predicate on a line of the plan
+static void describe_predicate(Buffer *out, QueryPredicate *predicate, int depth)
+{
+    buffer_printf(out, "%*s%s", 2 * depth, "", query_kind_names[predicate->kind]);
+    switch (predicate->kind)
+    {
+    case QUERY_TYPE:
+        buffer_printf(out, " %c", predicate->type);
+        break;
+    case QUERY_NAME:
+    case QUERY_PREFIX:
+        buffer_printf(out, " %s", predicate->text);
+        break;
+    case QUERY_BORN:
+    {
+        int parts[3] = {predicate->day, predicate->month, predicate->year};
+        for (int i = 0; i < 3; i++)
+        {
+            buffer_printf(out, parts[i] < 0 ? " *" : " %d", parts[i]);
+        }
+        break;
+    }
+    case QUERY_NEAR:
+        buffer_printf(out, " %g %g %g", predicate->x, predicate->y, predicate->radius);
+        break;
+    case QUERY_HOPS:
+        buffer_printf(out, " %s %d", predicate->text, predicate->hops);
+        break;
+    case QUERY_ROLE:
+        buffer_printf(out, " %s", edge_label_name(predicate->label));
+        break;
+    }
+    buffer_printf(out, " (estimate %.0f)", predicate->estimate);
+}
+
+static int query_nodes(QueryRun *run, Query *query, int depth, Node ***result);
+
+// Function to produce the ids of the nodes of a predicate, sorted and without duplicates. Ids of nodes out of the
+// snapshot can be left in, and for the index predicates nodes that do not match after all, they are checked afterwards.
+static void produce_ids(QueryRun *run, QueryPredicate *predicate, int depth, IdList *ids)
+{
+    Node **nodes;
+    int count;
+    switch (predicate->kind)
+    {
+    case QUERY_TYPE:
+        count = read_typed_nodes(predicate->type, &nodes);
+        for (int i = 0; i < count; i++)
+        {
+            if (nodes[i])
+            {
+                id_list_append(ids, nodes[i]->id);
+            }
+        }
+        return;
+    case QUERY_NAME:
+    case QUERY_PREFIX:
+        name_index_match(predicate->text, predicate->kind == QUERY_NAME, ids);
+        break;
+    case QUERY_BORN:
+        birthday_lists_matching(predicate, copy_id_list, ids);
+        break;
+    case QUERY_NEAR:
+        location_cells_matching(predicate, copy_id_list, ids);
+        break;
+    case QUERY_HOPS:
+        hops_search(run, predicate, ids);
+        return;
+    case QUERY_ROLE:
+        count = query_nodes(run, predicate->inner, depth + 1, &nodes);
+        for (int i = 0; i < count; i++)
+        {
+            LinkCursor cursor;
+            Node **links;
+            int num_links;
+            start_links(&cursor, nodes[i], edge_reverse(predicate->label));
+            while ((num_links = next_links(&cursor, &links)) > 0)
+            {
+                for (int j = 0; j < num_links; j++)
+                {
+                    if (links[j])
+                    {
+                        id_list_append(ids, links[j]->id);
+                    }
+                }
+            }
+        }
+        free(nodes);
+        break;
+    }
+    if (ids->size > 0)
+    {
+        ids->size = sort_unique(ids->ids, ids->size);
+    }
+}
+
+// Function to find the nodes of a query in the snapshot, in id order, writing each step to the plan. Returns their count.
+static int query_nodes(QueryRun *run, Query *query, int depth, Node ***result)
+{
+    query_estimate(run, query);
+
+    // The cheapest predicate produces the candidates, the others follow from the smallest estimate up.
+    int order[QUERY_MAX_PREDICATES];
+    for (int i = 0; i < query->size; i++)
+    {
+        int position = i;
+        while (position > 0 && query->predicates[order[position - 1]].estimate > query->predicates[i].estimate)
+        {
+            order[position] = order[position - 1];
+            position--;
+        }
+        order[position] = i;
+    }
+    int source = 0;
+    for (int i = 1; i < query->size; i++)
+    {
+        if (produce_cost(&query->predicates[order[i]]) < produce_cost(&query->predicates[order[source]]))
+        {
+            source = i;
+        }
+    }
+    QueryPredicate *first = &query->predicates[order[source]];
+
+    IdList ids = {NULL, 0, 0};
+    Buffer inner = run->plan;
+    run->plan = (Buffer){NULL, 0, 0};
+    produce_ids(run, first, depth, &ids);
+    Buffer produced = run->plan;
+    run->plan = inner;
+
+    // The ids are sorted, so each one is searched for from the position of the one before.
+    Node **all;
+    int num_all = read_all_nodes(&all), position = 0;
+    Node **nodes = malloc((ids.size > 0 ? ids.size : 1) * sizeof(Node *));
+    int count = 0;
+    for (int i = 0; nodes && i < ids.size; i++)
+    {
+        position = find_node_from(all, num_all, position, i > 0 ? ids.ids[i - 1] : 0, ids.ids[i]);
+        Node *node = position < num_all && all[position] && all[position]->id == ids.ids[i] ? all[position] : NULL;
+        if (node && (first->kind == QUERY_HOPS || first->kind == QUERY_ROLE || predicate_check(run, first, node)))
+        {
+            nodes[count++] = node;
+        }
+    }
+    describe_predicate(&run->plan, first, depth);
+    buffer_printf(&run->plan, ": produced %d ids, %d match\n", ids.size, count);
+    if (produced.data)
+    {
+        buffer_printf(&run->plan, "%.*s", (int)produced.length, produced.data);
+        free(produced.data);
+    }
+
+    for (int i = 0; i < query->size; i++)
+    {
+        QueryPredicate *predicate = &query->predicates[order[i]];
+        if (i == source)
+        {
+            continue;
+        }
+        describe_predicate(&run->plan, predicate, depth);
+
+        // A role is checked over the links of each candidate, unless producing its nodes looks at fewer links.
+        if (predicate->kind == QUERY_ROLE &&
+            produce_cost(predicate) + count < count * (1 + run->fanout[predicate->label] * query_check_cost(run, predicate->inner)))
+        {
+            ids.size = 0;
+            inner = run->plan;
+            run->plan = (Buffer){NULL, 0, 0};
+            produce_ids(run, predicate, depth, &ids);
+            produced = run->plan;
+            run->plan = inner;
+
+            int *candidates = malloc((count > 0 ? 2 * count : 1) * sizeof(int));
+            int kept = 0;
+            if (candidates)
+            {
+                for (int j = 0; j < count; j++)
+                {
+                    candidates[j] = nodes[j]->id;
+                }
+                int *common = candidates + count;
+                int num_common = intersect_sorted(candidates, count, ids.ids, ids.size, common);
+                for (int j = 0, k = 0; j < count && k < num_common; j++)
+                {
+                    if (nodes[j]->id == common[k])
+                    {
+                        nodes[kept++] = nodes[j];
+                        k++;
+                    }
+                }
+            }
+            free(candidates);
+            buffer_printf(&run->plan, ": intersected with %d ids, %d match\n", ids.size, kept);
+            if (produced.data)
+            {
+                buffer_printf(&run->plan, "%.*s", (int)produced.length, produced.data);
+                free(produced.data);
+            }
+            count = kept;
+            continue;
+        }
+
+        int kept = 0;
+        for (int j = 0; j < count; j++)
+        {
+            if (predicate_check(run, predicate, nodes[j]))
+            {
+                nodes[kept++] = nodes[j];
+            }
+        }
+        buffer_printf(&run->plan, ": checked %d, %d match\n", count, kept);
+        count = kept;
+    }
+
+    free(ids.ids);
+    *result = nodes;
+    return nodes ? count : 0;
+}
+
+// Function to find the nodes matching a query, see Queries above
+QueryResult run_query(const char *text)
+{
+    METRIC_SCOPE(run_query);
+    QueryResult result = {NULL, 0, NULL, NULL};
+
+    // Words are separated by white space, parentheses are words of their own.
+    size_t length = strlen(text);
+    char *spaced = malloc(3 * length + 1);
+    char **words = malloc((3 * length / 2 + 1) * sizeof(char *));
+    if (!spaced || !words)
+    {
+        free(spaced);
+        free(words);
+        result.error = "out of memory";
+        return result;
+    }
+    char *end = spaced;
+    for (const char *c = text; *c; c++)
+    {
+        if (*c == '(' || *c == ')')
+        {
+            *end++ = ' ';
+            *end++ = *c;
+            *end++ = ' ';
+        }
+        else
+        {
+            *end++ = isspace((unsigned char)*c) ? ' ' : *c;
+        }
+    }
+    *end = '\0';
+    int num_words = 0;
+    for (char *word = strtok(spaced, " "); word; word = strtok(NULL, " "))
+    {
+        words[num_words++] = word;
+    }
+
+    int position = 0;
+    Query *query = parse_query(words, num_words, &position, 0, &result.error);
+    if (query && position < num_words)
+    {
+        result.error = "unexpected )";
+    }
+    free(words);
+    free(spaced);
+    if (result.error)
+    {
+        free_query(query);
+        return result;
+    }
+
+    begin_read();
+    QueryRun run = {.plan = {NULL, 0, 0}};
+    run.max_id = __atomic_load_n(&id, __ATOMIC_ACQUIRE);
+
+    // Mean degree by role over a sample of the nodes, for the estimates and costs of role.
+    Node **nodes;
+    int count = read_all_nodes(&nodes);
+    int step = count > 256 ? count / 256 : 1;
+    double links[NUM_EDGE_LABELS] = {0}, linked[NUM_EDGE_LABELS] = {0};
+    for (int i = 0; i < count; i += step)
+    {
+        for (int label = 0; nodes[i] && label < NUM_EDGE_LABELS; label++)
+        {
+            int degree = __atomic_load_n(&nodes[i]->num_edges[label], __ATOMIC_RELAXED);
+            links[label] += degree;
+            linked[label] += degree > 0;
+        }
+    }
+    for (int label = 0; label < NUM_EDGE_LABELS; label++)
+    {
+        run.fanout[label] = linked[label] > 0 ? links[label] / linked[label] : 1;
+    }
+
+    result.size = query_nodes(&run, query, 0, &result.nodes);
+    end_read();
+
+    result.plan = run.plan.data ? run.plan.data : strdup("");
+    free_query(query);
+    return result;
+}
+
+// Function to free the nodes and plan of a QueryResult
+void free_query_result(QueryResult *result)
+{
+    free(result->nodes);
+    free(result->plan);
+    result->nodes = NULL;
+    result->plan = NULL;
+    result->size = 0;
+}
+
+// Scores kept from the last PageRank run, so that the next one after a few mutations starts close to the answer.
+static pthread_mutex_t pagerank_mutex = PTHREAD_MUTEX_INITIALIZER;
+static double *pagerank_warm = NULL; // Score by node id (-1 for none), NULL before the first run
+static int pagerank_warm_size = 0;
+static int pagerank_warm_seed = 0; // Id of the seed of those scores, 0 for the global rank
+
+#define PARTIAL_SUM_PADDING 8 // Per-thread sums are this many 8-byte values apart, one cache line each.
+
+// One PageRank run over a GraphView.
+typedef struct PageRank
+{
+    GraphView *view;
+    double *rank;          // Scores of the last iteration
+    double *next;          // Scores being computed
+    double *contribution;  // rank / degree of every node, what it gives each of its links
+    double *next_contribution;
+    double leaked;         // Score spread through teleports this iteration: 1 - damping plus what nodes without links hold
+    int seed;              // View index of the seed node, -1 for the global rank
+    double *partial;       // Per-thread sums of |next - rank| and of the score of nodes without links
+} PageRank;
+
+// Function to compute one iteration for a range of nodes: each node pulls the contributions of its links
+static void pagerank_range(void *context, long begin, long end, int thread)
+{
+    PageRank *run = context;
+    GraphView *view = run->view;
+    double teleport = run->seed < 0 ? run->leaked / view->num_nodes : 0;
+    double change = 0, dangling = 0;
+
+    for (long v = begin; v < end; v++)
+    {
+        double sum = 0;
+        for (long long e = view->offsets[v]; e < view->offsets[v + 1]; e++)
+        {
+            sum += run->contribution[view->neighbours[e]];
+        }
+
+        double score = PAGERANK_DAMPING * sum + (v == run->seed ? run->leaked : teleport);
+        run->next[v] = score;
+        change += fabs(score - run->rank[v]);
+
+        long long degree = view->offsets[v + 1] - view->offsets[v];
+        if (degree > 0)
+        {
+            run->next_contribution[v] = score / degree;
+        }
+        else
+        {
+            run->next_contribution[v] = 0;
+            dangling += score;
+        }
+    }
+
+    run->partial[thread * PARTIAL_SUM_PADDING] += change;
+    run->partial[thread * PARTIAL_SUM_PADDING + 1] += dangling;
+}
+
+// Function to rank nodes by PageRank, or by personalized PageRank from the first node named seed
+RankedResult pagerank(char *seed, int k, const char *types)
+{
+    METRIC_SCOPE(pagerank);
+    RankedResult result = {NULL, NULL, 0};
+
+    pthread_mutex_lock(&pagerank_mutex);
+    begin_read();
+    GraphView view = build_graph_view();
+    int n = view.num_nodes;
+
+    PageRank run;
+    run.view = &view;
+    run.seed = -1;
+    if (seed && *seed)
+    {
+        Node *node = find_first_node(seed, NULL);
+        if (node && node->id < view.max_id)
+        {
+            run.seed = view.index_of_id[node->id];
+        }
+        if (run.seed < 0)
+        {
+            end_read();
+            pthread_mutex_unlock(&pagerank_mutex);
+            free_graph_view(&view);
+            return result;
+        }
+    }
+    int seed_id = run.seed < 0 ? 0 : view.ids[run.seed];
+
+    run.rank = malloc((n + 1) * sizeof(double));
+    run.next = malloc((n + 1) * sizeof(double));
+    run.contribution = malloc((n + 1) * sizeof(double));
+    run.next_contribution = malloc((n + 1) * sizeof(double));
+    int threads = num_worker_threads();
+    run.partial = malloc(threads * PARTIAL_SUM_PADDING * sizeof(double));
+
+    // Start from the last scores with the same seed where there are some, nodes created since then start at the average.
+    double total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int warm = pagerank_warm && pagerank_warm_seed == seed_id && view.ids[i] < pagerank_warm_size && pagerank_warm[view.ids[i]] >= 0;
+        run.rank[i] = warm ? pagerank_warm[view.ids[i]] : 1.0 / n;
+        total += run.rank[i];
+    }
+
+    double dangling = 0;
+    for (int i = 0; i < n; i++)
+    {
+        run.rank[i] = total > 0 ? run.rank[i] / total : 1.0 / n;
+        long long degree = view.offsets[i + 1] - view.offsets[i];
+        run.contribution[i] = degree > 0 ? run.rank[i] / degree : 0;
+        dangling += degree > 0 ? 0 : run.rank[i];
+    }
+
+    for (int iteration = 0; iteration < PAGERANK_MAX_ITERATIONS && n > 0; iteration++)
+    {
+        run.leaked = 1 - PAGERANK_DAMPING + PAGERANK_DAMPING * dangling;
+        memset(run.partial, 0, threads * PARTIAL_SUM_PADDING * sizeof(double));
+        parallel_for(0, n, 4096, pagerank_range, &run);
+
+        double change = 0;
+        dangling = 0;
+        for (int t = 0; t < threads; t++)
+        {
+            change += run.partial[t * PARTIAL_SUM_PADDING];
+            dangling += run.partial[t * PARTIAL_SUM_PADDING + 1];
+        }
+
+        double *swap = run.rank;
+        run.rank = run.next;
+        run.next = swap;
+        swap = run.contribution;
+        run.contribution = run.next_contribution;
+        run.next_contribution = swap;
+
+        if (change < PAGERANK_TOLERANCE)
+        {
+            break;
+        }
+    }
+
+    // Keep the scores for a warm start, by id so that they survive nodes being added and deleted.
+    int max_id = view.max_id;
+    if (pagerank_warm_size < max_id)
+    {
+        free(pagerank_warm);
+        pagerank_warm = malloc(max_id * sizeof(double));
+        pagerank_warm_size = pagerank_warm ? max_id : 0;
+    }
+    if (pagerank_warm)
+    {
+        for (int i = 0; i < pagerank_warm_size; i++)
+        {
+            pagerank_warm[i] = -1;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            pagerank_warm[view.ids[i]] = run.rank[i];
+        }
+        pagerank_warm_seed = seed_id;
+    }
+
+    TopK top;
+    topk_init(&top, k);
+    for (int i = 0; i < n; i++)
+    {
+        if (i != run.seed && (!types || !*types || strchr(types, view.types[i])))
+        {
+            topk_push(&top, run.rank[i], view.ids[i]);
+        }
+    }
+    result = ranked_result_from_ids(&top);
+    topk_free(&top);
+    end_read();
+    pthread_mutex_unlock(&pagerank_mutex);
+
+    free(run.rank);
+    free(run.next);
+    free(run.contribution);
+    free(run.next_contribution);
+    free(run.partial);
+    free_graph_view(&view);
+    return result;
+}
+
+// Results of the last detect_communities() run, by node id. Nodes created since then have no results.
+static pthread_mutex_t community_mutex = PTHREAD_MUTEX_INITIALIZER;
+static NodeCommunity *community_of_id = NULL;
+static int community_of_id_size = 0;
+
+// State of one label propagation / triangle counting run over a GraphView.
+typedef struct CommunityRun
+{
+    GraphView *view;
+    int *order;             // Nodes in the (shuffled) order labels are updated in
+    int *labels;            // Community of each node, as the index of one of its nodes
+    int **scratch;          // Per-thread buffer for the labels of a node's links
+    long *changed;          // Per-thread number of labels changed, PARTIAL_SUM_PADDING apart
+    long long *rank_offsets; // Links to nodes of a higher (degree, index) rank, in CSR layout
+    int *ranked;
+    long long *triangles;
+} CommunityRun;
+
+#define COMMUNITY_MAX_ITERATIONS 20
+
+// Function to move each node in a range to the label most of its links have. Labels are updated in place, so later nodes
+// already see the new ones; threads may read a label while another thread changes it, which only delays convergence.
+static void label_propagation_range(void *context, long begin, long end, int thread)
+{
+    CommunityRun *run = context;
+    GraphView *view = run->view;
+    int *labels = run->scratch[thread];
+    long changed = 0;
+
+    for (long i = begin; i < end; i++)
+    {
+        int v = run->order[i];
+        long long first = view->offsets[v];
+        int degree = (int)(view->offsets[v + 1] - first);
+        if (degree == 0)
+        {
+            continue;
+        }
+
+        for (int j = 0; j < degree; j++)
+        {
+            labels[j] = __atomic_load_n(&run->labels[view->neighbours[first + j]], __ATOMIC_RELAXED);
+        }
+        qsort(labels, degree, sizeof(int), compare_ints);
+
+        // The current label wins ties, so that nodes settle instead of flipping between equally good labels.
+        int current = run->labels[v];
+        int best = current, best_count = 0, current_count = 0;
+        for (int j = 0; j < degree;)
+        {
+            int run_end = j;
+            while (run_end < degree && labels[run_end] == labels[j])
+            {
+                run_end++;
+            }
+            int count = run_end - j;
+            if (labels[j] == current)
+            {
+                current_count = count;
+            }
+            if (count > best_count)
+            {
+                best = labels[j];
+                best_count = count;
+            }
+            j = run_end;
+        }
+
+        if (best != current && best_count > current_count)
+        {
+            __atomic_store_n(&run->labels[v], best, __ATOMIC_RELAXED);
+            changed++;
+        }
+    }
+    run->changed[thread * PARTIAL_SUM_PADDING] += changed;
+}
+
+// Returns 1 if node a comes before node b when links are oriented from lower to higher degree
+static int community_rank_below(GraphView *view, int a, int b)
+{
+    long long degree_a = view->offsets[a + 1] - view->offsets[a], degree_b = view->offsets[b + 1] - view->offsets[b];
+    return degree_a < degree_b || (degree_a == degree_b && a < b);
+}
+
+// Function to count the triangles of a range of nodes. Each triangle is found once, from its lowest ranked node, by
+// intersecting the higher ranked links of two of its nodes. That keeps the lists short even around hubs.
+static void triangle_range(void *context, long begin, long end, int thread)
+{
+    CommunityRun *run = context;
+    int *common = run->scratch[thread];
+
+    for (long u = begin; u < end; u++)
+    {
+        const int *out_u = run->ranked + run->rank_offsets[u];
+        int num_out_u = (int)(run->rank_offsets[u + 1] - run->rank_offsets[u]);
+        long long found = 0;
+
+        for (int i = 0; i < num_out_u; i++)
+        {
+            int v = out_u[i];
+            const int *out_v = run->ranked + run->rank_offsets[v];
+            int num_out_v = (int)(run->rank_offsets[v + 1] - run->rank_offsets[v]);
+            int count = intersect_sorted(out_u, num_out_u, out_v, num_out_v, common);
+            if (count > 0)
+            {
+                found += count;
+                __atomic_fetch_add(&run->triangles[v], count, __ATOMIC_RELAXED);
+                for (int j = 0; j < count; j++)
+                {
+                    __atomic_fetch_add(&run->triangles[common[j]], 1, __ATOMIC_RELAXED);
+                }
+            }
+        }
+        __atomic_fetch_add(&run->triangles[u], found, __ATOMIC_RELAXED);
+    }
+}
+
+// Function to detect communities by label propagation and count triangles, keeping the results for the queries below
+int detect_communities()
+{
+    METRIC_SCOPE(detect_communities);
+    begin_read();
+    GraphView view = build_graph_view();
+    end_read();
+
+    int n = view.num_nodes;
+    int threads = num_worker_threads();
+    CommunityRun run;
+    run.view = &view;
+    run.order = malloc((n + 1) * sizeof(int));
+    run.labels = malloc((n + 1) * sizeof(int));
+    run.changed = malloc(threads * PARTIAL_SUM_PADDING * sizeof(long));
+    run.triangles = calloc(n + 1, sizeof(long long));
+    run.rank_offsets = malloc((n + 1) * sizeof(long long));
+
+    long long max_degree = 0;
+    for (int i = 0; i < n; i++)
+    {
+        run.labels[i] = i;
+        run.order[i] = i;
+        if (view.offsets[i + 1] - view.offsets[i] > max_degree)
+        {
+            max_degree = view.offsets[i + 1] - view.offsets[i];
+        }
+    }
+    run.scratch = malloc(threads * sizeof(int *));
+    for (int t = 0; t < threads; t++)
+    {
+        run.scratch[t] = malloc((max_degree + 1) * sizeof(int));
+    }
+
+    // A fixed shuffle, so that runs on the same graph give the same communities with one thread.
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    for (int i = n - 1; i > 0; i--)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int j = (int)(state % (unsigned long long)(i + 1));
+        int swap = run.order[i];
+        run.order[i] = run.order[j];
+        run.order[j] = swap;
+    }
+
+    for (int iteration = 0; iteration < COMMUNITY_MAX_ITERATIONS; iteration++)
+    {
+        memset(run.changed, 0, threads * PARTIAL_SUM_PADDING * sizeof(long));
+        parallel_for(0, n, 1024, label_propagation_range, &run);
+
+        long changed = 0;
+        for (int t = 0; t < threads; t++)
+        {
+            changed += run.changed[t * PARTIAL_SUM_PADDING];
+        }
+        if (changed <= n / 1000)
+        {
+            break;
+        }
+    }
+
+    // Orient every link from its lower to its higher ranked end, the neighbour lists stay sorted.
+    long long total = 0;
+    for (int u = 0; u < n; u++)
+    {
+        run.rank_offsets[u] = total;
+        for (long long e = view.offsets[u]; e < view.offsets[u + 1]; e++)
+        {
+            total += community_rank_below(&view, u, view.neighbours[e]);
+        }
+    }
+    run.rank_offsets[n] = total;
+    run.ranked = malloc((total + 1) * sizeof(int));
+    for (int u = 0; u < n; u++)
+    {
+        long long next = run.rank_offsets[u];
+        for (long long e = view.offsets[u]; e < view.offsets[u + 1]; e++)
+        {
+            if (community_rank_below(&view, u, view.neighbours[e]))
+            {
+                run.ranked[next++] = view.neighbours[e];
+            }
+        }
+    }
+    parallel_for(0, n, 256, triangle_range, &run);
+
+    int *sizes = calloc(n + 1, sizeof(int));
+    int communities = 0;
+    for (int i = 0; i < n; i++)
+    {
+        communities += sizes[run.labels[i]]++ == 0;
+    }
+
+    pthread_mutex_lock(&community_mutex);
+    if (community_of_id_size < view.max_id)
+    {
+        free(community_of_id);
+        community_of_id = malloc(view.max_id * sizeof(NodeCommunity));
+        community_of_id_size = community_of_id ? view.max_id : 0;
+    }
+    for (int i = 0; i < community_of_id_size; i++)
+    {
+        community_of_id[i].community = -1;
+    }
+    for (int i = 0; i < n && community_of_id; i++)
+    {
+        NodeCommunity *result = &community_of_id[view.ids[i]];
+        long long degree = view.offsets[i + 1] - view.offsets[i];
+        result->community = view.ids[run.labels[i]];
+        result->community_size = sizes[run.labels[i]];
+        result->triangles = run.triangles[i];
+        result->clustering = degree > 1 ? 2.0 * run.triangles[i] / ((double)degree * (degree - 1)) : 0;
+    }
+    pthread_mutex_unlock(&community_mutex);
+
+    for (int t = 0; t < threads; t++)
+    {
+        free(run.scratch[t]);
+    }
+    free(run.scratch);
+    free(run.order);
+    free(run.labels);
+    free(run.changed);
+    free(run.triangles);
+    free(run.rank_offsets);
+    free(run.ranked);
+    free(sizes);
+    free_graph_view(&view);
+    return communities;
+}
+
+// Function to copy the results of a node, returns 0 or -1 if it was created after the last detect_communities(). Caller holds community_mutex.
+static int lookup_community(Node *node, NodeCommunity *result)
+{
+    if (node->id >= community_of_id_size || community_of_id[node->id].community < 0)
+    {
+        return -1;
+    }
+    *result = community_of_id[node->id];
+    return 0;
+}
+
+// Function to get the community, triangles and clustering coefficient of the first node with the given name
+int node_community(char *name, NodeCommunity *result)
+{
+    METRIC_SCOPE(node_community);
+    if (!community_of_id && detect_communities() < 0)
+    {
+        return -1;
+    }
+
+    begin_read();
+    pthread_mutex_lock(&community_mutex);
+    int status = -1;
+    Node *node = find_first_node(name, NULL);
+    if (node)
+    {
+        status = lookup_community(node, result);
+    }
+    pthread_mutex_unlock(&community_mutex);
+    end_read();
+    return status;
+}
+
+// Function to compare the members of a group or organisation with the communities they were found in. Must be called
+// inside a read section, with community_mutex held.
+static void summarise_group(Node *group, GroupCommunity *result)
+{
+    memset(result, 0, sizeof(*result));
+    result->main_community = -1;
+
+    LinkCursor cursor;
+    Node **members;
+    int num_members;
+    int capacity = __atomic_load_n(&group->num_edges[EDGE_MEMBER], __ATOMIC_ACQUIRE) + 1;
+    int *labels = malloc(capacity * sizeof(int));
+    int known = 0;
+    start_links(&cursor, group, EDGE_MEMBER);
+    while ((num_members = next_links(&cursor, &members)) > 0)
+    {
+        for (int i = 0; i < num_members; i++)
+        {
+            NodeCommunity member;
+            if (members[i] && lookup_community(members[i], &member) == 0)
+            {
+                // A snapshot can see more members than the group has now.
+                if (known == capacity)
+                {
+                    capacity *= 2;
+                    labels = realloc(labels, capacity * sizeof(int));
+                }
+                labels[known++] = member.community;
+                result->clustering += member.clustering;
+            }
+        }
+    }
+    result->members = known;
+    if (known == 0)
+    {
+        free(labels);
+        return;
+    }
+    result->clustering /= known;
+
+    qsort(labels, known, sizeof(int), compare_ints);
+    int best_count = 0;
+    for (int j = 0; j < known;)
+    {
+        int run_end = j;
+        while (run_end < known && labels[run_end] == labels[j])
+        {
+            run_end++;
+        }
+        result->communities++;
+        if (run_end - j > best_count)
+        {
+            best_count = run_end - j;
+            result->main_community = labels[j];
+        }
+        j = run_end;
+    }
+    result->main_share = (double)best_count / known;
+    free(labels);
+}
+
+// Function to compare the first group or organisation with the given name with the detected communities
+int group_community(char *name, GroupCommunity *result)
+{
+    METRIC_SCOPE(group_community);
+    if (!community_of_id && detect_communities() < 0)
+    {
+        return -1;
+    }
+
+    begin_read();
+    pthread_mutex_lock(&community_mutex);
+    int status = -1;
+    Node *group = find_first_node(name, "GO");
+    if (group)
+    {
+        summarise_group(group, result);
+        status = 0;
+    }
+    pthread_mutex_unlock(&community_mutex);
+    end_read();
+    return status;
+}
+
+// Function to detect communities and write how every group and organisation compares to them, one line each
+int write_group_communities(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    int communities = detect_communities();
+    begin_read();
+    pthread_mutex_lock(&community_mutex);
+    Node **nodes;
+    int count = read_all_nodes(&nodes);
+    int written = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (nodes[i] && (nodes[i]->type == 'G' || nodes[i]->type == 'O'))
+        {
+            GroupCommunity group;
+            summarise_group(nodes[i], &group);
+            fprintf(file, "%s\t%d\t%d\t%d\t%.4f\t%.4f\n", nodes[i]->name, group.members, group.communities, group.main_community, group.main_share, group.clustering);
+            written++;
+        }
+    }
+    pthread_mutex_unlock(&community_mutex);
+    end_read();
+
+    if (fclose(file) != 0)
+    {
+        printf("Failed to write %s\n", path);
+        return -1;
+    }
+    report("%d communities, %d groups and organisations written.\n", communities, written);
+    return written;
+}
+
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+// Reads the postings of one query term, a decoded block at a time.
+typedef struct PostingCursor
+{
+    const unsigned char *postings; // The term's postings as of the snapshot
+    long length;
+    PostingBlock **blocks;
+    int num_blocks;
+    int num_posts; // Posts of the snapshot with the term
+    int limit;     // Number of posts in the snapshot, later ones are cut off
+    int count; // Postings decoded from the block
+    double idf;
+    double upper_bound; // Highest score the term can add to a post
+    int block;          // Decoded block, -1 before the first one
+    int position;
+    int post;           // Current post, INT_MAX once the postings are exhausted
+    int posts[POSTING_BLOCK_SIZE];
+    int frequencies[POSTING_BLOCK_SIZE];
+} PostingCursor;
+
+static unsigned int read_varint(const unsigned char **bytes)
+{
+    unsigned int value = 0;
+    int shift = 0;
+    while (**bytes & 0x80)
+    {
+        value |= (unsigned int)(*(*bytes)++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= (unsigned int)*(*bytes)++ << shift;
+    return value;
+}
+
+// Function to decode a block, up to the postings of the snapshot
+static void cursor_decode(PostingCursor *cursor, int block)
+{
+    const unsigned char *bytes = cursor->postings + cursor->blocks[block]->offset;
+    const unsigned char *end = cursor->postings + cursor->length;
+    int post = block > 0 ? __atomic_load_n(&cursor->blocks[block - 1]->last_post, __ATOMIC_RELAXED) : -1;
+    int count = __atomic_load_n(&cursor->blocks[block]->count, __ATOMIC_ACQUIRE);
+    cursor->count = 0;
+    for (int i = 0; i < count && bytes < end; i++)
+    {
+        post += (int)read_varint(&bytes);
+        if (post >= cursor->limit)
+        {
+            break;
+        }
+        cursor->posts[i] = post;
+        cursor->frequencies[i] = (int)read_varint(&bytes);
+        cursor->count++;
+    }
+    cursor->block = block;
+    cursor->position = 0;
+}
+
+// Function to move a cursor to its first post at or after target, skipping whole blocks where it can
+static void cursor_seek(PostingCursor *cursor, int target)
+{
+    int block = cursor->block < 0 ? 0 : cursor->block;
+    while (block < cursor->num_blocks && __atomic_load_n(&cursor->blocks[block]->last_post, __ATOMIC_RELAXED) < target)
+    {
+        block++;
+    }
+    if (block >= cursor->num_blocks)
+    {
+        cursor->post = INT_MAX;
+        return;
+    }
+    if (block != cursor->block)
+    {
+        cursor_decode(cursor, block);
+    }
+    while (cursor->position < cursor->count && cursor->posts[cursor->position] < target)
+    {
+        cursor->position++;
+    }
+    // A block cut short ends at the snapshot, so do all the postings.
+    cursor->post = cursor->position < cursor->count ? cursor->posts[cursor->position] : INT_MAX;
+}
+
+// Returns the number of posts of the snapshot with the cursor's term: every block but the last is full, so only the
+// block where the snapshot ends is decoded.
+static int cursor_count(PostingCursor *cursor)
+{
+    if (cursor->num_blocks == 0)
+    {
+        return 0;
+    }
+    int low = 0, high = cursor->num_blocks - 1;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (__atomic_load_n(&cursor->blocks[middle]->last_post, __ATOMIC_RELAXED) < cursor->limit)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    cursor_decode(cursor, low);
+    cursor->block = -1;
+    return low * POSTING_BLOCK_SIZE + cursor->count;
+}
+
+static double bm25(PostingCursor *cursor, const Post *documents, int post, double average_length)
+{
+    double frequency = cursor->frequencies[cursor->position];
+    double norm = BM25_K1 * (1 - BM25_B + BM25_B * documents[post].length / average_length);
+    return cursor->idf * frequency * (BM25_K1 + 1) / (frequency + norm);
+}
+
+static int compare_cursors(const void *a, const void *b)
+{
+    int x = (*(PostingCursor *const *)a)->post, y = (*(PostingCursor *const *)b)->post;
+    return (x > y) - (x < y);
+}
+
+// Function to offer a post to the top k, posts of deleted nodes and posts newer than the snapshot are left out
+static void offer_post(TopK *top, const Post *documents, int post, double score)
+{
+    Node *node = find_node_by_id(documents[post].node_id);
+    if (node && documents[post].sequence < count_posts(node))
+    {
+        topk_push(top, score, post);
+    }
+}
+
+// Function to search the posts for the terms of query, ranked by BM25
+ContentResult search_posts(char *query, int k, int match_all)
+{
+    METRIC_SCOPE(search_posts);
+    ContentResult result = {NULL, NULL, NULL, 0, NULL};
+    if (k < 1)
+    {
+        return result;
+    }
+    PostTerms terms = {NULL, 0, 0};
+    tokenize(query, collect_term, &terms);
+    qsort(terms.terms, terms.count, sizeof(*terms.terms), compare_terms);
+
+    begin_read();
+    void **words;
+    int num_posts = read_array(&text_index.posts, &text_index.post_words, &words) / POST_WORDS;
+    const Post *documents = (const Post *)words;
+    PostingCursor *cursors = malloc((terms.count + 1) * sizeof(PostingCursor));
+    PostingCursor **order = malloc((terms.count + 1) * sizeof(PostingCursor *));
+    int num_cursors = 0, missing = 0;
+    double average_length = num_posts ? (double)documents[num_posts - 1].total_length / num_posts : 1;
+    if (average_length <= 0)
+    {
+        average_length = 1;
+    }
+
+    for (int i = 0; i < terms.count; i++)
+    {
+        if (i > 0 && strcmp(terms.terms[i], terms.terms[i - 1]) == 0)
+        {
+            continue;
+        }
+        Term *term = find_term(terms.terms[i], strlen(terms.terms[i]));
+        if (!term)
+        {
+            missing++;
+            continue;
+        }
+
+        PostingCursor *cursor = &cursors[num_cursors];
+        void **postings;
+        int postings_words = read_array(&term->postings, &term->postings_words, &postings);
+        cursor->postings = postings ? (const unsigned char *)(postings + 1) : NULL;
+        cursor->length = postings_words > 0 ? (long)__atomic_load_n(&postings[0], __ATOMIC_ACQUIRE) : 0;
+        if (cursor->length > (long)(postings_words - 1) * (long)sizeof(void *))
+        {
+            cursor->length = (long)(postings_words - 1) * (long)sizeof(void *);
+        }
+        void **blocks;
+        cursor->num_blocks = read_array(&term->blocks, &term->num_blocks, &blocks);
+        cursor->blocks = (PostingBlock **)blocks;
+        cursor->limit = num_posts;
+        cursor->num_posts = cursor_count(cursor);
+        double posts = cursor->num_posts;
+        cursor->idf = log(1 + (num_posts - posts + 0.5) / (posts + 0.5));
+        // The score grows with the frequency and is highest for the shortest possible post.
+        double frequency = __atomic_load_n(&term->max_frequency, __ATOMIC_RELAXED);
+        cursor->upper_bound = cursor->idf * frequency * (BM25_K1 + 1) / (frequency + BM25_K1 * (1 - BM25_B));
+        cursor->block = -1;
+        cursor_seek(cursor, 0);
+        order[num_cursors] = cursor;
+        num_cursors++;
+    }
+
+    TopK top;
+    topk_init(&top, k);
+    if (num_cursors > 0 && !(match_all && missing > 0))
+    {
+        if (match_all)
+        {
+            // Intersection driven by the rarest term.
+            qsort(order, num_cursors, sizeof(PostingCursor *), compare_cursors);
+            for (int i = 1; i < num_cursors; i++)
+            {
+                for (int j = i; j > 0 && order[j]->num_posts < order[j - 1]->num_posts; j--)
+                {
+                    PostingCursor *swap = order[j];
+                    order[j] = order[j - 1];
+                    order[j - 1] = swap;
+                }
+            }
+            int candidate = order[0]->post;
+            while (candidate != INT_MAX)
+            {
+                int i = 1;
+                for (; i < num_cursors; i++)
+                {
+                    cursor_seek(order[i], candidate);
+                    if (order[i]->post != candidate)
+                    {
+                        break;
+                    }
+                }
+                if (i == num_cursors)
+                {
+                    double score = 0;
+                    for (int j = 0; j < num_cursors; j++)
+                    {
+                        score += bm25(order[j], documents, candidate, average_length);
+                    }
+                    offer_post(&top, documents, candidate, score);
+                    cursor_seek(order[0], candidate + 1);
+                }
+                else
+                {
+                    cursor_seek(order[0], order[i]->post);
+                }
+                candidate = order[0]->post;
+            }
+        }
+        else
+        {
+            // WAND: with the cursors ordered by post, the pivot is the first post whose terms could together beat the
+            // k-th best score so far. Posts before it are skipped without being scored.
+            while (1)
+            {
+                qsort(order, num_cursors, sizeof(PostingCursor *), compare_cursors);
+                double threshold = top.size == top.capacity ? topk_threshold(&top) : -1;
+                double bound = 0;
+                int pivot = -1;
+                for (int i = 0; i < num_cursors && order[i]->post != INT_MAX; i++)
+                {
+                    bound += order[i]->upper_bound;
+                    if (bound > threshold)
+                    {
+                        pivot = i;
+                        break;
+                    }
+                }
+                if (pivot < 0)
+                {
+                    break;
+                }
+
+                int pivot_post = order[pivot]->post;
+                if (order[0]->post == pivot_post)
+                {
+                    double score = 0;
+                    for (int i = 0; i < num_cursors && order[i]->post == pivot_post; i++)
+                    {
+                        score += bm25(order[i], documents, pivot_post, average_length);
+                    }
+                    offer_post(&top, documents, pivot_post, score);
+                    for (int i = 0; i < num_cursors && order[i]->post == pivot_post; i++)
+                    {
+                        cursor_seek(order[i], pivot_post + 1);
+                    }
+                }
+                else
+                {
+                    for (int i = 0; i < pivot; i++)
+                    {
+                        cursor_seek(order[i], pivot_post);
+                    }
+                }
+            }
+        }
+    }
+
+    result.scores = malloc((top.size + 1) * sizeof(double));
+    result.nodes = malloc((top.size + 1) * sizeof(Node *));
+    result.contents = malloc((top.size + 1) * sizeof(char *));
+    long *posts = malloc((top.size + 1) * sizeof(long));
+    result.size = topk_drain(&top, result.scores, posts);
+    Post *found = malloc((result.size + 1) * sizeof(Post));
+    for (int i = 0; i < result.size; i++)
+    {
+        found[i] = documents[posts[i]];
+    }
+
+    // Archived posts are read back and copied into one buffer, their contents point into it once it stops moving.
+    Buffer archived = {NULL, 0, 0}, block = {NULL, 0, 0};
+    long *offsets = malloc((result.size + 1) * sizeof(long));
+    int size = 0;
+    for (int i = 0; i < result.size; i++)
+    {
+        Node *node = find_node_by_id(found[i].node_id);
+        char *content = node ? timeline_post(node, found[i].sequence, &block) : NULL;
+        if (!content)
+        {
+            continue; // Its block could not be read back.
+        }
+        offsets[size] = -1;
+        if (block.data && content >= block.data && content < block.data + block.length)
+        {
+            offsets[size] = archived.length;
+            if (buffer_append(&archived, content, strlen(content) + 1) != 0)
+            {
+                continue;
+            }
+        }
+        result.nodes[size] = node;
+        result.scores[size] = result.scores[i];
+        result.contents[size] = content;
+        size++;
+    }
+    end_read();
+
+    result.size = size;
+    result.archived = archived.data;
+    for (int i = 0; i < size; i++)
+    {
+        if (offsets[i] >= 0)
+        {
+            result.contents[i] = archived.data + offsets[i];
+        }
+    }
+    free(offsets);
+    free(found);
+    free(block.data);
+
+    free(posts);
+    topk_free(&top);
+    free(cursors);
+    free(order);
+    free(terms.terms);
+    return result;
+}
+
+void free_content_result(ContentResult *result)
+{
+    free(result->nodes);
+    free(result->contents);
+    free(result->scores);
+    free(result->archived);
+    memset(result, 0, sizeof(*result));
+}
+
+/*
+    Server mode:
+
+    social --server <port | unix socket path> [workers]
+    social --loadgen <port | unix socket path> [connections] [pipeline depth] [requests per connection]
+
+    The server listens on 127.0.0.1 (or on a Unix socket when the address contains a '/'). Every request is one line and gets
+    exactly one response line, in order, so clients can pipeline. Words in a request are separated by spaces, items in a
+    response by tabs. Responses start with OK or ERR. Where a request names a node, the first node with that name is used.
+
+    C I <name> [<day> <month> <year>]      create individual                  -> OK <id>
+    C B <name> <x> <y> | C O <name> <x> <y> create business / organisation    -> OK <id>
+    C G <name>                              create group                       -> OK <id>
+    M <group or organisation> <member>      add_member                         -> OK
+    R <business> <individual> O|C           add_owner_or_customer              -> OK
+    P <name> <content...>                   post_content                       -> OK <nodes posted to>
+    D <name> [<name>...]                    delete_nodes, in one pass (one name per request when sharded) -> OK <nodes deleted>
+    S N <name> | S T <type> | S B <d> <m> <y> search                           -> OK <count> <id>:<type>:<name>...
+    S C <from> <to> [type] | S L <count> [type] created between two Unix times, or newest -> OK <count> <id>:<type>:<name>...
+    S P <prefix> [k] [type]                   first k (default 10) names starting with prefix, any case -> OK <count> <id>:<type>:<name>...
+    N <cursor> [limit] [type|-] [name]        page_nodes, cursor 0 first, limit 100 -> OK <count> <next cursor, 0 at the end> <id>:<type>:<name>...
+    U <name> [distance] [k]                   search_node_fuzzy, default 2 edits and 10 names -> OK <count> <name>:<distance>...
+    K <name>                                linked nodes                       -> OK <count> <name>...
+    J <name> [<name>]                       component size, or whether two nodes are connected -> OK <size> | OK <1 or 0>
+    E <name> <role>                         nodes linked with a role (owns, customer, member_of...) -> OK <count> <id>:<type>:<name>...
+    V <name>                                content of linked individuals      -> OK <count> <name>:<content>...
+    F <part of content>                     search for content                 -> OK <count> <name>:<content>...
+    W <k> [R]                               most reposted content, or rising (R) -> OK <count> <score>:<content>...
+    Q <k> A|O <words...>                    ranked search of posts, all (A) or any (O) words -> OK <count> <name>:<score>:<content>...
+    A                                       all nodes                          -> OK <count> <id>:<type>:<name>...
+    A edges|jsonl|graphml <path>            export_network                     -> OK <nodes written>
+    Y <name> [k] [A]                        people you may know (A: Adamic-Adar) -> OK <count> <name>:<score>...
+    Y * <path> [k] [A]                      recommend_all_people, for every individual to a file -> OK <individuals written>
+    I [k] [types] [seed]                    PageRank, personalized from seed   -> OK <count> <name>:<score>...
+    L R                                     detect communities                 -> OK <communities>
+    L N <name>                              community of a node                -> OK <community> <size> <triangles> <clustering>
+    L G <group or organisation>             members against communities        -> OK <members> <communities> <main> <share> <clustering>
+    L W <path>                              write_group_communities            -> OK <groups and organisations written>
+    H <from> <to> [k] [depth] [types]       shortest paths (types: e.g. I, - for any) -> OK <distance> <count> <name>,<name>...
+    X <name> [hops]                         nodes at most hops (default 2) links away, nearest first -> OK <count> <id>:<type>:<name>...
+    O [E] <query...>                        nodes matching a query (see Queries), or with E the plan -> OK <count> <id>:<type>:<name>...
+                                            | OK <plan line>..., ERR <why> for a query that does not parse
+    T                                       stats                              -> OK <stat line>...
+    Z P <name> <content> | Z M <group> <member> | Z R <business> <individual> O|C
+                                            queue the mutation for the ingestion applier -> OK, or ERR busy when the queue is full
+    Z F                                     wait for the queued mutations to be applied -> OK
+    Z S                                     ingestion stats -> OK <queued> <rejected> <applied> <failed> <waiting> <batches>
+                                            <mean batch> <max batch> <p50 ns> <p99 ns> <max latency ns>
+    B [path]                                start a background checkpoint to path -> OK <version> <pause ns>
+                                            or, without path, the last one    -> OK <running> <nodes> <bytes> <pause ns> <duration ns>
+
+    An epoll thread accepts connections and hands readable ones to a pool of workers. A connection is registered with
+    EPOLLONESHOT, so only one worker handles it at a time; that worker reads, answers every complete line and re-arms it.
+
+    tests/loopback.py starts a server and checks its answers against a model of the network it builds.
+*/
+
+#ifdef __linux__
+
+#define SERVER_QUEUE_SIZE 4096
+#define SERVER_MAX_LINE (1 << 20)
+#define SERVER_MAX_NAMES 4096 // Names a D request deletes at most
+
+typedef struct Connection
+{
+    int fd;
+    Buffer in;
+    Buffer out;
+} Connection;
+
+// Queue of connections ready to be served, shared between the epoll thread and the workers.
+typedef struct WorkQueue
+{
+    Connection *items[SERVER_QUEUE_SIZE];
+    int head;
+    int count;
+    int stopping;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} WorkQueue;
+
+static WorkQueue work_queue = {.mutex = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER};
+static int server_epoll = -1;
+static volatile sig_atomic_t server_stopping = 0;
+
+static void stop_server(int signal_number)
+{
+    (void)signal_number;
+    server_stopping = 1;
+}
+
+static void queue_push(WorkQueue *queue, Connection *connection)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == SERVER_QUEUE_SIZE)
+    {
+        pthread_cond_wait(&queue->not_full, &queue->mutex);
+    }
+    queue->items[(queue->head + queue->count) % SERVER_QUEUE_SIZE] = connection;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Returns the next connection to serve, or NULL once the server stops.
+static Connection *queue_pop(WorkQueue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0 && !queue->stopping)
+    {
+        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    }
+
+    Connection *connection = NULL;
+    if (queue->count > 0)
+    {
+        connection = queue->items[queue->head];
+        queue->head = (queue->head + 1) % SERVER_QUEUE_SIZE;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return connection;
+}
+
+// Function to split the next space separated word off a request
+static char *next_word(char **cursor)
+{
+    char *word = *cursor;
+    while (*word == ' ')
+    {
+        word++;
+    }
+    if (*word == '\0')
+    {
+        *cursor = word;
+        return NULL;
+    }
+
+    char *end = word;
+    while (*end && *end != ' ')
+    {
+        end++;
+    }
+    if (*end)
+    {
+        *end++ = '\0';
+    }
+    *cursor = end;
+    return word;
+}
+
+/*
+    Sharded mode:
+
+    social --shard <port | unix socket path> <index> <count> [workers]
+    social --coordinator <port | unix socket path> <shard address> [<shard address>...]
+
+    The nodes are split over count shard processes by a hash of their name, so all the nodes with one name live on the same
+    shard and creates, posts, name lookups and one-hop queries go to a single shard. Ids are global: shard i gives out
+    i, i + count, i + 2 * count..., so the shard of a node is its id % count. A shard is an ordinary server over its own nodes,
+    and a link to a node of another shard is kept as a remote link (id, type, name and role of the other node) at both ends.
+
+    The coordinator serves the protocol above to clients. It forwards C, P, S N, K and E to the shard of the name, runs M, R
+    and D as a few shard requests each, and answers X with a breadth-first search that sends each shard one batch of frontier
+    ids per hop. S T, S B, S C, S P and A (without a format) go to every shard and the coordinator merges the nodes. V, U, J,
+    Y, H, L N and L G go to the shard of their (first) name and cover its own nodes only, as the local algorithms
+    (recommendations, paths, components, communities) do not follow remote links. The other commands answer ERR not
+    supported by the coordinator. Updates over several shards are not atomic, a reader can see one end of a new link
+    before the other.
+
+    Requests from the coordinator to the shards, a node item being <id>:<type>:<name> and a role the number of its EDGE_ label:
+    G F <name>                                 first node with the name            -> OK <id> <type>
+    G E <role> <id> <node item> [<id> <node item>]...  link local nodes to nodes of any shard -> OK <links added>
+    G N <role|-> <id>...                       nodes linked to local nodes with a role, or any role -> OK <count> <node item>...
+    G D <name>                                 delete_node                         -> OK <deleted> <remote id>:<deleted id>...
+                                                                                      <member id>...
+    G U <id>:<remote id>...                    forget remote links of local nodes  -> OK <links removed>
+    G A <id>...                                groups of local individuals         -> OK <count> <id>:<group id>...
+    G C <id>:<other id>...                     drop co-member links of local nodes -> OK <links removed>
+                                               (both ways when both are local)
+
+    A delete on a shard leaves the co-member links alone. The coordinator gets the individual members of the deleted groups
+    with G D, their groups left with G A, and drops the co-member links of the pairs that share none with G C.
+*/
+
+static int shard_index = 0;
+static int shard_count = 1; // 1 when not sharded, global ids are then the node ids
+
+// A link to a node of another shard, kept on the node of this shard. One allocation with the name.
+typedef struct RemoteLink
+{
+    int id;    // Global id of the other node
+    int label; // Role of the other node, as in Node.edges
+    char type;
+    char name[];
+} RemoteLink;
+
+typedef struct RemoteLinks
+{
+    int node;    // Local id of the node
+    void **links; // Shared array of RemoteLink pointers
+    int size;
+} RemoteLinks;
+
+// Remote links by local node id, read without locks like the other indexes: the table is a shared array of RemoteLinks
+// pointers with open addressing and linear probing, NULL for free slots. Node ids are never reused, so an entry stays in
+// the table once added and a deleted node's entry is just left empty.
+static struct
+{
+    void **slots;
+    int capacity;
+    int used;
+} remote_links;
+
+// A node as named in shard requests and responses.
+typedef struct NodeItem
+{
+    int id;
+    char type;
+    char *name;
+} NodeItem;
+
+// Returns the id of a node as clients see it, unique over all the shards
+static int global_id(Node *node)
+{
+    return node->id * shard_count + shard_index;
+}
+
+// Returns 1 if a global id belongs to this shard
+static int is_local_id(int node_id)
+{
+    return node_id >= 0 && node_id % shard_count == shard_index;
+}
+
+// Function to split an <id>:<type>:<name> item, returns 0 or -1 if it is malformed
+static int parse_node_item(char *text, NodeItem *item)
+{
+    char *colon = strchr(text, ':');
+    if (!colon || colon[1] == '\0' || colon[2] != ':' || colon[3] == '\0')
+    {
+        return -1;
+    }
+    item->id = atoi(text);
+    item->type = colon[1];
+    item->name = colon + 3;
+    return 0;
+}
+
+// Returns the remote links of a local node id, or NULL. Inside a read section it searches the table of the snapshot.
+static RemoteLinks *remote_links_find(int node)
+{
+    void **slots;
+    int capacity = read_array(&remote_links.slots, &remote_links.capacity, &slots);
+    if (capacity == 0)
+    {
+        return NULL;
+    }
+    int mask = capacity - 1;
+    for (int slot = mix_hash(node) & mask;; slot = (slot + 1) & mask)
+    {
+        RemoteLinks *entry = __atomic_load_n(&slots[slot], __ATOMIC_ACQUIRE);
+        if (!entry || entry->node == node)
+        {
+            return entry;
+        }
+    }
+}
+
+// Function to find the remote links of a local node id, adding an empty entry if it has none. Must be called inside a write section.
+static RemoteLinks *remote_links_insert(int node)
+{
+    RemoteLinks *entry = remote_links_find(node);
+    if (entry)
+    {
+        return entry;
+    }
+
+    if (2 * (remote_links.used + 1) > remote_links.capacity)
+    {
+        int capacity = remote_links.capacity ? 2 * remote_links.capacity : 1024;
+        void **slots = array_alloc(capacity);
+        if (!slots)
+        {
+            return NULL;
+        }
+        for (int i = 0; i < remote_links.capacity; i++)
+        {
+            RemoteLinks *moved = remote_links.slots[i];
+            if (moved)
+            {
+                int slot = mix_hash(moved->node) & (capacity - 1);
+                while (slots[slot])
+                {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                slots[slot] = moved;
+            }
+        }
+        array_publish(&remote_links.slots, &remote_links.capacity, slots, capacity);
+    }
+
+    entry = calloc(1, sizeof(RemoteLinks));
+    if (!entry)
+    {
+        return NULL;
+    }
+    entry->node = node;
+    int mask = remote_links.capacity - 1;
+    int slot = mix_hash(node) & mask;
+    while (remote_links.slots[slot])
+    {
+        slot = (slot + 1) & mask;
+    }
+    __atomic_store_n(&remote_links.slots[slot], entry, __ATOMIC_RELEASE);
+    remote_links.used++;
+    return entry;
+}
+
+// Function to drop all the remote links of a node. Snapshots from before still see them. Must be called inside a write section.
+static void remote_links_clear(RemoteLinks *entry)
+{
+    void **empty = array_alloc(4);
+    if (!empty)
+    {
+        return;
+    }
+    for (int i = 0; i < entry->size; i++)
+    {
+        retire(entry->links[i]);
+    }
+    array_publish(&entry->links, &entry->size, empty, 0);
+}
+
+// Function to link a node to a node of another shard, returns 1 if the link was added, 0 if they were already linked and
+// -1 on failure. Must be called inside a write section.
+static int remote_link_add(Node *node, NodeItem *target, int label)
+{
+    RemoteLinks *entry = remote_links_insert(node->id);
+    int status = entry ? 1 : -1;
+    for (int i = 0; entry && i < entry->size; i++)
+    {
+        if (((RemoteLink *)entry->links[i])->id == target->id)
+        {
+            status = 0;
+            break;
+        }
+    }
+
+    if (status == 1)
+    {
+        RemoteLink *link = malloc(sizeof(RemoteLink) + strlen(target->name) + 1);
+        if (link)
+        {
+            link->id = target->id;
+            link->label = label;
+            link->type = target->type;
+            strcpy(link->name, target->name);
+        }
+        if (!link || array_append(&entry->links, &entry->size, link, 4) != 0)
+        {
+            free(link);
+            status = -1;
+        }
+    }
+
+    if (status < 0)
+    {
+        report("Failed to allocate memory for new remote link.\n");
+    }
+    return status;
+}
+
+// Function to remove the link from a local node id to a remote node, returns 1 if there was one. Must be called inside a write section.
+static int remote_link_remove(int node, int target)
+{
+    RemoteLinks *entry = remote_links_find(node);
+    for (int i = 0; entry && i < entry->size; i++)
+    {
+        RemoteLink *link = entry->links[i];
+        if (link->id == target)
+        {
+            if (array_remove(&entry->links, &entry->size, link) != 1)
+            {
+                return 0;
+            }
+            retire(link);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Function to write the remote links of a node with a role (any role if label is -1) as "\t" items, names only or
+// as node items. Returns how many were written.
+static int append_remote_items(Buffer *out, Node *node, int label, int names_only)
+{
+    int count = 0;
+    RemoteLinks *entry = remote_links_find(node->id);
+    void **links;
+    int size = entry ? read_array(&entry->links, &entry->size, &links) : 0;
+    for (int i = 0; i < size; i++)
+    {
+        RemoteLink *link = links[i];
+        if (!link || (label >= 0 && link->label != label))
+        {
+            continue;
+        }
+        if (names_only)
+        {
+            buffer_printf(out, "\t%s", link->name);
+        }
+        else
+        {
+            buffer_printf(out, "\t%d:%c:%s", link->id, link->type, link->name);
+        }
+        count++;
+    }
+    return count;
+}
+
+// Function to delete the nodes with a name and their remote links, writing a "\t<remote id>:<deleted id>" item for each
+// remote link so that the other ends can be told, and a "\t<member id>" item for each individual member of a deleted
+// group or organisation so that their co-member links can be dropped. Returns the number of nodes deleted.
+static int shard_delete(char *name, Buffer *items)
+{
+    begin_write();
+    SearchResult result = search_node_by_name(name);
+    for (int i = 0; i < result.size; i++)
+    {
+        Node *node = result.nodes[i];
+        int group = node->type == 'G' || node->type == 'O';
+        if (group)
+        {
+            LinkCursor cursor;
+            Node **links;
+            int num_links;
+            start_links(&cursor, node, EDGE_MEMBER);
+            while ((num_links = next_links(&cursor, &links)) > 0)
+            {
+                for (int j = 0; j < num_links; j++)
+                {
+                    if (links[j] && links[j]->type == 'I')
+                    {
+                        buffer_printf(items, "\t%d", global_id(links[j]));
+                    }
+                }
+            }
+        }
+
+        RemoteLinks *entry = remote_links_find(node->id);
+        if (entry)
+        {
+            for (int j = 0; j < entry->size; j++)
+            {
+                RemoteLink *link = entry->links[j];
+                buffer_printf(items, "\t%d:%d", link->id, global_id(node));
+                if (group && link->label == EDGE_MEMBER && link->type == 'I')
+                {
+                    buffer_printf(items, "\t%d", link->id);
+                }
+            }
+            remote_links_clear(entry);
+        }
+    }
+    free(result.nodes);
+
+    int deleted = delete_node(name);
+    end_write();
+    return deleted;
+}
+
+// Function to answer the G requests a coordinator sends to its shards
+static void handle_shard_request(char *cursor, Buffer *out)
+{
+    char *what = next_word(&cursor);
+    char *first = next_word(&cursor);
+    if (!what || !first)
+    {
+        buffer_printf(out, "ERR usage: G F|E|N|D|U|A|C ...\n");
+        return;
+    }
+
+    if (strcmp(what, "F") == 0)
+    {
+        begin_read();
+        Node *node = find_first_node(first, NULL);
+        if (node)
+        {
+            buffer_printf(out, "OK %d %c\n", global_id(node), node->type);
+        }
+        else
+        {
+            buffer_printf(out, "ERR node not found\n");
+        }
+        end_read();
+    }
+    else if (strcmp(what, "E") == 0)
+    {
+        int label = atoi(first);
+        if (label < 0 || label >= NUM_EDGE_LABELS)
+        {
+            buffer_printf(out, "ERR unknown role\n");
+            return;
+        }
+
+        int added = 0;
+        char *source_word, *target_word;
+        begin_write();
+        while ((source_word = next_word(&cursor)) != NULL && (target_word = next_word(&cursor)) != NULL)
+        {
+            int source_id = atoi(source_word);
+            NodeItem target;
+            Node *source = is_local_id(source_id) ? find_node_by_id(source_id / shard_count) : NULL;
+            if (!source || parse_node_item(target_word, &target) != 0)
+            {
+                continue;
+            }
+
+            if (!is_local_id(target.id))
+            {
+                added += remote_link_add(source, &target, label) == 1;
+                continue;
+            }
+            Node *local = find_node_by_id(target.id / shard_count);
+            if (local && !is_node_in_links(source, local) && append_edge(source, local, label) == 0)
+            {
+                added++;
+            }
+        }
+        end_write();
+        buffer_printf(out, "OK %d\n", added);
+    }
+    else if (strcmp(what, "N") == 0)
+    {
+        int label = strcmp(first, "-") == 0 ? -1 : atoi(first);
+        if (label >= NUM_EDGE_LABELS)
+        {
+            buffer_printf(out, "ERR unknown role\n");
+            return;
+        }
+
+        Buffer items = {NULL, 0, 0};
+        int count = 0;
+        char *word;
+        begin_read();
+        while ((word = next_word(&cursor)) != NULL)
+        {
+            int node_id = atoi(word);
+            Node *node = is_local_id(node_id) ? find_node_by_id(node_id / shard_count) : NULL;
+            if (!node)
+            {
+                continue;
+            }
+
+            LinkCursor links_cursor;
+            Node **links;
+            int num_links;
+            start_links(&links_cursor, node, label);
+            while ((num_links = next_links(&links_cursor, &links)) > 0)
+            {
+                for (int i = 0; i < num_links; i++)
+                {
+                    if (links[i])
+                    {
+                        buffer_printf(&items, "\t%d:%c:%s", global_id(links[i]), links[i]->type, links[i]->name);
+                        count++;
+                    }
+                }
+            }
+            count += append_remote_items(&items, node, label, 0);
+        }
+        end_read();
+
+        buffer_printf(out, "OK %d", count);
+        buffer_append(out, items.data, items.length);
+        buffer_append(out, "\n", 1);
+        free(items.data);
+    }
+    else if (strcmp(what, "D") == 0)
+    {
+        Buffer items = {NULL, 0, 0};
+        buffer_printf(out, "OK %d", shard_delete(first, &items));
+        buffer_append(out, items.data, items.length);
+        buffer_append(out, "\n", 1);
+        free(items.data);
+    }
+    else if (strcmp(what, "U") == 0)
+    {
+        int removed = 0;
+        begin_write();
+        for (char *word = first; word; word = next_word(&cursor))
+        {
+            char *colon = strchr(word, ':');
+            int node_id = atoi(word);
+            if (colon && is_local_id(node_id))
+            {
+                removed += remote_link_remove(node_id / shard_count, atoi(colon + 1));
+            }
+        }
+        end_write();
+        buffer_printf(out, "OK %d\n", removed);
+    }
+    else if (strcmp(what, "A") == 0)
+    {
+        Buffer items = {NULL, 0, 0};
+        int count = 0;
+        begin_read();
+        for (char *word = first; word; word = next_word(&cursor))
+        {
+            int node_id = atoi(word);
+            Node *node = is_local_id(node_id) ? find_node_by_id(node_id / shard_count) : NULL;
+            if (!node)
+            {
+                continue;
+            }
+
+            LinkCursor links_cursor;
+            Node **links;
+            int num_links;
+            start_links(&links_cursor, node, EDGE_MEMBER_OF);
+            while ((num_links = next_links(&links_cursor, &links)) > 0)
+            {
+                for (int i = 0; i < num_links; i++)
+                {
+                    if (links[i])
+                    {
+                        buffer_printf(&items, "\t%d:%d", node_id, global_id(links[i]));
+                        count++;
+                    }
+                }
+            }
+
+            RemoteLinks *entry = remote_links_find(node->id);
+            void **remote;
+            int num_remote = entry ? read_array(&entry->links, &entry->size, &remote) : 0;
+            for (int i = 0; i < num_remote; i++)
+            {
+                RemoteLink *link = remote[i];
+                if (link && link->label == EDGE_MEMBER_OF)
+                {
+                    buffer_printf(&items, "\t%d:%d", node_id, link->id);
+                    count++;
+                }
+            }
+        }
+        end_read();
+
+        buffer_printf(out, "OK %d", count);
+        buffer_append(out, items.data, items.length);
+        buffer_append(out, "\n", 1);
+        free(items.data);
+    }
+    else if (strcmp(what, "C") == 0)
+    {
+        int removed = 0;
+        begin_write();
+        for (char *word = first; word; word = next_word(&cursor))
+        {
+            char *colon = strchr(word, ':');
+            int node_id = atoi(word);
+            Node *node = colon && is_local_id(node_id) ? find_node_by_id(node_id / shard_count) : NULL;
+            int other_id = colon ? atoi(colon + 1) : -1;
+            if (!node)
+            {
+                continue;
+            }
+
+            if (!is_local_id(other_id))
+            {
+                removed += remote_link_remove(node->id, other_id);
+                continue;
+            }
+            Node *other = find_node_by_id(other_id / shard_count);
+            if (other && node->type == 'I' && other->type == 'I' && is_node_in_links(node, other))
+            {
+                unlink_node(node, other);
+                unlink_node(other, node);
+                components_unlink(node);
+                removed++;
+            }
+        }
+        components_rebuild();
+        end_write();
+        buffer_printf(out, "OK %d\n", removed);
+    }
+    else
+    {
+        buffer_printf(out, "ERR usage: G F|E|N|D|U|A|C ...\n");
+    }
+}
+
+// Function to write a list of nodes as a response
+static void respond_with_nodes(Buffer *out, SearchResult result)
+{
+    buffer_printf(out, "OK %d", result.size);
+    for (int i = 0; i < result.size; i++)
+    {
+        buffer_printf(out, "\t%d:%c:%s", global_id(result.nodes[i]), result.nodes[i]->type, result.nodes[i]->name);
+    }
+    buffer_append(out, "\n", 1);
+}
+
+// Function to answer one request line
+static void handle_request(char *line, Buffer *out)
+{
+    char *cursor = line;
+    char *command = next_word(&cursor);
+
+    if (!command)
+    {
+        buffer_printf(out, "ERR empty request\n");
+    }
+    else if (strcmp(command, "C") == 0)
+    {
+        char *type = next_word(&cursor);
+        char *name = next_word(&cursor);
+        if (!type || !name)
+        {
+            buffer_printf(out, "ERR usage: C <type> <name> ...\n");
+            return;
+        }
+
+        Node *node = NULL;
+        if (type[0] == 'I')
+        {
+            Birthday birthday = {-1, -1, -1};
+            char *day = next_word(&cursor), *month = next_word(&cursor), *year = next_word(&cursor);
+            if (day && month && year)
+            {
+                birthday.day = atoi(day);
+                birthday.month = atoi(month);
+                birthday.year = atoi(year);
+            }
+            node = (Node *)create_individual(name, birthday);
+        }
+        else if (type[0] == 'G')
+        {
+            node = (Node *)create_group(name);
+        }
+        else if (type[0] == 'B' || type[0] == 'O')
+        {
+            char *x = next_word(&cursor), *y = next_word(&cursor);
+            if (!x || !y)
+            {
+                buffer_printf(out, "ERR missing location\n");
+                return;
+            }
+            Location location = {atof(x), atof(y)};
+            node = type[0] == 'B' ? (Node *)create_business(name, location) : (Node *)create_organisation(name, location);
+        }
+        else
+        {
+            buffer_printf(out, "ERR unknown type\n");
+            return;
+        }
+        if (!node)
+        {
+            buffer_printf(out, "ERR not created\n");
+            return;
+        }
+        buffer_printf(out, "OK %d\n", global_id(node));
+    }
+    else if (strcmp(command, "M") == 0 || strcmp(command, "R") == 0)
+    {
+        char *first = next_word(&cursor);
+        char *second = next_word(&cursor);
+        char *role = next_word(&cursor);
+        if (!first || !second || (command[0] == 'R' && !role))
+        {
+            buffer_printf(out, "ERR missing argument\n");
+            return;
+        }
+
+        begin_write();
+        Node *target = find_first_node(first, NULL);
+        Node *member = find_first_node(second, NULL);
+        int status = -1;
+        if (!target || !member)
+        {
+            buffer_printf(out, "ERR node not found\n");
+        }
+        else if (command[0] == 'M')
+        {
+            status = add_member(target, member);
+            buffer_printf(out, status == 0 ? "OK\n" : "ERR not added\n");
+        }
+        else if (target->type != 'B' || member->type != 'I')
+        {
+            buffer_printf(out, "ERR R needs a business and an individual\n");
+        }
+        else
+        {
+            status = add_owner_or_customer((Business *)target, (Individual *)member, role[0]);
+            buffer_printf(out, status == 0 ? "OK\n" : "ERR not added\n");
+        }
+        end_write();
+    }
+    else if (strcmp(command, "P") == 0)
+    {
+        char *name = next_word(&cursor);
+        while (*cursor == ' ')
+        {
+            cursor++;
+        }
+        if (!name || *cursor == '\0')
+        {
+            buffer_printf(out, "ERR usage: P <name> <content>\n");
+            return;
+        }
+        int posted = post_content(name, cursor);
+        buffer_printf(out, posted < 0 ? "ERR not posted\n" : "OK %d\n", posted);
+    }
+    else if (strcmp(command, "D") == 0)
+    {
+        char *name = next_word(&cursor);
+        if (!name)
+        {
+            buffer_printf(out, "ERR usage: D <name> [<name>...]\n");
+            return;
+        }
+        if (shard_count == 1)
+        {
+            // Every name goes in one bulk delete.
+            char *names[SERVER_MAX_NAMES];
+            int num_names = 0;
+            for (char *word = name; word && num_names < SERVER_MAX_NAMES; word = next_word(&cursor))
+            {
+                names[num_names++] = word;
+            }
+            int deleted = delete_nodes(NULL, 0, names, num_names, NULL, NULL, NULL);
+            buffer_printf(out, "OK %d\n", deleted > 0 ? deleted : 0);
+            return;
+        }
+
+        // Remote links of the deleted nodes are dropped here, the coordinator's D also drops their other ends.
+        Buffer items = {NULL, 0, 0};
+        buffer_printf(out, "OK %d\n", shard_delete(name, &items));
+        free(items.data);
+    }
+    else if (strcmp(command, "S") == 0)
+    {
+        char *by = next_word(&cursor);
+        char *value = next_word(&cursor);
+        if (!by || !value)
+        {
+            buffer_printf(out, "ERR usage: S N|T|B|C|L|P <value>\n");
+            return;
+        }
+
+        begin_read();
+        SearchResult result = {NULL, 0};
+        if (by[0] == 'N')
+        {
+            result = search_node_by_name(value);
+        }
+        else if (by[0] == 'T')
+        {
+            result = search_node_by_type(value[0]);
+        }
+        else if (by[0] == 'B')
+        {
+            char *month = next_word(&cursor), *year = next_word(&cursor);
+            Birthday birthday = {atoi(value), month ? atoi(month) : -1, year ? atoi(year) : -1};
+            result = search_individual_by_birthday(birthday);
+        }
+        else if (by[0] == 'C')
+        {
+            char *to = next_word(&cursor), *type = next_word(&cursor);
+            result = search_nodes_by_creation(atoll(value), to ? atoll(to) : LLONG_MAX, type ? type[0] : '\0');
+        }
+        else if (by[0] == 'L')
+        {
+            char *type = next_word(&cursor);
+            result = newest_nodes(atoi(value), type ? type[0] : '\0');
+        }
+        else if (by[0] == 'P')
+        {
+            char *k = next_word(&cursor), *type = next_word(&cursor);
+            result = search_node_by_prefix(value, k ? atoi(k) : 10, type ? type[0] : '\0');
+        }
+        respond_with_nodes(out, result);
+        free(result.nodes);
+        end_read();
+    }
+    else if (strcmp(command, "K") == 0 || strcmp(command, "V") == 0)
+    {
+        char *name = next_word(&cursor);
+        if (!name)
+        {
+            buffer_printf(out, "ERR missing name\n");
+            return;
+        }
+
+        begin_read();
+        Node *node = find_first_node(name, NULL);
+        if (!node)
+        {
+            buffer_printf(out, "ERR node not found\n");
+            end_read();
+            return;
+        }
+
+        Buffer items = {NULL, 0, 0};
+        int count = 0;
+        LinkCursor links_cursor;
+        Node **links;
+        int num_links;
+        start_links(&links_cursor, node, -1);
+        while ((num_links = next_links(&links_cursor, &links)) > 0)
+        {
+            for (int i = 0; i < num_links; i++)
+            {
+                if (!links[i])
+                {
+                    continue;
+                }
+                if (command[0] == 'K')
+                {
+                    buffer_printf(&items, "\t%s", links[i]->name);
+                    count++;
+                }
+                else if (node->type == 'I' && links[i]->type == 'I')
+                {
+                    PostCursor posts;
+                    char **contents;
+                    int num_contents;
+                    start_posts(&posts, links[i]);
+                    while ((num_contents = next_posts(&posts, &contents)) > 0)
+                    {
+                        for (int j = 0; j < num_contents; j++)
+                        {
+                            buffer_printf(&items, "\t%s:%s", links[i]->name, contents[j]);
+                            count++;
+                        }
+                    }
+                    end_posts(&posts);
+                }
+            }
+        }
+        if (command[0] == 'K')
+        {
+            count += append_remote_items(&items, node, -1, 1);
+        }
+        end_read();
+
+        buffer_printf(out, "OK %d", count);
+        buffer_append(out, items.data, items.length);
+        buffer_append(out, "\n", 1);
+        free(items.data);
+    }
+    else if (strcmp(command, "F") == 0)
+    {
+        while (*cursor == ' ')
+        {
+            cursor++;
+        }
+
+        Buffer items = {NULL, 0, 0};
+        int count = 0;
+        begin_read();
+        Node **nodes;
+        int num = read_all_nodes(&nodes);
+        for (int i = 0; i < num; i++)
+        {
+            if (!nodes[i])
+            {
+                continue;
+            }
+            PostCursor posts;
+            char **contents;
+            int num_contents, found = 0;
+            start_posts(&posts, nodes[i]);
+            while (!found && (num_contents = next_posts(&posts, &contents)) > 0)
+            {
+                for (int j = 0; j < num_contents; j++)
+                {
+                    if (strstr(contents[j], cursor))
+                    {
+                        buffer_printf(&items, "\t%s:%s", nodes[i]->name, contents[j]);
+                        count++;
+                        found = 1;
+                        break;
+                    }
+                }
+            }
+            end_posts(&posts);
+        }
+        end_read();
+
+        buffer_printf(out, "OK %d", count);
+        buffer_append(out, items.data, items.length);
+        buffer_append(out, "\n", 1);
+        free(items.data);
+    }
+    else if (strcmp(command, "W") == 0)
+    {
+        char *k = next_word(&cursor);
+        char *rising = next_word(&cursor);
+        if (!k)
+        {
+            buffer_printf(out, "ERR usage: W <k> [R]\n");
+            return;
+        }
+
+        begin_read();
+        TrendingResult result = trending_content(atoi(k), rising && rising[0] == 'R');
+        buffer_printf(out, "OK %d", result.size);
+        for (int i = 0; i < result.size; i++)
+        {
+            buffer_printf(out, "\t%g:%s", result.scores[i], result.contents[i]);
+        }
+        buffer_append(out, "\n", 1);
+        free_trending_result(&result);
+        end_read();
+    }
+    else if (strcmp(command, "Q") == 0)
+    {
+        char *k = next_word(&cursor);
+        char *mode = next_word(&cursor);
+        if (!k || !mode || (mode[0] != 'A' && mode[0] != 'O'))
+        {
+            buffer_printf(out, "ERR usage: Q <k> A|O <words...>\n");
+            return;
+        }
+
+        begin_read();
+        ContentResult result = search_posts(cursor, atoi(k), mode[0] == 'A');
+        buffer_printf(out, "OK %d", result.size);
+        for (int i = 0; i < result.size; i++)
+        {
+            buffer_printf(out, "\t%s:%g:%s", result.nodes[i]->name, result.scores[i], result.contents[i]);
+        }
+        buffer_append(out, "\n", 1);
+        free_content_result(&result);
+        end_read();
+    }
+    else if (strcmp(command, "A") == 0)
+    {
+        char *format = next_word(&cursor);
+        char *path = next_word(&cursor);
+        if (format)
+        {
+            if (!path || export_format_by_name(format) < 0)
+            {
+                buffer_printf(out, "ERR usage: A [edges|jsonl|graphml <path>]\n");
+                return;
+            }
+            int written = export_network(path, export_format_by_name(format));
+            if (written >= 0)
+            {
+                buffer_printf(out, "OK %d\n", written);
+            }
+            else
+            {
+                buffer_printf(out, "ERR failed to write %s\n", path);
+            }
+            return;
+        }
+
+        begin_read();
+        Node **nodes;
+        int num = read_all_nodes(&nodes);
+        SearchResult result;
+        result.nodes = malloc(num * sizeof(Node *));
+        result.size = 0;
+        for (int i = 0; i < num; i++)
+        {
+            if (nodes[i])
+            {
+                result.nodes[result.size++] = nodes[i];
+            }
+        }
+        respond_with_nodes(out, result);
+        free(result.nodes);
+        end_read();
+    }
+    else if (strcmp(command, "Y") == 0)
+    {
+        char *name = next_word(&cursor);
+        char *path = name && strcmp(name, "*") == 0 ? next_word(&cursor) : NULL;
+        char *k = next_word(&cursor);
+        char *weighted = next_word(&cursor);
+        if (!name || (strcmp(name, "*") == 0 && !path))
+        {
+            buffer_printf(out, "ERR usage: Y <name> [k] [A] | Y * <path> [k] [A]\n");
+            return;
+        }
+        if (path)
+        {
+            int written = recommend_all_people(path, k ? atoi(k) : 10, weighted && weighted[0] == 'A');
+            if (written >= 0)
+            {
+                buffer_printf(out, "OK %d\n", written);
+            }
+            else
+            {
+                buffer_printf(out, "ERR failed to write %s\n", path);
+            }
+            return;
+        }
+
+        begin_read();
+        RankedResult result = recommend_people(name, k ? atoi(k) : 10, weighted && weighted[0] == 'A');
+        buffer_printf(out, "OK %d", result.size);
+        for (int i = 0; i < result.size; i++)
+        {
+            buffer_printf(out, "\t%s:%g", result.nodes[i]->name, result.scores[i]);
+        }
+        buffer_append(out, "\n", 1);
+        free_ranked_result(&result);
+        end_read();
+    }
+    else if (strcmp(command, "N") == 0)
+    {
+        char *cursor_word = next_word(&cursor);
+        char *limit = next_word(&cursor);
+        char *type = next_word(&cursor);
+        char *name = next_word(&cursor);
+        if (!cursor_word)
+        {
+            buffer_printf(out, "ERR usage: N <cursor> [limit] [type|-] [name]\n");
+            return;
+        }
+
+        begin_read();
+        NodePage page = page_nodes(type && type[0] != '-' ? type[0] : '\0', name ? has_name : NULL, name,
+                                   atoll(cursor_word), limit ? atoi(limit) : 100);
+        buffer_printf(out, "OK %d %lld", page.size, page.next);
+        for (int i = 0; i < page.size; i++)
+        {
+            buffer_printf(out, "\t%d:%c:%s", global_id(page.nodes[i]), page.nodes[i]->type, page.nodes[i]->name);
+        }
+        buffer_append(out, "\n", 1);
+        free(page.nodes);
+        end_read();
+    }
+    else if (strcmp(command, "U") == 0)
+    {
+        char *name = next_word(&cursor);
+        char *distance = next_word(&cursor);
+        char *k = next_word(&cursor);
+        if (!name)
+        {
+            buffer_printf(out, "ERR usage: U <name> [distance] [k]\n");
+            return;
+        }
+
+        begin_read();
+        RankedResult result = search_node_fuzzy(name, distance ? atoi(distance) : 2, k ? atoi(k) : 10);
+        buffer_printf(out, "OK %d", result.size);
+        for (int i = 0; i < result.size; i++)
+        {
+            buffer_printf(out, "\t%s:%g", result.nodes[i]->name, result.scores[i]);
+        }
+        buffer_append(out, "\n", 1);
+        free_ranked_result(&result);
+        end_read();
+    }
+    else if (strcmp(command, "J") == 0)
+    {
+        char *name = next_word(&cursor);
+        char *other = next_word(&cursor);
+        if (!name)
+        {
+            buffer_printf(out, "ERR usage: J <name> [<name>]\n");
+            return;
+        }
+
+        int answer = other ? same_component(name, other) : component_size(name);
+        if (answer < 0)
+        {
+            buffer_printf(out, "ERR not found\n");
+            return;
+        }
+        buffer_printf(out, "OK %d\n", answer);
+    }
+    else if (strcmp(command, "E") == 0)
+    {
+        char *name = next_word(&cursor);
+        char *role = next_word(&cursor);
+        int label = role ? edge_label_by_name(role) : -1;
+        if (!name || label < 0)
+        {
+            buffer_printf(out, "ERR usage: E <name> member|member_of|owner|owns|customer|customer_of|co_member\n");
+            return;
+        }
+
+        begin_read();
+        SearchResult result = search_edges(name, label);
+        Buffer remote = {NULL, 0, 0};
+        Node *node = shard_count > 1 ? find_first_node(name, NULL) : NULL;
+        int num_remote = node ? append_remote_items(&remote, node, label, 0) : 0;
+
+        buffer_printf(out, "OK %d", result.size + num_remote);
+        for (int i = 0; i < result.size; i++)
+        {
+            buffer_printf(out, "\t%d:%c:%s", global_id(result.nodes[i]), result.nodes[i]->type, result.nodes[i]->name);
+        }
+        buffer_append(out, remote.data, remote.length);
+        buffer_append(out, "\n", 1);
+        free(remote.data);
+        free(result.nodes);
+        end_read();
+    }
+    else if (strcmp(command, "X") == 0)
+    {
+        char *name = next_word(&cursor);
+        char *hops = next_word(&cursor);
+        if (!name)
+        {
+            buffer_printf(out, "ERR usage: X <name> [hops]\n");
+            return;
+        }
+
+        begin_read();
+        SearchResult result = nodes_within_hops(name, hops ? atoi(hops) : 2);
+        respond_with_nodes(out, result);
+        free(result.nodes);
+        end_read();
+    }
+    else if (strcmp(command, "O") == 0)
+    {
+        while (*cursor == ' ')
+        {
+            cursor++;
+        }
+        int explain = cursor[0] == 'E' && (cursor[1] == ' ' || cursor[1] == '\0');
+        if (explain)
+        {
+            cursor++;
+        }
+
+        begin_read();
+        QueryResult result = run_query(cursor);
+        if (result.error)
+        {
+            buffer_printf(out, "ERR %s\n", result.error);
+        }
+        else if (explain)
+        {
+            buffer_printf(out, "OK");
+            for (char *line = strtok(result.plan, "\n"); line; line = strtok(NULL, "\n"))
+            {
+                buffer_printf(out, "\t%s", line);
+            }
+            buffer_append(out, "\n", 1);
+        }
+        else
+        {
+            respond_with_nodes(out, (SearchResult){result.nodes, result.size});
+        }
+        free_query_result(&result);
+        end_read();
+    }
+    else if (strcmp(command, "G") == 0)
+    {
+        handle_shard_request(cursor, out);
+    }
+    else if (strcmp(command, "I") == 0)
+    {
+        char *k = next_word(&cursor);
+        char *types = next_word(&cursor);
+        char *seed = next_word(&cursor);
+
+        begin_read();
+        RankedResult result = pagerank(seed, k ? atoi(k) : 10, types && strcmp(types, "-") != 0 ? types : NULL);
+        buffer_printf(out, "OK %d", result.size);
+        for (int i = 0; i < result.size; i++)
+        {
+            buffer_printf(out, "\t%s:%g", result.nodes[i]->name, result.scores[i]);
+        }
+        buffer_append(out, "\n", 1);
+        free_ranked_result(&result);
+        end_read();
+    }
+    else if (strcmp(command, "L") == 0)
+    {
+        char *what = next_word(&cursor);
+        char *name = next_word(&cursor);
+        if (what && strcmp(what, "R") == 0)
+        {
+            buffer_printf(out, "OK %d\n", detect_communities());
+        }
+        else if (what && name && strcmp(what, "N") == 0)
+        {
+            NodeCommunity result;
+            if (node_community(name, &result) != 0)
+            {
+                buffer_printf(out, "ERR not found\n");
+                return;
+            }
+            buffer_printf(out, "OK %d %d %lld %g\n", result.community, result.community_size, result.triangles, result.clustering);
+        }
+        else if (what && name && strcmp(what, "G") == 0)
+        {
+            GroupCommunity result;
+            if (group_community(name, &result) != 0)
+            {
+                buffer_printf(out, "ERR not found\n");
+                return;
+            }
+            buffer_printf(out, "OK %d %d %d %g %g\n", result.members, result.communities, result.main_community, result.main_share, result.clustering);
+        }
+        else if (what && name && strcmp(what, "W") == 0)
+        {
+            int written = write_group_communities(name);
+            if (written >= 0)
+            {
+                buffer_printf(out, "OK %d\n", written);
+            }
+            else
+            {
+                buffer_printf(out, "ERR failed to write %s\n", name);
+            }
+        }
+        else
+        {
+            buffer_printf(out, "ERR usage: L R | L N <name> | L G <group> | L W <path>\n");
+        }
+    }
+    else if (strcmp(command, "H") == 0)
+    {
+        char *from = next_word(&cursor);
+        char *to = next_word(&cursor);
+        char *k = next_word(&cursor);
+        char *depth = next_word(&cursor);
+        char *types = next_word(&cursor);
+        if (!from || !to)
+        {
+            buffer_printf(out, "ERR usage: H <from> <to> [k] [depth] [types]\n");
+            return;
+        }
+
+        begin_read();
+        PathResult result = shortest_paths(from, to, k ? atoi(k) : 1, depth ? atoi(depth) : 0, types && strcmp(types, "-") != 0 ? types : NULL);
+        buffer_printf(out, "OK %d %d", result.distance, result.num_paths);
+        for (int p = 0; p < result.num_paths; p++)
+        {
+            Node **path = result.nodes + (long)p * (result.distance + 1);
+            for (int i = 0; i <= result.distance; i++)
+            {
+                buffer_printf(out, "%s%s", i == 0 ? "\t" : ",", path[i]->name);
+            }
+        }
+        buffer_append(out, "\n", 1);
+        free_path_result(&result);
+        end_read();
+    }
+    else if (strcmp(command, "T") == 0)
+    {
+        Buffer stats = {NULL, 0, 0};
+        format_stats(&stats);
+        for (size_t i = 0; i < stats.length; i++)
+        {
+            if (stats.data[i] == '\n')
+            {
+                stats.data[i] = '\t';
+            }
+        }
+        buffer_append(out, "OK\t", 3);
+        buffer_append(out, stats.data, stats.length ? stats.length - 1 : 0);
+        buffer_append(out, "\n", 1);
+        free(stats.data);
+    }
+    else if (strcmp(command, "Z") == 0)
+    {
+        char *what = next_word(&cursor);
+        if (what && strcmp(what, "F") == 0)
+        {
+            ingest_flush();
+            buffer_printf(out, "OK\n");
+            return;
+        }
+        if (what && strcmp(what, "S") == 0)
+        {
+            IngestStats stats;
+            ingest_stats(&stats);
+            buffer_printf(out, "OK %lld %lld %lld %lld %lld %lld %.1f %d %lld %lld %lld\n", stats.queued, stats.rejected, stats.applied,
+                          stats.failed, stats.waiting, stats.batches, stats.mean_batch, stats.max_batch, stats.p50_latency_ns,
+                          stats.p99_latency_ns, stats.max_latency_ns);
+            return;
+        }
+
+        char *first = next_word(&cursor);
+        char *second = NULL;
+        if (what && strcmp(what, "P") == 0)
+        {
+            while (*cursor == ' ')
+            {
+                cursor++;
+            }
+            second = *cursor ? cursor : NULL;
+        }
+        else
+        {
+            second = next_word(&cursor);
+        }
+        char *role = what && strcmp(what, "R") == 0 ? next_word(&cursor) : NULL;
+        if (!what || !first || !second || (what[0] == 'R' && (!role || (role[0] != 'O' && role[0] != 'C'))) || !strchr("PMR", what[0]) || what[1])
+        {
+            buffer_printf(out, "ERR usage: Z P <name> <content> | Z M <group> <member> | Z R <business> <individual> O|C | Z F | Z S\n");
+            return;
+        }
+
+        begin_read();
+        Node *target = find_first_node(first, NULL);
+        Node *other = what[0] == 'P' ? NULL : find_first_node(second, NULL);
+        int status = -2;
+        if (!target || (what[0] != 'P' && !other))
+        {
+            buffer_printf(out, "ERR node not found\n");
+        }
+        else if (what[0] == 'P')
+        {
+            status = ingest_post(target, second);
+        }
+        else if (what[0] == 'M')
+        {
+            status = ingest_member(target, other);
+        }
+        else if (target->type != 'B' || other->type != 'I')
+        {
+            buffer_printf(out, "ERR R needs a business and an individual\n");
+        }
+        else
+        {
+            status = ingest_owner_or_customer((Business *)target, (Individual *)other, role[0]);
+        }
+        end_read();
+
+        if (status != -2)
+        {
+            buffer_printf(out, status == 0 ? "OK\n" : "ERR busy\n");
+        }
+    }
+    else if (strcmp(command, "B") == 0)
+    {
+        char *path = next_word(&cursor);
+        CheckpointStats stats;
+        if (path && start_checkpoint(path) != 0)
+        {
+            buffer_printf(out, "ERR checkpoint running\n");
+            return;
+        }
+
+        checkpoint_stats(&stats, 0);
+        if (path)
+        {
+            buffer_printf(out, "OK %lu %lld\n", stats.version, stats.pause_ns);
+        }
+        else
+        {
+            buffer_printf(out, "OK %d %d %lld %lld %lld\n", stats.running, stats.nodes, stats.bytes, stats.pause_ns, stats.duration_ns);
+        }
+    }
+    else
+    {
+        buffer_printf(out, "ERR unknown command\n");
+    }
+}
+
+// Answers request lines: handle_request(), or coordinator_request() in front of shards.
+static void (*request_handler)(char *line, Buffer *out) = handle_request;
+
+static void close_connection(Connection *connection)
+{
+    close(connection->fd);
+    free(connection->in.data);
+    free(connection->out.data);
+    free(connection);
+}
+
+// Function to serve a connection: read what arrived, answer every complete line, write back and re-arm
+static void serve_connection(Connection *connection)
+{
+    int closed = 0;
+    char chunk[65536];
+
+    while (1)
+    {
+        ssize_t received = read(connection->fd, chunk, sizeof(chunk));
+        if (received > 0)
+        {
+            if (buffer_append(&connection->in, chunk, received) != 0)
+            {
+                closed = 1;
+                break;
+            }
+            continue;
+        }
+        if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            closed = 1;
+        }
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        break;
+    }
+
+    size_t start = 0;
+    while (start < connection->in.length)
+    {
+        char *newline = memchr(connection->in.data + start, '\n', connection->in.length - start);
+        if (!newline)
+        {
+            break;
+        }
+        *newline = '\0';
+        if (newline > connection->in.data + start && newline[-1] == '\r')
+        {
+            newline[-1] = '\0';
+        }
+        request_handler(connection->in.data + start, &connection->out);
+        start = newline - connection->in.data + 1;
+    }
+    buffer_consume(&connection->in, start);
+
+    if (connection->in.length > SERVER_MAX_LINE)
+    {
+        closed = 1;
+    }
+
+    size_t sent = 0;
+    while (sent < connection->out.length)
+    {
+        ssize_t written = send(connection->fd, connection->out.data + sent, connection->out.length - sent, MSG_NOSIGNAL);
+        if (written > 0)
+        {
+            sent += written;
+            continue;
+        }
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            closed = 1;
+        }
+        break;
+    }
+    buffer_consume(&connection->out, sent);
+
+    if (closed)
+    {
+        close_connection(connection);
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT | EPOLLRDHUP | (connection->out.length ? EPOLLOUT : 0);
+    event.data.ptr = connection;
+    if (epoll_ctl(server_epoll, EPOLL_CTL_MOD, connection->fd, &event) != 0)
+    {
+        close_connection(connection);
+    }
+}
+
+static void *server_worker(void *argument)
+{
+    (void)argument;
+    Connection *connection;
+    while ((connection = queue_pop(&work_queue)) != NULL)
+    {
+        serve_connection(connection);
+    }
+    return NULL;
+}
+
+// Function to open a socket for an address, a TCP port on 127.0.0.1 or a Unix socket path
+static int open_socket(const char *address, int listening)
+{
+    int fd;
+    if (strchr(address, '/'))
+    {
+        struct sockaddr_un unix_address;
+        memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        strncpy(unix_address.sun_path, address, sizeof(unix_address.sun_path) - 1);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        if (listening)
+        {
+            unlink(address);
+        }
+        if ((listening ? bind(fd, (struct sockaddr *)&unix_address, sizeof(unix_address)) : connect(fd, (struct sockaddr *)&unix_address, sizeof(unix_address))) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        struct sockaddr_in inet_address;
+        memset(&inet_address, 0, sizeof(inet_address));
+        inet_address.sin_family = AF_INET;
+        inet_address.sin_port = htons(atoi(address));
+        inet_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        int one = 1;
+        if (listening)
+        {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if ((listening ? bind(fd, (struct sockaddr *)&inet_address, sizeof(inet_address)) : connect(fd, (struct sockaddr *)&inet_address, sizeof(inet_address))) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listening && listen(fd, SOMAXCONN) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function to run the query server until SIGINT or SIGTERM
+int run_server(const char *address, int num_workers)
+{
+    int listener = open_socket(address, 1);
+    if (listener < 0)
+    {
+        printf("Failed to listen on %s: %s\n", address, strerror(errno));
+        return 1;
+    }
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+
+    server_epoll = epoll_create1(0);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; // NULL marks the listening socket.
+    epoll_ctl(server_epoll, EPOLL_CTL_ADD, listener, &event);
+
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+    signal(SIGPIPE, SIG_IGN);
+    quiet = 1;
+
+    if (num_workers < 1)
+    {
+        num_workers = 1;
+    }
+    pthread_t *workers = malloc(num_workers * sizeof(pthread_t));
+    for (int i = 0; i < num_workers; i++)
+    {
+        pthread_create(&workers[i], NULL, server_worker, NULL);
+    }
+
+    printf("Listening on %s with %d workers\n", address, num_workers);
+    fflush(stdout);
+
+    struct epoll_event events[256];
+    while (!server_stopping)
+    {
+        int ready = epoll_wait(server_epoll, events, 256, 200);
+        for (int i = 0; i < ready; i++)
+        {
+            if (events[i].data.ptr != NULL)
+            {
+                queue_push(&work_queue, events[i].data.ptr);
+                continue;
+            }
+
+            int fd;
+            while ((fd = accept(listener, NULL, NULL)) >= 0)
+            {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                Connection *connection = calloc(1, sizeof(Connection));
+                connection->fd = fd;
+
+                struct epoll_event connection_event;
+                connection_event.events = EPOLLIN | EPOLLONESHOT | EPOLLRDHUP;
+                connection_event.data.ptr = connection;
+                if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, fd, &connection_event) != 0)
+                {
+                    close_connection(connection);
+                }
+            }
+        }
+    }
+
+    pthread_mutex_lock(&work_queue.mutex);
+    work_queue.stopping = 1;
+    pthread_cond_broadcast(&work_queue.not_empty);
+    pthread_mutex_unlock(&work_queue.mutex);
+    for (int i = 0; i < num_workers; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    close(listener);
+    close(server_epoll);
+    if (strchr(address, '/'))
+    {
+        unlink(address);
+    }
+    printf("Server stopped\n");
+    return 0;
+}
+
+// Function to serve as shard index of count, see Sharded mode above
+int run_shard(const char *address, int index, int count, int num_workers)
+{
+    if (count < 1 || index < 0 || index >= count)
+    {
+        printf("Shard index must be between 0 and the number of shards - 1\n");
+        return 1;
+    }
+    shard_index = index;
+    shard_count = count;
+    delete_keeps_co_members = count > 1;
+    return run_server(address, num_workers);
+}
+
+// Connection from a coordinator worker to one shard. Each worker has its own, so responses come back in the order of its requests.
+typedef struct ShardLink
+{
+    int fd;
+    Buffer in;
+    size_t line; // Length of the response last returned, consumed by the next receive
+} ShardLink;
+
+static const char **shard_addresses = NULL;
+static int num_shards = 0;
+static __thread ShardLink *shard_links = NULL;
+static pthread_key_t shard_links_key;
+static pthread_once_t shard_links_once = PTHREAD_ONCE_INIT;
+
+static void shard_disconnect(ShardLink *link)
+{
+    if (link->fd >= 0)
+    {
+        close(link->fd);
+    }
+    link->fd = -1;
+    link->in.length = 0;
+    link->line = 0;
+}
+
+// Function to close the shard connections of an exiting worker and free them
+static void shard_links_free(void *argument)
+{
+    ShardLink *links = argument;
+    for (int i = 0; i < num_shards; i++)
+    {
+        shard_disconnect(&links[i]);
+        free(links[i].in.data);
+    }
+    free(links);
+    shard_links = NULL;
+}
+
+static void create_shard_links_key()
+{
+    pthread_key_create(&shard_links_key, shard_links_free);
+}
+
+// Function to send a request to a shard, connecting first if needed. Returns 0 on success.
+static int shard_send(int shard, Buffer *request)
+{
+    // The connections of a worker are registered with shard_links_key, so they are closed and freed when it exits.
+    if (!shard_links)
+    {
+        shard_links = calloc(num_shards, sizeof(ShardLink));
+        if (!shard_links)
+        {
+            return -1;
+        }
+        for (int i = 0; i < num_shards; i++)
+        {
+            shard_links[i].fd = -1;
+        }
+        pthread_once(&shard_links_once, create_shard_links_key);
+        pthread_setspecific(shard_links_key, shard_links);
+    }
+
+    ShardLink *link = &shard_links[shard];
+    if (link->fd < 0 && (link->fd = open_socket(shard_addresses[shard], 0)) < 0)
+    {
+        return -1;
+    }
+
+    size_t sent = 0;
+    while (sent < request->length)
+    {
+        ssize_t written = send(link->fd, request->data + sent, request->length - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            shard_disconnect(link);
+            return -1;
+        }
+        sent += written;
+    }
+    return 0;
+}
+
+// Function to wait for the next response of a shard, returns it without the newline or NULL if the shard is gone.
+// The response stays valid until the next receive from the same shard.
+static char *shard_receive(int shard)
+{
+    ShardLink *link = &shard_links[shard];
+    buffer_consume(&link->in, link->line);
+    link->line = 0;
+
+    char chunk[65536];
+    while (1)
+    {
+        char *newline = link->in.length ? memchr(link->in.data, '\n', link->in.length) : NULL;
+        if (newline)
+        {
+            *newline = '\0';
+            link->line = newline - link->in.data + 1;
+            return link->in.data;
+        }
+
+        ssize_t received = read(link->fd, chunk, sizeof(chunk));
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0 || buffer_append(&link->in, chunk, received) != 0)
+        {
+            shard_disconnect(link);
+            return NULL;
+        }
+    }
+}
+
+// Function to send one request line to a shard and wait for its response
+static char *shard_call(int shard, Buffer *request)
+{
+    return shard_send(shard, request) == 0 ? shard_receive(shard) : NULL;
+}
+
+// Function to send the non-empty requests to their shards at once, then collect the responses. Returns 0 if every shard answered.
+static int shard_call_all(Buffer *requests, char **responses)
+{
+    int status = 0;
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        responses[shard] = NULL;
+        if (requests[shard].length && shard_send(shard, &requests[shard]) != 0)
+        {
+            requests[shard].length = 0;
+            status = -1;
+        }
+    }
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        if (requests[shard].length && (responses[shard] = shard_receive(shard)) == NULL)
+        {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+static int shard_of_name(const char *name)
+{
+    return hash_term(name, strlen(name)) % num_shards;
+}
+
+static int shard_of_id(int node_id)
+{
+    return node_id % num_shards;
+}
+
+static int compare_long_long(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Set of ids with open addressing, -1 marks a free slot.
+typedef struct IdSet
+{
+    int *slots;
+    int capacity;
+    int size;
+} IdSet;
+
+// Function to add an id to a set, returns 1 if it was not there yet
+static int id_set_add(IdSet *set, int value)
+{
+    if (2 * (set->size + 1) > set->capacity)
+    {
+        IdSet grown = {malloc(2 * (set->capacity ? set->capacity : 512) * sizeof(int)), 2 * (set->capacity ? set->capacity : 512), 0};
+        memset(grown.slots, -1, grown.capacity * sizeof(int));
+        for (int i = 0; i < set->capacity; i++)
+        {
+            if (set->slots[i] >= 0)
+            {
+                id_set_add(&grown, set->slots[i]);
+            }
+        }
+        free(set->slots);
+        *set = grown;
+    }
+
+    int mask = set->capacity - 1;
+    int slot = mix_hash(value) & mask;
+    while (set->slots[slot] >= 0)
+    {
+        if (set->slots[slot] == value)
+        {
+            return 0;
+        }
+        slot = (slot + 1) & mask;
+    }
+    set->slots[slot] = value;
+    set->size++;
+    return 1;
+}
+
+// Function to find the first node with a name on its shard, returns 0, -1 if there is none or -2 if the shard did not answer
+static int coordinator_find(char *name, NodeItem *item)
+{
+    Buffer request = {NULL, 0, 0};
+    buffer_printf(&request, "G F %s\n", name);
+    char *response = shard_call(shard_of_name(name), &request);
+    free(request.data);
+
+    if (!response)
+    {
+        return -2;
+    }
+    if (strncmp(response, "OK ", 3) != 0)
+    {
+        return -1;
+    }
+
+    char *type = strchr(response + 3, ' ');
+    item->id = atoi(response + 3);
+    item->type = type ? type[1] : '\0';
+    item->name = name;
+    return 0;
+}
+
+// Function to link two nodes, label being the role of target as seen from node. Returns 1 if the link was added, 0 if they
+// were already linked and -1 if a shard did not answer.
+static int coordinator_link(NodeItem *node, NodeItem *target, int label)
+{
+    Buffer request = {NULL, 0, 0};
+    buffer_printf(&request, "G E %d %d %d:%c:%s\n", label, node->id, target->id, target->type, target->name);
+    char *response = shard_call(shard_of_id(node->id), &request);
+    int added = response && strncmp(response, "OK ", 3) == 0 ? atoi(response + 3) : -1;
+
+    // Nodes of one shard are linked both ways by the first request, otherwise the other end keeps its own remote link.
+    if (added == 1 && shard_of_id(target->id) != shard_of_id(node->id))
+    {
+        request.length = 0;
+        buffer_printf(&request, "G E %d %d %d:%c:%s\n", edge_reverse(label), target->id, node->id, node->type, node->name);
+        response = shard_call(shard_of_id(target->id), &request);
+        if (!response || strncmp(response, "OK ", 3) != 0)
+        {
+            added = -1;
+        }
+    }
+    free(request.data);
+    return added;
+}
+
+// Function to add a pair to the G E request of a shard, starting the request if it is empty
+static void add_link_request(Buffer *request, int label, int node_id, NodeItem *target)
+{
+    if (request->length == 0)
+    {
+        buffer_printf(request, "G E %d", label);
+    }
+    buffer_printf(request, " %d %d:%c:%s", node_id, target->id, target->type, target->name);
+}
+
+// Function to add a member the way add_member() does, linking it with the individual members too
+static void coordinator_add_member(NodeItem *group, NodeItem *member, Buffer *out)
+{
+    if (group->type == 'O' && member->type != 'I')
+    {
+        buffer_printf(out, "ERR not added\n");
+        return;
+    }
+
+    int added = coordinator_link(group, member, EDGE_MEMBER);
+    if (added <= 0)
+    {
+        buffer_printf(out, added < 0 ? "ERR shard unavailable\n" : "ERR not added\n");
+        return;
+    }
+    if (group->type != 'G' && group->type != 'O')
+    {
+        buffer_printf(out, "OK\n");
+        return;
+    }
+
+    Buffer request = {NULL, 0, 0};
+    buffer_printf(&request, "G N %d %d\n", EDGE_MEMBER, group->id);
+    char *response = shard_call(shard_of_id(group->id), &request);
+    free(request.data);
+    if (!response)
+    {
+        buffer_printf(out, "ERR shard unavailable\n");
+        return;
+    }
+
+    // One G E request per shard holds both ends of every co-member link it stores. Pairs already linked are skipped there.
+    Buffer *requests = calloc(num_shards, sizeof(Buffer));
+    char **responses = malloc(num_shards * sizeof(char *));
+    char *cursor = strchr(response, '\t');
+    while (cursor)
+    {
+        char *item = cursor + 1;
+        cursor = strchr(item, '\t');
+        if (cursor)
+        {
+            *cursor = '\0';
+        }
+
+        NodeItem other;
+        if (parse_node_item(item, &other) != 0 || other.type != 'I' || other.id == member->id)
+        {
+            continue;
+        }
+        add_link_request(&requests[shard_of_id(other.id)], EDGE_CO_MEMBER, other.id, member);
+        if (shard_of_id(other.id) != shard_of_id(member->id))
+        {
+            add_link_request(&requests[shard_of_id(member->id)], EDGE_CO_MEMBER, member->id, &other);
+        }
+    }
+
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        if (requests[shard].length)
+        {
+            buffer_append(&requests[shard], "\n", 1);
+        }
+    }
+    buffer_printf(out, shard_call_all(requests, responses) == 0 ? "OK\n" : "ERR shard unavailable\n");
+
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        free(requests[shard].data);
+    }
+    free(requests);
+    free(responses);
+}
+
+// Function to drop the co-member links between individuals that were members of a deleted group and share no group left.
+// Like the links add_member() made, every pair is sent, with both ends when they live on different shards. Returns 0, or
+// -1 if a shard did not answer.
+static int coordinator_drop_co_members(int *members, int num_members)
+{
+    num_members = sort_unique(members, num_members);
+    if (num_members < 2)
+    {
+        return 0;
+    }
+
+    Buffer *requests = calloc(num_shards, sizeof(Buffer));
+    char **responses = malloc(num_shards * sizeof(char *));
+    for (int i = 0; i < num_members; i++)
+    {
+        Buffer *request = &requests[shard_of_id(members[i])];
+        if (request->length == 0)
+        {
+            buffer_printf(request, "G A");
+        }
+        buffer_printf(request, " %d", members[i]);
+    }
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        if (requests[shard].length)
+        {
+            buffer_append(&requests[shard], "\n", 1);
+        }
+    }
+    int status = shard_call_all(requests, responses);
+
+    // The groups of the members as <member id> << 32 | <group id> keys, sorted so that each member has a sorted range.
+    long long *groups = NULL;
+    int num_groups = 0, capacity = 0;
+    for (int shard = 0; shard < num_shards && status == 0; shard++)
+    {
+        for (char *cursor = responses[shard] ? strchr(responses[shard], '\t') : NULL; cursor; cursor = strchr(cursor + 1, '\t'))
+        {
+            char *colon = strchr(cursor + 1, ':');
+            if (!colon)
+            {
+                continue;
+            }
+            if (num_groups == capacity)
+            {
+                capacity = capacity ? 2 * capacity : 64;
+                groups = realloc(groups, capacity * sizeof(long long));
+            }
+            groups[num_groups++] = (long long)atoi(cursor + 1) << 32 | (unsigned)atoi(colon + 1);
+        }
+    }
+    if (num_groups > 1)
+    {
+        qsort(groups, num_groups, sizeof(long long), compare_long_long);
+    }
+
+    int *start = malloc((num_members + 1) * sizeof(int));
+    for (int i = 0, group = 0; i <= num_members; i++)
+    {
+        while (group < num_groups && (i == num_members || (int)(groups[group] >> 32) < members[i]))
+        {
+            group++;
+        }
+        start[i] = group;
+    }
+
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        requests[shard].length = 0;
+    }
+    for (int i = 0; i < num_members && status == 0; i++)
+    {
+        for (int j = i + 1; j < num_members; j++)
+        {
+            int shared = 0;
+            for (int a = start[i], b = start[j]; !shared && a < start[i + 1] && b < start[j + 1];)
+            {
+                unsigned group_a = (unsigned)groups[a], group_b = (unsigned)groups[b];
+                shared = group_a == group_b;
+                a += group_a <= group_b;
+                b += group_b <= group_a;
+            }
+            if (shared)
+            {
+                continue;
+            }
+
+            int ends = shard_of_id(members[i]) == shard_of_id(members[j]) ? 1 : 2;
+            for (int end = 0; end < ends; end++)
+            {
+                int node_id = end ? members[j] : members[i], other_id = end ? members[i] : members[j];
+                Buffer *request = &requests[shard_of_id(node_id)];
+                if (request->length == 0)
+                {
+                    buffer_printf(request, "G C");
+                }
+                buffer_printf(request, " %d:%d", node_id, other_id);
+            }
+        }
+    }
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        if (requests[shard].length)
+        {
+            buffer_append(&requests[shard], "\n", 1);
+        }
+    }
+    if (status == 0)
+    {
+        status = shard_call_all(requests, responses);
+    }
+
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        free(requests[shard].data);
+    }
+    free(requests);
+    free(responses);
+    free(groups);
+    free(start);
+    return status;
+}
+
+// Function to delete the nodes with a name on their shard, then the remote links other shards keep to them and the
+// co-member links made through the deleted groups
+static void coordinator_delete(char *name, Buffer *out)
+{
+    Buffer request = {NULL, 0, 0};
+    buffer_printf(&request, "G D %s\n", name);
+    char *response = shard_call(shard_of_name(name), &request);
+    free(request.data);
+    if (!response || strncmp(response, "OK ", 3) != 0)
+    {
+        buffer_printf(out, "ERR shard unavailable\n");
+        return;
+    }
+
+    int deleted = atoi(response + 3);
+    int *members = NULL;
+    int num_members = 0, members_capacity = 0;
+    Buffer *requests = calloc(num_shards, sizeof(Buffer));
+    char **responses = malloc(num_shards * sizeof(char *));
+    char *cursor = strchr(response, '\t');
+    while (cursor)
+    {
+        char *item = cursor + 1;
+        cursor = strchr(item, '\t');
+        if (cursor)
+        {
+            *cursor = '\0';
+        }
+
+        // A <member id> item is an individual member of a deleted group.
+        if (!strchr(item, ':'))
+        {
+            if (num_members == members_capacity)
+            {
+                members_capacity = members_capacity ? 2 * members_capacity : 64;
+                members = realloc(members, members_capacity * sizeof(int));
+            }
+            members[num_members++] = atoi(item);
+            continue;
+        }
+
+        // The item is <remote id>:<deleted id>, the remote node forgets the deleted one.
+        Buffer *forget = &requests[shard_of_id(atoi(item))];
+        if (forget->length == 0)
+        {
+            buffer_printf(forget, "G U");
+        }
+        buffer_printf(forget, " %s", item);
+    }
+
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        if (requests[shard].length)
+        {
+            buffer_append(&requests[shard], "\n", 1);
+        }
+    }
+    if (shard_call_all(requests, responses) == 0 && coordinator_drop_co_members(members, num_members) == 0)
+    {
+        buffer_printf(out, "OK %d\n", deleted);
+    }
+    else
+    {
+        buffer_printf(out, "ERR shard unavailable\n");
+    }
+
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        free(requests[shard].data);
+    }
+    free(requests);
+    free(responses);
+    free(members);
+}
+
+// Function to find the nodes at most hops links away from the first node with a name. Each hop sends every shard one
+// G N request with the frontier nodes it holds, and the nodes not seen before become the next frontier.
+static void coordinator_within_hops(char *name, int hops, Buffer *out)
+{
+    NodeItem start;
+    int status = coordinator_find(name, &start);
+    if (status < 0)
+    {
+        buffer_printf(out, status == -1 ? "OK 0\n" : "ERR shard unavailable\n");
+        return;
+    }
+
+    IdSet seen = {NULL, 0, 0};
+    id_set_add(&seen, start.id);
+    int *frontier = malloc(sizeof(int));
+    int frontier_size = 1;
+    frontier[0] = start.id;
+
+    Buffer items = {NULL, 0, 0};
+    int count = 0;
+    Buffer *requests = calloc(num_shards, sizeof(Buffer));
+    char **responses = malloc(num_shards * sizeof(char *));
+
+    for (int depth = 1; depth <= hops && frontier_size > 0 && status == 0; depth++)
+    {
+        for (int shard = 0; shard < num_shards; shard++)
+        {
+            requests[shard].length = 0;
+        }
+        for (int i = 0; i < frontier_size; i++)
+        {
+            Buffer *request = &requests[shard_of_id(frontier[i])];
+            if (request->length == 0)
+            {
+                buffer_printf(request, "G N -");
+            }
+            buffer_printf(request, " %d", frontier[i]);
+        }
+        for (int shard = 0; shard < num_shards; shard++)
+        {
+            if (requests[shard].length)
+            {
+                buffer_append(&requests[shard], "\n", 1);
+            }
+        }
+
+        status = shard_call_all(requests, responses);
+        int next_size = 0, next_capacity = 0;
+        int *next = NULL;
+        for (int shard = 0; shard < num_shards && status == 0; shard++)
+        {
+            char *cursor = responses[shard] ? strchr(responses[shard], '\t') : NULL;
+            while (cursor)
+            {
+                char *item = cursor + 1;
+                cursor = strchr(item, '\t');
+                if (cursor)
+                {
+                    *cursor = '\0';
+                }
+
+                NodeItem node;
+                if (parse_node_item(item, &node) != 0 || !id_set_add(&seen, node.id))
+                {
+                    continue;
+                }
+                if (next_size == next_capacity)
+                {
+                    next_capacity = next_capacity ? 2 * next_capacity : 64;
+                    next = realloc(next, next_capacity * sizeof(int));
+                }
+                next[next_size++] = node.id;
+                buffer_printf(&items, "\t%d:%c:%s", node.id, node.type, node.name);
+                count++;
+            }
+        }
+        free(frontier);
+        frontier = next;
+        frontier_size = next_size;
+    }
+
+    if (status == 0)
+    {
+        buffer_printf(out, "OK %d", count);
+        buffer_append(out, items.data, items.length);
+        buffer_append(out, "\n", 1);
+    }
+    else
+    {
+        buffer_printf(out, "ERR shard unavailable\n");
+    }
+
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        free(requests[shard].data);
+    }
+    free(requests);
+    free(responses);
+    free(frontier);
+    free(items.data);
+    free(seen.slots);
+}
+
+// Function to forward a request line to one shard and pass its response on
+static void coordinator_forward(int shard, Buffer *request, Buffer *out)
+{
+    char *response = shard_call(shard, request);
+    if (response)
+    {
+        buffer_printf(out, "%s\n", response);
+    }
+    else
+    {
+        buffer_printf(out, "ERR shard unavailable\n");
+    }
+}
+
+static int compare_items_by_id(const void *a, const void *b)
+{
+    int x = ((const NodeItem *)a)->id, y = ((const NodeItem *)b)->id;
+    return (x > y) - (x < y);
+}
+
+static int compare_items_by_name(const void *a, const void *b)
+{
+    int order = fold_compare(((const NodeItem *)a)->name, ((const NodeItem *)b)->name);
+    return order ? order : compare_items_by_id(a, b);
+}
+
+// Function to send a node search to every shard and answer with all their node items, in id order or, with by_name, in
+// name order ignoring case, and at most limit of them if limit is not negative
+static void coordinator_gather(Buffer *request, Buffer *out, int by_name, int limit)
+{
+    Buffer *requests = calloc(num_shards, sizeof(Buffer));
+    char **responses = malloc(num_shards * sizeof(char *));
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        buffer_append(&requests[shard], request->data, request->length);
+    }
+
+    int status = shard_call_all(requests, responses);
+    char *error = NULL;
+    NodeItem *items = NULL;
+    int count = 0, capacity = 0;
+    for (int shard = 0; shard < num_shards && status == 0 && !error; shard++)
+    {
+        if (strncmp(responses[shard], "OK", 2) != 0)
+        {
+            error = responses[shard];
+            break;
+        }
+        char *cursor = strchr(responses[shard], '\t');
+        while (cursor)
+        {
+            char *item = cursor + 1;
+            cursor = strchr(item, '\t');
+            if (cursor)
+            {
+                *cursor = '\0';
+            }
+
+            if (count == capacity)
+            {
+                capacity = capacity ? 2 * capacity : 64;
+                items = realloc(items, capacity * sizeof(NodeItem));
+            }
+            if (parse_node_item(item, &items[count]) == 0)
+            {
+                count++;
+            }
+        }
+    }
+
+    if (status != 0)
+    {
+        buffer_printf(out, "ERR shard unavailable\n");
+    }
+    else if (error)
+    {
+        buffer_printf(out, "%s\n", error);
+    }
+    else
+    {
+        qsort(items, count, sizeof(NodeItem), by_name ? compare_items_by_name : compare_items_by_id);
+        if (limit >= 0 && count > limit)
+        {
+            count = limit;
+        }
+        buffer_printf(out, "OK %d", count);
+        for (int i = 0; i < count; i++)
+        {
+            buffer_printf(out, "\t%d:%c:%s", items[i].id, items[i].type, items[i].name);
+        }
+        buffer_append(out, "\n", 1);
+    }
+
+    for (int shard = 0; shard < num_shards; shard++)
+    {
+        free(requests[shard].data);
+    }
+    free(requests);
+    free(responses);
+    free(items);
+}
+
+// Function to answer one request line as the coordinator of the shards
+static void coordinator_request(char *line, Buffer *out)
+{
+    Buffer request = {NULL, 0, 0};
+    buffer_printf(&request, "%s\n", line);
+
+    char *cursor = line;
+    char *command = next_word(&cursor);
+    char *first = next_word(&cursor);
+    char *second = next_word(&cursor);
+
+    if (!command)
+    {
+        buffer_printf(out, "ERR empty request\n");
+    }
+    else if ((strcmp(command, "C") == 0 || strcmp(command, "S") == 0) && first && second)
+    {
+        if (command[0] == 'C' || strcmp(first, "N") == 0)
+        {
+            coordinator_forward(shard_of_name(second), &request, out);
+        }
+        else if (strcmp(first, "P") == 0)
+        {
+            char *k = next_word(&cursor);
+            coordinator_gather(&request, out, 1, k ? atoi(k) : 10);
+        }
+        else if (strcmp(first, "T") == 0 || strcmp(first, "B") == 0 || strcmp(first, "C") == 0)
+        {
+            coordinator_gather(&request, out, 0, -1);
+        }
+        else
+        {
+            buffer_printf(out, "ERR not supported by the coordinator\n");
+        }
+    }
+    else if ((strcmp(command, "P") == 0 || strcmp(command, "K") == 0 || strcmp(command, "E") == 0) && first)
+    {
+        coordinator_forward(shard_of_name(first), &request, out);
+    }
+    else if (first && (strcmp(command, "V") == 0 || strcmp(command, "U") == 0 || strcmp(command, "J") == 0 ||
+                       strcmp(command, "H") == 0 || (strcmp(command, "Y") == 0 && strcmp(first, "*") != 0)))
+    {
+        // Answered by the shard of the (first) name, over its own nodes.
+        coordinator_forward(shard_of_name(first), &request, out);
+    }
+    else if (strcmp(command, "L") == 0 && first && second && (strcmp(first, "N") == 0 || strcmp(first, "G") == 0))
+    {
+        coordinator_forward(shard_of_name(second), &request, out);
+    }
+    else if (strcmp(command, "A") == 0 && !first)
+    {
+        coordinator_gather(&request, out, 0, -1);
+    }
+    else if ((strcmp(command, "M") == 0 || strcmp(command, "R") == 0) && first && second)
+    {
+        char *role = next_word(&cursor);
+        NodeItem node, target;
+        int status = coordinator_find(first, &node);
+        if (status == 0)
+        {
+            status = coordinator_find(second, &target);
+        }
+
+        if (status < 0)
+        {
+            buffer_printf(out, status == -1 ? "ERR node not found\n" : "ERR shard unavailable\n");
+        }
+        else if (command[0] == 'M')
+        {
+            coordinator_add_member(&node, &target, out);
+        }
+        else if (node.type != 'B' || target.type != 'I' || !role || (role[0] != 'O' && role[0] != 'C'))
+        {
+            buffer_printf(out, "ERR R needs a business, an individual and O or C\n");
+        }
+        else
+        {
+            int added = coordinator_link(&node, &target, role[0] == 'O' ? EDGE_OWNER : EDGE_CUSTOMER);
+            buffer_printf(out, added > 0 ? "OK\n" : added == 0 ? "ERR not added\n" : "ERR shard unavailable\n");
+        }
+    }
+    else if (strcmp(command, "D") == 0 && first)
+    {
+        coordinator_delete(first, out);
+    }
+    else if (strcmp(command, "X") == 0 && first)
+    {
+        coordinator_within_hops(first, second ? atoi(second) : 2, out);
     }
+    else
+    {
+        buffer_printf(out, "ERR not supported by the coordinator\n");
+    }
+    free(request.data);
+}
 
-    if (content_index == -1)
+// Function to serve clients in front of the given shards, see Sharded mode above
+int run_coordinator(const char *address, int count, const char **addresses, int num_workers)
+{
+    if (count < 1)
     {
-        strcpy(all_content[num_content], content);
-        content_index = num_content;
-        num_content++;
+        printf("A coordinator needs at least one shard\n");
+        return 1;
     }
+    shard_addresses = addresses;
+    num_shards = count;
+    request_handler = coordinator_request;
+    return run_server(address, num_workers);
+}
 
-    SearchResult result = search_node_by_name(name);
+// Settings and results of one load generator connection.
+typedef struct LoadClient
+{
+    const char *address;
+    int index;
+    int depth;
+    int requests;
+    long long *latencies;
+    int completed;
+} LoadClient;
+
+#define LOADGEN_USERS 1000
+#define LOADGEN_GROUPS 20
+
+// Function to write a request of the load generator mix
+static void loadgen_request(Buffer *out, unsigned *seed)
+{
+    int user = rand_r(seed) % LOADGEN_USERS;
+    int kind = rand_r(seed) % 10;
 
-    if (result.size == 0)
+    if (kind < 5)
     {
-        printf("Node not found\n");
+        buffer_printf(out, "S N user%d\n", user);
+    }
+    else if (kind < 7)
+    {
+        buffer_printf(out, "K user%d\n", user);
+    }
+    else if (kind < 8)
+    {
+        buffer_printf(out, "P user%d post number %d\n", user, rand_r(seed) % 5000);
+    }
+    else if (kind < 9)
+    {
+        buffer_printf(out, "M group%d user%d\n", rand_r(seed) % LOADGEN_GROUPS, user);
     }
     else
     {
-        printf("Node(s) found:\n");
+        buffer_printf(out, "V user%d\n", user);
+    }
+}
 
-        for (int i = 0; i < result.size; i++)
+// Function to send requests over one connection, keeping up to depth of them in flight
+static void *loadgen_client(void *argument)
+{
+    LoadClient *client = argument;
+    int fd = open_socket(client->address, 0);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    unsigned seed = 12345 + client->index;
+    long long *sent_at = malloc(client->depth * sizeof(long long)); // FIFO of send times, responses arrive in order.
+    int sent = 0;
+    Buffer out = {NULL, 0, 0};
+    Buffer in = {NULL, 0, 0};
+    char chunk[65536];
+
+    while (client->completed < client->requests)
+    {
+        out.length = 0;
+        while (sent < client->requests && sent - client->completed < client->depth)
         {
-            Node *current_node = result.nodes[i];
+            loadgen_request(&out, &seed);
+            sent_at[sent % client->depth] = now_ns();
+            sent++;
+        }
 
-            current_node->content = realloc(current_node->content, (current_node->num_contents + 1) * sizeof(char *));
-            if (!current_node->content)
+        size_t written = 0;
+        while (written < out.length)
+        {
+            ssize_t result = send(fd, out.data + written, out.length - written, MSG_NOSIGNAL);
+            if (result <= 0)
             {
-                printf("Failed to allocate memory for new content reference.\n");
-                return;
+                goto done;
             }
+            written += result;
+        }
 
-            current_node->content[current_node->num_contents] = all_content[content_index];
-            current_node->num_contents++;
+        ssize_t received = read(fd, chunk, sizeof(chunk));
+        if (received <= 0)
+        {
+            goto done;
         }
+        buffer_append(&in, chunk, received);
 
-        printf("Content posted to node(s)\n");
+        size_t start = 0;
+        char *newline;
+        while ((newline = memchr(in.data + start, '\n', in.length - start)) != NULL)
+        {
+            client->latencies[client->completed] = now_ns() - sent_at[client->completed % client->depth];
+            client->completed++;
+            start = newline - in.data + 1;
+        }
+        buffer_consume(&in, start);
     }
 
-    free(result.nodes);
+done:
+    close(fd);
+    free(sent_at);
+    free(out.data);
+    free(in.data);
+    return NULL;
 }
 
-// Function to search and print the content posted by a node
-void search_and_print_content(char *content)
+// Function to send requests one line at a time and wait for each response, used to set up the load generator graph
+static int loadgen_setup(int fd, const char *request)
 {
-    for (int i = 0; i < num_nodes; i++)
+    char response[256];
+    if (send(fd, request, strlen(request), MSG_NOSIGNAL) <= 0)
+    {
+        return -1;
+    }
+    size_t length = 0;
+    while (length < sizeof(response) - 1)
     {
-        if (all_nodes[i]->content)
+        if (read(fd, response + length, 1) != 1)
         {
-            for (int j = 0; j < all_nodes[i]->num_contents; j++)
-            {
-                if (strstr(all_nodes[i]->content[j], content))
-                {
-                    printf("Content posted by: %s\n", all_nodes[i]->name);
-                    printf("The full content is: %s\n", all_nodes[i]->content[j]);
-                    break;
-                }
-            }
+            return -1;
+        }
+        if (response[length++] == '\n')
+        {
+            break;
         }
     }
+    return 0;
 }
 
-// Function to print the content posted by linked nodes of a node
-void display_linked_content(char *name)
+// Function to load a running server and report QPS and latency percentiles
+int run_loadgen(const char *address, int connections, int depth, int requests)
 {
-    SearchResult result = search_node_by_name(name);
+    int fd = open_socket(address, 0);
+    if (fd < 0)
+    {
+        printf("Failed to connect to %s: %s\n", address, strerror(errno));
+        return 1;
+    }
 
-    if (result.size == 0)
+    char request[128];
+    for (int i = 0; i < LOADGEN_GROUPS; i++)
     {
-        printf("Node not found\n");
+        snprintf(request, sizeof(request), "C G group%d\n", i);
+        loadgen_setup(fd, request);
+    }
+    for (int i = 0; i < LOADGEN_USERS; i++)
+    {
+        snprintf(request, sizeof(request), "C I user%d %d %d %d\n", i, i % 28 + 1, i % 12 + 1, 1950 + i % 50);
+        loadgen_setup(fd, request);
+    }
+    close(fd);
+
+    if (connections < 1)
+    {
+        connections = 1;
+    }
+    if (depth < 1)
+    {
+        depth = 1;
+    }
+
+    LoadClient *clients = calloc(connections, sizeof(LoadClient));
+    pthread_t *threads = malloc(connections * sizeof(pthread_t));
+    long long start = now_ns();
+    for (int i = 0; i < connections; i++)
+    {
+        clients[i].address = address;
+        clients[i].index = i;
+        clients[i].depth = depth;
+        clients[i].requests = requests;
+        clients[i].latencies = malloc(requests * sizeof(long long));
+        pthread_create(&threads[i], NULL, loadgen_client, &clients[i]);
+    }
+
+    long long total = 0;
+    for (int i = 0; i < connections; i++)
+    {
+        pthread_join(threads[i], NULL);
+        total += clients[i].completed;
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    long long *latencies = malloc((total ? total : 1) * sizeof(long long));
+    long long merged = 0;
+    for (int i = 0; i < connections; i++)
+    {
+        memcpy(latencies + merged, clients[i].latencies, clients[i].completed * sizeof(long long));
+        merged += clients[i].completed;
+        free(clients[i].latencies);
+    }
+    qsort(latencies, total, sizeof(long long), compare_long_long);
+
+    if (total == 0)
+    {
+        printf("No responses received\n");
     }
     else
     {
-        printf("Node(s) found:\n");
+        printf("requests: %lld, seconds: %.3f, qps: %.0f\n", total, seconds, total / seconds);
+        printf("latency us: p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n", latencies[total / 2] / 1e3, latencies[total * 99 / 100] / 1e3, latencies[total * 999 / 1000] / 1e3, latencies[total - 1] / 1e3);
+    }
 
-        for (int i = 0; i < result.size; i++)
+    free(latencies);
+    free(threads);
+    free(clients);
+    return total == (long long)connections * requests ? 0 : 1;
+}
+
+#else
+
+int run_server(const char *address, int num_workers)
+{
+    (void)address;
+    (void)num_workers;
+    printf("Server mode needs Linux (epoll).\n");
+    return 1;
+}
+
+int run_shard(const char *address, int index, int count, int num_workers)
+{
+    (void)address;
+    (void)index;
+    (void)count;
+    (void)num_workers;
+    printf("Server mode needs Linux (epoll).\n");
+    return 1;
+}
+
+int run_coordinator(const char *address, int count, const char **addresses, int num_workers)
+{
+    (void)address;
+    (void)count;
+    (void)addresses;
+    (void)num_workers;
+    printf("Server mode needs Linux (epoll).\n");
+    return 1;
+}
+
+int run_loadgen(const char *address, int connections, int depth, int requests)
+{
+    (void)address;
+    (void)connections;
+    (void)depth;
+    (void)requests;
+    printf("Server mode needs Linux (epoll).\n");
+    return 1;
+}
+
+#endif
+
+/*
+    Benchmark mode:
+
+    social --bench [size ...]     (sizes such as 1000 or 1e7, default 1e3 1e4 1e5)
+
+    For every size a synthetic graph is generated in a child process, then every function of social.h is timed on it.
+    Each benchmark runs until BENCH_SECONDS have passed or BENCH_MAX_OPS calls were made (at least one call).
+    Results are printed as one JSON object per line:
+    {"size":..,"benchmark":"..","ops":..,"ops_per_sec":..,"p50_ns":..,"p90_ns":..,"p99_ns":..,"max_ns":..,"peak_rss_kb":..}
+
+    The generated graph:
+    - 90% individuals with random birthdays, 3% businesses, 5% groups, 2% organisations.
+    - Businesses and organisations are placed around a few city centres.
+    - Group and organisation sizes follow a power law (capped at BENCH_MAX_GROUP, as add_member links all co-members),
+      business customer counts follow a heavier power law, so a few businesses become hubs.
+    - Posts come from a pool of BENCH_CONTENT_POOL texts picked with a power law, so most posts are reposts.
+*/
+
+#ifdef __linux__
+
+#define BENCH_SECONDS 0.5
+#define BENCH_MAX_OPS 100000
+#define BENCH_MAX_GROUP 256
+#define BENCH_MAX_CUSTOMERS 100000
+#define BENCH_CONTENT_POOL 10000
+
+// Nodes of a generated graph, grouped by type so benchmarks can pick arguments.
+typedef struct GeneratedGraph
+{
+    Individual **individuals;
+    int num_individuals;
+    Business **businesses;
+    int num_businesses;
+    Group **groups;
+    int num_groups;
+    Organisation **organisations;
+    int num_organisations;
+    char **content_pool;
+} GeneratedGraph;
+
+// Latency samples of one benchmark.
+typedef struct BenchRun
+{
+    long long *samples;
+    int count;
+    long long started;
+} BenchRun;
+
+static FILE *bench_output; // The real stdout, the engine's own printing goes to /dev/null while benchmarking.
+static unsigned long long bench_seed = 88172645463325252ULL;
+
+// xorshift64, the benchmarks need a fast generator that is the same on every platform
+static unsigned long long bench_random()
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+    return bench_seed;
+}
+
+static double bench_uniform()
+{
+    return (bench_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Returns a Pareto distributed integer >= minimum, capped at maximum
+static int bench_power_law(double alpha, int minimum, int maximum)
+{
+    double value = minimum * pow(1.0 - bench_uniform(), -1.0 / alpha);
+    return value > maximum ? maximum : (int)value;
+}
+
+// Returns an index in [0, n), small indices being much more likely
+static int bench_skewed_index(int n)
+{
+    int index = (int)(n * pow(bench_uniform(), 3.0));
+    return index < n ? index : n - 1;
+}
+
+static Location bench_location()
+{
+    static const Location centres[] = {{10, 10}, {50, 80}, {90, 20}, {30, 60}, {75, 75}};
+    Location centre = centres[bench_random() % 5];
+    Location location = {centre.x + (bench_uniform() - 0.5) * 10, centre.y + (bench_uniform() - 0.5) * 10};
+    return location;
+}
+
+static Birthday bench_birthday()
+{
+    Birthday birthday = {(int)(bench_random() % 28) + 1, (int)(bench_random() % 12) + 1, 1940 + (int)(bench_random() % 70)};
+    return birthday;
+}
+
+// Function to generate a synthetic social graph with the given number of nodes
+static void generate_graph(GeneratedGraph *graph, long size)
+{
+    memset(graph, 0, sizeof(*graph));
+    graph->individuals = malloc(size * sizeof(Individual *));
+    graph->businesses = malloc((size / 33 + 1) * sizeof(Business *));
+    graph->groups = malloc((size / 20 + 1) * sizeof(Group *));
+    graph->organisations = malloc((size / 50 + 1) * sizeof(Organisation *));
+    char name[64];
+
+    for (long i = 0; i < size; i++)
+    {
+        long slot = i % 100;
+        if (slot < 90 || size < 100)
         {
-            Node *current_node = result.nodes[i];
+            snprintf(name, sizeof(name), "person%ld", i);
+            graph->individuals[graph->num_individuals++] = create_individual(name, bench_birthday());
+        }
+        else if (slot < 93)
+        {
+            snprintf(name, sizeof(name), "business%ld", i);
+            graph->businesses[graph->num_businesses++] = create_business(name, bench_location());
+        }
+        else if (slot < 98)
+        {
+            snprintf(name, sizeof(name), "group%ld", i);
+            graph->groups[graph->num_groups++] = create_group(name);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "organisation%ld", i);
+            graph->organisations[graph->num_organisations++] = create_organisation(name, bench_location());
+        }
+    }
 
-            if (current_node->type == 'I')
-            {
-                printf("Content linked to individuals linked to %s:\n", current_node->name);
-                for (int j = 0; j < current_node->num_links; j++)
-                {
-                    if (current_node->links[j]->type == 'I')
-                    {
-                        printf("Content posted by %s:\n", current_node->links[j]->name);
-                        for (int k = 0; k < current_node->links[j]->num_contents; k++)
-                        {
-                            printf("%s\n", current_node->links[j]->content[k]);
-                        }
-                    }
-                }
-            }
+    if (graph->num_individuals == 0)
+    {
+        return;
+    }
+
+    for (int i = 0; i < graph->num_groups; i++)
+    {
+        int members = bench_power_law(1.2, 2, BENCH_MAX_GROUP);
+        for (int j = 0; j < members; j++)
+        {
+            add_member(&graph->groups[i]->node, &graph->individuals[bench_random() % graph->num_individuals]->node);
+        }
+        // Groups can have businesses as members too.
+        if (graph->num_businesses > 0 && bench_random() % 4 == 0)
+        {
+            add_member(&graph->groups[i]->node, &graph->businesses[bench_skewed_index(graph->num_businesses)]->node);
         }
     }
 
-    free(result.nodes);
+    for (int i = 0; i < graph->num_organisations; i++)
+    {
+        int members = bench_power_law(1.2, 2, BENCH_MAX_GROUP);
+        for (int j = 0; j < members; j++)
+        {
+            add_member(&graph->organisations[i]->node, &graph->individuals[bench_random() % graph->num_individuals]->node);
+        }
+    }
+
+    for (int i = 0; i < graph->num_businesses; i++)
+    {
+        add_owner_or_customer(graph->businesses[i], graph->individuals[bench_random() % graph->num_individuals], 'O');
+        int customers = bench_power_law(1.1, 1, BENCH_MAX_CUSTOMERS);
+        for (int j = 0; j < customers; j++)
+        {
+            add_owner_or_customer(graph->businesses[i], graph->individuals[bench_random() % graph->num_individuals], 'C');
+        }
+    }
+
+    graph->content_pool = malloc(BENCH_CONTENT_POOL * sizeof(char *));
+    begin_write();
+    for (int i = 0; i < BENCH_CONTENT_POOL; i++)
+    {
+        snprintf(name, sizeof(name), "post%d_about_topic%d", i, i % 97);
+        graph->content_pool[i] = intern_content(name);
+    }
+
+    // Posts are attached directly, post_content() looks every node up by name which is what is being measured below.
+    for (int i = 0; i < graph->num_individuals; i++)
+    {
+        int posts = bench_power_law(1.5, 1, 1000) - 1;
+        for (int j = 0; j < posts; j++)
+        {
+            append_content(&graph->individuals[i]->node, graph->content_pool[bench_skewed_index(BENCH_CONTENT_POOL)]);
+        }
+    }
+    end_write();
 }
 
-// Function to print the details of a node
-void print_node_details(Node *node)
+static void bench_start(BenchRun *run)
 {
-    printf("Node details:\n");
-    printf("ID: %d\n", node->id);
-    printf("Name: %s\n", node->name);
+    run->samples = malloc(BENCH_MAX_OPS * sizeof(long long));
+    run->count = 0;
+    run->started = now_ns();
+}
 
-    printf("Type: ");
-    if (node->type == 'I')
+// Returns 1 while the benchmark should make another call
+static int bench_continue(BenchRun *run)
+{
+    return run->count == 0 || (run->count < BENCH_MAX_OPS && now_ns() - run->started < (long long)(BENCH_SECONDS * 1e9));
+}
+
+// Function to print the result of a benchmark as a JSON line
+static void bench_report(long size, const char *name, BenchRun *run)
+{
+    long long total = 0;
+    for (int i = 0; i < run->count; i++)
     {
-        printf("Individual\n");
-        if (((Individual *)node)->birthday.day == -1)
+        total += run->samples[i];
+    }
+    qsort(run->samples, run->count, sizeof(long long), compare_long_long);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(bench_output, "{\"size\":%ld,\"benchmark\":\"%s\",\"ops\":%d,\"ops_per_sec\":%.1f,\"p50_ns\":%lld,\"p90_ns\":%lld,\"p99_ns\":%lld,\"max_ns\":%lld,\"peak_rss_kb\":%ld}\n",
+            size, name, run->count, total ? run->count * 1e9 / total : 0.0, run->samples[run->count / 2], run->samples[run->count * 9 / 10], run->samples[run->count * 99 / 100], run->samples[run->count - 1], usage.ru_maxrss);
+    fflush(bench_output);
+    free(run->samples);
+}
+
+// Times one call of an expression and records it
+#define BENCH_TIME(run, call)                                        \
+    do                                                               \
+    {                                                                \
+        long long bench_started = now_ns();                          \
+        call;                                                        \
+        (run)->samples[(run)->count++] = now_ns() - bench_started;   \
+    } while (0)
+
+// Function to run all benchmarks on a freshly generated graph of the given size
+static void bench_size(long size)
+{
+    GeneratedGraph graph;
+    BenchRun run;
+    char name[64];
+
+    long long started = now_ns();
+    generate_graph(&graph, size);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(bench_output, "{\"size\":%ld,\"benchmark\":\"generate_graph\",\"seconds\":%.3f,\"nodes\":%d,\"contents\":%d,\"peak_rss_kb\":%ld}\n",
+            size, (now_ns() - started) / 1e9, num_nodes, num_content, usage.ru_maxrss);
+
+    // Read-only benchmarks first and node creation last, so that the graph measured is the generated one.
+    int n = graph.num_individuals;
+    Birthday birthday = bench_birthday();
+    Location location = bench_location();
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        Node *node = &graph.individuals[bench_random() % n]->node;
+        Node *target = &graph.individuals[bench_random() % n]->node;
+        BENCH_TIME(&run, is_node_in_links(node, target));
+    }
+    bench_report(size, "is_node_in_links", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        SearchResult result;
+        BENCH_TIME(&run, result = search_node_by_name(graph.individuals[bench_random() % n]->node.name));
+        free(result.nodes);
+    }
+    bench_report(size, "search_node_by_name", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        static const char types[] = {'I', 'B', 'G', 'O'};
+        SearchResult result;
+        BENCH_TIME(&run, result = search_node_by_type(types[bench_random() % 4]));
+        free(result.nodes);
+    }
+    bench_report(size, "search_node_by_type", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        SearchResult result;
+        BENCH_TIME(&run, result = search_individual_by_birthday(bench_birthday()));
+        free(result.nodes);
+    }
+    bench_report(size, "search_individual_by_birthday", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        BENCH_TIME(&run, print_linked_nodes(graph.individuals[bench_random() % n]->node.name));
+    }
+    bench_report(size, "print_linked_nodes", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        BENCH_TIME(&run, print_node_details(&graph.individuals[bench_random() % n]->node));
+    }
+    bench_report(size, "print_node_details", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        snprintf(name, sizeof(name), "topic%d", (int)(bench_random() % 97));
+        BENCH_TIME(&run, search_and_print_content(name));
+    }
+    bench_report(size, "search_and_print_content", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        BENCH_TIME(&run, display_linked_content(graph.individuals[bench_random() % n]->node.name));
+    }
+    bench_report(size, "display_linked_content", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        BENCH_TIME(&run, print_all_nodes());
+    }
+    bench_report(size, "print_all_nodes", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        char *content = graph.content_pool[bench_skewed_index(BENCH_CONTENT_POOL)];
+        BENCH_TIME(&run, post_content(graph.individuals[bench_random() % n]->node.name, content));
+    }
+    bench_report(size, "post_content", &run);
+
+    if (graph.num_groups > 0)
+    {
+        bench_start(&run);
+        while (bench_continue(&run))
         {
-            printf("Birthday: Not added\n");
+            Node *group = &graph.groups[bench_skewed_index(graph.num_groups)]->node;
+            Node *member = &graph.individuals[bench_random() % n]->node;
+            BENCH_TIME(&run, add_member(group, member));
         }
-        else
+        bench_report(size, "add_member", &run);
+    }
+
+    if (graph.num_businesses > 0)
+    {
+        bench_start(&run);
+        while (bench_continue(&run))
         {
-            printf("Birthday: %d-%d-%d\n", ((Individual *)node)->birthday.day, ((Individual *)node)->birthday.month, ((Individual *)node)->birthday.year);
+            Business *business = graph.businesses[bench_skewed_index(graph.num_businesses)];
+            Individual *individual = graph.individuals[bench_random() % n];
+            BENCH_TIME(&run, add_owner_or_customer(business, individual, bench_random() % 8 ? 'C' : 'O'));
         }
+        bench_report(size, "add_owner_or_customer", &run);
     }
-    else if (node->type == 'G')
-        printf("Group\n");
 
-    else if (node->type == 'B')
+    // Victims get a few links first, so that unlinking is part of what is measured.
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        snprintf(name, sizeof(name), "bench_victim%d", run.count);
+        Individual *victim = create_individual(name, birthday);
+        if (graph.num_groups > 0)
+        {
+            add_member(&graph.groups[bench_random() % graph.num_groups]->node, &victim->node);
+        }
+        BENCH_TIME(&run, delete_node(name));
+    }
+    bench_report(size, "delete_node", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        Node *node = &graph.individuals[bench_random() % n]->node;
+        Node *target = node;
+        LinkCursor cursor;
+        Node **links;
+        start_links(&cursor, node, -1);
+        if (next_links(&cursor, &links) > 0 && links[0])
+        {
+            target = links[0];
+        }
+        BENCH_TIME(&run, remove_node_from_links(node, target));
+    }
+    bench_report(size, "remove_node_from_links", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        Node *node;
+        BENCH_TIME(&run, node = create_node("bench_node", 'I'));
+        free(node->name);
+        free(node->date);
+        free(node);
+    }
+    bench_report(size, "create_node", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        BENCH_TIME(&run, create_individual("bench_individual", birthday));
+    }
+    bench_report(size, "create_individual", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        BENCH_TIME(&run, create_business("bench_business", location));
+    }
+    bench_report(size, "create_business", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        BENCH_TIME(&run, create_group("bench_group"));
+    }
+    bench_report(size, "create_group", &run);
+
+    bench_start(&run);
+    while (bench_continue(&run))
+    {
+        BENCH_TIME(&run, create_organisation("bench_organisation", location));
+    }
+    bench_report(size, "create_organisation", &run);
+}
+
+// Function to run the benchmark suite, each size in its own process so that peak RSS is per size
+int run_bench(int num_sizes, char *sizes[])
+{
+    static char *default_sizes[] = {"1e3", "1e4", "1e5"};
+    if (num_sizes == 0)
     {
-        printf("Business\n");
-        printf("Location: (%lf, %lf)\n", ((Business *)node)->location.x, ((Business *)node)->location.y);
+        num_sizes = 3;
+        sizes = default_sizes;
     }
-    else if (node->type == 'O')
+
+    fflush(stdout);
+    bench_output = fdopen(dup(STDOUT_FILENO), "w");
+    if (!bench_output || !freopen("/dev/null", "w", stdout))
     {
-        printf("Organisation\n");
-        printf("Location: (%lf, %lf)\n", ((Organisation *)node)->location.x, ((Organisation *)node)->location.y);
+        fprintf(stderr, "Failed to set up benchmark output.\n");
+        return 1;
     }
+    quiet = 1;
 
-    printf("Date of creation: %s\n", node->date);
-    if (node->num_contents > 0)
+    for (int i = 0; i < num_sizes; i++)
     {
-        printf("Content: ");
-        for (int i = 0; i < node->num_contents; i++)
+        long size = (long)strtod(sizes[i], NULL);
+        if (size < 1)
         {
-            if (i == node->num_contents - 1)
-            {
-                printf("%s", node->content[i]);
-            }
-            else
-            {
-                printf("%s, ", node->content[i]);
-            }
+            fprintf(stderr, "Invalid size: %s\n", sizes[i]);
+            continue;
+        }
+
+        fflush(bench_output);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            bench_size(size);
+            fflush(bench_output);
+            _exit(0);
+        }
+
+        int status;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "Benchmark of size %ld failed.\n", size);
         }
-        printf("\n");
     }
+    return 0;
 }
 
-// Function to print all nodes
-void print_all_nodes()
+#else
+
+int run_bench(int num_sizes, char *sizes[])
 {
-    for (int i = 0; i < num_nodes; i++)
-    {
-        printf("Node %d:\n", i + 1);
-        print_node_details(all_nodes[i]);
-        printf("\n");
-    }
+    (void)num_sizes;
+    (void)sizes;
+    printf("Benchmark mode needs Linux.\n");
+    return 1;
 }
 
+#endif
+
 // Master text-based interface
 void interface()
 {
@@ -584,7 +12854,20 @@ void interface()
         printf("6. Search for content\n");
         printf("7. Display all content posted by individuals linked to an individual\n");
         printf("8. Print all nodes\n");
-        printf("9. Exit\n\n");
+        printf("9. Exit\n");
+        printf("10. Print stats\n");
+        printf("11. People you may know\n");
+        printf("12. Degrees of separation\n");
+        printf("13. Linked nodes by role\n");
+        printf("14. Most influential nodes (PageRank)\n");
+        printf("15. Communities\n");
+        printf("16. Connected components\n");
+        printf("17. Ranked search of posts\n");
+        printf("18. Trending content\n");
+        printf("19. Export network\n");
+        printf("20. Checkpoint network\n");
+        printf("21. Query nodes\n");
+        printf("22. People you may know, for every individual\n\n");
 
         printf("Choice: ");
         int choice;
@@ -629,7 +12912,10 @@ void interface()
                 printf("Enter name: ");
                 scanf("%s", name);
                 Group *group = create_group(name);
-                int group_id = group->node.id;
+                if (!group)
+                {
+                    continue; // Already reported
+                }
 
                 printf("Does your group have members? Y/N : ");
                 char yesno;
@@ -669,14 +12955,12 @@ void interface()
                                     scanf("%d", &birthday.day);
                                     scanf("%d", &birthday.month);
                                     scanf("%d", &birthday.year);
-                                    create_individual(name, birthday);
                                 }
-                                else
+                                Individual *individual = create_individual(name, birthday);
+                                if (individual)
                                 {
-                                    create_individual(name, birthday);
+                                    add_member(&group->node, &individual->node);
                                 }
-
-                                add_member(all_nodes[group_id - 1], all_nodes[num_nodes - 1]);
                             }
 
                             else if (type == 'B')
@@ -686,6 +12970,10 @@ void interface()
                                 printf("Enter name, location (x y): ");
                                 scanf("%s %lf %lf", name, &location.x, &location.y);
                                 Business *business = create_business(name, location);
+                                if (!business)
+                                {
+                                    continue; // Already reported
+                                }
 
                                 printf("Does your business have owners? Y/N : ");
                                 char yesno;
@@ -720,14 +13008,12 @@ void interface()
                                                 scanf("%d", &birthday.day);
                                                 scanf("%d", &birthday.month);
                                                 scanf("%d", &birthday.year);
-                                                create_individual(name, birthday);
                                             }
-                                            else
+                                            Individual *individual = create_individual(name, birthday);
+                                            if (individual)
                                             {
-                                                create_individual(name, birthday);
+                                                add_owner_or_customer(business, individual, 'O');
                                             }
-
-                                            add_owner_or_customer(business, (Individual *)all_nodes[num_nodes - 1], 'O');
                                         }
                                         else if (choice == 'E')
                                         {
@@ -739,6 +13025,7 @@ void interface()
                                             if (result.size == 0)
                                             {
                                                 printf("Node not found\n");
+                                                print_name_suggestions(name);
                                             }
                                             else
                                             {
@@ -788,14 +13075,12 @@ void interface()
                                                 scanf("%d", &birthday.day);
                                                 scanf("%d", &birthday.month);
                                                 scanf("%d", &birthday.year);
-                                                create_individual(name, birthday);
                                             }
-                                            else
+                                            Individual *individual = create_individual(name, birthday);
+                                            if (individual)
                                             {
-                                                create_individual(name, birthday);
+                                                add_owner_or_customer(business, individual, 'C');
                                             }
-
-                                            add_owner_or_customer(business, (Individual *)all_nodes[num_nodes - 1], 'C');
                                         }
                                         else if (choice == 'E')
                                         {
@@ -807,6 +13092,7 @@ void interface()
                                             if (result.size == 0)
                                             {
                                                 printf("Node not found\n");
+                                                print_name_suggestions(name);
                                             }
                                             else
                                             {
@@ -825,7 +13111,7 @@ void interface()
                                             free(result.nodes);
                                         }
 
-                                        add_member(all_nodes[group_id - 1], (Node *)business);
+                                        add_member(&group->node, (Node *)business);
                                     }
                                 }
                             }
@@ -840,6 +13126,7 @@ void interface()
                             if (result.size == 0)
                             {
                                 printf("Node not found\n");
+                                print_name_suggestions(name);
                             }
                             else
                             {
@@ -849,7 +13136,7 @@ void interface()
                                 {
                                     Node *current_node = result.nodes[i];
 
-                                    add_member(all_nodes[group_id - 1], current_node);
+                                    add_member(&group->node, current_node);
                                 }
 
                                 printf("Node(s) added as member(s)\n");
@@ -868,6 +13155,10 @@ void interface()
                 printf("Enter name, location (x y): ");
                 scanf("%s %lf %lf", name, &location.x, &location.y);
                 Business *business = create_business(name, location);
+                if (!business)
+                {
+                    continue; // Already reported
+                }
 
                 printf("Does your business have owners? Y/N : ");
                 char yesno;
@@ -902,14 +13193,12 @@ void interface()
                                 scanf("%d", &birthday.day);
                                 scanf("%d", &birthday.month);
                                 scanf("%d", &birthday.year);
-                                create_individual(name, birthday);
                             }
-                            else
+                            Individual *individual = create_individual(name, birthday);
+                            if (individual)
                             {
-                                create_individual(name, birthday);
+                                add_owner_or_customer(business, individual, 'O');
                             }
-
-                            add_owner_or_customer(business, (Individual *)all_nodes[num_nodes - 1], 'O');
                         }
                         else if (choice == 'E')
                         {
@@ -921,6 +13210,7 @@ void interface()
                             if (result.size == 0)
                             {
                                 printf("Node not found\n");
+                                print_name_suggestions(name);
                             }
                             else
                             {
@@ -970,14 +13260,12 @@ void interface()
                                 scanf("%d", &birthday.day);
                                 scanf("%d", &birthday.month);
                                 scanf("%d", &birthday.year);
-                                create_individual(name, birthday);
                             }
-                            else
+                            Individual *individual = create_individual(name, birthday);
+                            if (individual)
                             {
-                                create_individual(name, birthday);
+                                add_owner_or_customer(business, individual, 'C');
                             }
-
-                            add_owner_or_customer(business, (Individual *)all_nodes[num_nodes - 1], 'C');
                         }
                         else if (choice == 'E')
                         {
@@ -989,6 +13277,7 @@ void interface()
                             if (result.size == 0)
                             {
                                 printf("Node not found\n");
+                                print_name_suggestions(name);
                             }
                             else
                             {
@@ -1017,7 +13306,10 @@ void interface()
                 printf("Enter name, location (x y): ");
                 scanf("%s %lf %lf", name, &location.x, &location.y);
                 Organisation *organisation = create_organisation(name, location);
-                int organisation_id = organisation->node.id;
+                if (!organisation)
+                {
+                    continue; // Already reported
+                }
 
                 printf("Does your organisation have members (Only individuals allowed) ? Y/N: ");
                 char yesno;
@@ -1051,14 +13343,12 @@ void interface()
                                 scanf("%d", &birthday.day);
                                 scanf("%d", &birthday.month);
                                 scanf("%d", &birthday.year);
-                                create_individual(name, birthday);
                             }
-                            else
+                            Individual *individual = create_individual(name, birthday);
+                            if (individual)
                             {
-                                create_individual(name, birthday);
+                                add_member(&organisation->node, &individual->node);
                             }
-
-                            add_member(all_nodes[organisation_id - 1], all_nodes[num_nodes - 1]);
                         }
                         else if (choice == 'E')
                         {
@@ -1070,6 +13360,7 @@ void interface()
                             if (result.size == 0)
                             {
                                 printf("Node not found\n");
+                                print_name_suggestions(name);
                             }
                             else
                             {
@@ -1079,7 +13370,7 @@ void interface()
                                 {
                                     Node *current_node = result.nodes[i];
 
-                                    add_member(all_nodes[organisation_id - 1], current_node);
+                                    add_member(&organisation->node, current_node);
                                 }
 
                                 printf("Node(s) added as member(s)\n");
@@ -1098,7 +13389,10 @@ void interface()
                 char name[100];
                 printf("Enter name of node to delete: ");
                 scanf("%s", name);
-                delete_node(name);
+                if (delete_node(name) == 0)
+                {
+                    print_name_suggestions(name);
+                }
             }
             else
             {
@@ -1109,7 +13403,7 @@ void interface()
         {
             if (num_nodes > 0)
             {
-                printf("Do you want to search by name, type or birthday (for individual only)? N- name, T- type, B- birthday: ");
+                printf("Do you want to search by name, type, birthday (for individual only) or creation time? N- name, T- type, B- birthday, C- created between, L- latest created, P- name prefix, F- name with typos: ");
                 char choice;
                 scanf(" %c", &choice);
                 if (choice == 'N')
@@ -1117,10 +13411,12 @@ void interface()
                     char name[100];
                     printf("Enter name: ");
                     scanf("%s", name);
+                    begin_read();
                     SearchResult result = search_node_by_name(name);
                     if (result.size == 0)
                     {
                         printf("Node not found\n");
+                        print_name_suggestions(name);
                     }
                     else
                     {
@@ -1133,12 +13429,16 @@ void interface()
                             print_node_details(current_node);
                         }
                     }
+
+                    free(result.nodes);
+                    end_read();
                 }
                 else if (choice == 'T')
                 {
                     char type;
                     printf("Enter type: ");
                     scanf(" %c", &type);
+                    begin_read();
                     SearchResult result = search_node_by_type(type);
                     if (result.size == 0)
                     {
@@ -1155,6 +13455,9 @@ void interface()
                             print_node_details(current_node);
                         }
                     }
+
+                    free(result.nodes);
+                    end_read();
                 }
                 else if (choice == 'B')
                 {
@@ -1163,6 +13466,7 @@ void interface()
                     scanf("%d", &birthday.day);
                     scanf("%d", &birthday.month);
                     scanf("%d", &birthday.year);
+                    begin_read();
                     SearchResult result = search_individual_by_birthday(birthday);
                     if (result.size == 0)
                     {
@@ -1179,6 +13483,93 @@ void interface()
                             print_node_details(current_node);
                         }
                     }
+
+                    free(result.nodes);
+                    end_read();
+                }
+                else if (choice == 'P')
+                {
+                    char prefix[100];
+                    printf("Enter the start of the name: ");
+                    scanf("%99s", prefix);
+                    begin_read();
+                    SearchResult result = search_node_by_prefix(prefix, 10, '\0');
+                    if (result.size == 0)
+                    {
+                        printf("Node not found\n");
+                    }
+                    else
+                    {
+                        printf("Node(s) found:\n");
+
+                        for (int i = 0; i < result.size; i++)
+                        {
+                            print_node_details(result.nodes[i]);
+                        }
+                    }
+
+                    free(result.nodes);
+                    end_read();
+                }
+                else if (choice == 'F')
+                {
+                    char name[100];
+                    int distance;
+                    printf("Enter name and the number of typos to allow (up to %d): ", FUZZY_MAX_DISTANCE);
+                    scanf("%99s %d", name, &distance);
+                    begin_read();
+                    RankedResult result = search_node_fuzzy(name, distance, 10);
+                    if (result.size == 0)
+                    {
+                        printf("Node not found\n");
+                    }
+                    else
+                    {
+                        printf("Node(s) found:\n");
+
+                        for (int i = 0; i < result.size; i++)
+                        {
+                            printf("Edit distance: %.0f\n", result.scores[i]);
+                            print_node_details(result.nodes[i]);
+                        }
+                    }
+
+                    free_ranked_result(&result);
+                    end_read();
+                }
+                else if (choice == 'C' || choice == 'L')
+                {
+                    long long from = 0, to = 0;
+                    int count = 0;
+                    char type;
+                    if (choice == 'C')
+                    {
+                        printf("Enter the two times (seconds since 1970) and type (I, B, G, O or A for any): ");
+                        scanf("%lld %lld %c", &from, &to, &type);
+                    }
+                    else
+                    {
+                        printf("Enter number of nodes and type (I, B, G, O or A for any): ");
+                        scanf("%d %c", &count, &type);
+                    }
+                    begin_read();
+                    SearchResult result = choice == 'C' ? search_nodes_by_creation(from, to, type == 'A' ? '\0' : type) : newest_nodes(count, type == 'A' ? '\0' : type);
+                    if (result.size == 0)
+                    {
+                        printf("Node not found\n");
+                    }
+                    else
+                    {
+                        printf("Node(s) found:\n");
+
+                        for (int i = 0; i < result.size; i++)
+                        {
+                            print_node_details(result.nodes[i]);
+                        }
+                    }
+
+                    free(result.nodes);
+                    end_read();
                 }
             }
             else
@@ -1204,11 +13595,15 @@ void interface()
         {
             if (num_nodes > 0)
             {
-                char name[100], content[100];
+                char name[100], content[MAX_CONTENT];
                 int flag = 0;
                 printf("Enter name of node and content to post: ");
-                scanf("%s %s", name, content);
-                post_content(name, content);
+                scanf("%s ", name);
+                if (fgets(content, sizeof(content), stdin))
+                {
+                    content[strcspn(content, "\n")] = '\0';
+                    post_content(name, content);
+                }
             }
             else
             {
@@ -1219,7 +13614,7 @@ void interface()
         {
             if (num_content > 0)
             {
-                char content[100];
+                char content[MAX_CONTENT];
                 printf("Enter content (or a part of it): ");
                 scanf("%s", content);
                 search_and_print_content(content);
@@ -1247,7 +13642,31 @@ void interface()
         {
             if (num_nodes > 0)
             {
-                print_all_nodes();
+                // A page at a time, the cursor keeps its place if nodes are added or deleted in between.
+                long long cursor = 0;
+                int printed = 0;
+                char more = 'Y';
+                while (more == 'Y')
+                {
+                    begin_read();
+                    NodePage page = page_nodes('\0', NULL, NULL, cursor, 20);
+                    for (int i = 0; i < page.size; i++)
+                    {
+                        printf("Node %d:\n", ++printed);
+                        print_node_details(page.nodes[i]);
+                        printf("\n");
+                    }
+                    free(page.nodes);
+                    end_read();
+
+                    cursor = page.next;
+                    more = 'N';
+                    if (cursor != 0)
+                    {
+                        printf("Show more? Y/N: ");
+                        scanf(" %c", &more);
+                    }
+                }
             }
             else
             {
@@ -1258,11 +13677,346 @@ void interface()
         {
             break;
         }
+        else if (choice == 10)
+        {
+            print_stats();
+        }
+        else if (choice == 11)
+        {
+            char name[100];
+            int k;
+            char weighted;
+            printf("Enter name of individual, number of suggestions and whether to weight by Adamic-Adar (Y/N): ");
+            scanf("%s %d %c", name, &k, &weighted);
+
+            begin_read();
+            RankedResult result = recommend_people(name, k, weighted == 'Y');
+            if (result.size == 0)
+            {
+                printf("No suggestions found.\n");
+            }
+            for (int i = 0; i < result.size; i++)
+            {
+                printf("%s (%.2f)\n", result.nodes[i]->name, result.scores[i]);
+            }
+            free_ranked_result(&result);
+            end_read();
+        }
+        else if (choice == 12)
+        {
+            char from[100], to[100], types[10];
+            int k, depth;
+            printf("Enter the two names, number of paths, maximum depth (0 for none) and types to pass through (e.g. I, - for any): ");
+            scanf("%s %s %d %d %9s", from, to, &k, &depth, types);
+
+            begin_read();
+            PathResult result = shortest_paths(from, to, k, depth, strcmp(types, "-") != 0 ? types : NULL);
+            if (result.distance < 0)
+            {
+                printf("No path found.\n");
+            }
+            else
+            {
+                printf("Degrees of separation: %d\n", result.distance);
+            }
+            for (int p = 0; p < result.num_paths; p++)
+            {
+                Node **path = result.nodes + (long)p * (result.distance + 1);
+                for (int i = 0; i <= result.distance; i++)
+                {
+                    printf("%s%s", i == 0 ? "" : " -> ", path[i]->name);
+                }
+                printf("\n");
+            }
+            free_path_result(&result);
+            end_read();
+        }
+        else if (choice == 13)
+        {
+            char name[100], role[20];
+            printf("Enter name and role (member, member_of, owner, owns, customer, customer_of, co_member): ");
+            scanf("%s %19s", name, role);
+
+            int label = edge_label_by_name(role);
+            if (label < 0)
+            {
+                printf("Invalid role.\n");
+                continue;
+            }
+
+            begin_read();
+            SearchResult result = search_edges(name, label);
+            if (result.size == 0)
+            {
+                printf("No linked nodes found.\n");
+            }
+            for (int i = 0; i < result.size; i++)
+            {
+                printf("%s (%s)\n", result.nodes[i]->name, edge_label_name(label));
+            }
+            free(result.nodes);
+            end_read();
+        }
+        else if (choice == 14)
+        {
+            char seed[100], types[10];
+            int k;
+            printf("Enter number of nodes, types to rank (e.g. IB, - for any) and the name to personalize for (- for none): ");
+            scanf("%d %9s %99s", &k, types, seed);
+
+            begin_read();
+            RankedResult result = pagerank(strcmp(seed, "-") != 0 ? seed : NULL, k, strcmp(types, "-") != 0 ? types : NULL);
+            if (result.size == 0)
+            {
+                printf("No nodes found.\n");
+            }
+            for (int i = 0; i < result.size; i++)
+            {
+                printf("%s (%.6f)\n", result.nodes[i]->name, result.scores[i]);
+            }
+            free_ranked_result(&result);
+            end_read();
+        }
+        else if (choice == 15)
+        {
+            char what;
+            printf("R- detect communities, N- community of a node, G- group against communities, W- every group to a file: ");
+            scanf(" %c", &what);
+
+            if (what == 'R')
+            {
+                printf("%d communities found.\n", detect_communities());
+            }
+            else if (what == 'N')
+            {
+                char name[100];
+                printf("Enter name: ");
+                scanf("%s", name);
+                NodeCommunity result;
+                if (node_community(name, &result) != 0)
+                {
+                    printf("Node not found\n");
+                    print_name_suggestions(name);
+                }
+                else
+                {
+                    printf("Community: %d (%d nodes)\nTriangles: %lld\nClustering coefficient: %.4f\n", result.community, result.community_size, result.triangles, result.clustering);
+                }
+            }
+            else if (what == 'G')
+            {
+                char name[100];
+                printf("Enter name of group or organisation: ");
+                scanf("%s", name);
+                GroupCommunity result;
+                if (group_community(name, &result) != 0)
+                {
+                    printf("Group or organisation not found\n");
+                    print_name_suggestions(name);
+                }
+                else
+                {
+                    printf("Members: %d\nCommunities they are in: %d\nMain community: %d (%.1f%% of members)\nAverage clustering coefficient: %.4f\n", result.members, result.communities, result.main_community, result.main_share * 100, result.clustering);
+                }
+            }
+            else if (what == 'W')
+            {
+                char path[256];
+                printf("Enter file name: ");
+                scanf("%255s", path);
+                int written = write_group_communities(path);
+                if (written >= 0)
+                {
+                    printf("%d group(s) and organisation(s) written to %s\n", written, path);
+                }
+            }
+            else
+            {
+                printf("Invalid choice.\n");
+            }
+        }
+        else if (choice == 16)
+        {
+            char a[100], b[100];
+            printf("Enter two names (- as the second for the size of the first one's component): ");
+            scanf("%s %s", a, b);
+
+            if (strcmp(b, "-") == 0)
+            {
+                int size = component_size(a);
+                if (size < 0)
+                {
+                    printf("Node not found\n");
+                    print_name_suggestions(a);
+                }
+                else
+                {
+                    printf("%s is in a component of %d node(s).\n", a, size);
+                }
+            }
+            else
+            {
+                int connected = same_component(a, b);
+                if (connected < 0)
+                {
+                    printf("Node not found\n");
+                }
+                else
+                {
+                    printf("%s and %s are %s.\n", a, b, connected ? "connected" : "not connected");
+                }
+            }
+        }
+        else if (choice == 17)
+        {
+            char query[MAX_CONTENT], mode;
+            int k;
+            printf("Enter number of results, A- posts with all words or O- posts with any word, and the words: ");
+            scanf("%d %c ", &k, &mode);
+            if (!fgets(query, sizeof(query), stdin))
+            {
+                continue;
+            }
+
+            begin_read();
+            ContentResult result = search_posts(query, k, mode == 'A');
+            if (result.size == 0)
+            {
+                printf("No posts found.\n");
+            }
+            for (int i = 0; i < result.size; i++)
+            {
+                printf("%s (%.3f): %s\n", result.nodes[i]->name, result.scores[i], result.contents[i]);
+            }
+            free_content_result(&result);
+            end_read();
+        }
+        else if (choice == 18)
+        {
+            int k;
+            char rising;
+            printf("Enter number of contents and M- most reposted or R- rising fastest: ");
+            scanf("%d %c", &k, &rising);
+
+            begin_read();
+            TrendingResult result = trending_content(k, rising == 'R');
+            if (result.size == 0)
+            {
+                printf("Nothing trending.\n");
+            }
+            for (int i = 0; i < result.size; i++)
+            {
+                printf("%s (%s%.0f)\n", result.contents[i], rising == 'R' ? "+" : "", result.scores[i]);
+            }
+            free_trending_result(&result);
+            end_read();
+        }
+        else if (choice == 19)
+        {
+            char format[16], path[256];
+            printf("Enter format (edges, jsonl or graphml) and file name: ");
+            scanf("%15s %255s", format, path);
+
+            int written = export_network(path, export_format_by_name(format));
+            if (written >= 0)
+            {
+                printf("%d node(s) written to %s\n", written, path);
+            }
+        }
+        else if (choice == 20)
+        {
+            char path[256];
+            printf("Enter file name: ");
+            scanf("%255s", path);
+
+            CheckpointStats stats;
+            if (start_checkpoint(path) == 0)
+            {
+                checkpoint_stats(&stats, 1);
+                if (stats.nodes >= 0)
+                {
+                    printf("%d node(s), %lld bytes written to %s in %.3f ms after a %.3f ms pause\n", stats.nodes, stats.bytes, path,
+                           stats.duration_ns / 1e6, stats.pause_ns / 1e6);
+                }
+                else
+                {
+                    printf("Failed to write %s\n", path);
+                }
+            }
+        }
+        else if (choice == 21)
+        {
+            char query[MAX_CONTENT * 4];
+            printf("Enter a query, e.g. type I born * 12 * role customer_of ( near 0 0 5 ): ");
+            scanf(" ");
+            if (!fgets(query, sizeof(query), stdin))
+            {
+                continue;
+            }
+
+            begin_read();
+            QueryResult result = run_query(query);
+            if (result.error)
+            {
+                printf("Invalid query: %s\n", result.error);
+            }
+            else
+            {
+                printf("%s", result.plan);
+                printf("%d node(s) found:\n", result.size);
+                for (int i = 0; i < result.size; i++)
+                {
+                    print_node_details(result.nodes[i]);
+                }
+            }
+            free_query_result(&result);
+            end_read();
+        }
+        else if (choice == 22)
+        {
+            char path[256];
+            int k;
+            char weighted;
+            printf("Enter file name, number of suggestions and whether to weight by Adamic-Adar (Y/N): ");
+            scanf("%255s %d %c", path, &k, &weighted);
+
+            int written = recommend_all_people(path, k, weighted == 'Y');
+            if (written >= 0)
+            {
+                printf("Suggestions for %d individual(s) written to %s\n", written, path);
+            }
+        }
     }
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    start_stats_signal_thread();
+    const char *compressed = getenv("SOCIAL_COMPRESSED_LINKS");
+    compressed_links = compressed && atoi(compressed) != 0;
+    archive_directory = getenv("SOCIAL_ARCHIVE_DIR");
+
+    if (argc >= 3 && strcmp(argv[1], "--server") == 0)
+    {
+        return run_server(argv[2], argc > 3 ? atoi(argv[3]) : 4);
+    }
+    if (argc >= 5 && strcmp(argv[1], "--shard") == 0)
+    {
+        return run_shard(argv[2], atoi(argv[3]), atoi(argv[4]), argc > 5 ? atoi(argv[5]) : 4);
+    }
+    if (argc >= 4 && strcmp(argv[1], "--coordinator") == 0)
+    {
+        return run_coordinator(argv[2], argc - 3, (const char **)argv + 3, 4);
+    }
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0)
+    {
+        return run_bench(argc - 2, argv + 2);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--loadgen") == 0)
+    {
+        return run_loadgen(argv[2], argc > 3 ? atoi(argv[3]) : 4, argc > 4 ? atoi(argv[4]) : 16, argc > 5 ? atoi(argv[5]) : 10000);
+    }
+
     interface();
 
     return 0;
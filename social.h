@@ -6,6 +6,7 @@
 	Structures:
 	1. Node:
 	   - Represents a generic node in the social network with essential information such as ID, links to other nodes, name, date, content, and type (individual, business, group, or organization).
+	   - Every link is stored on both nodes. links holds all of them, edges[label] holds the ones with a given role (member, owner, customer, co-member, or the reverse).
 
 	2. Individual:
 	   - Inherits from Node and adds specific information for individuals, such as birthday.
@@ -14,13 +15,13 @@
 	   - Represents a geographical location with x and y coordinates.
 
 	4. Business:
-	   - Inherits from Node and adds information about a business, including its location, owners, and customers.
+	   - Inherits from Node and adds information about a business, including its location. Its owners and customers are its EDGE_OWNER and EDGE_CUSTOMER edges.
 
 	5. Group:
-	   - Inherits from Node and represents a group of nodes/members.
+	   - Inherits from Node and represents a group of nodes/members (its EDGE_MEMBER edges).
 
 	6. Organisation:
-	   - Inherits from Node and represents an organization with a location and members.
+	   - Inherits from Node and represents an organization with a location and members (its EDGE_MEMBER edges, individuals only).
 
 	7. SearchResult:
 	   - A structure to store search results, including an array of nodes and the result size.
@@ -29,33 +30,90 @@
 	   - A structure to store birthdays in the format dd, mm, yyyy.
 
 	ASSUMPTIONS MADE:
-	- The maximum nodes in the network can be 100. This value can be changed by modifying the MAX_NODES macro.
-	- I have used an array to store references of contents posted by nodes, so as to prevent duplication while allowing reposting. The maximum length and number of strings have been set as 100, this can be modified using the MAX_CONTENT macro.
+	- all_nodes starts with room for 100 nodes and doubles when full. The starting size can be changed by modifying the MAX_NODES macro.
+	- I have used a hash table (all_content) to store each content posted by nodes once, so as to prevent duplication while allowing reposting. Content is counted by reference and freed when no node holds it anymore. MAX_CONTENT is the length of the content read by the text interface.
+	- A node keeps its newest posts in memory (TIMELINE_WINDOW to twice that), older ones are written to the content archive on disk and read back by start_posts()/next_posts(), so the posts held in memory stay bounded however much is posted.
 	- Since the id has been made self incrementing (using global variable id in social.c), most of the functions performing RUD operations ask for the name of the node.
+	- Many threads can read (search, print, traverse) while one thread at a time writes. Readers wrap their work in begin_read()/end_read() and never block,
+	  writers wrap theirs in begin_write()/end_write(). Deleted nodes and replaced arrays are freed only after every reader that could see them is done.
+	  Each write section commits one version, and a read section sees the links, edges, content, node lists and indexes as of the version committed when it began.
+	  Node pointers returned in a SearchResult stay valid until the caller leaves its read or write section. Build with: gcc social.c -o social -pthread -lm
+	- Run as social --server <port> [workers] to serve the same operations over a socket instead of the text interface, and social --loadgen <port> to measure it.
+	  A graph too big for one process can be split over social --shard processes behind a social --coordinator on the same machine.
+	- Run as social --bench [sizes] to time every function below on generated graphs, results are printed as JSON lines.
 
 */
 
 #define MAX_NODES 100	// Set as a default value, can be changed as per requirement
 #define MAX_CONTENT 100 // Set as a default value, can be changed as per requirement
+#define MAX_THREADS 256 // Maximum number of threads that can read at the same time
+#define RECOMMEND_HUB_CAP 10000 // Links of nodes with more links than this are not expanded when looking for people you may know
+#define PAGERANK_DAMPING 0.85 // Share of a node's score passed on to its links, the rest goes back to all nodes (or to the seed)
+#define PAGERANK_TOLERANCE 1e-7 // PageRank stops once the scores change by less than this in total during an iteration
+#define PAGERANK_MAX_ITERATIONS 100
+#define TRENDING_CAPACITY 1024 // Contents tracked for trending, must be a power of two
+#define TRENDING_BUCKETS 12 // Trending keeps counts for this many buckets of TRENDING_BUCKET_SECONDS
+#define TRENDING_BUCKET_SECONDS 300
+#define TRENDING_RISING_BUCKETS 3 // Rising content is compared over this many buckets against as many before them
+#define FUZZY_MAX_DISTANCE 3 // Largest edit distance of fuzzy name search
+#define PAGE_MAX_SCAN 1000000 // Nodes a page looks at before it returns, full or not
+#define LINK_BATCH 64 // Compressed links decoded at a time by next_links()
+#define INGEST_QUEUE_SIZE 65536 // Mutations queued for the ingestion applier at most, a power of two
+#define INGEST_BATCH 1024 // Queued mutations applied at a time, in one write section
+#define LOCATION_CELL 1.0 // Side of the squares the location index groups businesses and organisations by, in Location units
+#define TIMELINE_WINDOW 64 // Posts a node moves to the content archive at a time, once it holds twice as many in memory
+#define ARCHIVE_SEGMENT_BYTES (64LL << 20) // Size after which the content archive starts a new segment file
+
+// Role of a link, seen from the node that stores it. Each label comes in a pair with its reverse (see edge_reverse()).
+enum
+{
+	EDGE_MEMBER,	  // Group or organisation -> member
+	EDGE_MEMBER_OF,	  // Member -> group or organisation
+	EDGE_OWNER,		  // Business -> owner
+	EDGE_OWNS,		  // Owner -> business
+	EDGE_CUSTOMER,	  // Business -> customer
+	EDGE_CUSTOMER_OF, // Customer -> business
+	EDGE_CO_MEMBER,	  // Individual <-> other member of the same group or organisation
+	NUM_EDGE_LABELS
+};
+
+// File formats of export_network().
+enum
+{
+	EXPORT_EDGE_LIST,  // "id<TAB>id<TAB>label" lines, one per edge
+	EXPORT_JSON_LINES, // One JSON object per node with its fields, linked ids by label and content
+	EXPORT_GRAPHML	   // GraphML with the node fields as data and one labelled edge element per edge
+};
 
 typedef struct Node
 {
 	int id;
-	struct Node **links;
+	struct Node **links; // Every linked node, whatever the role
 	int num_links;
+	struct Node **edges[NUM_EDGE_LABELS]; // The same links split by role
+	int num_edges[NUM_EDGE_LABELS];
+	void **adjacency; // With compressed_links, the links and their roles delta-encoded instead, see LinkCursor
+	int num_adjacency;
 	char *name;
 	char *date; // using the time.h header file to set the date in the format of a string
-	char **content;
+	long long created; // The same time in seconds since 1970, never smaller than that of a node with a lower id
+	char **content; // The newest posts, older ones are in the content archive
 	int num_contents;
+	void **archived; // Positions of the node's blocks of TIMELINE_WINDOW posts in the content archive, oldest first
+	int num_archived;
 	char type; // I- individual, B- business, G- group, O- organisation
 } Node;
 
-extern Node *all_nodes[MAX_NODES];
+extern Node **all_nodes;
 extern int num_nodes;
 
-extern char all_content[MAX_CONTENT][MAX_CONTENT];
+extern char **all_content;
 extern int num_content;
 
+extern int quiet; // Set to silence the status messages of the create/update/delete functions, e.g. in server mode.
+extern int compressed_links; // Set before any link is added to keep links delta-encoded, about 6 bytes a link instead of 16 and more.
+extern const char *archive_directory; // Directory of the content archive's segment files, $TMPDIR or /tmp when NULL (social reads SOCIAL_ARCHIVE_DIR). Set before the first post.
+
 typedef struct Birthday
 {
 	int day;
@@ -79,36 +137,222 @@ typedef struct Business
 {
 	Node node;
 	Location location;
-	Individual **owners;
-	int num_owners;
-	Individual **customers;
-	int num_customers;
 } Business;
 
 typedef struct Group
 {
 	Node node;
-	Node **members;
-	int num_members;
 } Group;
 
 typedef struct Organisation
 {
 	Node node;
 	Location location;
-	Individual *members;
-	int num_members;
 } Organisation;
 
+// Position in the links of a node, see start_links(). Compressed links are decoded LINK_BATCH at a time into batch.
+typedef struct LinkCursor
+{
+	int label;
+	int tagged; // 1 if tail holds Node pointers with the role in their low bits
+	Node **tail; // Links not yet handed out: the uncompressed ones, or the tail of an adjacency block
+	int num_tail;
+	const unsigned char *bytes; // Packed links not yet decoded
+	const unsigned char *end;
+	int node_id; // Id of the last decoded link
+	Node **nodes; // all_nodes, searched forward to find the decoded ids
+	int num_nodes;
+	int node_position;
+	int position_id; // Id last searched for, the node at node_position has this id or a bigger one
+	Node *batch[LINK_BATCH];
+} LinkCursor;
+
+// Position in the posts of a node, see start_posts(). Archived posts are read back a block at a time into buffer.
+typedef struct PostCursor
+{
+	void **blocks; // Positions of the node's archived blocks
+	int num_blocks;
+	int block; // Next block to read
+	char **recent; // Posts in memory, handed out after the archived ones
+	int num_recent;
+	char *buffer; // Text of the last block read
+	size_t capacity;
+	char *batch[TIMELINE_WINDOW];
+} PostCursor;
+
 typedef struct SearchResult
 {
 	Node **nodes;
 	int size;
 } SearchResult;
 
+// A page of nodes in id order. next is the cursor to pass for the following page, 0 when there is none.
+typedef struct NodePage
+{
+	Node **nodes;
+	int size;
+	long long next;
+} NodePage;
+
+// Filter for page_nodes(): returns non-zero for the nodes to keep.
+typedef int (*NodeFilter)(Node *node, void *context);
+
+// Search result ordered best first, with a score per node.
+typedef struct RankedResult
+{
+	Node **nodes;
+	double *scores;
+	int size;
+} RankedResult;
+
+// Shortest paths between two nodes: num_paths paths of distance + 1 nodes each, stored one after the other in nodes.
+// distance is -1 when there is no path.
+typedef struct PathResult
+{
+	int distance;
+	int num_paths;
+	Node **nodes;
+} PathResult;
+
+// Posts found by a full-text search, best first: the node, the content it posted and the BM25 score.
+typedef struct ContentResult
+{
+	Node **nodes;
+	char **contents;
+	double *scores;
+	int size;
+	char *archived; // Text of the posts read back from the content archive, contents point into it
+} ContentResult;
+
+// Trending contents, best first, with their scores (posts, or growth in posts).
+typedef struct TrendingResult
+{
+	char **contents;
+	double *scores;
+	int size;
+} TrendingResult;
+
+// Community and triangles of a node, as found by the last detect_communities().
+typedef struct NodeCommunity
+{
+	int community;		// Id of one node of the community, the same for all its nodes
+	int community_size;
+	long long triangles; // Pairs of linked nodes that are both linked to this node
+	double clustering;	 // Local clustering coefficient: triangles / (degree * (degree - 1) / 2)
+} NodeCommunity;
+
+// How the members of a group or organisation spread over the detected communities.
+typedef struct GroupCommunity
+{
+	int members;
+	int communities;	// Number of communities the members are in
+	int main_community; // The community most members are in
+	double main_share;	// Share of members in the main community
+	double clustering;	// Average clustering coefficient of the members
+} GroupCommunity;
+
+// What delete_nodes() removed.
+typedef struct DeleteStats
+{
+	int nodes;
+	long long links;		   // Links between the deleted nodes and the nodes left
+	long long co_member_links; // Co-member links between nodes left that no longer share a group or organisation
+	long long posts;		   // Posts of the deleted nodes
+	long long duration_ns;
+} DeleteStats;
+
+// Running or last checkpoint, see start_checkpoint().
+typedef struct CheckpointStats
+{
+	int running;
+	int nodes;			   // Nodes written, -1 if the checkpoint failed
+	unsigned long version; // Version of the snapshot written
+	long long pause_ns;	   // Time start_checkpoint() took to pin the snapshot
+	long long bytes;	   // Bytes written
+	long long duration_ns; // Time from start to the file being in place
+} CheckpointStats;
+
+// Counters of the ingestion queue, see ingest_post().
+typedef struct IngestStats
+{
+	long long queued;	  // Records accepted
+	long long rejected;	  // Records refused because the queue was full
+	long long applied;
+	long long failed;	  // Records whose nodes were gone or whose mutation was refused, e.g. an existing link
+	long long waiting;	  // Records queued and not applied yet
+	long long batches;
+	int max_batch;
+	double mean_batch;
+	long long p50_latency_ns; // Queue to applied, rounded up to a power of two
+	long long p99_latency_ns;
+	long long max_latency_ns;
+} IngestStats;
+
+// Nodes matching a query of run_query(), in id order, with the steps the planner took, one per line. error is NULL, or says
+// why the query could not be parsed.
+typedef struct QueryResult
+{
+	Node **nodes;
+	int size;
+	char *plan;
+	const char *error;
+} QueryResult;
+
+// Compact copy of the links for whole-graph algorithms (CSR layout). Nodes are numbered 0..num_nodes-1 in id order,
+// and the links of node i are neighbours[offsets[i] .. offsets[i + 1]), sorted and without duplicates.
+typedef struct GraphView
+{
+	int num_nodes;
+	long long num_edges;
+	Node **nodes; // Only valid inside the read section the view was built in.
+	int *ids;
+	char *types;
+	long long *offsets;
+	int *neighbours;
+	int *index_of_id; // index_of_id[id] is the index of a node, or -1. Sized max_id.
+	int max_id;
+} GraphView;
+
+// A piece of parallel work, called with a range of [begin, end) and the index of the thread running it.
+typedef void (*RangeTask)(void *context, long begin, long end, int thread);
+
+// Read sections: readers never block and may run alongside one writer. Sections can be nested. A read section is a snapshot:
+// it sees the shared arrays as they were when it began, never part of a write section committed after that.
+void begin_read();
+void end_read();
+// Version seen by the calling thread's read section (the last committed version outside of one).
+unsigned long read_version();
+// Write sections: serialise writers. A write section can contain read sections.
+void begin_write();
+void end_write();
+// Loads a shared array and its count as of the read section's snapshot, or the latest inside a write section. Entries can be NULL
+// at the end while a removal is in flight, skip those.
+int read_array(void ***array_slot, int *count_slot, void ***array);
+int read_all_nodes(Node ***nodes);
+int read_typed_nodes(char type, Node ***nodes);
+// The uncompressed links and edges only, start_links() walks the links however they are stored.
+int read_links(Node *node, Node ***links);
+int read_edges(Node *node, int label, Node ***edges);
+// The posts a node keeps in memory, its newest ones. start_posts() walks all of them.
+int read_contents(Node *node, char ***content);
+// Walks the links of a node with a role (-1 for any) in batches, inside a read or write section:
+//   LinkCursor cursor; Node **links; int count;
+//   start_links(&cursor, node, label);
+//   while ((count = next_links(&cursor, &links)) > 0) ... links[0 .. count - 1], skipping NULL entries
+void start_links(LinkCursor *cursor, Node *node, int label);
+int next_links(LinkCursor *cursor, Node ***links);
+// Walks every post of a node oldest first in batches, inside a read or write section, reading archived ones back from disk:
+//   PostCursor cursor; char **posts; int count;
+//   start_posts(&cursor, node);
+//   while ((count = next_posts(&cursor, &posts)) > 0) ... posts[0 .. count - 1], valid until the next call
+//   end_posts(&cursor);
+void start_posts(PostCursor *cursor, Node *node);
+int next_posts(PostCursor *cursor, char ***posts);
+void end_posts(PostCursor *cursor);
+
 // Creates a new node.
 Node *create_node(char *name, char type);
-// Creates a new individual node.
+// Creates a new individual node. Like the other create functions below, returns NULL if it could not be added.
 Individual *create_individual(char *name, Birthday birthday);
 // Creates a new business node.
 Business *create_business(char *name, Location location);
@@ -117,28 +361,70 @@ Group *create_group(char *name);
 // Creates a new organisation node.
 Organisation *create_organisation(char *name, Location location);
 
-// Function to add a member to a group or organisation. Groups can have businesses as members too.
-void add_member(Node *group_or_org, Node *new_member);
-// Function to add an owner or customer to a business.
-void add_owner_or_customer(Business *business, Individual *new_owner_or_customer, char role);
+// Function to add a member to a group or organisation. Groups can have businesses as members too. Returns 0 on success, -1 otherwise.
+int add_member(Node *group_or_org, Node *new_member);
+// Function to add an owner or customer to a business. Returns 0 on success, -1 otherwise.
+int add_owner_or_customer(Business *business, Individual *new_owner_or_customer, char role);
 
-// Deletes a node.
-void delete_node(char *name);
-// Utility function to remove links and finish deleting the node.
+// Deletes all nodes with the given name, returns how many were deleted.
+int delete_node(char *name);
+// Bulk delete: deletes the nodes with one of num_ids ids, one of num_names names, or for which filter returns non-zero (each can
+// be left out with NULL) in one write section, compacting all_nodes and the links of the nodes linked to them in one parallel
+// pass. Co-member links that only existed through a deleted group or organisation go too. Returns how many were deleted
+// (-1 when out of memory) and fills in stats unless it is NULL. Also available as the D server command with several names.
+int delete_nodes(const int *ids, int num_ids, char **names, int num_names, NodeFilter filter, void *context, DeleteStats *stats);
+// Utility function to remove the link between two nodes, in both directions and with its role.
 void remove_node_from_links(Node *node, Node *target);
 // Search functions for searching by name, type or birthday (birthday, only for individuals)
 SearchResult search_node_by_name(char *name);
 SearchResult search_node_by_type(char type);
 SearchResult search_individual_by_birthday(Birthday birthday);
+// Nodes created between two times (seconds since 1970, both included), oldest first, and the newest count nodes, newest first.
+// Both take one type, or '\0' for any, and binary search the nodes in id order, which is also creation order.
+SearchResult search_nodes_by_creation(long long from, long long to, char type);
+SearchResult newest_nodes(int count, char type);
+// Autocomplete: the first k nodes, in name order ignoring case (then by id), whose names start with prefix, ignoring case,
+// of one type or '\0' for any. Uses a name index of sorted runs updated on create and delete. Call inside a read section to use the nodes.
+SearchResult search_node_by_prefix(char *prefix, int k, char type);
+// Typo-tolerant search: the k nodes whose names are closest to name ignoring case, within max_distance edits (at most
+// FUZZY_MAX_DISTANCE), closest first with the distances as scores. Candidates come from an index of name bigrams and are
+// checked with a bit-parallel edit distance. Call inside a read section to use the nodes.
+RankedResult search_node_fuzzy(char *name, int max_distance, int k);
 
+// Connectivity from a union-find kept up to date by every new link: returns 1 if the first nodes named a and b are connected,
+// 0 if not, -1 if one does not exist. Components that lost a node or link are rebuilt by the first query that needs them.
+int same_component(char *a, char *b);
+// Number of nodes connected to the first node with the given name (itself included), -1 if there is none.
+int component_size(char *name);
 // Utility function to check if a node is already linked to a node, so that duplicate links aren't created.
 int is_node_in_links(Node *node, Node *target);
 // Prints 1- hop linked nodes.
 void print_linked_nodes(char *name);
-// Function to post content in a node.
-void post_content(char *name, char *content);
+// Returns the label reverse of an edge label (EDGE_OWNER <-> EDGE_OWNS and so on), and the name of a label (e.g. "owns").
+int edge_reverse(int label);
+const char *edge_label_name(int label);
+// Returns the label with the given name, or -1.
+int edge_label_by_name(const char *name);
+// Nodes linked with the given role to the first node with the given name, e.g. the businesses X owns (EDGE_OWNS), the
+// customers of B (EDGE_CUSTOMER) or the groups X is in (EDGE_MEMBER_OF). Takes time in the number of results only.
+// Call inside a read section to use the nodes.
+SearchResult search_edges(char *name, int label);
+// Function to post content in all nodes with the given name, returns how many nodes it was posted to (-1 on failure).
+int post_content(char *name, char *content);
 // Function to search by content and print the node which posted that content, allows partial content search too.
 void search_and_print_content(char *name);
+// Full-text search of posts: finds the k posts that best match the words of query by BM25, either posts with all the words
+// (match_all) or with any of them. Words are runs of letters and digits, case is ignored. Uses an inverted index updated as
+// content is posted. Call inside a read section to use the nodes and contents.
+ContentResult search_posts(char *query, int k, int match_all);
+// Frees the arrays of a ContentResult.
+void free_content_result(ContentResult *result);
+// Trending: the k most reposted contents (by posts, an upper bound) or, if rising, the k contents whose posts grew the most
+// over the last TRENDING_RISING_BUCKETS buckets compared with the ones before (estimates). Uses fixed-size sketches updated by
+// every post in constant time. Call inside a read section to use the contents.
+TrendingResult trending_content(int k, int rising);
+// Frees the arrays of a TrendingResult.
+void free_trending_result(TrendingResult *result);
 // Displays the contents of individuals linked to an individual.
 void display_linked_content(char *name);
 
@@ -146,5 +432,105 @@ void display_linked_content(char *name);
 void print_node_details(Node *node);
 // Prints all nodes in the network.
 void print_all_nodes();
+// Finds a node by id with a binary search (all_nodes is sorted by id). Call inside a read or write section.
+Node *find_node_by_id(int node_id);
+// Pagination: up to limit nodes after cursor (0 for the first page), of one type or '\0' for any, that pass filter (NULL for all).
+// Pages follow ids, so they stay correct while nodes are added (new nodes come in later pages) or deleted, and a page costs
+// a binary search plus the nodes it looks at. A sparse filter can return a partial page with a cursor to go on from.
+// Call inside a read section to use the nodes, free the nodes array.
+NodePage page_nodes(char type, NodeFilter filter, void *context, long long cursor, int limit);
+// Number of threads used for parallel work (cores, or the SOCIAL_THREADS environment variable).
+int num_worker_threads();
+// Runs task over [begin, end) in chunks on all worker threads and waits for it.
+void parallel_for(long begin, long end, long chunk, RangeTask task, void *context);
+// Builds / frees a GraphView of the current links. Build inside a read section.
+GraphView build_graph_view();
+void free_graph_view(GraphView *view);
+// Intersects two sorted int arrays without duplicates (SIMD where available). Writes the common values to out unless it is NULL, returns their count.
+int intersect_sorted(const int *a, int na, const int *b, int nb, int *out);
+// Frees the arrays of a RankedResult.
+void free_ranked_result(RankedResult *result);
+
+// People you may know: ranks individuals not linked to the named individual by the number of links they have in common, or by
+// Adamic-Adar (each common link weighted by 1 / log(its degree)). Returns at most k. Call inside a read section to use the nodes.
+RankedResult recommend_people(char *name, int k, int adamic_adar);
+// Computes recommendations for every individual in parallel and writes them to a file, one "name<TAB>suggestion:score..." line each.
+// Returns the number of individuals written or -1. Also available as option 22 of the text interface and the Y * <file> [k] [A]
+// server request.
+int recommend_all_people(const char *path, int k, int adamic_adar);
+// Streams every node to a file in one of the EXPORT_* formats, formatting chunks of nodes in parallel. Edges are written once,
+// from the group, organisation or business end (from the lower id between co-members). Returns the number of nodes written
+// or -1. Also available as option 19 of the text interface and the A edges|jsonl|graphml <file> server request.
+int export_network(const char *path, int format);
+// Returns the EXPORT_* format named "edges", "jsonl" or "graphml", or -1.
+int export_format_by_name(const char *name);
+// Writes the network to path in the background, in the jsonl format, as of a snapshot pinned before returning: writers
+// never wait for it. Returns 0, or -1 if a checkpoint is running already. Also available as the B server command.
+int start_checkpoint(const char *path);
+// Gets the stats of the running or last checkpoint, first waiting for a running one to finish if wait is set.
+void checkpoint_stats(CheckpointStats *stats, int wait);
+
+// Ingestion: queue a mutation from any thread without waiting for it, a single applier thread applies the queue in
+// batches sorted by node, each batch in one write section. Returns 0 once queued, or -1 when INGEST_QUEUE_SIZE records
+// are waiting already: the caller backs off and tries again (backpressure). Also available as the Z server command.
+int ingest_post(Node *node, char *content);
+int ingest_member(Node *group_or_org, Node *new_member);
+int ingest_owner_or_customer(Business *business, Individual *new_owner_or_customer, char role);
+// Waits until every mutation queued before the call is applied.
+void ingest_flush();
+void ingest_stats(IngestStats *stats);
+
+// Degrees of separation: finds up to k shortest paths between the first nodes named from and to with a bidirectional BFS,
+// giving up beyond max_depth hops (0 for no limit). If through_types is not NULL or empty, paths only pass through nodes of
+// those types (e.g. "I"), the two ends can be of any type. Call inside a read section to use the nodes.
+PathResult shortest_paths(char *from, char *to, int k, int max_depth, const char *through_types);
+// Frees the paths of a PathResult.
+void free_path_result(PathResult *result);
+// Neighbourhood: the nodes at most hops links away from the first node with the given name, nearest first. Call inside a
+// read section to use the nodes.
+SearchResult nodes_within_hops(char *name, int hops);
+// Composite queries: the nodes matching every predicate of a query such as "type I born * 12 * hops alice 2 role customer_of
+// ( near 0 0 5 )", over type, name, prefix, birthday, location, hop distance and roles (see social.c for the language).
+// A planner produces candidates from the most selective index and intersects or checks the other predicates on them.
+// Call inside a read section to use the nodes. Also available as the O server command.
+QueryResult run_query(const char *query);
+// Frees the nodes and plan of a QueryResult.
+void free_query_result(QueryResult *result);
+
+// Influence: ranks nodes by PageRank over the links (scores add up to 1), or, if seed names a node, by personalized PageRank
+// from that node (which is left out of the result). Returns the k best nodes whose type is in types (NULL for any type).
+// Runs on all worker threads and starts from the scores of the previous run with the same seed, so recomputing after a few
+// changes takes few iterations. Call inside a read section to use the nodes.
+RankedResult pagerank(char *seed, int k, const char *types);
+
+// Detects communities by label propagation and counts the triangles of every node, both in parallel. Returns the number of
+// communities. The results are kept for node_community() and group_community(), which run it first if it never ran.
+int detect_communities();
+// Community, triangles and clustering coefficient of the first node with the given name, returns 0 or -1 if it was not found
+// (nodes created after the last detect_communities() are not found either).
+int node_community(char *name, NodeCommunity *result);
+// Compares the members of the first group or organisation with the given name with the detected communities, returns 0 or -1.
+int group_community(char *name, GroupCommunity *result);
+// Detects communities and writes one "name<TAB>members<TAB>communities<TAB>main community<TAB>main share<TAB>clustering" line
+// per group and organisation. Returns the number of lines or -1. Also available as option 15 W of the text interface and
+// the L W <file> server request.
+int write_group_communities(const char *path);
+
+// Prints node, edge and content totals, plus per-operation counts and latency percentiles when built with -DSOCIAL_METRICS.
+void print_stats();
+// Writes the same stats to a file, returns 0 on success. Also done on SIGUSR1 (file named by SOCIAL_STATS_FILE, default social_stats.txt).
+int write_stats(const char *path);
 // The text-based interface.
-void interface();
\ No newline at end of file
+void interface();
+// Serves the operations above over a line protocol on a localhost TCP port or a Unix socket path, see social.c for the protocol.
+int run_server(const char *address, int num_workers);
+// Serves as shard index (from 0) of count: the same server over the nodes whose names hash to this shard, plus the requests a
+// coordinator sends. Also available as social --shard <address> <index> <count> [workers].
+int run_shard(const char *address, int index, int count, int num_workers);
+// Serves the protocol in front of count shards, routing by name and running k-hop queries across them. Also available as
+// social --coordinator <address> <shard address>..., with the shards listed in index order.
+int run_coordinator(const char *address, int count, const char **addresses, int num_workers);
+// Load generator for the server, reports QPS and latency percentiles.
+int run_loadgen(const char *address, int connections, int depth, int requests);
+// Benchmark suite on synthetic power-law graphs of the given sizes (e.g. "1e5").
+int run_bench(int num_sizes, char *sizes[]);
\ No newline at end of file
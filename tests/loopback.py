@@ -0,0 +1,467 @@
+#!/usr/bin/env python3
+"""
+Loopback tests of the server protocol.
+
+    gcc -O2 social.c -o social -pthread -lm
+    python3 tests/loopback.py [path to social] [seed]
+
+Every test starts its own `social --server` on a Unix socket, sends requests as a client would, and checks the answers
+against a model of the network the test keeps itself: shortest paths, the co-member links a delete drops, what a read
+sees while writes run (snapshots of single requests and of a checkpoint), and query results and plans. Prints one line
+per test and exits with 1 if any check failed.
+"""
+
+import json
+import os
+import random
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BINARY = sys.argv[1] if len(sys.argv) > 1 else os.path.join(ROOT, "social")
+SEED = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+
+LABELS = ["member", "member_of", "owner", "owns", "customer", "customer_of", "co_member"]
+INVERSE = {"member": "member_of", "member_of": "member", "owner": "owns", "owns": "owner", "customer": "customer_of",
+           "customer_of": "customer", "co_member": "co_member"}
+
+failures = []
+
+
+def check(condition, what):
+    if not condition:
+        failures.append(what)
+        if len(failures) <= 20:
+            print("  FAIL " + what)
+    return condition
+
+
+class Server:
+    """A server on a Unix socket in a temporary directory, stopped on exit."""
+
+    def __init__(self, workers=4):
+        self.directory = tempfile.TemporaryDirectory()
+        self.path = os.path.join(self.directory.name, "social.sock")
+        self.process = subprocess.Popen([BINARY, "--server", self.path, str(workers)], stdout=subprocess.DEVNULL)
+        for _ in range(200):
+            if os.path.exists(self.path):
+                break
+            time.sleep(0.01)
+
+    def client(self):
+        return Client(self.path)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exception):
+        self.process.terminate()
+        self.process.wait()
+        self.directory.cleanup()
+
+
+class Client:
+    def __init__(self, path):
+        self.socket = socket.socket(socket.AF_UNIX)
+        self.socket.connect(path)
+        self.file = self.socket.makefile("rb")
+
+    # Sends the requests in one write and returns their responses, in order
+    def pipeline(self, requests):
+        self.socket.sendall("".join(request + "\n" for request in requests).encode())
+        return [self.file.readline().decode().rstrip("\n") for _ in requests]
+
+    def ask(self, request):
+        return self.pipeline([request])[0]
+
+    # Returns the items of an "OK <count> <item>..." response
+    def items(self, request):
+        response = self.ask(request)
+        parts = response.split("\t")
+        head = parts[0].split(" ")
+        check(head[0] == "OK" and int(head[1]) == len(parts) - 1, "%s -> %s" % (request, response[:200]))
+        return parts[1:]
+
+    # Returns the names of the <id>:<type>:<name> items of a response
+    def names(self, request):
+        return sorted(item.split(":", 2)[2] for item in self.items(request))
+
+
+class Model:
+    """The network as the test built it: nodes by name, and the links add_member() and add_owner_or_customer() made."""
+
+    def __init__(self):
+        self.nodes = {}  # name -> {"id", "type", "born", "x", "y"}
+        self.members = {}  # group or organisation -> set of individuals
+        self.roles = {}  # business -> {individual: "owner" | "customer"}
+
+    def create(self, client, name, kind, **fields):
+        if kind == "I":
+            fields.setdefault("born", (1, 1, 1990))
+            response = client.ask("C I %s %d %d %d" % ((name,) + fields["born"]))
+        elif kind == "G":
+            response = client.ask("C G %s" % name)
+        else:
+            response = client.ask("C %s %s %d %d" % (kind, name, fields["x"], fields["y"]))
+        check(response.startswith("OK "), "create %s -> %s" % (name, response))
+        self.nodes[name] = dict(fields, id=int(response.split(" ")[1]), type=kind)
+        if kind in "GO":
+            self.members[name] = set()
+        if kind == "B":
+            self.roles[name] = {}
+
+    def add_member(self, client, group, member):
+        response = client.ask("M %s %s" % (group, member))
+        check(response.startswith("ERR") == (member in self.members[group]), "M %s %s -> %s" % (group, member, response))
+        self.members[group].add(member)
+
+    def add_role(self, client, business, individual, role):
+        response = client.ask("R %s %s %s" % (business, individual, role))
+        check(response.startswith("ERR") == (individual in self.roles[business]),
+              "R %s %s %s -> %s" % (business, individual, role, response))
+        self.roles[business].setdefault(individual, "owner" if role == "O" else "customer")
+
+    def delete(self, names):
+        for name in names:
+            del self.nodes[name]
+            self.members.pop(name, None)
+            self.roles.pop(name, None)
+        for group in self.members.values():
+            group.difference_update(names)
+        for roles in self.roles.values():
+            for name in names:
+                roles.pop(name, None)
+
+    # Returns the links of every node as {name: {label: set of names}}; co-members are individuals that share a group
+    def links(self):
+        links = {name: {} for name in self.nodes}
+
+        def link(a, label, b):
+            links[a].setdefault(label, set()).add(b)
+            links[b].setdefault(INVERSE[label], set()).add(a)
+
+        for group, members in self.members.items():
+            for member in members:
+                link(group, "member", member)
+                for other in members:
+                    if other != member:
+                        link(member, "co_member", other)
+        for business, roles in self.roles.items():
+            for individual, role in roles.items():
+                link(business, role, individual)
+        return links
+
+    def neighbours(self):
+        return {name: set().union(*labels.values()) for name, labels in self.links().items()}
+
+
+# Function to build a random network of individuals in groups and organisations, and businesses with owners and customers
+def build_network(client, model, rng, individuals=150, groups=15, organisations=5, businesses=12):
+    for i in range(individuals):
+        model.create(client, "%s%03d" % (rng.choice(["al", "Al", "bo", "cy"]), i), "I",
+                     born=(rng.randint(1, 28), rng.randint(1, 12), rng.randint(1980, 1984)))
+    for i in range(groups):
+        model.create(client, "g%02d" % i, "G")
+    for i in range(organisations):
+        model.create(client, "o%02d" % i, "O", x=rng.randint(0, 20), y=rng.randint(0, 20))
+    for i in range(businesses):
+        model.create(client, "b%02d" % i, "B", x=rng.randint(0, 20), y=rng.randint(0, 20))
+
+    people = [name for name, node in model.nodes.items() if node["type"] == "I"]
+    for person in people:
+        for _ in range(rng.choice([0, 1, 1, 2])):
+            model.add_member(client, rng.choice(list(model.members)), person)
+        if rng.random() < 0.3:
+            model.add_role(client, rng.choice(list(model.roles)), person, rng.choice("OC"))
+
+
+# Function to count the shortest paths between two nodes that only pass through the allowed types, as (distance, paths)
+def count_paths(model, neighbours, start, end, types):
+    if start == end:
+        return 0, 1
+    distance, paths, frontier = {start: 0}, {start: 1}, [start]
+    while frontier and end not in distance:
+        following = []
+        for node in frontier:
+            if node != start and types and model.nodes[node]["type"] not in types:
+                continue
+            for other in neighbours[node]:
+                if other not in distance:
+                    distance[other] = distance[node] + 1
+                    paths[other] = 0
+                    following.append(other)
+                if distance[other] == distance[node] + 1:
+                    paths[other] += paths[node]
+        frontier = following
+    return (distance[end], paths[end]) if end in distance else (-1, 0)
+
+
+def check_paths(client, model, rng, count=300):
+    neighbours = model.neighbours()
+    names = list(model.nodes)
+    for _ in range(count):
+        start, end = rng.choice(names), rng.choice(names)
+        k, depth, types = rng.choice([1, 2, 5]), rng.choice([0, 0, 2, 3]), rng.choice(["-", "-", "I", "IG", "B"])
+        request = "H %s %s %d %d %s" % (start, end, k, depth, types)
+        distance, total = count_paths(model, neighbours, start, end, "" if types == "-" else types)
+        if depth and distance > depth:
+            distance, total = -1, 0
+
+        parts = client.ask(request).split("\t")
+        head = parts[0].split(" ")
+        if not check(head[0] == "OK" and int(head[1]) == distance and int(head[2]) == min(k, total) == len(parts) - 1,
+                     "%s -> %s, expected distance %d and %d of %d paths" % (request, "\t".join(parts)[:200], distance,
+                                                                             min(k, total), total)):
+            continue
+        paths = [path.split(",") for path in parts[1:]]
+        check(len(set(map(tuple, paths))) == len(paths), "%s repeats a path" % request)
+        for path in paths:
+            valid = len(path) == distance + 1 and path[0] == start and path[-1] == end
+            valid = valid and all(b in neighbours[a] for a, b in zip(path, path[1:]))
+            valid = valid and all(types == "-" or model.nodes[node]["type"] in types for node in path[1:-1])
+            check(valid, "%s gave the path %s" % (request, ",".join(path)))
+
+
+def test_paths():
+    rng = random.Random(SEED)
+    with Server() as server:
+        client, model = server.client(), Model()
+        build_network(client, model, rng)
+        check_paths(client, model, rng)
+
+        # Paths change with the links: through a new link, and around a deleted node.
+        model.create(client, "bridge", "G")
+        for person in rng.sample([name for name in model.nodes if model.nodes[name]["type"] == "I"], 2):
+            model.add_member(client, "bridge", person)
+        check_paths(client, model, rng, 100)
+        victims = rng.sample([name for name in model.nodes if model.nodes[name]["type"] == "G"], 3)
+        check(client.ask("D " + " ".join(victims)) == "OK 3", "D " + " ".join(victims))
+        model.delete(victims)
+        check_paths(client, model, rng, 200)
+
+
+# Function to compare the links of every node the server has with the model, by role
+def check_links(client, model):
+    links = model.links()
+    for name in model.nodes:
+        check(sorted(client.items("K %s" % name)) == sorted(set().union(*links[name].values())), "K %s" % name)
+        for label in ["member", "member_of", "co_member"]:
+            check(client.names("E %s %s" % (name, label)) == sorted(links[name].get(label, ())), "E %s %s" % (name, label))
+
+
+def test_delete():
+    rng = random.Random(SEED)
+    with Server() as server:
+        client, model = server.client(), Model()
+
+        # dave shares chess with alice and go with carol, so deleting chess drops alice-dave but keeps dave-carol.
+        for name in ["alice", "bob", "carol", "dave"]:
+            model.create(client, name, "I")
+        model.create(client, "chess", "G")
+        model.create(client, "go", "G")
+        for group, member in [("chess", "alice"), ("chess", "bob"), ("go", "bob"), ("go", "carol"), ("chess", "dave"),
+                              ("go", "dave")]:
+            model.add_member(client, group, member)
+        check(client.names("E dave co_member") == ["alice", "bob", "carol"], "E dave co_member before the delete")
+        check(client.ask("D chess") == "OK 1", "D chess")
+        model.delete(["chess"])
+        check(client.names("E dave co_member") == ["bob", "carol"], "E dave co_member after the delete")
+        check(client.names("E alice co_member") == [], "E alice co_member after the delete")
+        check_links(client, model)
+
+        # Deleting several groups and individuals in one request drops the same links as the model.
+        build_network(client, model, rng)
+        check_links(client, model)
+        for _ in range(4):
+            victims = rng.sample(list(model.members), 2) + rng.sample([n for n in model.nodes if model.nodes[n]["type"] == "I"], 3)
+            check(client.ask("D " + " ".join(victims)) == "OK %d" % len(victims), "D " + " ".join(victims))
+            model.delete(victims)
+            check_links(client, model)
+        check(client.ask("D nobody") == "OK 0", "D nobody")
+
+
+def test_snapshots():
+    rng = random.Random(SEED)
+    with Server() as server:
+        writer, reader, model = server.client(), server.client(), Model()
+
+        # A request reads one snapshot: a delete drops a group and the co-member links made through it in one write, so
+        # the neighbourhood of a member shows all of them or none of them.
+        for step in range(40):
+            groups = ["r%dg%d" % (step, i) for i in range(3)]
+            members = ["r%dm%d" % (step, i) for i in range(5)]
+            for name in groups:
+                model.create(writer, name, "G")
+            for name in members:
+                model.create(writer, name, "I")
+            kept = groups[2] if step % 2 else None
+            for group in groups[:1 + (step % 3 > 0)] + ([kept] if kept else []):
+                for member in members:
+                    model.add_member(writer, group, member)
+            victims = [group for group in groups[:2] if model.members[group]]
+
+            before = sorted(set(victims + members[1:] + ([kept] if kept else [])))
+            after = sorted(set(members[1:] + [kept])) if kept else []
+            seen, done = [], threading.Event()
+
+            def read():
+                while not done.is_set():
+                    seen.append(reader.names("X %s 1" % members[0]))
+
+            thread = threading.Thread(target=read)
+            thread.start()
+            time.sleep(0.002)
+            check(writer.ask("D " + " ".join(victims)) == "OK %d" % len(victims), "D " + " ".join(victims))
+            model.delete(victims)
+            done.set()
+            thread.join()
+            check(all(names in (before, after) for names in seen),
+                  "X %s 1 saw %s" % (members[0], [names for names in seen if names not in (before, after)][:1]))
+            check(reader.names("X %s 1" % members[0]) == after, "X %s 1 after the delete" % members[0])
+
+        # A checkpoint writes the network as it was when it started, while the writes after it go on.
+        build_network(writer, model, rng, individuals=3000, groups=100)
+        expected = model.links()
+        ids = {name: node["id"] for name, node in model.nodes.items()}
+        path = os.path.join(server.directory.name, "checkpoint.jsonl")
+        check(writer.ask("B %s" % path).startswith("OK "), "B %s" % path)
+        victims = rng.sample(list(model.members), 20) + rng.sample([n for n in model.nodes if model.nodes[n]["type"] == "I"], 200)
+        writer.pipeline(["D %s" % name for name in victims] + ["C I late%d" % i for i in range(200)] +
+                        ["M %s late%d" % (rng.choice(list(model.members)), i) for i in range(200)])
+        while writer.ask("B").startswith("OK 1 "):
+            time.sleep(0.01)
+
+        with open(path) as file:
+            written = {node["name"]: node for node in map(json.loads, file)}
+        check(sorted(written) == sorted(expected), "checkpoint has %d nodes, expected %d" % (len(written), len(expected)))
+        for name, node in written.items():
+            if name in expected:
+                check(node["id"] == ids[name], "checkpoint id of %s" % name)
+                edges = {label: sorted(targets) for label, targets in node["edges"].items() if targets}
+                check(edges == {label: sorted(ids[n] for n in targets) for label, targets in expected[name].items()},
+                      "checkpoint edges of %s" % name)
+
+
+# Function to find the names matching a query of the model, given as a list of predicates
+def evaluate(model, query, links, neighbours):
+    matches = set(model.nodes)
+    for predicate in query:
+        kind, args = predicate[0], predicate[1:]
+        if kind == "type":
+            found = {n for n in model.nodes if model.nodes[n]["type"] == args[0]}
+        elif kind == "name":
+            found = {args[0]} & set(model.nodes)
+        elif kind == "prefix":
+            found = {n for n in model.nodes if n.lower().startswith(args[0].lower())}
+        elif kind == "born":
+            found = {n for n, node in model.nodes.items() if node["type"] == "I" and
+                     all(want == "*" or int(want) == have for want, have in zip(args, node["born"]))}
+        elif kind == "near":
+            found = {n for n, node in model.nodes.items() if node["type"] in "BO" and
+                     (node["x"] - args[0]) ** 2 + (node["y"] - args[1]) ** 2 <= args[2] ** 2}
+        elif kind == "hops":
+            found, frontier = {args[0]}, {args[0]}
+            for _ in range(args[1]):
+                frontier = set().union(*(neighbours[n] for n in frontier)) - found
+                found |= frontier
+            found.discard(args[0])
+        else:
+            inner = evaluate(model, args[1], links, neighbours)
+            found = {n for n in model.nodes if links[n].get(args[0], set()) & inner}
+        matches &= found
+    return matches
+
+
+def render(query):
+    words = []
+    for predicate in query:
+        if predicate[0] == "role":
+            words += ["role", predicate[1], "(", render(predicate[2]), ")"]
+        else:
+            words += [str(word) for word in predicate]
+    return " ".join(words)
+
+
+def random_predicate(model, rng, depth=0):
+    names = list(model.nodes)
+    kind = rng.choice(["type", "name", "prefix", "born", "near", "hops"] + (["role", "role"] if depth < 2 else []))
+    if kind == "type":
+        return ("type", rng.choice("IBGO"))
+    if kind == "name":
+        return ("name", rng.choice(names))
+    if kind == "prefix":
+        return ("prefix", rng.choice(["a", "AL", "bo", "c", "g0", "b", "al1"]))
+    if kind == "born":
+        return ("born", rng.choice(["*", rng.randint(1, 28)]), rng.choice(["*", rng.randint(1, 12)]),
+                rng.choice(["*", rng.randint(1980, 1984)]))
+    if kind == "near":
+        return ("near", rng.randint(0, 20), rng.randint(0, 20), rng.randint(1, 10))
+    if kind == "hops":
+        return ("hops", rng.choice(names), rng.randint(1, 3))
+    return ("role", rng.choice(LABELS), [random_predicate(model, rng, depth + 1) for _ in range(rng.randint(1, 2))])
+
+
+# Function to check a plan: the source produces the candidates, each later step takes the ones the step before kept, in
+# order of their estimates, and the last step keeps the nodes of the answer
+def check_plan(client, request, count):
+    lines = client.ask("O E " + request).split("\t")
+    if not check(lines[0] == "OK" and len(lines) > 1, "O E %s -> %s" % (request, lines[0])):
+        return
+    steps = [line for line in lines[1:] if not line.startswith(" ")]
+    estimates, kept = [], None
+    for i, step in enumerate(steps):
+        description, result = step.rsplit("): ", 1)
+        estimates.append(float(description.rsplit("(estimate ", 1)[1]))
+        words = result.replace(",", "").split(" ")
+        if i == 0:
+            check(words[0] == "produced", "O E %s: the first step %s" % (request, step))
+        else:
+            check(words[0] == "intersected" or int(words[1]) == kept, "O E %s: step %s after %s kept" % (request, step, kept))
+        kept = int(words[-2])
+    check(estimates[1:] == sorted(estimates[1:]), "O E %s: steps out of order %s" % (request, estimates))
+    check(kept == count, "O E %s: the plan keeps %s, the answer has %d" % (request, kept, count))
+
+
+def check_queries(client, model, rng, count=300):
+    links, neighbours = model.links(), model.neighbours()
+    for _ in range(count):
+        query = [random_predicate(model, rng) for _ in range(rng.randint(1, 3))]
+        request = render(query)
+        names = client.names("O " + request)
+        check(names == sorted(evaluate(model, query, links, neighbours)), "O %s" % request)
+        check_plan(client, request, len(names))
+
+
+def test_queries():
+    rng = random.Random(SEED)
+    with Server() as server:
+        client, model = server.client(), Model()
+        build_network(client, model, rng)
+        check_queries(client, model, rng)
+
+        # The cheapest predicate produces the candidates: one name beats every individual.
+        person = next(name for name in model.nodes if model.nodes[name]["type"] == "I")
+        lines = client.ask("O E type I name %s" % person).split("\t")
+        check(lines[1].startswith("name %s (estimate 1): produced 1 ids, 1 match" % person),
+              "O E type I name %s -> %s" % (person, lines))
+        for request in ["bogus", "type X", "role member_of ( type G", "hops %s 0" % person, "born 1 2"]:
+            check(client.ask("O " + request).startswith("ERR "), "O %s is not an error" % request)
+
+        victims = rng.sample(list(model.nodes), 30)
+        check(client.ask("D " + " ".join(victims)) == "OK 30", "D " + " ".join(victims))
+        model.delete(victims)
+        check_queries(client, model, rng, 200)
+
+
+if __name__ == "__main__":
+    status = 0
+    for test in [test_paths, test_delete, test_snapshots, test_queries]:
+        before = len(failures)
+        test()
+        print("%s %s" % ("ok  " if len(failures) == before else "FAIL", test.__name__))
+        status |= len(failures) > before
+    sys.exit(status)